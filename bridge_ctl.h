@@ -38,6 +38,8 @@ typedef struct
     char name[IFNAMSIZ];
 
     bool up;
+    int worker; /* owning worker thread, -1 for the event loop */
+    bool seen;  /* in the current resync dump */
 } sysdep_br_data_t;
 
 typedef struct
@@ -48,6 +50,10 @@ typedef struct
 
     bool up;
     int speed, duplex;
+    __u32 supported; /* legacy ethtool SUPPORTED_xxx mask */
+    bool seen;  /* in the current resync dump */
+    bool offloaded; /* to switchdev hardware */
+    unsigned int rapid_ageing; /* seconds, 0 - ageing of the bridge */
 } sysdep_if_data_t;
 
 #define GET_PORT_SPEED(port)    ((port)->sysdeps.speed)
@@ -78,13 +84,75 @@ typedef struct
          _ptp->port->sysdeps.name, __be16_to_cpu(ptp->MSTID), ##_args)
 
 extern struct rtnl_handle rth_state;
+/* Socket for the port states of the calling thread, &rth_state on the
+ * event loop */
+extern __thread struct rtnl_handle *rth_state_local;
 
-int init_bridge_ops(void);
+/* Receive buffer of the link monitor socket, bytes */
+#define MONITOR_RCVBUF_DEFAULT  (4 << 20)
+#define MONITOR_RCVBUF_MIN      (64 << 10)
+#define MONITOR_RCVBUF_MAX      (1 << 30)
 
-int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags);
+int init_bridge_ops(int rcvbuf);
+
+/* Link attributes taken from the netlink message */
+typedef struct
+{
+    unsigned flags;         /* IFF_xxx */
+    const __u8 *macaddr;    /* IFLA_ADDRESS, NULL if not in the message */
+    int state;              /* IFLA_BRPORT_STATE, -1 if not in the message */
+} link_attrs_t;
+
+int bridge_notify(int br_index, int if_index, bool newlink,
+                  const link_attrs_t *attrs);
+/* Speed (Mb/s, -1 if unknown) and duplex (-1 if unknown) of a port from
+ * an ethtool link modes notification */
+void bridge_link_settings_notify(int if_index, int speed, int duplex);
+/* A link of a bond or team member, agg_index is the aggregate it is in or
+ * -1 if it left or is gone. Active members carry traffic of the aggregate,
+ * whose path cost follows the sum of their speeds. */
+void bridge_member_notify(int agg_index, int if_index, const char *name,
+                          bool active);
+
+/* Bridge port as found in a link dump */
+typedef struct
+{
+    int if_index;
+    int br_index;           /* IFLA_MASTER */
+    char name[IFNAMSIZ];    /* empty if only if_index is known */
+    __u8 macaddr[ETH_ALEN];
+    unsigned flags;         /* IFF_xxx */
+    bool query;             /* macaddr and flags are to be queried */
+    int portno;             /* IFLA_BRPORT_NO, -1 if not in the dump */
+    int state;              /* IFLA_BRPORT_STATE, -1 if not in the dump */
+} link_port_t;
+
+/* One AF_BRIDGE link dump for the ports of bridge br_index, or of all
+ * bridges if br_index is -1. Returns the number of ports in *ports, which
+ * the caller frees, or -1 on error.
+ */
+int bridge_dump_ports(int br_index, link_port_t **ports);
+/* Create the bridge if it is not known yet and make the count ports its
+ * ports, all ports which are up are enabled at once. Entries without a
+ * name are queried from the system. */
+int bridge_add_ports(int br_index, link_port_t *ports, int count);
+
+/* Resynchronization with a full link dump after lost notifications:
+ * begin, one bridge_resync_link() per dumped link, then end, which
+ * deletes the bridges and ports missing from the dump. Returns the number
+ * of changes applied.
+ */
+void bridge_resync_begin(void);
+void bridge_resync_link(int br_index, int if_index, const link_attrs_t *attrs);
+int bridge_resync_end(void);
 
 void bridge_bpdu_rcv(int ifindex, const unsigned char *data, int len);
 
 void bridge_one_second(void);
 
+/* Called by the worker for its own bridges, with its lock held */
+void bridge_worker_bpdu_rcv(int worker, int if_index,
+                            const unsigned char *data, int len, __u64 start);
+void bridge_worker_one_second(int worker);
+
 #endif /* BRIDGE_CTL_H */
@@ -30,6 +30,7 @@
 #include <linux/param.h>
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
+#include <linux/neighbour.h>
 #include <asm/byteorder.h>
 
 #include "bridge_ctl.h"
@@ -39,7 +40,14 @@
 #include "log.h"
 #include "mstp.h"
 #include "driver.h"
+#include "switchdev.h"
 #include "libnetlink.h"
+#include "trace.h"
+#include "stats.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "worker.h"
+#include "checkpoint.h"
 
 #ifndef SYSFS_CLASS_NET
 #define SYSFS_CLASS_NET "/sys/class/net"
@@ -47,6 +55,8 @@
 
 static LIST_HEAD(bridges);
 
+static void br_age_ports(bridge_t *br);
+
 static bridge_t * create_br(int if_index)
 {
     bridge_t *br;
@@ -54,6 +64,7 @@ static bridge_t * create_br(int if_index)
 
     /* Init system dependent info */
     br->sysdeps.if_index = if_index;
+    br->sysdeps.worker = worker_assign();
     if (!index_to_name(if_index, br->sysdeps.name))
         goto err;
     if (get_hwaddr(br->sysdeps.name, br->sysdeps.macaddr))
@@ -81,20 +92,109 @@ static bridge_t * find_br(int if_index)
     return NULL;
 }
 
-static port_t * create_if(bridge_t * br, int if_index)
+/* Fill in what the link dump did not tell about the port */
+static bool query_port(link_port_t *lp)
+{
+    int flags;
+
+    if(!lp->name[0] && !index_to_port_name(lp->if_index, lp->name))
+        return false;
+    if(lp->query)
+    {
+        if(get_hwaddr(lp->name, lp->macaddr))
+            return false;
+        flags = get_flags(lp->name);
+        lp->flags = (0 > flags) ? 0 : flags;
+        lp->query = false;
+    }
+    if(0 > lp->portno)
+        lp->portno = get_bridge_portno(lp->name);
+    return true;
+}
+
+/* Member of a bond or team interface. The aggregate itself is the bridge
+ * port, its speed is the sum of the speeds of its active members. */
+typedef struct
+{
+    struct list_head list;
+    int if_index;
+    char name[IFNAMSIZ];
+    int agg_index;          /* the bond or team */
+    bool active;            /* carries traffic of the aggregate */
+    int speed, duplex;      /* read when the member becomes active */
+    bool seen;              /* in the current resync dump */
+} agg_member_t;
+
+static LIST_HEAD(members);
+
+static agg_member_t *find_member(int if_index)
+{
+    agg_member_t *m;
+
+    list_for_each_entry(m, &members, list)
+        if(m->if_index == if_index)
+            return m;
+    return NULL;
+}
+
+/* Leaves speed and duplex alone and returns false if the interface has no
+ * active members */
+static bool aggregate_speed(int agg_index, int *speed, int *duplex)
+{
+    agg_member_t *m;
+    int count = 0, sum = 0, full = 1;
+
+    list_for_each_entry(m, &members, list)
+    {
+        if((m->agg_index != agg_index) || !m->active)
+            continue;
+        sum += m->speed;
+        if(!m->duplex)
+            full = 0;
+        ++count;
+    }
+    if(!count)
+        return false;
+    *speed = sum;
+    *duplex = full;
+    return true;
+}
+
+static void get_link_settings(port_t *prt)
+{
+    int speed = -1;
+    int duplex = -1;
+    __u32 supported = 0;
+
+    int r = ethtool_get_link_settings(prt->sysdeps.name, &speed, &duplex,
+                                      &supported);
+    if((r < 0) || (speed < 0))
+        speed = 10;
+    if((r < 0) || (duplex < 0))
+        duplex = 0; /* Assume half duplex */
+    /* Bonds and teams report one member or nothing */
+    aggregate_speed(prt->sysdeps.if_index, &speed, &duplex);
+    prt->sysdeps.speed = speed;
+    prt->sysdeps.duplex = duplex;
+    prt->sysdeps.supported = supported;
+}
+
+static port_t * create_if_from(bridge_t * br, link_port_t *lp)
 {
     port_t *prt;
-    TST((prt = calloc(1, sizeof(*prt))) != NULL, NULL);
+    TST((prt = MSTP_IN_alloc_port(br)) != NULL, NULL);
 
     /* Init system dependent info */
-    prt->sysdeps.if_index = if_index;
-    if (!index_to_port_name(if_index, prt->sysdeps.name))
-        goto err;
-    if (get_hwaddr(prt->sysdeps.name, prt->sysdeps.macaddr))
+    prt->sysdeps.if_index = lp->if_index;
+    if(!query_port(lp))
         goto err;
+    memcpy(prt->sysdeps.name, lp->name, IFNAMSIZ);
+    memcpy(prt->sysdeps.macaddr, lp->macaddr, ETH_ALEN);
+    prt->sysdeps.offloaded = is_switchdev_port(prt->sysdeps.name);
+    get_link_settings(prt);
 
-    int portno;
-    if(0 > (portno = get_bridge_portno(prt->sysdeps.name)))
+    int portno = lp->portno;
+    if(0 > portno)
     {
         ERROR("Couldn't get port number for %s", prt->sysdeps.name);
         goto err;
@@ -107,16 +207,23 @@ static port_t * create_if(bridge_t * br, int if_index)
 
     INFO("Add iface %s as port#%d to bridge %s", prt->sysdeps.name,
          portno, br->sysdeps.name);
-    prt->bridge = br;
     if(!MSTP_IN_port_create_and_add_tail(prt, portno))
         goto err;
 
     return prt;
 err:
-    free(prt);
+    MSTP_IN_free_port(prt);
     return NULL;
 }
 
+static port_t * create_if(bridge_t * br, int if_index)
+{
+    link_port_t lp = { .if_index = if_index, .query = true, .portno = -1,
+                       .state = -1 };
+
+    return create_if_from(br, &lp);
+}
+
 static port_t * find_if(bridge_t * br, int if_index)
 {
     port_t *prt;
@@ -131,7 +238,8 @@ static port_t * find_if(bridge_t * br, int if_index)
 static inline void delete_if(port_t *prt)
 {
     MSTP_IN_delete_port(prt);
-    free(prt);
+    driver_ops_cancel(prt->bridge, prt, -1);
+    MSTP_IN_free_port(prt);
 }
 
 static inline bool delete_if_byindex(bridge_t * br, int if_index)
@@ -150,38 +258,49 @@ static bool delete_br_byindex(int if_index)
         return false;
     list_del(&br->list);
     MSTP_IN_delete_bridge(br);
+    driver_ops_cancel(br, NULL, -1);
     free(br);
     return true;
 }
 
+void bridge_for_each(void (*func)(bridge_t *br))
+{
+    bridge_t *br;
+
+    list_for_each_entry(br, &bridges, list)
+        func(br);
+}
+
 void bridge_one_second(void)
+{
+    bridge_worker_one_second(-1);
+    checkpoint_tick();
+}
+
+void bridge_worker_one_second(int worker)
 {
     bridge_t *br;
     list_for_each_entry(br, &bridges, list)
-        MSTP_IN_one_second(br);
+        if(br->sysdeps.worker == worker)
+        {
+            MSTP_IN_one_second(br);
+            br_age_ports(br);
+        }
+    snapshot_invalidate();
 }
 
 /* New MAC address is stored in addr, which also holds the old value on entry.
    Return true if the address changed */
-static bool check_mac_address(char *name, __u8 *addr)
+static bool check_mac_address(const __u8 *new_addr, __u8 *addr)
 {
-    __u8 temp_addr[ETH_ALEN];
-    if(get_hwaddr(name, temp_addr))
-    {
-        LOG("Error getting hw address: %s", name);
-        /* Error. Ignore the new value */
+    if(!new_addr || (memcmp(addr, new_addr, ETH_ALEN) == 0))
         return false;
-    }
-    if(memcmp(addr, temp_addr, sizeof(temp_addr)) == 0)
-        return false;
-    else
-    {
-        memcpy(addr, temp_addr, sizeof(temp_addr));
-        return true;
-    }
+    memcpy(addr, new_addr, ETH_ALEN);
+    return true;
 }
 
-static void set_br_up(bridge_t * br, bool up)
+/* macaddr is the address from the netlink message, NULL if unknown */
+static void set_br_up(bridge_t * br, bool up, const __u8 *macaddr)
 {
     bool changed = false;
 
@@ -193,7 +312,7 @@ static void set_br_up(bridge_t * br, bool up)
              br->sysdeps.up ? "up" : "down", up ? "up" : "down");
     }
 
-    if(check_mac_address(br->sysdeps.name, br->sysdeps.macaddr))
+    if(check_mac_address(macaddr, br->sysdeps.macaddr))
     {
         /* MAC address changed */
         /* Notify bridge address change */
@@ -204,80 +323,167 @@ static void set_br_up(bridge_t * br, bool up)
         MSTP_IN_set_bridge_enable(br, br->sysdeps.up);
 }
 
-static void set_if_up(port_t *prt, bool up)
+/* The link settings are queried when the port is created and when it comes
+ * up, the negotiated speed and duplex can't change without a link down.
+ * Changes made with ethtool while the link stays up come through
+ * bridge_link_settings_notify(). A change of the port address which changes
+ * the bridge address comes with its own notification for the bridge.
+ */
+static void set_if_up(port_t *prt, bool up, const __u8 *macaddr)
 {
+    check_mac_address(macaddr, prt->sysdeps.macaddr);
+
+    if(up == prt->sysdeps.up)
+        return;
     INFO("Port %s : %s", prt->sysdeps.name, (up ? "up" : "down"));
-    int speed = -1;
-    int duplex = -1;
-    bool changed = false;
 
-    if(check_mac_address(prt->sysdeps.name, prt->sysdeps.macaddr))
+    if(up)
+        get_link_settings(prt);
+    prt->sysdeps.up = up;
+    MSTP_IN_set_port_enable(prt, prt->sysdeps.up, prt->sysdeps.speed,
+                            prt->sysdeps.duplex);
+}
+
+static port_t *find_port(int if_index)
+{
+    bridge_t *br;
+    port_t *prt;
+
+    list_for_each_entry(br, &bridges, list)
+        if((prt = find_if(br, if_index)))
+            return prt;
+    return NULL;
+}
+
+/* Path cost and point-to-point status follow the new settings, the state
+ * machines go on from where they are */
+static void update_link_settings(port_t *prt, int speed, int duplex)
+{
+    if(!prt->sysdeps.up)
+        return;
+    if((speed == prt->sysdeps.speed) && (duplex == prt->sysdeps.duplex))
+        return;
+    INFO("Port %s : speed %d, %s duplex", prt->sysdeps.name, speed,
+         duplex ? "full" : "half");
+    snapshot_invalidate();
+    prt->sysdeps.speed = speed;
+    prt->sysdeps.duplex = duplex;
+    MSTP_IN_set_port_enable(prt, true, speed, duplex);
+}
+
+static void update_aggregate(int agg_index)
+{
+    port_t *prt;
+    int speed, duplex;
+
+    if((prt = find_port(agg_index))
+       && aggregate_speed(agg_index, &speed, &duplex))
+        update_link_settings(prt, speed, duplex);
+}
+
+void bridge_link_settings_notify(int if_index, int speed, int duplex)
+{
+    agg_member_t *m;
+    port_t *prt;
+
+    /* Unknown while the link is down, it is queried again on link up */
+    if((0 > speed) || (0 > duplex))
+        return;
+    if((m = find_member(if_index)))
     {
-        /* MAC address changed */
-        if(check_mac_address(prt->bridge->sysdeps.name,
-           prt->bridge->sysdeps.macaddr))
-        {
-            /* Notify bridge address change */
-            MSTP_IN_set_bridge_address(prt->bridge,
-                                       prt->bridge->sysdeps.macaddr);
-        }
+        if(!m->active)
+            return;
+        m->speed = speed;
+        m->duplex = duplex;
+        update_aggregate(m->agg_index);
+        return;
     }
+    if(!(prt = find_port(if_index))
+       || aggregate_speed(if_index, &speed, &duplex))
+        return;
+    update_link_settings(prt, speed, duplex);
+}
 
-    if(!up)
-    { /* Down */
-        if(prt->sysdeps.up)
-        {
-            prt->sysdeps.up = false;
-            changed = true;
-        }
+static void remove_member(agg_member_t *m)
+{
+    int agg_index = m->agg_index;
+    bool active = m->active;
+
+    INFO("Interface %s left aggregate %d", m->name, agg_index);
+    list_del(&m->list);
+    free(m);
+    if(active)
+        update_aggregate(agg_index);
+}
+
+void bridge_member_notify(int agg_index, int if_index, const char *name,
+                          bool active)
+{
+    agg_member_t *m;
+    int speed = -1, duplex = -1;
+    __u32 supported;
+
+    if(!(m = find_member(if_index)))
+    {
+        if(0 > agg_index)
+            return;
+        TST((m = calloc(1, sizeof(*m))) != NULL,);
+        m->if_index = if_index;
+        m->agg_index = agg_index;
+        list_add_tail(&m->list, &members);
+        INFO("Interface %s joined aggregate %d", name, agg_index);
     }
-    else
-    { /* Up */
-        int r = ethtool_get_speed_duplex(prt->sysdeps.name, &speed, &duplex);
-        if((r < 0) || (speed < 0))
-            speed = 10;
-        if((r < 0) || (duplex < 0))
-            duplex = 0; /* Assume half duplex */
-
-        if(speed != prt->sysdeps.speed)
-        {
-            prt->sysdeps.speed = speed;
-            changed = true;
-        }
-        if(duplex != prt->sysdeps.duplex)
-        {
-            prt->sysdeps.duplex = duplex;
-            changed = true;
-        }
-        if(!prt->sysdeps.up)
-        {
-            prt->sysdeps.up = true;
-            changed = true;
-        }
+    strncpy(m->name, name, IFNAMSIZ - 1);
+    m->seen = true;
+    if(0 > agg_index)
+    {
+        remove_member(m);
+        return;
     }
-    if(changed)
-        MSTP_IN_set_port_enable(prt, prt->sysdeps.up, prt->sysdeps.speed,
-                                prt->sysdeps.duplex);
+    if(m->agg_index != agg_index)
+    {
+        /* Moved without a notification of leaving the old aggregate */
+        remove_member(m);
+        bridge_member_notify(agg_index, if_index, name, active);
+        return;
+    }
+    if(active == m->active)
+        return;
+
+    if(active)
+    {
+        if((0 > ethtool_get_link_settings(m->name, &speed, &duplex,
+                                          &supported)) || (0 > speed))
+            speed = 0; /* adds nothing until ethtool notifies it */
+        if(0 > duplex)
+            duplex = 0;
+        m->speed = speed;
+        m->duplex = duplex;
+    }
+    m->active = active;
+    LOG("Aggregate %d member %s %s", agg_index, m->name,
+        active ? "active" : "inactive");
+    update_aggregate(agg_index);
 }
 
 /* br_index == if_index means: interface is bridge master */
-int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags)
+int bridge_notify(int br_index, int if_index, bool newlink,
+                  const link_attrs_t *attrs)
 {
     port_t *prt;
     bridge_t *br = NULL, *other_br;
-    bool up = !!(flags & IFF_UP);
-    bool running = up && (flags & IFF_RUNNING);
+    bool up = !!(attrs->flags & IFF_UP);
+    bool running = up && (attrs->flags & IFF_RUNNING);
 
     LOG("br_index %d, if_index %d, newlink %d, up %d, running %d",
         br_index, if_index, newlink, up, running);
+    snapshot_invalidate();
 
     if((br_index >= 0) && (br_index != if_index))
     {
+        /* The bridge flags come with the notifications for the bridge */
         if(!(br = find_br(br_index)))
             return -2; /* bridge not in list */
-        int br_flags = get_flags(br->sysdeps.name);
-        if(br_flags >= 0)
-            set_br_up(br, !!(br_flags & IFF_UP));
     }
 
     if(br)
@@ -322,7 +528,9 @@ int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags)
             delete_if(prt);
             return 0;
         }
-        set_if_up(prt, running); /* And speed and duplex */
+        if(prt->sysdeps.offloaded && (0 <= attrs->state))
+            switchdev_port_state(if_index, attrs->state);
+        set_if_up(prt, running, attrs->macaddr); /* And speed and duplex */
     }
     else
     { /* Interface is not a bridge slave */
@@ -344,13 +552,106 @@ int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags)
             {
                 if(!(br = find_br(br_index)))
                     return -2; /* bridge not in list */
-                set_br_up(br, up);
+                set_br_up(br, up, attrs->macaddr);
             }
         }
     }
     return 0;
 }
 
+static int resync_changes;
+
+void bridge_resync_begin(void)
+{
+    bridge_t *br;
+    port_t *prt;
+    agg_member_t *m;
+
+    resync_changes = 0;
+    list_for_each_entry(m, &members, list)
+        m->seen = false;
+    list_for_each_entry(br, &bridges, list)
+    {
+        br->sysdeps.seen = false;
+        list_for_each_entry(prt, &br->ports, br_list)
+            prt->sysdeps.seen = false;
+    }
+}
+
+void bridge_resync_link(int br_index, int if_index, const link_attrs_t *attrs)
+{
+    bridge_t *br;
+    port_t *prt;
+    bool up = !!(attrs->flags & IFF_UP);
+    bool running = up && (attrs->flags & IFF_RUNNING);
+
+    if((br_index < 0) || !(br = find_br(br_index)))
+        return;
+    if(br_index == if_index)
+    {
+        br->sysdeps.seen = true;
+        if((up != br->sysdeps.up) || (attrs->macaddr
+           && memcmp(attrs->macaddr, br->sysdeps.macaddr, ETH_ALEN)))
+        {
+            ++resync_changes;
+            set_br_up(br, up, attrs->macaddr);
+        }
+        return;
+    }
+    /* A port which moved to another bridge is missing from the old one */
+    if(!(prt = find_if(br, if_index)))
+        return;
+    prt->sysdeps.seen = true;
+    /* The kernel resets the state on link up, a state other than ours
+     * means that we missed a down and up */
+    if(running && prt->sysdeps.up && (0 <= attrs->state)
+       && (attrs->state != GET_CIST_PTP_FROM_PORT(prt)->state))
+    {
+        INFO("Port %s missed a link flap", prt->sysdeps.name);
+        set_if_up(prt, false, NULL);
+    }
+    if((running != prt->sysdeps.up) || (attrs->macaddr
+       && memcmp(attrs->macaddr, prt->sysdeps.macaddr, ETH_ALEN)))
+    {
+        ++resync_changes;
+        set_if_up(prt, running, attrs->macaddr);
+    }
+}
+
+int bridge_resync_end(void)
+{
+    bridge_t *br, *nxt_br;
+    port_t *prt, *nxt;
+    agg_member_t *m, *nxt_m;
+
+    list_for_each_entry_safe(m, nxt_m, &members, list)
+        if(!m->seen)
+        {
+            ++resync_changes;
+            remove_member(m);
+        }
+    list_for_each_entry_safe(br, nxt_br, &bridges, list)
+    {
+        if(!br->sysdeps.seen)
+        {
+            INFO("Bridge %s is gone", br->sysdeps.name);
+            ++resync_changes;
+            delete_br_byindex(br->sysdeps.if_index);
+            continue;
+        }
+        list_for_each_entry_safe(prt, nxt, &br->ports, br_list)
+            if(!prt->sysdeps.seen)
+            {
+                INFO("Port %s is gone from bridge %s", prt->sysdeps.name,
+                     br->sysdeps.name);
+                ++resync_changes;
+                delete_if(prt);
+            }
+    }
+    snapshot_invalidate();
+    return resync_changes;
+}
+
 struct llc_header
 {
     __u8 dest_addr[ETH_ALEN];
@@ -372,10 +673,46 @@ static const __u8 bridge_group_address[ETH_ALEN] =
     0x01, 0x80, 0xc2, 0x00, 0x00, 0x00
 };
 
+/* Validates the frame, returns the length of the BPDU with the LLC
+ * control byte or 0 */
+static unsigned int bpdu_len(int if_index, const unsigned char *data, int len)
+{
+    /* Validate Ethernet and LLC header,
+     * maybe we can skip this check thanks to Berkeley filter in packet socket?
+     */
+    struct llc_header *h;
+    unsigned int l;
+    TST(len > sizeof(struct llc_header), 0);
+    h = (struct llc_header *)data;
+    TST(0 == memcmp(h->dest_addr, bridge_group_address, ETH_ALEN),
+             (INFO("ifindex %d, len %d, %02hhX%02hhX%02hhX%02hhX%02hhX%02hhX",
+                   if_index, len,
+                   h->dest_addr[0], h->dest_addr[1], h->dest_addr[2],
+                   h->dest_addr[3], h->dest_addr[4], h->dest_addr[5]), 0)
+       );
+    l = __be16_to_cpu(h->len8023);
+    TST(l <= ETH_DATA_LEN && l <= len - ETH_HLEN && l >= LLC_PDU_LEN_U, 0);
+    TST(h->d_sap == LLC_SAP_BSPAN && h->s_sap == LLC_SAP_BSPAN && (h->llc_ctrl & 0x3) == LLC_PDU_TYPE_U, 0);
+    return l;
+}
+
+static void bpdu_rcv(port_t *prt, const unsigned char *data, unsigned int l,
+                     __u64 start)
+{
+    MSTP_IN_rx_bpdu(prt,
+                    /* Don't include LLC header */
+                    (bpdu_t *)(data + sizeof(struct llc_header)),
+                    l - LLC_PDU_LEN_U);
+    snapshot_invalidate();
+    stats_record_since(STATS_RX_BPDU, start);
+}
+
 void bridge_bpdu_rcv(int if_index, const unsigned char *data, int len)
 {
     port_t *prt = NULL;
     bridge_t *br;
+    unsigned int l;
+    __u64 start = stats_now();
 
     LOG("ifindex %d, len %d", if_index, len);
 
@@ -390,27 +727,32 @@ void bridge_bpdu_rcv(int if_index, const unsigned char *data, int len)
     /* sanity checks */
     TST(br == prt->bridge,);
     TST(prt->sysdeps.up,);
+    if(!(l = bpdu_len(if_index, data, len)))
+        return;
 
-    /* Validate Ethernet and LLC header,
-     * maybe we can skip this check thanks to Berkeley filter in packet socket?
-     */
-    struct llc_header *h;
-    unsigned int l;
-    TST(len > sizeof(struct llc_header),);
-    h = (struct llc_header *)data;
-    TST(0 == memcmp(h->dest_addr, bridge_group_address, ETH_ALEN),
-             INFO("ifindex %d, len %d, %02hhX%02hhX%02hhX%02hhX%02hhX%02hhX",
-                  if_index, len,
-                  h->dest_addr[0], h->dest_addr[1], h->dest_addr[2],
-                  h->dest_addr[3], h->dest_addr[4], h->dest_addr[5])
-       );
-    l = __be16_to_cpu(h->len8023);
-    TST(l <= ETH_DATA_LEN && l <= len - ETH_HLEN && l >= LLC_PDU_LEN_U, );
-    TST(h->d_sap == LLC_SAP_BSPAN && h->s_sap == LLC_SAP_BSPAN && (h->llc_ctrl & 0x3) == LLC_PDU_TYPE_U,);
+    if(0 <= br->sysdeps.worker)
+        worker_bpdu_rcv(br->sysdeps.worker, if_index, data, len, start);
+    else
+        bpdu_rcv(prt, data, l, start);
+}
 
-    MSTP_IN_rx_bpdu(prt,
-                    /* Don't include LLC header */
-                    (bpdu_t *)(data + sizeof(*h)), l - LLC_PDU_LEN_U);
+void bridge_worker_bpdu_rcv(int worker, int if_index,
+                            const unsigned char *data, int len, __u64 start)
+{
+    port_t *prt = NULL;
+    bridge_t *br;
+
+    list_for_each_entry(br, &bridges, list)
+    {
+        if((prt = find_if(br, if_index)))
+            break;
+    }
+    /* Port may have gone or moved to another bridge since the BPDU
+     * was routed */
+    if(!prt || (br->sysdeps.worker != worker) || !prt->sysdeps.up)
+        return;
+    bpdu_rcv(prt, data, __be16_to_cpu(((struct llc_header *)data)->len8023),
+             start);
 }
 
 static int br_set_state(struct rtnl_handle *rth, unsigned ifindex, __u8 state)
@@ -447,32 +789,149 @@ static int br_flush_port(char *ifname)
     return 0;
 }
 
-static int br_set_ageing_time(char *brname, unsigned int ageing_time)
+/* Rapid ageing. The kernel bridge has one ageing time for all its ports,
+ * so the entries of the ports in rapid ageing are aged out here instead:
+ * once a second the FDB of each of these ports is dumped, and its dynamic
+ * entries which were not updated for the ageing time are deleted in
+ * batches. The ageing time of the bridge stays as it is.
+ * Entries learned by switchdev hardware don't tell their age, offloaded
+ * ports are flushed when rapid ageing starts instead.
+ */
+#define FDB_DEL_BATCH_SIZE  16384
+#define FDB_DEL_REQ_MAX     64      /* one RTM_DELNEIGH request */
+
+#define NDA_RTA(r) \
+    ((struct rtattr *)(((char *)(r)) + NLMSG_ALIGN(sizeof(struct ndmsg))))
+
+typedef struct
 {
-    char fname[128], str_time[32];
-    snprintf(fname, sizeof(fname), SYSFS_CLASS_NET "/%s/bridge/ageing_time",
-             brname);
-    int fd = open(fname, O_WRONLY);
-    TSTM(0 <= fd, -1, "Couldn't open file %s for write: %m", fname);
-    int len = sprintf(str_time, "%u", ageing_time * HZ);
-    int write_result = write(fd, str_time, len);
-    close(fd);
-    TST(len == write_result, -1);
+    port_t *prt;
+    __u64 tick_ns;          /* unit of NDA_CACHEINFO */
+    char *buf;              /* RTM_DELNEIGH requests */
+    int len, size;
+} fdb_ageing_t;
+
+static int fdb_ageing_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                          void *arg)
+{
+    fdb_ageing_t *ageing = arg;
+    struct ndmsg *ndm = NLMSG_DATA(n);
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+    struct rtattr *tb[NDA_MAX + 1];
+    struct nda_cacheinfo *ci;
+    struct nlmsghdr *req;
+    port_t *prt = ageing->prt;
+
+    if((RTM_NEWNEIGH != n->nlmsg_type) || (len < 0)
+       || (AF_BRIDGE != ndm->ndm_family)
+       || (ndm->ndm_ifindex != prt->sysdeps.if_index)
+       || (ndm->ndm_flags & (NTF_SELF | NTF_EXT_LEARNED))
+       || (ndm->ndm_state & (NUD_PERMANENT | NUD_NOARP)))
+        return 0;
+    parse_rtattr(tb, NDA_MAX, NDA_RTA(ndm), len);
+    if(!tb[NDA_LLADDR] || (ETH_ALEN != RTA_PAYLOAD(tb[NDA_LLADDR]))
+       || !tb[NDA_CACHEINFO]
+       || (sizeof(*ci) > RTA_PAYLOAD(tb[NDA_CACHEINFO])))
+        return 0;
+    ci = RTA_DATA(tb[NDA_CACHEINFO]);
+    if((__u64)ci->ndm_updated * ageing->tick_ns
+       < prt->sysdeps.rapid_ageing * 1000000000ULL)
+        return 0;
+
+    if(ageing->len + FDB_DEL_REQ_MAX > ageing->size)
+    {
+        int size = ageing->size ? 2 * ageing->size : 4096;
+        char *buf = realloc(ageing->buf, size);
+        if(!buf)
+            return -1;
+        ageing->buf = buf;
+        ageing->size = size;
+    }
+    req = (struct nlmsghdr *)(ageing->buf + ageing->len);
+    memset(req, 0, FDB_DEL_REQ_MAX);
+    req->nlmsg_len = NLMSG_LENGTH(sizeof(*ndm));
+    req->nlmsg_type = RTM_DELNEIGH;
+    req->nlmsg_flags = NLM_F_REQUEST;
+    ndm = NLMSG_DATA(req);
+    ndm->ndm_family = PF_BRIDGE;
+    ndm->ndm_ifindex = prt->sysdeps.if_index;
+    ndm->ndm_flags = NTF_MASTER;
+    addattr_l(req, FDB_DEL_REQ_MAX, NDA_LLADDR, RTA_DATA(tb[NDA_LLADDR]), ETH_ALEN);
+    if(tb[NDA_VLAN])
+        addattr_l(req, FDB_DEL_REQ_MAX, NDA_VLAN, RTA_DATA(tb[NDA_VLAN]),
+                  sizeof(__u16));
+    ageing->len += NLMSG_ALIGN(req->nlmsg_len);
     return 0;
 }
 
+static void br_age_ports(bridge_t *br)
+{
+    struct ifinfomsg ifi;
+    fdb_ageing_t ageing;
+    port_t *prt;
+    bool rapid = false;
+    int off, len, failed = 0;
+    long ticks;
+    __u64 start;
+
+    /* Nothing to do while no port is in rapid ageing */
+    list_for_each_entry(prt, &br->ports, br_list)
+        rapid = rapid || prt->sysdeps.rapid_ageing;
+    if(!rapid)
+        return;
+
+    start = stats_now();
+    memset(&ageing, 0, sizeof(ageing));
+    ticks = sysconf(_SC_CLK_TCK);
+    ageing.tick_ns = 1000000000ULL / ((0 < ticks) ? ticks : 100);
+    /* An ifinfomsg request dumps the entries of one bridge port, the
+     * requests for all ports are sent together below */
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        if(!prt->sysdeps.rapid_ageing)
+            continue;
+        ageing.prt = prt;
+        memset(&ifi, 0, sizeof(ifi));
+        ifi.ifi_family = PF_BRIDGE;
+        ifi.ifi_index = prt->sysdeps.if_index;
+        if((0 > rtnl_dump_request(rth_state_local, RTM_GETNEIGH, &ifi,
+                                  sizeof(ifi)))
+           || (0 > rtnl_dump_filter(rth_state_local, fdb_ageing_msg, &ageing,
+                                    NULL, NULL)))
+            ERROR_PRTNAME(br, prt,
+                          "Couldn't dump forwarding database for ageing");
+    }
+
+    /* Cut the requests in batches at message boundaries */
+    for(off = 0; off < ageing.len; off += len)
+    {
+        struct nlmsghdr *h;
+        for(len = 0; off + len < ageing.len; len += NLMSG_ALIGN(h->nlmsg_len))
+        {
+            h = (struct nlmsghdr *)(ageing.buf + off + len);
+            if(len + NLMSG_ALIGN(h->nlmsg_len) > FDB_DEL_BATCH_SIZE)
+                break;
+        }
+        /* Entries may age out in the kernel meanwhile */
+        failed += rtnl_talk_batch(rth_state_local, ageing.buf + off, len,
+                                  ENOENT);
+    }
+    if(failed)
+        INFO_BRNAME(br, "Couldn't age out %d forwarding database entries",
+                    failed);
+    free(ageing.buf);
+    stats_record_since(STATS_BR_FDB_AGEING, start);
+}
+
 /* External actions for MSTP protocol */
 
-void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
+/* Count, log and notify the new ptp->state and set it in the kernel */
+static void port_state_changed(per_tree_port_t *ptp)
 {
     char * state_name;
     port_t *prt = ptp->port;
     bridge_t *br = prt->bridge;
 
-    if(ptp->state == new_state)
-        return;
-    ptp->state = driver_set_new_state(ptp, new_state);
-
     switch(ptp->state)
     {
         case BR_STATE_LISTENING:
@@ -483,11 +942,11 @@ void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
             break;
         case BR_STATE_FORWARDING:
             state_name = "forwarding";
-            ++(prt->num_trans_fwd);
+            ++(prt->counters.trans_fwd);
             break;
         case BR_STATE_BLOCKING:
             state_name = "blocking";
-            ++(prt->num_trans_blk);
+            ++(prt->counters.trans_blk);
             break;
         default:
         case BR_STATE_DISABLED:
@@ -495,14 +954,67 @@ void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
             break;
     }
     INFO_MSTINAME(br, prt, ptp, "entering %s state", state_name);
+    MSTP_OUT_notify(ptp->tree, prt, MSTP_EVENT_PORT_STATE, ptp->state);
 
     /* Translate new CIST state to the kernel bridge code */
     if(0 == ptp->MSTID)
     { /* CIST */
-        if(0 > br_set_state(&rth_state, prt->sysdeps.if_index, ptp->state))
+        __u64 start = stats_now();
+        if(0 > br_set_state(rth_state_local, prt->sysdeps.if_index,
+                            ptp->state))
             INFO_PRTNAME(br, prt, "Couldn't set kernel bridge state %s",
                           state_name);
+        stats_record_since(STATS_BR_SET_STATE, start);
+    }
+}
+
+void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
+{
+    if(ptp->state == new_state)
+        return;
+    ptp->state = driver_ops_set_state(ptp, new_state);
+    TRACE_PTP(ptp, TRACE_SET_STATE, ptp->state, new_state);
+    if(ptp->roleChangeTime)
+    {
+        stats_record_since(STATS_ROLE_TO_STATE, ptp->roleChangeTime);
+        ptp->roleChangeTime = 0;
     }
+    port_state_changed(ptp);
+}
+
+void bridge_driver_state(per_tree_port_t *ptp, int requested, int state)
+{
+    /* The state machines have moved on meanwhile */
+    if(ptp->state != requested)
+        return;
+    INFO_MSTINAME(ptp->port->bridge, ptp->port, ptp,
+                  "Driver has set state %d instead of %d", state, requested);
+    ptp->state = state;
+    TRACE_PTP(ptp, TRACE_SET_STATE, state, requested);
+    port_state_changed(ptp);
+    snapshot_invalidate();
+}
+
+void MSTP_OUT_notify(tree_t *tree, port_t *prt, mstp_event_t event,
+                     unsigned int arg)
+{
+    CTL_Event ev;
+    struct timespec ts;
+
+    if(!ctl_num_subscribers)
+        return;
+    memset(&ev, 0, sizeof(ev));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ev.ts = (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    ev.br_index = (tree ? tree->bridge : prt->bridge)->sysdeps.if_index;
+    ev.if_index = prt ? prt->sysdeps.if_index : 0;
+    ev.mstid = tree ? __be16_to_cpu(tree->MSTID) : 0;
+    ev.event = event;
+    ev.arg = arg;
+    if(tree)
+        ev.root = tree->MSTID ? tree->rootPriority.RRootID
+                              : tree->rootPriority.RootID;
+    ctl_socket_notify(&ev);
 }
 
 /* This function initiates process of flushing
@@ -516,16 +1028,19 @@ void MSTP_OUT_flush_all_fids(per_tree_port_t * ptp)
     port_t *prt = ptp->port;
     bridge_t *br = prt->bridge;
 
+    TRACE_PTP(ptp, TRACE_FLUSH, 0, 0);
     /* Translate CIST flushing to the kernel bridge code */
     if(0 == ptp->MSTID)
     { /* CIST */
+        __u64 start = stats_now();
         if(0 > br_flush_port(prt->sysdeps.name))
             ERROR_PRTNAME(br, prt,
                           "Couldn't flush kernel bridge forwarding database");
+        stats_record_since(STATS_BR_FLUSH_PORT, start);
     }
     /* Completion signal MSTP_IN_all_fids_flushed will be called by driver */
     INFO_MSTINAME(br, prt, ptp, "Flushing forwarding database");
-    driver_flush_all_fids(ptp);
+    driver_ops_flush(ptp);
 }
 
 void MSTP_OUT_set_ageing_time(port_t *prt, unsigned int ageingTime)
@@ -533,16 +1048,49 @@ void MSTP_OUT_set_ageing_time(port_t *prt, unsigned int ageingTime)
     unsigned int actual_ageing_time;
     bridge_t *br = prt->bridge;
 
-    actual_ageing_time = driver_set_ageing_time(prt, ageingTime);
+    TRACE_PRT(prt, TRACE_SET_AGEING, 0, ageingTime);
+    actual_ageing_time = driver_ops_set_ageing_time(prt, ageingTime);
     INFO_PRTNAME(br, prt, "Setting new ageing time to %u", actual_ageing_time);
 
     /*
-     * Translate new ageing time to the kernel bridge code.
-     * Kernel bridging code does not support per-port ageing time,
-     * so set ageing time for the whole bridge.
+     * Kernel bridging code does not support per-port ageing time.
+     * Ageing time shorter than the one of the bridge is rapid ageing of
+     * this port, done by br_age_ports() every second.
      */
-    if(0 > br_set_ageing_time(br->sysdeps.name, actual_ageing_time))
-        ERROR_BRNAME(br, "Couldn't set new ageing time in kernel bridge");
+    if(actual_ageing_time >= br->Ageing_Time)
+    {
+        prt->sysdeps.rapid_ageing = 0;
+        return;
+    }
+    /* br_age_ports() leaves the entries of the hardware alone, the flush
+     * reaches it through switchdev */
+    if(!prt->sysdeps.rapid_ageing && prt->sysdeps.offloaded
+       && (0 > br_flush_port(prt->sysdeps.name)))
+        ERROR_PRTNAME(br, prt, "Couldn't flush for rapid ageing");
+    prt->sysdeps.rapid_ageing = actual_ageing_time ? actual_ageing_time : 1;
+}
+
+/* The ageing time of the kernel bridge is the one of the bridge; the short
+ * ageing times of single ports are done by br_age_ports() */
+static int br_set_ageing_time(char *brname, unsigned int ageing_time)
+{
+    char fname[128], str_time[32];
+    snprintf(fname, sizeof(fname), SYSFS_CLASS_NET "/%s/bridge/ageing_time",
+             brname);
+    int fd = open(fname, O_WRONLY);
+    TSTM(0 <= fd, -1, "Couldn't open file %s for write: %m", fname);
+    int len = sprintf(str_time, "%u", ageing_time * HZ);
+    int write_result = write(fd, str_time, len);
+    close(fd);
+    TST(len == write_result, -1);
+    return 0;
+}
+
+void MSTP_OUT_set_bridge_ageing_time(bridge_t *br, unsigned int ageingTime)
+{
+    INFO_BRNAME(br, "Setting bridge ageing time to %u", ageingTime);
+    if(br_set_ageing_time(br->sysdeps.name, ageingTime))
+        ERROR_BRNAME(br, "Couldn't set bridge ageing time");
 }
 
 void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t * bpdu, int size)
@@ -557,9 +1105,11 @@ void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t * bpdu, int size)
             {
                 case bpduTypeConfig:
                     bpdu_type = "STP-Config";
+                    ++(prt->counters.tx_config);
                     break;
                 case bpduTypeTCN:
                     bpdu_type = "STP-TCN";
+                    ++(prt->counters.tx_tcn);
                     break;
                 default:
                     bpdu_type = "STP-UnknownType";
@@ -567,18 +1117,21 @@ void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t * bpdu, int size)
             break;
         case protoRSTP:
             bpdu_type = "RST";
+            ++(prt->counters.tx_rst);
             break;
         case protoMSTP:
             bpdu_type = "MST";
+            ++(prt->counters.tx_mst);
             break;
         default:
             bpdu_type = "UnknownProto";
     }
 
-    ++(prt->num_tx_bpdu);
+    ++(prt->counters.tx_bpdu);
+    TRACE_PRT(prt, TRACE_TX_BPDU, bpdu->bpduType, TRACE_BPDU_ARG(bpdu, size));
     if((protoSTP == bpdu->protocolVersion) && (bpduTypeTCN == bpdu->bpduType))
     {
-        ++(prt->num_tx_tcn);
+        ++(prt->counters.tx_tc);
         LOG_PRTNAME(br, prt, "sending %s BPDU", bpdu_type);
     }
     else
@@ -586,7 +1139,7 @@ void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t * bpdu, int size)
         tcflag = "";
         if(bpdu->flags & (1 << offsetTc))
         {
-            ++(prt->num_tx_tcn);
+            ++(prt->counters.tx_tc);
             tcflag = ", tcFlag";
         }
         LOG_PRTNAME(br, prt, "sending %s BPDU%s", bpdu_type, tcflag);
@@ -610,6 +1163,7 @@ void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t * bpdu, int size)
 
 void MSTP_OUT_shutdown_port(port_t *prt)
 {
+    TRACE_PRT(prt, TRACE_SHUTDOWN, 0, 0);
     if(0 > if_shutdown(prt->sysdeps.name))
         ERROR_PRTNAME(prt->bridge, prt, "Couldn't shutdown port");
 }
@@ -771,7 +1325,8 @@ int CTL_get_mstilist(int br_index, int *num_mstis, __u16 *mstids)
 int CTL_create_msti(int br_index, __u16 mstid)
 {
     CTL_CHECK_BRIDGE;
-    if((!driver_create_msti(br, mstid)) || (!MSTP_IN_create_msti(br, mstid)))
+    if((!driver_ops_create_msti(br, mstid))
+       || (!MSTP_IN_create_msti(br, mstid)))
         return -1;
     return 0;
 }
@@ -779,8 +1334,10 @@ int CTL_create_msti(int br_index, __u16 mstid)
 int CTL_delete_msti(int br_index, __u16 mstid)
 {
     CTL_CHECK_BRIDGE;
-    if((!driver_delete_msti(br, mstid)) || (!MSTP_IN_delete_msti(br, mstid)))
+    if((!driver_ops_delete_msti(br, mstid))
+       || (!MSTP_IN_delete_msti(br, mstid)))
         return -1;
+    driver_ops_cancel(br, NULL, mstid);
     return 0;
 }
 
@@ -801,7 +1358,10 @@ int CTL_set_mstconfid(int br_index, __u16 revision, __u8 *name)
 int CTL_get_vids2fids(int br_index, __u16 *vids2fids)
 {
     CTL_CHECK_BRIDGE;
-    memcpy(vids2fids, br->vid2fid, sizeof(br->vid2fid));
+    if(br->vid2fid)
+        memcpy(vids2fids, br->vid2fid, (MAX_VID + 1) * sizeof(__u16));
+    else
+        memset(vids2fids, 0, (MAX_VID + 1) * sizeof(__u16));
     return 0;
 }
 
@@ -809,8 +1369,8 @@ int CTL_get_fids2mstids(int br_index, __u16 *fids2mstids)
 {
     CTL_CHECK_BRIDGE;
     int i;
-    for(i = 0; i < COUNT_OF(br->fid2mstid); ++i)
-        fids2mstids[i] = __be16_to_cpu(br->fid2mstid[i]);
+    for(i = 0; i <= MAX_FID; ++i)
+        fids2mstids[i] = __be16_to_cpu(GET_FID2MSTID(br, i));
     return 0;
 }
 
@@ -838,77 +1398,226 @@ int CTL_set_fids2mstids(int br_index, __u16 *fids2mstids)
     return MSTP_IN_set_all_fids2mstids(br, fids2mstids) ? 0 : -1;
 }
 
-int CTL_add_bridges(int *br_array, int* *ifaces_lists)
+int CTL_get_memory_status(int br_index, Bridge_MemoryStatus *status)
 {
-    int i, j, ifcount, brcount = br_array[0];
+    CTL_CHECK_BRIDGE;
+    MSTP_IN_get_memory_status(br, status);
+    return 0;
+}
+
+int CTL_get_trace(__u32 seq, __u32 *next_seq, int *num, trace_rec_t *recs)
+{
+    *next_seq = seq;
+    *num = trace_get(next_seq, recs, TRACE_CHUNK_SIZE);
+    return 0;
+}
+
+int CTL_get_stats(int id, stats_hist_t *hist, __u64 *sm_run_timeouts,
+                  epoll_stats_t *loop)
+{
+    if((0 > id) || (STATS_NUM_HISTS <= id))
+    {
+        ERROR("Bad statistics id %d", id);
+        return -1;
+    }
+    stats_get(id, hist);
+    *sm_run_timeouts = stats_sm_run_timeouts;
+    *loop = epoll_stats;
+    return 0;
+}
+
+int CTL_reset_stats(void)
+{
+    stats_reset();
+    memset(&epoll_stats, 0, sizeof(epoll_stats));
+    return 0;
+}
+
+int CTL_get_port_counters(int br_index, int first, void *buf, int len)
+{
+    PortCounters_Header *hdr = buf;
+    unsigned char *p = (unsigned char *)(hdr + 1);
+    Port_Counters *pc;
+    TreePort_Counters *tpc;
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+    int i = 0;
+
+    CTL_CHECK_BRIDGE;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->first = first;
+    list_for_each_entry(tree, &br->trees, bridge_list)
+        ++(hdr->num_trees);
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        if(first > i++)
+            continue;
+        if(PORT_COUNTERS_SIZE(hdr->num_trees)
+           > len - (p - (unsigned char *)buf))
+            continue;
+        pc = (Port_Counters *)p;
+        pc->if_index = prt->sysdeps.if_index;
+        pc->counters = prt->counters;
+        tpc = (TreePort_Counters *)(pc + 1);
+        list_for_each_entry(ptp, &prt->trees, port_list)
+        {
+            tpc->mstid = __be16_to_cpu(ptp->MSTID);
+            tpc->counters = ptp->counters;
+            ++tpc;
+        }
+        p += PORT_COUNTERS_SIZE(hdr->num_trees);
+        ++(hdr->count);
+    }
+    hdr->num_ports = i;
+    return 0;
+}
+
+int bridge_add_ports(int br_index, link_port_t *ports, int count)
+{
+    int i, br_flags;
     bridge_t *br, *other_br;
     port_t *prt, *nxt;
-    int br_flags, if_flags;
-    int *if_array;
-    bool found;
+    port_t **up_ports;
+    int num_up = 0;
+    bool found, resume = false;
 
-    for(i = 1; i <= brcount; ++i)
+    if(NULL == (br = find_br(br_index)))
     {
-        if(NULL == (br = find_br(br_array[i])))
+        if(NULL == (br = create_br(br_index)))
         {
-            if(NULL == (br = create_br(br_array[i])))
+            ERROR("Couldn't create data for bridge interface %d", br_index);
+            return -1;
+        }
+        /* A bridge in the checkpoint is enabled after its ports */
+        if(0 <= (br_flags = get_flags(br->sysdeps.name)))
+        {
+            resume = (br_flags & IFF_UP) && checkpoint_has_bridge(br);
+            if(!resume)
+                set_br_up(br, !!(br_flags & IFF_UP), NULL);
+        }
+    }
+    /* delete all interfaces which are not in list */
+    list_for_each_entry_safe(prt, nxt, &br->ports, br_list)
+    {
+        found = false;
+        for(i = 0; i < count; ++i)
+        {
+            if(prt->sysdeps.if_index == ports[i].if_index)
             {
-                ERROR("Couldn't create data for bridge interface %d",
-                      br_array[i]);
-                return -1;
+                found = true;
+                break;
             }
-            if(0 <= (br_flags = get_flags(br->sysdeps.name)))
-                set_br_up(br, !!(br_flags & IFF_UP));
         }
-        if_array = ifaces_lists[i - 1];
-        ifcount = if_array[0];
-        /* delete all interfaces which are not in list */
-        list_for_each_entry_safe(prt, nxt, &br->ports, br_list)
+        if(!found)
+            delete_if(prt);
+    }
+    TST(NULL != (up_ports = calloc(count + 1, sizeof(*up_ports))), -1);
+    /* add all new interfaces from the list,
+     * memory for all of them is allocated in one go */
+    if(!MSTP_IN_reserve_ports(br, count))
+    {
+        ERROR("Couldn't allocate %d ports for bridge %s", count,
+              br->sysdeps.name);
+        free(up_ports);
+        return -1;
+    }
+    for(i = 0; i < count; ++i)
+    {
+        if(NULL != find_if(br, ports[i].if_index))
+            continue;
+        /* Check if this interface is slave of another bridge */
+        list_for_each_entry(other_br, &bridges, list)
         {
-            found = false;
-            for(j = 1; j <= ifcount; ++j)
-            {
-                if(prt->sysdeps.if_index == if_array[j])
+            if(other_br != br)
+                if(delete_if_byindex(other_br, ports[i].if_index))
                 {
-                    found = true;
+                    INFO("Device %d has come to bridge %s. "
+                         "Missed notify for deletion from bridge %s",
+                         ports[i].if_index, br->sysdeps.name,
+                         other_br->sysdeps.name);
                     break;
                 }
-            }
-            if(!found)
-                delete_if(prt);
         }
-        /* add all new interfaces from the list */
-        for(j = 1; j <= ifcount; ++j)
+        if(NULL == (prt = create_if_from(br, ports + i)))
         {
-            if(NULL != find_if(br, if_array[j]))
-                continue;
-            /* Check if this interface is slave of another bridge */
-            list_for_each_entry(other_br, &bridges, list)
-            {
-                if(other_br != br)
-                    if(delete_if_byindex(other_br, if_array[j]))
-                    {
-                        INFO("Device %d has come to bridge %s. "
-                             "Missed notify for deletion from bridge %s",
-                             if_array[j], br->sysdeps.name,
-                             other_br->sysdeps.name);
-                        break;
-                    }
-            }
-            if(NULL == (prt = create_if(br, if_array[j])))
+            INFO("Couldn't create data for interface %d (master %s)",
+                 ports[i].if_index, br->sysdeps.name);
+            continue;
+        }
+        if((IFF_UP | IFF_RUNNING) == (ports[i].flags & (IFF_UP | IFF_RUNNING)))
+        {
+            INFO("Port %s : up", prt->sysdeps.name);
+            prt->sysdeps.up = true;
+            up_ports[num_up++] = prt;
+        }
+    }
+    /* The state machines run once for all new ports, not once per port */
+    MSTP_IN_enable_ports(br, up_ports, num_up);
+    free(up_ports);
+    if(resume)
+    {
+        if(checkpoint_resume(br, ports, count))
+            br->sysdeps.up = true;
+        else
+            set_br_up(br, true, NULL);
+    }
+
+    return 0;
+}
+
+static int cmp_link_port(const void *a, const void *b)
+{
+    return ((const link_port_t *)a)->if_index
+           - ((const link_port_t *)b)->if_index;
+}
+
+int CTL_add_bridges(int *br_array, int* *ifaces_lists)
+{
+    int i, j, ifcount, brcount = br_array[0];
+    link_port_t *dumped = NULL, *ports, *lp;
+    int num_dumped;
+    int *if_array;
+    int r = 0;
+
+    /* One dump for the ports of all bridges, ports missing from it are
+     * queried one by one */
+    if(0 >= (num_dumped = bridge_dump_ports(-1, &dumped)))
+        num_dumped = 0;
+    else
+        qsort(dumped, num_dumped, sizeof(*dumped), cmp_link_port);
+
+    for(i = 1; (i <= brcount) && !r; ++i)
+    {
+        if_array = ifaces_lists[i - 1];
+        ifcount = if_array[0];
+        if(NULL == (ports = calloc(ifcount + 1, sizeof(*ports))))
+        {
+            ERROR("Out of memory for %d ports", ifcount);
+            r = -1;
+            break;
+        }
+        for(j = 0; j < ifcount; ++j)
+        {
+            link_port_t key = { .if_index = if_array[j + 1] };
+
+            if(num_dumped && (lp = bsearch(&key, dumped, num_dumped, sizeof(*dumped),
+                             cmp_link_port)))
+                ports[j] = *lp;
+            else
             {
-                INFO("Couldn't create data for interface %d (master %s)",
-                     if_array[j], br->sysdeps.name);
-                continue;
+                ports[j].if_index = if_array[j + 1];
+                ports[j].query = true;
+                ports[j].portno = -1;
+                ports[j].state = -1;
             }
-            if(0 <= (if_flags = get_flags(prt->sysdeps.name)))
-                set_if_up(prt, (IFF_UP | IFF_RUNNING) ==
-                               (if_flags & (IFF_UP | IFF_RUNNING))
-                         );
         }
+        r = bridge_add_ports(br_array[i], ports, ifcount);
+        free(ports);
     }
+    free(dumped);
 
-    return 0;
+    return r;
 }
 
 int CTL_del_bridges(int *br_array)
@@ -15,9 +15,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
+#include <linux/genetlink.h>
+#include <linux/ethtool_netlink.h>
 
 #include "log.h"
 #include "libnetlink.h"
@@ -44,6 +49,10 @@ enum
     IF_LINK_MODE_DORMANT, /* limit upward transition to dormant */
 };
 
+/* IFLA_BOND_SLAVE_STATE, from linux/if_bonding.h which clashes with
+ * net/if.h */
+#define BOND_STATE_ACTIVE   0
+
 static const char *port_states[] =
 {
     [BR_STATE_DISABLED] = "disabled",
@@ -53,21 +62,92 @@ static const char *port_states[] =
     [BR_STATE_BLOCKING] = "blocking",
 };
 
+#define RESYNC_TRIES    3
+
 static struct rtnl_handle rth;
+static struct rtnl_handle rth_dump;     /* for resync dumps */
 static struct epoll_event_handler br_handler;
 
+static struct rtnl_handle rth_ethtool;  /* ethtool link mode changes */
+static struct epoll_event_handler ethtool_handler;
+static __u16 ethtool_family;
+
 struct rtnl_handle rth_state;
+__thread struct rtnl_handle *rth_state_local = &rth_state;
+
+/* Bridges carry IFLA_INFO_KIND "bridge" in their AF_UNSPEC messages, bridge
+ * ports their IFLA_BRPORT_xxx in IFLA_INFO_SLAVE_DATA. Returns true for
+ * bridges, the port state goes to *port_state if not NULL.
+ */
+static bool parse_linkinfo(struct rtattr *linkinfo, int *port_state)
+{
+    struct rtattr *li[IFLA_INFO_MAX + 1];
+    struct rtattr *brport[IFLA_BRPORT_MAX + 1];
+    static const char kind[] = "bridge";
+
+    if(!linkinfo)
+        return false;
+    parse_rtattr_nested(li, IFLA_INFO_MAX, linkinfo);
+    if(port_state && li[IFLA_INFO_SLAVE_DATA])
+    {
+        parse_rtattr_nested(brport, IFLA_BRPORT_MAX, li[IFLA_INFO_SLAVE_DATA]);
+        if(brport[IFLA_BRPORT_STATE])
+            *port_state = *(uint8_t *)RTA_DATA(brport[IFLA_BRPORT_STATE]);
+    }
+    return li[IFLA_INFO_KIND]
+           && (RTA_PAYLOAD(li[IFLA_INFO_KIND]) >= sizeof(kind))
+           && !memcmp(RTA_DATA(li[IFLA_INFO_KIND]), kind, sizeof(kind));
+}
+
+/* Bond and team members carry IFLA_INFO_SLAVE_KIND "bond" or "team" in
+ * their AF_UNSPEC messages. Returns true for them, *active tells whether the
+ * member carries traffic of the aggregate: it is running and, for bonds, not
+ * a backup (active-backup mode, or not in the active 802.3ad aggregator).
+ */
+static bool parse_member(struct rtattr *linkinfo, unsigned flags,
+                         bool *active)
+{
+    struct rtattr *li[IFLA_INFO_MAX + 1];
+    struct rtattr *bond[IFLA_BOND_SLAVE_MAX + 1];
+    static const char bond_kind[] = "bond", team_kind[] = "team";
+    struct rtattr *kind;
+
+    if(!linkinfo)
+        return false;
+    parse_rtattr_nested(li, IFLA_INFO_MAX, linkinfo);
+    if(!(kind = li[IFLA_INFO_SLAVE_KIND]))
+        return false;
+    *active = ((IFF_UP | IFF_RUNNING) == (flags & (IFF_UP | IFF_RUNNING)));
+    if((RTA_PAYLOAD(kind) >= sizeof(team_kind))
+       && !memcmp(RTA_DATA(kind), team_kind, sizeof(team_kind)))
+        return true;
+    if((RTA_PAYLOAD(kind) < sizeof(bond_kind))
+       || memcmp(RTA_DATA(kind), bond_kind, sizeof(bond_kind)))
+        return false;
+    if(li[IFLA_INFO_SLAVE_DATA])
+    {
+        parse_rtattr_nested(bond, IFLA_BOND_SLAVE_MAX,
+                            li[IFLA_INFO_SLAVE_DATA]);
+        if(bond[IFLA_BOND_SLAVE_STATE]
+           && (BOND_STATE_ACTIVE
+               != *(__u8 *)RTA_DATA(bond[IFLA_BOND_SLAVE_STATE])))
+            *active = false;
+    }
+    return true;
+}
 
 static int dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
                     void *arg)
 {
     struct ifinfomsg *ifi = NLMSG_DATA(n);
     struct rtattr * tb[IFLA_MAX + 1];
+    struct rtattr * brport[IFLA_BRPORT_MAX + 1];
     int len = n->nlmsg_len;
     char b1[IFNAMSIZ];
     int af_family = ifi->ifi_family;
     bool newlink;
     int br_index;
+    link_attrs_t attrs;
 
     if(n->nlmsg_type == NLMSG_DONE)
         return 0;
@@ -86,16 +166,31 @@ static int dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 
     parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
 
-    /* Check if we got this from bonding */
-    if(tb[IFLA_MASTER] && af_family != AF_BRIDGE)
-        return 0;
-
     if(tb[IFLA_IFNAME] == NULL)
     {
         ERROR("BUG: nil ifname\n");
         return -1;
     }
 
+    if(af_family == AF_UNSPEC)
+    {
+        bool active;
+
+        if(tb[IFLA_MASTER]
+           && parse_member(tb[IFLA_LINKINFO], ifi->ifi_flags, &active))
+            bridge_member_notify((n->nlmsg_type == RTM_NEWLINK)
+                                   ? *(int *)RTA_DATA(tb[IFLA_MASTER]) : -1,
+                                 ifi->ifi_index, RTA_DATA(tb[IFLA_IFNAME]),
+                                 active);
+        else /* Not or no longer in a bond or team */
+            bridge_member_notify(-1, ifi->ifi_index,
+                                 RTA_DATA(tb[IFLA_IFNAME]), false);
+    }
+
+    /* Bridge ports are taken from their AF_BRIDGE messages */
+    if(tb[IFLA_MASTER] && af_family != AF_BRIDGE)
+        return 0;
+
     if(n->nlmsg_type == RTM_DELLINK)
         LOG("Deleted ");
 
@@ -141,38 +236,392 @@ static int dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
                 if_indextoname(*(int*)RTA_DATA(tb[IFLA_MASTER]), b1));
     }
 
+    attrs.state = -1;
     if(tb[IFLA_PROTINFO])
     {
-        uint8_t state = *(uint8_t *)RTA_DATA(tb[IFLA_PROTINFO]);
-        if(state <= BR_STATE_BLOCKING)
-            LOG("state %s", port_states[state]);
+        /* Nested IFLA_BRPORT_xxx attributes, a single state byte on
+         * old kernels */
+        int state = -1;
+        if(1 == RTA_PAYLOAD(tb[IFLA_PROTINFO]))
+            state = *(uint8_t *)RTA_DATA(tb[IFLA_PROTINFO]);
         else
+        {
+            parse_rtattr_nested(brport, IFLA_BRPORT_MAX, tb[IFLA_PROTINFO]);
+            if(brport[IFLA_BRPORT_STATE])
+                state = *(uint8_t *)RTA_DATA(brport[IFLA_BRPORT_STATE]);
+        }
+        if((0 <= state) && (state <= BR_STATE_BLOCKING))
+            LOG("state %s", port_states[state]);
+        else if(0 <= state)
             LOG("state (%d)", state);
+        attrs.state = state;
     }
 
     newlink = (n->nlmsg_type == RTM_NEWLINK);
 
     if(tb[IFLA_MASTER])
         br_index = *(int*)RTA_DATA(tb[IFLA_MASTER]);
-    else if(is_bridge((char*)RTA_DATA(tb[IFLA_IFNAME])))
+    else if(parse_linkinfo(tb[IFLA_LINKINFO], NULL))
         br_index = ifi->ifi_index;
     else
         br_index = -1;
 
-    bridge_notify(br_index, ifi->ifi_index, newlink, ifi->ifi_flags);
+    /* Everything bridge_notify() needs is in the message, no ioctls */
+    attrs.flags = ifi->ifi_flags;
+    attrs.macaddr = NULL;
+    if(tb[IFLA_ADDRESS] && (ETH_ALEN == RTA_PAYLOAD(tb[IFLA_ADDRESS])))
+        attrs.macaddr = RTA_DATA(tb[IFLA_ADDRESS]);
+
+    bridge_notify(br_index, ifi->ifi_index, newlink, &attrs);
+
+    return 0;
+}
+
+/* AF_UNSPEC dump has the bridges and the ports, with their master */
+static int resync_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                      void *arg)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+    struct rtattr * tb[IFLA_MAX + 1];
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    link_attrs_t attrs;
+    int br_index;
+    bool active;
+
+    if(n->nlmsg_flags & NLM_F_DUMP_INTR)
+    {
+        INFO("Link dump interrupted by changes");
+        return -1;
+    }
+    if((n->nlmsg_type != RTM_NEWLINK) || (len < 0))
+        return 0;
+
+    parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+    if(tb[IFLA_MASTER] && tb[IFLA_IFNAME]
+       && parse_member(tb[IFLA_LINKINFO], ifi->ifi_flags, &active))
+    {
+        bridge_member_notify(*(int *)RTA_DATA(tb[IFLA_MASTER]),
+                             ifi->ifi_index, RTA_DATA(tb[IFLA_IFNAME]),
+                             active);
+        return 0;
+    }
+    attrs.state = -1;
+    if(parse_linkinfo(tb[IFLA_LINKINFO], &attrs.state))
+        br_index = ifi->ifi_index;
+    else if(tb[IFLA_MASTER])
+        br_index = *(int*)RTA_DATA(tb[IFLA_MASTER]);
+    else
+        return 0;
+
+    attrs.flags = ifi->ifi_flags;
+    attrs.macaddr = NULL;
+    if(tb[IFLA_ADDRESS] && (ETH_ALEN == RTA_PAYLOAD(tb[IFLA_ADDRESS])))
+        attrs.macaddr = RTA_DATA(tb[IFLA_ADDRESS]);
+    bridge_resync_link(br_index, ifi->ifi_index, &attrs);
+    return 0;
+}
+
+/* The bond and team members which are there before we start */
+static int member_dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                           void *arg)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+    struct rtattr * tb[IFLA_MAX + 1];
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    bool active;
+
+    if((n->nlmsg_type != RTM_NEWLINK) || (len < 0))
+        return 0;
+
+    parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+    if(tb[IFLA_MASTER] && tb[IFLA_IFNAME]
+       && parse_member(tb[IFLA_LINKINFO], ifi->ifi_flags, &active))
+        bridge_member_notify(*(int *)RTA_DATA(tb[IFLA_MASTER]),
+                             ifi->ifi_index, RTA_DATA(tb[IFLA_IFNAME]),
+                             active);
+    return 0;
+}
+
+typedef struct
+{
+    int br_index;
+    link_port_t *ports;
+    int count, size;
+} port_dump_t;
+
+/* AF_BRIDGE dump has the bridge ports only, with their port number */
+static int port_dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                         void *arg)
+{
+    port_dump_t *dump = arg;
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+    struct rtattr * tb[IFLA_MAX + 1];
+    struct rtattr * brport[IFLA_BRPORT_MAX + 1];
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    link_port_t *lp;
+    int br_index;
+
+    if(n->nlmsg_flags & NLM_F_DUMP_INTR)
+    {
+        INFO("Link dump interrupted by changes");
+        return -1;
+    }
+    if((n->nlmsg_type != RTM_NEWLINK) || (len < 0)
+       || (ifi->ifi_family != AF_BRIDGE))
+        return 0;
+
+    parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+    if(!tb[IFLA_MASTER] || !tb[IFLA_IFNAME]
+       || (RTA_PAYLOAD(tb[IFLA_IFNAME]) > IFNAMSIZ))
+        return 0;
+    br_index = *(int*)RTA_DATA(tb[IFLA_MASTER]);
+    /* The bridge itself is in the dump as its own master */
+    if((br_index == ifi->ifi_index)
+       || ((0 <= dump->br_index) && (br_index != dump->br_index)))
+        return 0;
 
+    if(dump->count == dump->size)
+    {
+        int size = dump->size ? 2 * dump->size : 64;
+        link_port_t *ports = realloc(dump->ports, size * sizeof(*ports));
+        if(!ports)
+        {
+            ERROR("Out of memory for %d ports", size);
+            return -1;
+        }
+        dump->ports = ports;
+        dump->size = size;
+    }
+    lp = dump->ports + dump->count++;
+    memset(lp, 0, sizeof(*lp));
+    lp->if_index = ifi->ifi_index;
+    lp->br_index = br_index;
+    strncpy(lp->name, RTA_DATA(tb[IFLA_IFNAME]), IFNAMSIZ - 1);
+    lp->flags = ifi->ifi_flags;
+    if(tb[IFLA_ADDRESS] && (ETH_ALEN == RTA_PAYLOAD(tb[IFLA_ADDRESS])))
+        memcpy(lp->macaddr, RTA_DATA(tb[IFLA_ADDRESS]), ETH_ALEN);
+    else
+        lp->query = true;
+    lp->portno = -1;
+    lp->state = -1;
+    if(tb[IFLA_PROTINFO] && (1 == RTA_PAYLOAD(tb[IFLA_PROTINFO])))
+        lp->state = *(uint8_t *)RTA_DATA(tb[IFLA_PROTINFO]);
+    else if(tb[IFLA_PROTINFO])
+    {
+        parse_rtattr_nested(brport, IFLA_BRPORT_MAX, tb[IFLA_PROTINFO]);
+        if(brport[IFLA_BRPORT_NO])
+            lp->portno = *(__u16 *)RTA_DATA(brport[IFLA_BRPORT_NO]);
+        if(brport[IFLA_BRPORT_STATE])
+            lp->state = *(uint8_t *)RTA_DATA(brport[IFLA_BRPORT_STATE]);
+    }
     return 0;
 }
 
+int bridge_dump_ports(int br_index, link_port_t **ports)
+{
+    port_dump_t dump = { .br_index = br_index };
+    int tries;
+
+    for(tries = 0; tries < RESYNC_TRIES; ++tries)
+    {
+        dump.count = 0;
+        if(rtnl_wilddump_request(&rth_dump, AF_BRIDGE, RTM_GETLINK) < 0)
+        {
+            ERROR("Cannot send dump request: %m");
+            break;
+        }
+        if(rtnl_dump_filter(&rth_dump, port_dump_msg, &dump, NULL, NULL) < 0)
+            continue;
+        *ports = dump.ports;
+        return dump.count;
+    }
+    free(dump.ports);
+    *ports = NULL;
+    return -1;
+}
+
+/* Notifications were lost: compare a full dump with what we know and apply
+ * only the differences */
+static void resync(void)
+{
+    int tries;
+
+    for(tries = 0; tries < RESYNC_TRIES; ++tries)
+    {
+        bridge_resync_begin();
+        if(rtnl_wilddump_request(&rth_dump, AF_UNSPEC, RTM_GETLINK) < 0)
+        {
+            ERROR("Cannot send dump request: %m");
+            return;
+        }
+        if(rtnl_dump_filter(&rth_dump, resync_msg, NULL, NULL, NULL) < 0)
+            continue;
+        INFO("Resynchronized with the kernel, %d changes",
+             bridge_resync_end());
+        return;
+    }
+    ERROR("Couldn't resynchronize with the kernel, giving up");
+}
+
 static inline void br_ev_handler(uint32_t events, struct epoll_event_handler *h)
 {
-    if(rtnl_listen(&rth, dump_msg, stdout) < 0)
+    bool overrun = false;
+    int err;
+
+    /* Go on with the queued notifications after an overrun, they are newer
+     * than the lost ones; the dump afterwards catches up with the rest */
+    while(-ENOBUFS == (err = rtnl_listen(&rth, dump_msg, stdout)))
+        overrun = true;
+    if(err < 0)
     {
         ERROR("Error on bridge monitoring socket\n");
     }
+    if(overrun)
+        resync();
+}
+
+#define GENL_ATTRS(_n)  ((struct rtattr *)((char *)NLMSG_DATA(_n) + GENL_HDRLEN))
+#define GENL_ATTRLEN(_n) ((int)(_n)->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN))
+
+/* The speed and duplex of a port changed with ethtool while its link stays
+ * up come in ETHTOOL_MSG_LINKMODES_NTF. The negotiated ones are read when
+ * the link comes up, ethtool doesn't notify them. */
+static int ethtool_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                       void *arg)
+{
+    struct genlmsghdr *ghdr = NLMSG_DATA(n);
+    struct rtattr *tb[ETHTOOL_A_LINKMODES_MAX + 1];
+    struct rtattr *hdr[ETHTOOL_A_HEADER_MAX + 1];
+    int speed = -1, duplex = -1;
+    __u32 s;
+
+    if((n->nlmsg_type != ethtool_family) || (0 > GENL_ATTRLEN(n))
+       || (ETHTOOL_MSG_LINKMODES_NTF != ghdr->cmd))
+        return 0;
+
+    parse_rtattr(tb, ETHTOOL_A_LINKMODES_MAX, GENL_ATTRS(n), GENL_ATTRLEN(n));
+    if(!tb[ETHTOOL_A_LINKMODES_HEADER])
+        return 0;
+    parse_rtattr_nested(hdr, ETHTOOL_A_HEADER_MAX,
+                        tb[ETHTOOL_A_LINKMODES_HEADER]);
+    if(!hdr[ETHTOOL_A_HEADER_DEV_INDEX])
+        return 0;
+
+    if(tb[ETHTOOL_A_LINKMODES_SPEED])
+    {
+        s = *(__u32 *)RTA_DATA(tb[ETHTOOL_A_LINKMODES_SPEED]);
+        speed = (s <= INT_MAX) ? (int)s : -1;
+    }
+    if(tb[ETHTOOL_A_LINKMODES_DUPLEX])
+    {
+        duplex = *(__u8 *)RTA_DATA(tb[ETHTOOL_A_LINKMODES_DUPLEX]);
+        if((DUPLEX_HALF != duplex) && (DUPLEX_FULL != duplex))
+            duplex = -1;
+    }
+    bridge_link_settings_notify(
+        *(__u32 *)RTA_DATA(hdr[ETHTOOL_A_HEADER_DEV_INDEX]), speed, duplex);
+    return 0;
+}
+
+/* Lost notifications are not recovered, the settings are read again when
+ * the links come up */
+static void ethtool_ev_handler(uint32_t events, struct epoll_event_handler *h)
+{
+    int err;
+
+    while(-ENOBUFS == (err = rtnl_listen(&rth_ethtool, ethtool_msg, NULL)))
+        INFO("Lost ethtool notifications");
+    if(err < 0)
+        ERROR("Error on ethtool monitoring socket\n");
 }
 
-int init_bridge_ops(void)
+/* Resolve the ethtool generic netlink family and join its "monitor" group.
+ * Kernels without ethtool netlink have no such family, then the link
+ * settings are only read when the links come up. */
+static int init_ethtool_monitor(void)
+{
+    struct
+    {
+        struct nlmsghdr n;
+        struct genlmsghdr g;
+        char buf[64];
+    } req;
+    union
+    {
+        struct nlmsghdr n;
+        char buf[16384];
+    } answer;
+    struct rtattr *tb[CTRL_ATTR_MAX + 1];
+    struct rtattr *grp[CTRL_ATTR_MCAST_GRP_MAX + 1];
+    struct rtattr *rta;
+    int len, group = -1;
+
+    if(rtnl_open_byproto(&rth_ethtool, 0, NETLINK_GENERIC) < 0)
+    {
+        ERROR("Couldn't open genetlink socket for ethtool\n");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    req.n.nlmsg_flags = NLM_F_REQUEST;
+    req.n.nlmsg_type = GENL_ID_CTRL;
+    req.g.cmd = CTRL_CMD_GETFAMILY;
+    req.g.version = 1;
+    addattr_l(&req.n, sizeof(req), CTRL_ATTR_FAMILY_NAME, ETHTOOL_GENL_NAME,
+              sizeof(ETHTOOL_GENL_NAME));
+    if(rtnl_talk(&rth_ethtool, &req.n, 0, 0, &answer.n, NULL, NULL) < 0)
+    {
+        INFO("No ethtool netlink, link settings are read on link up only");
+        goto err;
+    }
+
+    parse_rtattr(tb, CTRL_ATTR_MAX, GENL_ATTRS(&answer.n),
+                 GENL_ATTRLEN(&answer.n));
+    if(!tb[CTRL_ATTR_FAMILY_ID] || !tb[CTRL_ATTR_MCAST_GROUPS])
+        goto err;
+    ethtool_family = *(__u16 *)RTA_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+    rta = RTA_DATA(tb[CTRL_ATTR_MCAST_GROUPS]);
+    len = RTA_PAYLOAD(tb[CTRL_ATTR_MCAST_GROUPS]);
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        parse_rtattr_nested(grp, CTRL_ATTR_MCAST_GRP_MAX, rta);
+        if(grp[CTRL_ATTR_MCAST_GRP_NAME] && grp[CTRL_ATTR_MCAST_GRP_ID]
+           && !strcmp(RTA_DATA(grp[CTRL_ATTR_MCAST_GRP_NAME]),
+                      ETHTOOL_MCGRP_MONITOR_NAME))
+            group = *(__u32 *)RTA_DATA(grp[CTRL_ATTR_MCAST_GRP_ID]);
+    }
+    if(0 > group)
+        goto err;
+
+    if(setsockopt(rth_ethtool.fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+                  &group, sizeof(group)) < 0)
+    {
+        ERROR("Couldn't join the ethtool monitor group: %m\n");
+        goto err;
+    }
+    if(fcntl(rth_ethtool.fd, F_SETFL, O_NONBLOCK) < 0)
+    {
+        ERROR("Error setting O_NONBLOCK: %m\n");
+        goto err;
+    }
+
+    ethtool_handler.fd = rth_ethtool.fd;
+    ethtool_handler.arg = NULL;
+    ethtool_handler.handler = ethtool_ev_handler;
+    ethtool_handler.prio = EPOLL_PRIO_NETLINK;
+    if(add_epoll(&ethtool_handler) < 0)
+        goto err;
+    return 0;
+
+err:
+    rtnl_close(&rth_ethtool);
+    return -1;
+}
+
+/* NETLINK_NO_ENOBUFS stays off: the overrun must be reported for us
+ * to know that a resync is needed */
+int init_bridge_ops(int rcvbuf)
 {
     if(rtnl_open(&rth, RTMGRP_LINK) < 0)
     {
@@ -180,12 +629,33 @@ int init_bridge_ops(void)
         return -1;
     }
 
+    if(rtnl_set_rcvbuf(&rth, rcvbuf) < 0)
+        return -1;
+
+    if(rtnl_open(&rth_dump, 0) < 0)
+    {
+        ERROR("Couldn't open rtnl socket for dumps\n");
+        return -1;
+    }
+
     if(rtnl_open(&rth_state, 0) < 0)
     {
         ERROR("Couldn't open rtnl socket for setting state\n");
         return -1;
     }
 
+    if(rtnl_wilddump_request(&rth_dump, AF_UNSPEC, RTM_GETLINK) < 0)
+    {
+        ERROR("Cannot send dump request: %m\n");
+        return -1;
+    }
+
+    if(rtnl_dump_filter(&rth_dump, member_dump_msg, NULL, NULL, NULL) < 0)
+    {
+        ERROR("Dump terminated\n");
+        return -1;
+    }
+
     if(rtnl_wilddump_request(&rth, PF_BRIDGE, RTM_GETLINK) < 0)
     {
         ERROR("Cannot send dump request: %m\n");
@@ -207,9 +677,13 @@ int init_bridge_ops(void)
     br_handler.fd = rth.fd;
     br_handler.arg = NULL;
     br_handler.handler = br_ev_handler;
+    br_handler.prio = EPOLL_PRIO_NETLINK;
 
     if(add_epoll(&br_handler) < 0)
         return -1;
 
+    /* Not fatal, the link settings are read on link up anyway */
+    init_ethtool_monitor();
+
     return 0;
 }
@@ -10,14 +10,41 @@
  * Authors: Vladimir Cotfas <unix_router@yahoo.com> -- Broadcom Xstrata support
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pty.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
 #include <asm/byteorder.h>
 #include <linux/if_bridge.h>
 
 #include "log.h"
 #include "mstp.h"
+#include "driver.h"
+#include "epoll_loop.h"
+#include "stats.h"
+
+#define BCM_SHELL           "/bin/bcm"
+#define BCM_PROMPT          "BCM.0> "
+/* Commands written to the shell and not done yet. The shell reads them
+ * from the pty, keep them well below its 4 KiB line discipline buffer */
+#define BCM_MAX_RUNNING     32
+#define BCM_LINE_MAX        256
+#define BCM_OUT_MAX         (BCM_MAX_RUNNING * 2 * BCM_LINE_MAX)
+#define BCM_RESTART_HOLDOFF 5   /* seconds */
+/* For the first prompt and for each command once the shell gets to it */
+#define BCM_TIMEOUT_NS      (2000 * 1000000ULL)
+/* Every command is followed by "echo <BCM_MARKER><seq>", the echoed line
+ * tells that the shell is done with the command */
+#define BCM_MARKER          "mstpd-done-"
 
 static const char* port_states_bcm[] =
 {
@@ -41,19 +68,457 @@ static char* if_linux2bcm(const char* name)
     return "???";
 }
 
+/*
+ * One bcm shell runs for the whole life of mstpd on a pty, instead of a
+ * shell and bcmexp per command. Operations are written to it as soon as
+ * they are submitted, up to BCM_MAX_RUNNING at a time, and are done when
+ * the shell echoes their marker. The output is read on the event loop.
+ * If the shell dies, its operations fail and it is started again with
+ * the next submit. If it hangs, they fail with -ETIMEDOUT and it is
+ * started again at once.
+ *
+ * driver_data of the operations links them in the queues.
+ */
+static struct
+{
+    pthread_mutex_t lock;   /* submit() runs on the workers too */
+    pid_t pid;
+    struct epoll_event_handler ev;  /* pty master */
+    bool in_epoll;
+    struct epoll_event_handler timer;
+    bool ready;             /* the first prompt was seen */
+    time_t started;
+    /* For the first prompt, or for the oldest running command */
+    __u64 deadline;
+    unsigned int seq;       /* marker of the last command written */
+    driver_op_t *waiting, **waiting_tail;   /* not written yet */
+    driver_op_t *running, **running_tail;   /* written, in order */
+    int num_running;
+    char out[BCM_OUT_MAX];  /* not written yet because the pty is full */
+    int out_len;
+    char line[BCM_LINE_MAX];
+    int line_len;
+} bcm =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .pid = -1,
+    .ev.fd = -1,
+    .timer.fd = -1,
+};
+
+#define BCM_NEXT(_op)   (*(driver_op_t **)&(_op)->driver_data)
+
+static void bcm_push(driver_op_t ***tail, driver_op_t *op)
+{
+    BCM_NEXT(op) = NULL;
+    **tail = op;
+    *tail = (driver_op_t **)&op->driver_data;
+}
+
+static driver_op_t *bcm_pop(driver_op_t **head, driver_op_t ***tail)
+{
+    driver_op_t *op = *head;
+
+    if(op && !(*head = BCM_NEXT(op)))
+        *tail = head;
+    return op;
+}
+
+static void bcm_fail(driver_op_t *op, int err)
+{
+    op->result = -err;
+    driver_op_done(op);
+}
+
+static void bcm_read(uint32_t events, struct epoll_event_handler *h);
+
+/* Called with bcm.lock held */
+static int bcm_start(void)
+{
+    struct termios tio;
+    int fd;
+
+    bcm.started = time(NULL);
+    bcm.deadline = stats_now() + BCM_TIMEOUT_NS;
+    memset(&tio, 0, sizeof(tio));
+    cfmakeraw(&tio);
+    /* The shell reads lines, but we don't need our commands back */
+    tio.c_lflag |= ICANON;
+    tio.c_oflag |= OPOST | ONLCR;
+    if(0 > (bcm.pid = forkpty(&fd, NULL, &tio, NULL)))
+    {
+        ERROR("Couldn't start " BCM_SHELL ": forkpty: %m");
+        return -1;
+    }
+    if(0 == bcm.pid)
+    {
+        execl(BCM_SHELL, "bcm", NULL);
+        _exit(127);
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    bcm.ev.fd = fd;
+    bcm.ev.arg = NULL;
+    bcm.ev.handler = bcm_read;
+    /* Completions let the state machines go on */
+    bcm.ev.prio = EPOLL_PRIO_NETLINK;
+    bcm.ready = false;
+    bcm.line_len = bcm.out_len = 0;
+    INFO("Started " BCM_SHELL ", pid %d", bcm.pid);
+    return 0;
+}
+
+/* Called with bcm.lock held, fails all queued operations with err */
+static void bcm_stop(int err)
+{
+    driver_op_t *op;
+
+    if(bcm.in_epoll)
+        remove_epoll(&bcm.ev);
+    bcm.in_epoll = false;
+    if(0 <= bcm.ev.fd)
+        close(bcm.ev.fd);
+    bcm.ev.fd = -1;
+    if(0 < bcm.pid)
+    {
+        kill(bcm.pid, SIGKILL);
+        waitpid(bcm.pid, NULL, 0);
+    }
+    bcm.pid = -1;
+    while((op = bcm_pop(&bcm.running, &bcm.running_tail)))
+        bcm_fail(op, err);
+    bcm.num_running = 0;
+    while((op = bcm_pop(&bcm.waiting, &bcm.waiting_tail)))
+        bcm_fail(op, err);
+}
+
+/* Called with bcm.lock held */
+static int bcm_spawn(void)
+{
+    if(0 != bcm_start())
+        return -1;
+    if(0 != add_epoll(&bcm.ev))
+    {
+        bcm_stop(EIO);
+        return -1;
+    }
+    bcm.in_epoll = true;
+    return 0;
+}
+
+/* Called with bcm.lock held. Expire at the deadline while the shell is
+ * expected to print something */
+static void bcm_arm(void)
+{
+    struct itimerspec its;
+
+    if(0 > bcm.timer.fd)
+        return;
+    memset(&its, 0, sizeof(its));
+    if(bcm.num_running || (!bcm.ready && bcm.waiting))
+    {
+        its.it_value.tv_sec = bcm.deadline / 1000000000ULL;
+        its.it_value.tv_nsec = bcm.deadline % 1000000000ULL;
+    }
+    if(0 > timerfd_settime(bcm.timer.fd, TFD_TIMER_ABSTIME, &its, NULL))
+        ERROR(BCM_SHELL ": timerfd_settime failed: %m");
+}
+
+/* Called with bcm.lock held */
+static void bcm_flush_out(void)
+{
+    int r;
+
+    if(!bcm.out_len)
+        return;
+    r = write(bcm.ev.fd, bcm.out, bcm.out_len);
+    if(0 > r)
+    {
+        if(EAGAIN != errno)
+            ERROR(BCM_SHELL " write: %m");
+        return;
+    }
+    memmove(bcm.out, bcm.out + r, bcm.out_len - r);
+    bcm.out_len -= r;
+}
+
+/* Called with bcm.lock held. Move waiting operations to the shell */
+static void bcm_write(void)
+{
+    driver_op_t *op;
+    const char *bcmport;
+    char cmd[BCM_LINE_MAX];
+    int len;
+
+    while(bcm.ready && (BCM_MAX_RUNNING > bcm.num_running) && bcm.waiting)
+    {
+        op = bcm_pop(&bcm.waiting, &bcm.waiting_tail);
+        bcmport = if_linux2bcm(op->ifname);
+        if('?' == bcmport[0])
+        {
+            /* Not on the switch, nothing to do */
+            driver_op_done(op);
+            continue;
+        }
+        if(DRIVER_OP_SET_STATE == op->type)
+            len = snprintf(cmd, sizeof(cmd), "port %s stp=%s", bcmport,
+                           port_states_bcm[op->state]);
+        else
+            len = snprintf(cmd, sizeof(cmd), "l2 clear port=%s", bcmport);
+        LOG("CMD: %s", cmd);
+        len += snprintf(cmd + len, sizeof(cmd) - len,
+                        "\necho " BCM_MARKER "%u\n", ++bcm.seq);
+        memcpy(bcm.out + bcm.out_len, cmd, len);
+        bcm.out_len += len;
+        /* The shell gets to it now */
+        if(!bcm.num_running)
+            bcm.deadline = stats_now() + BCM_TIMEOUT_NS;
+        bcm_push(&bcm.running_tail, op);
+        ++bcm.num_running;
+    }
+    /* One write for all of them */
+    bcm_flush_out();
+    bcm_arm();
+}
+
+/* Called with bcm.lock held */
+static void bcm_line(char *line)
+{
+    unsigned int seq, first;
+    driver_op_t *op;
+
+    /* The prompt and the echo of our own commands */
+    while(!strncmp(line, BCM_PROMPT, strlen(BCM_PROMPT)))
+        line += strlen(BCM_PROMPT);
+    if(!strncmp(line, "echo ", 5))
+        return;
+
+    if(!strncmp(line, BCM_MARKER, strlen(BCM_MARKER)))
+    {
+        if(1 != sscanf(line + strlen(BCM_MARKER), "%u", &seq))
+            return;
+        /* Complete everything up to the marker, in case lines got lost */
+        first = bcm.seq - bcm.num_running + 1;
+        while(bcm.num_running && (0 <= (int)(seq - first)))
+        {
+            op = bcm_pop(&bcm.running, &bcm.running_tail);
+            --bcm.num_running;
+            ++first;
+            driver_op_done(op);
+        }
+        /* The shell goes on with the next one */
+        bcm.deadline = stats_now() + BCM_TIMEOUT_NS;
+        return;
+    }
+
+    /* Any other output is about the oldest running command */
+    if(bcm.running && (strstr(line, "rror") || strstr(line, "nknown")
+                       || strstr(line, "nvalid")))
+    {
+        ERROR(BCM_SHELL ": %s", line);
+        bcm.running->result = -EIO;
+    }
+}
+
+/* Event loop */
+static void bcm_read(uint32_t events, struct epoll_event_handler *h)
+{
+    char buf[1024];
+    int r, i;
+    char c;
+
+    pthread_mutex_lock(&bcm.lock);
+    r = read(h->fd, buf, sizeof(buf));
+    if(0 >= r)
+    {
+        if((0 > r) && (EAGAIN == errno))
+            goto out;
+        ERROR(BCM_SHELL " exited");
+        bcm_stop(EIO);
+        goto out;
+    }
+    for(i = 0; i < r; ++i)
+    {
+        if(('\r' == (c = buf[i])) || ('\0' == c))
+            continue;
+        if('\n' == c)
+        {
+            bcm.line[bcm.line_len] = '\0';
+            bcm_line(bcm.line);
+            bcm.line_len = 0;
+            continue;
+        }
+        if(BCM_LINE_MAX - 1 > bcm.line_len)
+            bcm.line[bcm.line_len++] = c;
+        /* The prompt is not followed by a newline */
+        if(!bcm.ready && (strlen(BCM_PROMPT) <= bcm.line_len)
+           && !strncmp(bcm.line + bcm.line_len - strlen(BCM_PROMPT),
+                       BCM_PROMPT, strlen(BCM_PROMPT)))
+        {
+            bcm.ready = true;
+            bcm.line_len = 0;
+        }
+    }
+    /* Room for more commands */
+    bcm_write();
+out:
+    pthread_mutex_unlock(&bcm.lock);
+}
+
+/* Event loop. The shell hangs or never printed its prompt */
+static void bcm_timeout(uint32_t events, struct epoll_event_handler *h)
+{
+    __u64 expirations;
+
+    if(0 > read(h->fd, &expirations, sizeof(expirations)) && EAGAIN != errno)
+        ERROR(BCM_SHELL ": timerfd read: %m");
+    pthread_mutex_lock(&bcm.lock);
+    if((0 < bcm.pid) && (bcm.num_running || (!bcm.ready && bcm.waiting))
+       && (bcm.deadline <= stats_now()))
+    {
+        if(bcm.ready)
+            ERROR(BCM_SHELL ": command timed out, restarting");
+        else
+            ERROR(BCM_SHELL ": no prompt, restarting");
+        bcm_stop(ETIMEDOUT);
+        bcm_spawn();
+    }
+    bcm_arm();
+    pthread_mutex_unlock(&bcm.lock);
+}
+
+static int bcm_ops_start(void)
+{
+    int r = 0;
+
+    pthread_mutex_lock(&bcm.lock);
+    /* Without the timer a hung shell is only noticed when it exits */
+    bcm.timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(0 > bcm.timer.fd)
+        ERROR(BCM_SHELL ": timerfd_create failed: %m");
+    else
+    {
+        bcm.timer.arg = NULL;
+        bcm.timer.handler = bcm_timeout;
+        bcm.timer.prio = EPOLL_PRIO_NETLINK;
+        if(0 != add_epoll(&bcm.timer))
+        {
+            close(bcm.timer.fd);
+            bcm.timer.fd = -1;
+        }
+    }
+    if(0 == add_epoll(&bcm.ev))
+        bcm.in_epoll = true;
+    else
+    {
+        bcm_stop(EIO);
+        r = -1;
+    }
+    pthread_mutex_unlock(&bcm.lock);
+    return r;
+}
+
+static void bcm_get_caps(driver_caps_t *caps)
+{
+    /* "port stp=" sets the one state of the port */
+    caps->msti_states = false;
+    caps->flush = DRIVER_FLUSH_PORT;
+    caps->ageing_granularity = 1;
+    caps->max_batch = 0;
+}
+
+static void bcm_submit(driver_op_t **ops, int n)
+{
+    int i;
+
+    pthread_mutex_lock(&bcm.lock);
+    if((0 > bcm.pid) && (BCM_RESTART_HOLDOFF <= time(NULL) - bcm.started))
+        bcm_spawn();
+    for(i = 0; i < n; ++i)
+    {
+        if(0 > bcm.pid)
+            bcm_fail(ops[i], EIO);
+        else
+            bcm_push(&bcm.waiting_tail, ops[i]);
+    }
+    if(0 < bcm.pid)
+        bcm_write();
+    pthread_mutex_unlock(&bcm.lock);
+}
+
+static const driver_ops_t bcm_ops =
+{
+    .name = "bcm",
+    .start = bcm_ops_start,
+    .get_caps = bcm_get_caps,
+    .submit = bcm_submit,
+};
+
+/* Initialize driver objects & states */
+int driver_mstp_init()
+{
+    int r;
+
+    bcm.waiting_tail = &bcm.waiting;
+    bcm.running_tail = &bcm.running;
+    /* Without the shell fall back to bcmexp per command below */
+    if(access(BCM_SHELL, X_OK))
+    {
+        INFO(BCM_SHELL " not found, using bcmexp");
+        return 0;
+    }
+    pthread_mutex_lock(&bcm.lock);
+    r = bcm_start();
+    pthread_mutex_unlock(&bcm.lock);
+    if(0 == r)
+        driver_ops_register(&bcm_ops);
+    return 0;
+}
+
+/* Cleanup driver objects & states */
+void driver_mstp_fini()
+{
+    pthread_mutex_lock(&bcm.lock);
+    bcm_stop(EIO);
+    pthread_mutex_unlock(&bcm.lock);
+}
+
+/* Driver hook that is called before a bridge is created */
+bool driver_create_bridge(bridge_t *br, __u8 *macaddr)
+{
+    return true;
+}
+
+/* Driver hook that is called before a port is created */
+bool driver_create_port(port_t *prt, __u16 portno)
+{
+    return true;
+}
+
+/* Driver hook that is called when a bridge is deleted */
+void driver_delete_bridge(bridge_t *br)
+{
+
+}
+
+/* Driver hook that is called when a port is deleted */
+void driver_delete_port(port_t *prt)
+{
+
+}
+
 /*
  * Set new state (BR_STATE_xxx) for the given port and MSTI.
  * Return new actual state (BR_STATE_xxx) from driver.
  */
 int driver_set_new_state(per_tree_port_t *ptp, int new_state)
 {
-    unsigned int port;
     port_t *ifc = ptp->port;
 
     char cmd[257] = {0};
     snprintf(cmd, 256, "bcmexp port %s stp=%s &>/dev/null",
              if_linux2bcm(ifc->sysdeps.name), port_states_bcm[new_state]);
-    Dprintf(2, "CMD: %s\n", cmd);
+    LOG("CMD: %s", cmd);
     system(cmd);
 
     return new_state;
@@ -76,31 +541,23 @@ bool driver_delete_msti(bridge_t *br, __u16 mstid)
  */
 void driver_flush_all_fids(per_tree_port_t *ptp)
 {
-    unsigned int port;
     port_t *ifc = ptp->port;
 
     char cmd[257] = {0};
     snprintf(cmd, 256, "bcmexp l2 clear port=%s &>/dev/null",
              if_linux2bcm(ifc->sysdeps.name));
-    Dprintf(2, "CMD: %s\n", cmd);
+    LOG("CMD: %s", cmd);
     system(cmd);
 
-    /*
-     * TODO: Confirm that L2 forwarding table is _really_ flushed
-     *   when bcmexp returns. If that is not true and after return from
-     *   bcmexp the flushing is still in process, then we should wait for the
-     *   end of that process (preferably in asynchronous manner) and only than
-     *   call MSTP_IN_all_fids_flushed().
-     */
     MSTP_IN_all_fids_flushed(ptp);
 }
 
 /*
- * Set new ageing time (in seconds) for the bridge.
+ * Set new ageing time (in seconds) for the port.
  * Return new actual ageing time from driver (the ageing timer granularity
  *  in the hardware can be more than 1 sec)
  */
-unsigned int driver_set_ageing_time(bridge_t *br, unsigned int ageingTime)
+unsigned int driver_set_ageing_time(port_t *prt, unsigned int ageingTime)
 {
     /* TODO: do set new ageing time */
     return ageingTime;
@@ -0,0 +1,752 @@
+/*
+ * checkpoint.c   Warm restart from checkpoints of the protocol state.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <asm/byteorder.h>
+
+#include "checkpoint.h"
+#include "worker.h"
+#include "log.h"
+
+#define CKPT_MAGIC      "MSTPCKPT"
+#define CKPT_VERSION    1
+#define CKPT_MAX_LENGTH (256 << 20)
+
+/* The file is the header and the records of all enabled bridges. Records
+ * are written as they are laid out in memory, a build with other sizes of
+ * them does not take the file.
+ */
+typedef struct
+{
+    char magic[8];
+    __u32 version;
+    __u16 bridge_size, tree_size, port_size, ptp_size;
+    __u64 time;             /* CLOCK_REALTIME of the save, s */
+    __u32 num_bridges;
+    __u32 length;           /* of the records after the header */
+    __u32 checksum;         /* FNV-1a of the records */
+    __u32 reserved;
+} ckpt_header_t;
+
+/* Followed by num_vids and num_fids ckpt_map_t, num_trees ckpt_tree_t and
+ * num_ports ckpt_port_t, each of them followed by its num_trees ckpt_ptp_t
+ */
+typedef struct
+{
+    char name[IFNAMSIZ];
+    __u8 macaddr[ETH_ALEN];
+    __u8 protocol_version;
+    __u8 max_hops, forward_delay, max_age, hello_time;
+    __u8 config_name[CONFIGURATION_NAME_LEN];
+    __u16 revision;
+    __u32 tx_hold_count, ageing_time;
+    __u16 num_trees;        /* including the CIST */
+    __u16 num_vids;         /* non-zero entries of the VID-to-FID table */
+    __u16 num_fids;         /* non-zero entries of the FID-to-MSTID table */
+    __u32 num_ports;
+} ckpt_bridge_t;
+
+typedef struct
+{
+    __u16 from, to;
+} ckpt_map_t;
+
+typedef struct
+{
+    __u16 mstid;
+    __u8 priority;          /* 0..15 */
+    tree_state_t state;
+} ckpt_tree_t;
+
+typedef struct
+{
+    char name[IFNAMSIZ];
+    int if_index;
+    __u16 port_number;
+    __u16 num_trees;
+    __u32 admin_external_cost;
+    __u8 admin_p2p;
+    bool admin_edge, auto_edge, restricted_role, restricted_tcn;
+    bool bpdu_guard, network_port, dont_txmt;
+    port_state_t state;
+} ckpt_port_t;
+
+typedef struct
+{
+    __u16 mstid;
+    __u8 priority;          /* 0..15 */
+    __u32 admin_internal_cost;
+    ptp_state_t state;
+} ckpt_ptp_t;
+
+typedef struct
+{
+    const char *p, *end;
+} ckpt_reader_t;
+
+static char *ckpt_path;
+static unsigned int ckpt_interval, ckpt_elapsed;
+
+/* Loaded checkpoint, until all its bridges are resumed or it expires */
+static struct
+{
+    char *data;             /* records */
+    __u32 length;
+    __u32 num_bridges;
+    __u64 time;
+    __u64 expires;          /* CLOCK_REALTIME, s */
+    bool *resumed;          /* per bridge */
+    unsigned int pending;   /* bridges not resumed yet */
+} loaded;
+
+/* Records being saved, bridge_for_each() callbacks take no argument */
+static struct
+{
+    char *data;
+    size_t length, size;
+    __u32 num_bridges;
+    bool failed;
+} out;
+
+static __u64 realtime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec;
+}
+
+static __u32 fnv1a(const char *data, size_t length)
+{
+    __u32 hash = 2166136261u;
+
+    while(length--)
+    {
+        hash ^= (unsigned char)*data++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*********************** Saving *********************/
+
+static void out_put(const void *rec, size_t size)
+{
+    char *data;
+    size_t new_size;
+
+    if(out.failed)
+        return;
+    if(out.length + size > out.size)
+    {
+        new_size = out.size ? 2 * out.size : 4096;
+        while(new_size < out.length + size)
+            new_size *= 2;
+        if(!(data = realloc(out.data, new_size)))
+        {
+            out.failed = true;
+            return;
+        }
+        out.data = data;
+        out.size = new_size;
+    }
+    memcpy(out.data + out.length, rec, size);
+    out.length += size;
+}
+
+static void save_bridge(bridge_t *br)
+{
+    ckpt_bridge_t b;
+    ckpt_map_t m;
+    ckpt_tree_t t;
+    ckpt_port_t p;
+    ckpt_ptp_t pt;
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+    int i;
+
+    if(!br->bridgeEnabled)
+        return;
+
+    /* Zeroed, so that the padding is the same in every save */
+    memset(&b, 0, sizeof(b));
+    strncpy(b.name, br->sysdeps.name, IFNAMSIZ);
+    memcpy(b.macaddr, br->sysdeps.macaddr, ETH_ALEN);
+    b.protocol_version = br->ForceProtocolVersion;
+    b.max_hops = br->MaxHops;
+    b.forward_delay = br->Forward_Delay;
+    b.max_age = br->Max_Age;
+    b.hello_time = br->Hello_Time;
+    memcpy(b.config_name, br->MstConfigId.s.configuration_name,
+           CONFIGURATION_NAME_LEN);
+    b.revision = __be16_to_cpu(br->MstConfigId.s.revision_level);
+    b.tx_hold_count = br->Transmit_Hold_Count;
+    b.ageing_time = br->Ageing_Time;
+    list_for_each_entry(tree, &br->trees, bridge_list)
+        ++b.num_trees;
+    for(i = 0; i <= MAX_VID; ++i)
+        if(GET_VID2FID(br, i))
+            ++b.num_vids;
+    for(i = 0; i <= MAX_FID; ++i)
+        if(GET_FID2MSTID(br, i))
+            ++b.num_fids;
+    list_for_each_entry(prt, &br->ports, br_list)
+        ++b.num_ports;
+    out_put(&b, sizeof(b));
+
+    for(i = 0; i <= MAX_VID; ++i)
+        if(GET_VID2FID(br, i))
+        {
+            m.from = i;
+            m.to = GET_VID2FID(br, i);
+            out_put(&m, sizeof(m));
+        }
+    for(i = 0; i <= MAX_FID; ++i)
+        if(GET_FID2MSTID(br, i))
+        {
+            m.from = i;
+            m.to = __be16_to_cpu(GET_FID2MSTID(br, i));
+            out_put(&m, sizeof(m));
+        }
+
+    list_for_each_entry(tree, &br->trees, bridge_list)
+    {
+        memset(&t, 0, sizeof(t));
+        t.mstid = __be16_to_cpu(tree->MSTID);
+        t.priority = GET_PRIORITY_FROM_IDENTIFIER(tree->BridgeIdentifier) >> 4;
+        MSTP_IN_save_tree(tree, &t.state);
+        out_put(&t, sizeof(t));
+    }
+
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        memset(&p, 0, sizeof(p));
+        strncpy(p.name, prt->sysdeps.name, IFNAMSIZ);
+        p.if_index = prt->sysdeps.if_index;
+        p.port_number = __be16_to_cpu(prt->port_number);
+        list_for_each_entry(ptp, &prt->trees, port_list)
+            ++p.num_trees;
+        p.admin_external_cost = prt->AdminExternalPortPathCost;
+        p.admin_p2p = prt->AdminP2P;
+        p.admin_edge = prt->AdminEdgePort;
+        p.auto_edge = prt->AutoEdge;
+        p.restricted_role = prt->restrictedRole;
+        p.restricted_tcn = prt->restrictedTcn;
+        p.bpdu_guard = prt->BpduGuardPort;
+        p.network_port = prt->NetworkPort;
+        p.dont_txmt = prt->dontTxmtBpdu;
+        MSTP_IN_save_port(prt, &p.state);
+        out_put(&p, sizeof(p));
+
+        list_for_each_entry(ptp, &prt->trees, port_list)
+        {
+            memset(&pt, 0, sizeof(pt));
+            pt.mstid = __be16_to_cpu(ptp->MSTID);
+            pt.priority = GET_PRIORITY_FROM_IDENTIFIER(ptp->portId) >> 4;
+            pt.admin_internal_cost = ptp->AdminInternalPortPathCost;
+            MSTP_IN_save_ptp(ptp, &pt.state);
+            out_put(&pt, sizeof(pt));
+        }
+    }
+    ++out.num_bridges;
+}
+
+static bool write_all(int fd, const void *buf, size_t size)
+{
+    const char *p = buf;
+    ssize_t r;
+
+    while(size)
+    {
+        if(0 > (r = write(fd, p, size)))
+        {
+            if(EINTR == errno)
+                continue;
+            return false;
+        }
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+/*********************** Loading *********************/
+
+static bool read_all(int fd, void *buf, size_t size)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while(size)
+    {
+        if(0 >= (r = read(fd, p, size)))
+        {
+            if((0 > r) && (EINTR == errno))
+                continue;
+            return false;
+        }
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+/* rec == NULL skips the record */
+static bool ckpt_get(ckpt_reader_t *r, void *rec, size_t size)
+{
+    if((size_t)(r->end - r->p) < size)
+        return false;
+    if(rec)
+        memcpy(rec, r->p, size);
+    r->p += size;
+    return true;
+}
+
+/* Skip the records of the bridge after its ckpt_bridge_t */
+static bool skip_bridge(ckpt_reader_t *r, const ckpt_bridge_t *b)
+{
+    ckpt_port_t p;
+    __u32 i;
+
+    if(!ckpt_get(r, NULL, (b->num_vids + b->num_fids) * sizeof(ckpt_map_t))
+       || !ckpt_get(r, NULL, b->num_trees * sizeof(ckpt_tree_t)))
+        return false;
+    for(i = 0; i < b->num_ports; ++i)
+        if(!ckpt_get(r, &p, sizeof(p))
+           || !ckpt_get(r, NULL, p.num_trees * sizeof(ckpt_ptp_t)))
+            return false;
+    return true;
+}
+
+static void drop_loaded(void)
+{
+    free(loaded.data);
+    free(loaded.resumed);
+    memset(&loaded, 0, sizeof(loaded));
+}
+
+/* The loaded checkpoint has bridges which could be resumed yet */
+static bool loaded_pending(void)
+{
+    if(!loaded.data)
+        return false;
+    if(loaded.pending && (realtime() <= loaded.expires))
+        return true;
+    if(loaded.pending)
+        INFO("Checkpoint expired, %u bridges were not resumed",
+             loaded.pending);
+    drop_loaded();
+    return false;
+}
+
+static void load(const char *path)
+{
+    ckpt_header_t h;
+    ckpt_reader_t r;
+    ckpt_bridge_t b;
+    __u64 now = realtime();
+    __u8 max_age = 0;
+    __u32 i;
+    int fd;
+
+    if(0 > (fd = open(path, O_RDONLY | O_CLOEXEC)))
+    {
+        if(ENOENT != errno)
+            ERROR("Couldn't open checkpoint %s: %m", path);
+        return;
+    }
+    if(!read_all(fd, &h, sizeof(h))
+       || memcmp(h.magic, CKPT_MAGIC, sizeof(h.magic))
+       || (CKPT_VERSION != h.version) || (CKPT_MAX_LENGTH < h.length))
+    {
+        INFO("%s is not a checkpoint of this version, ignored", path);
+        goto out;
+    }
+    if((sizeof(ckpt_bridge_t) != h.bridge_size)
+       || (sizeof(ckpt_tree_t) != h.tree_size)
+       || (sizeof(ckpt_port_t) != h.port_size)
+       || (sizeof(ckpt_ptp_t) != h.ptp_size))
+    {
+        INFO("Checkpoint %s is of another build, ignored", path);
+        goto out;
+    }
+    if(!(loaded.data = malloc(h.length ? : 1))
+       || !(loaded.resumed = calloc(h.num_bridges + 1, sizeof(bool))))
+    {
+        ERROR("Out of memory for checkpoint of %u bytes", h.length);
+        goto drop;
+    }
+    if(!read_all(fd, loaded.data, h.length)
+       || (fnv1a(loaded.data, h.length) != h.checksum))
+    {
+        ERROR("Checkpoint %s is corrupt, ignored", path);
+        goto drop;
+    }
+
+    r.p = loaded.data;
+    r.end = loaded.data + h.length;
+    for(i = 0; i < h.num_bridges; ++i)
+    {
+        if(!ckpt_get(&r, &b, sizeof(b)) || !skip_bridge(&r, &b))
+            break;
+        if(max_age < b.max_age)
+            max_age = b.max_age;
+    }
+    if((i < h.num_bridges) || (r.p != r.end))
+    {
+        ERROR("Checkpoint %s is corrupt, ignored", path);
+        goto drop;
+    }
+    if((now < h.time) || (now > h.time + max_age))
+    {
+        INFO("Checkpoint %s is too old to resume", path);
+        goto drop;
+    }
+
+    INFO("Loaded checkpoint %s of %u bridges, saved %llu s ago", path,
+         h.num_bridges, (unsigned long long)(now - h.time));
+    loaded.length = h.length;
+    loaded.num_bridges = loaded.pending = h.num_bridges;
+    loaded.time = h.time;
+    loaded.expires = h.time + max_age;
+    goto out;
+drop:
+    drop_loaded();
+out:
+    close(fd);
+}
+
+/* Finds the bridge in the loaded checkpoint, positions r after its
+ * ckpt_bridge_t. Returns its number or -1. */
+static int find_bridge(bridge_t *br, ckpt_bridge_t *b, ckpt_reader_t *r)
+{
+    __u32 i;
+
+    if(!loaded_pending())
+        return -1;
+    r->p = loaded.data;
+    r->end = loaded.data + loaded.length;
+    for(i = 0; i < loaded.num_bridges; ++i)
+    {
+        if(!ckpt_get(r, b, sizeof(*b)))
+            break;
+        if(!loaded.resumed[i]
+           && !strncmp(b->name, br->sysdeps.name, IFNAMSIZ)
+           && !memcmp(b->macaddr, br->sysdeps.macaddr, ETH_ALEN))
+        {
+            /* Max Age is how long the neighbours keep what we sent */
+            if(realtime() > loaded.time + b->max_age)
+                return -1;
+            return i;
+        }
+        if(!skip_bridge(r, b))
+            break;
+    }
+    return -1;
+}
+
+static tree_t *find_tree(bridge_t *br, __u16 mstid)
+{
+    tree_t *tree;
+
+    list_for_each_entry(tree, &br->trees, bridge_list)
+        if(__be16_to_cpu(tree->MSTID) == mstid)
+            return tree;
+    return NULL;
+}
+
+static per_tree_port_t *find_ptp(port_t *prt, __u16 mstid)
+{
+    per_tree_port_t *ptp;
+
+    list_for_each_entry(ptp, &prt->trees, port_list)
+        if(__be16_to_cpu(ptp->MSTID) == mstid)
+            return ptp;
+    return NULL;
+}
+
+static port_t *find_port(bridge_t *br, const ckpt_port_t *p)
+{
+    port_t *prt;
+
+    list_for_each_entry(prt, &br->ports, br_list)
+        if(prt->sysdeps.if_index == p->if_index)
+        {
+            if(strncmp(prt->sysdeps.name, p->name, IFNAMSIZ)
+               || (__be16_to_cpu(prt->port_number) != p->port_number))
+                return NULL;
+            return prt;
+        }
+    return NULL;
+}
+
+static int kernel_state(const link_port_t *ports, int count, int if_index)
+{
+    int i;
+
+    for(i = 0; i < count; ++i)
+        if(ports[i].if_index == if_index)
+            return ports[i].state;
+    return -1;
+}
+
+static void restore_config(bridge_t *br, const ckpt_bridge_t *b)
+{
+    CIST_BridgeConfig cfg;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.bridge_max_age = b->max_age;
+    cfg.set_bridge_max_age = true;
+    cfg.bridge_forward_delay = b->forward_delay;
+    cfg.set_bridge_forward_delay = true;
+    cfg.protocol_version = b->protocol_version;
+    cfg.set_protocol_version = true;
+    cfg.tx_hold_count = b->tx_hold_count;
+    cfg.set_tx_hold_count = true;
+    cfg.max_hops = b->max_hops;
+    cfg.set_max_hops = true;
+    cfg.bridge_hello_time = b->hello_time;
+    cfg.set_bridge_hello_time = true;
+    cfg.bridge_ageing_time = b->ageing_time;
+    cfg.set_bridge_ageing_time = true;
+    MSTP_IN_set_cist_bridge_config(br, &cfg);
+    MSTP_IN_set_mst_config_id(br, b->revision, (__u8 *)b->config_name);
+}
+
+static void restore_port_config(port_t *prt, const ckpt_port_t *p)
+{
+    CIST_PortConfig cfg;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.admin_external_port_path_cost = p->admin_external_cost;
+    cfg.set_admin_external_port_path_cost = true;
+    cfg.admin_edge_port = p->admin_edge;
+    cfg.set_admin_edge_port = true;
+    cfg.auto_edge_port = p->auto_edge;
+    cfg.set_auto_edge_port = true;
+    cfg.admin_p2p = p->admin_p2p;
+    cfg.set_admin_p2p = true;
+    cfg.restricted_role = p->restricted_role;
+    cfg.set_restricted_role = true;
+    cfg.restricted_tcn = p->restricted_tcn;
+    cfg.set_restricted_tcn = true;
+    cfg.bpdu_guard_port = p->bpdu_guard;
+    cfg.set_bpdu_guard_port = true;
+    cfg.network_port = p->network_port;
+    cfg.set_network_port = true;
+    cfg.dont_txmt = p->dont_txmt;
+    cfg.set_dont_txmt = true;
+    MSTP_IN_set_cist_port_config(prt, &cfg);
+}
+
+/* Restores the configuration of the port and tells whether its state can
+ * be resumed: it is up, in the kernel state of the checkpoint, and has the
+ * trees of the checkpoint. */
+static bool restore_port(port_t *prt, const ckpt_port_t *p, ckpt_reader_t *r,
+                         int state)
+{
+    ckpt_ptp_t pt;
+    MSTI_PortConfig cfg;
+    per_tree_port_t *ptp;
+    unsigned int num_ptps = 0, matched = 0;
+    int cist_state = -1;
+    __u32 i;
+
+    restore_port_config(prt, p);
+    for(i = 0; i < p->num_trees; ++i)
+    {
+        ckpt_get(r, &pt, sizeof(pt));
+        if(!(ptp = find_ptp(prt, pt.mstid)))
+            continue;
+        ++matched;
+        if(0 == pt.mstid)
+            cist_state = pt.state.state;
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.admin_internal_port_path_cost = pt.admin_internal_cost;
+        cfg.set_admin_internal_port_path_cost = true;
+        cfg.port_priority = pt.priority;
+        cfg.set_port_priority = true;
+        MSTP_IN_set_msti_port_config(ptp, &cfg);
+    }
+    list_for_each_entry(ptp, &prt->trees, port_list)
+        ++num_ptps;
+
+    return prt->portEnabled && (0 <= state) && (state == cist_state)
+           && (matched == num_ptps) && (matched == p->num_trees);
+}
+
+/*********************** Interface *********************/
+
+int checkpoint_init(const char *path, unsigned int interval)
+{
+    TST(NULL != (ckpt_path = strdup(path)), -1);
+    ckpt_interval = interval;
+    load(path);
+    return 0;
+}
+
+void checkpoint_tick(void)
+{
+    if(!ckpt_path)
+        return;
+    loaded_pending();
+    if(!ckpt_interval || (++ckpt_elapsed < ckpt_interval))
+        return;
+    ckpt_elapsed = 0;
+    checkpoint_save();
+}
+
+void checkpoint_save(void)
+{
+    ckpt_header_t h;
+    char tmp[PATH_MAX];
+    int fd;
+    bool ok;
+
+    /* Keep the file for the bridges which are not added yet */
+    if(!ckpt_path || loaded_pending())
+        return;
+
+    out.length = 0;
+    out.num_bridges = 0;
+    out.failed = false;
+    worker_lock_all();
+    bridge_for_each(save_bridge);
+    worker_unlock_all();
+    if(out.failed)
+    {
+        ERROR("Out of memory for checkpoint");
+        return;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+    h.version = CKPT_VERSION;
+    h.bridge_size = sizeof(ckpt_bridge_t);
+    h.tree_size = sizeof(ckpt_tree_t);
+    h.port_size = sizeof(ckpt_port_t);
+    h.ptp_size = sizeof(ckpt_ptp_t);
+    h.time = realtime();
+    h.num_bridges = out.num_bridges;
+    h.length = out.length;
+    h.checksum = fnv1a(out.data, out.length);
+
+    /* A new file replaces the old one, a crash leaves either of them */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ckpt_path);
+    if(0 > (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)))
+    {
+        ERROR("Couldn't write checkpoint %s: %m", tmp);
+        return;
+    }
+    ok = write_all(fd, &h, sizeof(h)) && write_all(fd, out.data, out.length);
+    if(close(fd))
+        ok = false;
+    if(!ok || rename(tmp, ckpt_path))
+    {
+        ERROR("Couldn't write checkpoint %s: %m", ckpt_path);
+        unlink(tmp);
+    }
+}
+
+bool checkpoint_has_bridge(bridge_t *br)
+{
+    ckpt_bridge_t b;
+    ckpt_reader_t r;
+
+    return 0 <= find_bridge(br, &b, &r);
+}
+
+bool checkpoint_resume(bridge_t *br, const link_port_t *ports, int count)
+{
+    ckpt_bridge_t b;
+    ckpt_reader_t r, trees, ptps;
+    ckpt_map_t m;
+    ckpt_tree_t t;
+    ckpt_port_t p;
+    ckpt_ptp_t pt;
+    tree_t *tree;
+    port_t *prt;
+    __u16 *vids2fids, *fids2mstids;
+    int index, num_resumed = 0;
+    __u32 i, j;
+
+    if(0 > (index = find_bridge(br, &b, &r)))
+        return false;
+    loaded.resumed[index] = true;
+    --loaded.pending;
+
+    /* Configuration first. The bridge is disabled, nothing runs */
+    restore_config(br, &b);
+    TST(NULL != (vids2fids = calloc(MAX_VID + 1 + MAX_FID + 1,
+                                    sizeof(__u16))), false);
+    fids2mstids = vids2fids + MAX_VID + 1;
+    for(i = 0; i < b.num_vids; ++i)
+        if(ckpt_get(&r, &m, sizeof(m)) && (MAX_VID >= m.from))
+            vids2fids[m.from] = m.to;
+    for(i = 0; i < b.num_fids; ++i)
+        if(ckpt_get(&r, &m, sizeof(m)) && (MAX_FID >= m.from))
+            fids2mstids[m.from] = m.to;
+    trees = r;
+    for(i = 0; i < b.num_trees; ++i)
+    {
+        ckpt_get(&r, &t, sizeof(t));
+        if(t.mstid && !MSTP_IN_create_msti(br, t.mstid))
+            continue;
+        if((tree = find_tree(br, t.mstid)))
+            MSTP_IN_set_msti_bridge_config(tree, t.priority);
+    }
+    MSTP_IN_set_all_fids2mstids(br, fids2mstids);
+    MSTP_IN_set_all_vids2fids(br, vids2fids);
+    free(vids2fids);
+
+    for(i = 0; i < b.num_ports; ++i)
+    {
+        ckpt_get(&r, &p, sizeof(p));
+        ptps = r;
+        if(!(prt = find_port(br, &p)))
+        {
+            ckpt_get(&r, NULL, p.num_trees * sizeof(ckpt_ptp_t));
+            continue;
+        }
+        if(!restore_port(prt, &p, &r,
+                         kernel_state(ports, count, p.if_index)))
+            continue;
+        MSTP_IN_restore_port(prt, &p.state);
+        for(j = 0; j < p.num_trees; ++j)
+        {
+            ckpt_get(&ptps, &pt, sizeof(pt));
+            MSTP_IN_restore_ptp(find_ptp(prt, pt.mstid), &pt.state);
+        }
+        ++num_resumed;
+    }
+    if(!num_resumed)
+    {
+        INFO("%s: no port to resume from the checkpoint", br->sysdeps.name);
+        return false;
+    }
+
+    for(i = 0; i < b.num_trees; ++i)
+    {
+        ckpt_get(&trees, &t, sizeof(t));
+        if((tree = find_tree(br, t.mstid)))
+            MSTP_IN_restore_tree(tree, &t.state);
+    }
+    MSTP_IN_resume_bridge(br);
+    INFO("%s: resumed %d of %d ports from the checkpoint", br->sysdeps.name,
+         num_resumed, count);
+    return true;
+}
@@ -0,0 +1,46 @@
+/*
+ * checkpoint.h   Warm restart from checkpoints of the protocol state.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_CHECKPOINT_H
+#define _MSTP_CHECKPOINT_H
+
+#include "bridge_ctl.h"
+#include "mstp.h"
+
+/* With -c mstpd saves the configuration and the protocol state of its
+ * bridges to a file every few seconds and on exit. The next mstpd loads
+ * the file and resumes a bridge from it when the bridge is added: ports
+ * which are up and still in the kernel state of the checkpoint keep their
+ * roles, states and received information, so forwarding ports go on
+ * forwarding without flushes or topology changes, while the BPDUs of the
+ * neighbours confirm the topology. The other ports start from BEGIN.
+ *
+ * A checkpoint older than Max Age of its bridge is not resumed. The file
+ * is not overwritten while bridges of the loaded checkpoint could still be
+ * resumed.
+ */
+
+#define CHECKPOINT_INTERVAL_DEFAULT 5   /* seconds */
+
+/* Load the checkpoint at path and save to it every interval seconds,
+ * 0 - only on exit */
+int checkpoint_init(const char *path, unsigned int interval);
+/* Called by the event loop every second */
+void checkpoint_tick(void);
+/* Save now, registered with atexit() */
+void checkpoint_save(void);
+/* The loaded checkpoint has the new bridge br */
+bool checkpoint_has_bridge(bridge_t *br);
+/* Restore the new bridge br from the checkpoint and enable it. Called
+ * with the bridge still disabled and its count ports created and enabled.
+ * Returns false if no port could be resumed, the bridge is left disabled
+ * with the configuration of the checkpoint then. */
+bool checkpoint_resume(bridge_t *br, const link_port_t *ports, int count);
+
+#endif /* _MSTP_CHECKPOINT_H */
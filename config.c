@@ -45,6 +45,7 @@
 #include <sys/ioctl.h>
 #include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include "epoll_loop.h"
 #include <linux/in6.h>
 #include <linux/if_bridge.h>
@@ -74,7 +75,11 @@ struct spanning_conf_t
     struct port_data_t port_conf[MAX_NUM_ATUS];
 };
 
+/* Written on the event loop only, by read_config() at startup and on
+ * SIGHUP. The management thread reads it through port_is_enabled(), under
+ * conf_lock, which is held while a new configuration is copied in. */
 struct spanning_conf_t stp_port_conf;
+static pthread_mutex_t conf_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct epoll_event_handler signal_event;
 
 cfg_t *parse_conf(char *conf)
@@ -114,6 +119,29 @@ cfg_t *parse_conf(char *conf)
     return cfg;
 }
 
+/* For the management thread only. The SNMP tables and the status files
+ * read the port list on every walk or write, the file is parsed again only
+ * when it has changed. The result stays owned by the cache. */
+cfg_t *parse_conf_cached(void)
+{
+    static cfg_t *cfg;
+    static struct stat cached;
+    struct stat st;
+
+    if(stat(MSTPD_CONFIG_FILE, &st))
+	return cfg;
+    if(cfg && (st.st_ino == cached.st_ino) && (st.st_size == cached.st_size)
+       && (st.st_mtim.tv_sec == cached.st_mtim.tv_sec)
+       && (st.st_mtim.tv_nsec == cached.st_mtim.tv_nsec))
+	return cfg;
+
+    if(cfg)
+	cfg_free(cfg);
+    cfg = parse_conf(MSTPD_CONFIG_FILE);
+    cached = st;
+    return cfg;
+}
+
 int get_rstp_pid(void)
 {
     char filename[] = "/var/run/mstpd.pid";
@@ -129,7 +157,7 @@ int get_rstp_pid(void)
     return pid;
 }
 
-static int read_config(cfg_t *parse_cfg)
+static int read_config(cfg_t *parse_cfg, struct spanning_conf_t *conf)
 {
     size_t i;
     int forward_delay = 0;
@@ -141,22 +169,22 @@ static int read_config(cfg_t *parse_cfg)
     prio = cfg_getint(parse_cfg, "prio");
     if(prio > 255)
 	prio = 255;
-    stp_port_conf.prio = prio;
+    conf->prio = prio;
 
     forward_delay = cfg_getint(parse_cfg, "forward-delay");
     if(forward_delay > 255)
 	forward_delay = 255;
-    stp_port_conf.forward_delay = forward_delay;
+    conf->forward_delay = forward_delay;
 
     hello_time = cfg_getint(parse_cfg, "hello-time");
     if(hello_time > 255)
 	hello_time = 255;
-    stp_port_conf.hello_time = hello_time;
+    conf->hello_time = hello_time;
 
     max_age = cfg_getint(parse_cfg, "max-age");
     if(max_age > 255)
 	max_age = 255;
-    stp_port_conf.max_age = max_age;
+    conf->max_age = max_age;
 
     for(i = 0; i < cfg_size(parse_cfg, "ports"); i++)
     {
@@ -173,19 +201,24 @@ static int read_config(cfg_t *parse_cfg)
 	    ERROR("Could not find ifindex for %s", name);
 	    continue;
 	}
+	if(port_index >= MAX_NUM_ATUS)
+	{
+	    ERROR("Interface index %d of %s is too large", port_index, name);
+	    continue;
+	}
 	LOG("%s name=%s index=%d", __FUNCTION__, name, port_index);
 
 	/* Save the enable value in table for later use. */
 	enable = cfg_getbool(cfg_port, "enable");
-	stp_port_conf.port_conf[port_index].enable = enable;
+	conf->port_conf[port_index].enable = enable;
 
 	/* Save the edge value in table for later use. */
 	edge = cfg_getbool(cfg_port, "admin-edge");
-	stp_port_conf.port_conf[port_index].edge = edge;
+	conf->port_conf[port_index].edge = edge;
 
 	/* Save the port_path_cost value in table for later use. */
 	port_path_cost = cfg_getint(cfg_port, "path-cost");
-	stp_port_conf.port_conf[port_index].port_path_cost = port_path_cost;
+	conf->port_conf[port_index].port_path_cost = port_path_cost;
     }
 
     return 0;
@@ -194,45 +227,60 @@ static int read_config(cfg_t *parse_cfg)
 int port_is_enabled(char * ifname)
 {
     int port_index = if_nametoindex(ifname);
+    int enable = 0;
 
-    if(port_index > 0 && stp_port_conf.port_conf[port_index].enable)
-    {
-	LOG("%s ret=1 index=%d enable=%d\n", __FUNCTION__, port_index,
-	    stp_port_conf.port_conf[port_index].enable);
-	return 1;
-    }
-    LOG("%s ret=0 index=%d enable=%d\n", __FUNCTION__, port_index,
-	stp_port_conf.port_conf[port_index].enable);
+    pthread_mutex_lock(&conf_lock);
+    if((port_index > 0) && (port_index < MAX_NUM_ATUS))
+	enable = stp_port_conf.port_conf[port_index].enable;
+    pthread_mutex_unlock(&conf_lock);
+    LOG("%s ret=%d index=%d\n", __FUNCTION__, !!enable, port_index);
 
-    return 0;
+    return !!enable;
 }
 
-/* filter out . .. and eth3.10, i.e., this and parent directory as well
- * as 1Q interfaces ... */
-static int not_dot_dotdot(const struct dirent *entry)
+/* filter out 1Q interfaces, e.g. eth3.10, and the ports without MSTP */
+static bool port_filter(const link_port_t *lp)
 {
-    if(strchr (entry->d_name, '.'))
-	return 0;
-   
-    if(port_is_enabled((char *)entry->d_name))
+    if(strchr(lp->name, '.'))
+	return false;
+
+    if((lp->if_index < MAX_NUM_ATUS)
+       && stp_port_conf.port_conf[lp->if_index].enable)
     {
-	INFO("%s name=%s. return 1\n", __func__, entry->d_name);
-	return 1;
+	INFO("%s name=%s. return 1\n", __func__, lp->name);
+	return true;
     }
-    return 0;  
+    return false;
 }
 
-static int get_port_list(const char *br_ifname, struct dirent ***namelist)
+static int port_name_cmp(const void *a, const void *b)
 {
-    int res;
-    char buf[SYSFS_PATH_MAX];
+#ifdef __LIBC_HAS_VERSIONSORT__
+    return strverscmp(((const link_port_t *)a)->name,
+		      ((const link_port_t *)b)->name);
+#else
+    return strcmp(((const link_port_t *)a)->name,
+		  ((const link_port_t *)b)->name);
+#endif
+}
 
-    snprintf(buf, sizeof(buf), SYSFS_CLASS_NET "/%s/brif", br_ifname);
-    res = scandir(buf, namelist, not_dot_dotdot, sorting_func);
-    if(res < 0)
-	ERROR("Error getting list of all ports of bridge %s", br_ifname);
+/* One link dump for all ports of the bridge, in the order of their names */
+static int get_port_list(int br_index, link_port_t **ports)
+{
+    int i, res, count = 0;
 
-    return res;
+    if(0 > (res = bridge_dump_ports(br_index, ports)))
+    {
+	ERROR("Error getting list of all ports of bridge %d", br_index);
+	return res;
+    }
+    for(i = 0; i < res; ++i)
+	if(port_filter(*ports + i))
+	    (*ports)[count++] = (*ports)[i];
+    if(count)
+	qsort(*ports, count, sizeof(**ports), port_name_cmp);
+
+    return count;
 }
 
 int get_index(const char *ifname, const char *doc)
@@ -250,78 +298,35 @@ int get_index(const char *ifname, const char *doc)
 
 static int cmd_addbridge(char *bridge_name)
 {
-    int i, j, res, ifcount, brcount = 1;
-    int *br_array;
-    int* *ifaces_lists;
+    int j, res, ifcount, br_index;
+    link_port_t *ports;
     char filename[128];
 
-    if(NULL == (br_array = malloc((brcount + 1) * sizeof(int))))
-    {
-    out_of_memory_exit:
-	ERROR("out of memory, brcount = %d", brcount);
-	return -1;
-    }
-   
-    if(NULL == (ifaces_lists = malloc(brcount * sizeof(int*))))
-    {
-	free(br_array);
-	goto out_of_memory_exit;
-    }
-
     /* Create directory for MSTP */
     snprintf (filename, sizeof (filename), "%s", MSTP_STATUS_PATH);
     mkdir(filename, 0755);
 
-    br_array[0] = brcount;
-    for(i = 1; i <= brcount; ++i)
-    {
-	struct dirent **namelist;
-
-	br_array[i] = get_index(bridge_name, "bridge");
-
-        /* Create directory for MSTP instance */
-	snprintf (filename, sizeof (filename), "%s/%d", MSTP_STATUS_PATH, i-1);
-	mkdir(filename, 0755);
-
-	if(0 > (ifcount = get_port_list(bridge_name, &namelist)))
-	{
-        ifaces_error_exit:
-	    for(i -= 2; i >= 0; --i)
-		free(ifaces_lists[i]);
-	    free(ifaces_lists);
-	    free(br_array);
-	    return ifcount;
-	}
+    if(0 > (br_index = get_index(bridge_name, "bridge")))
+	return -1;
 
-	if(NULL == (ifaces_lists[i - 1] = malloc((ifcount + 1) * sizeof(int))))
-	{
-	    ERROR("out of memory, bridge %s, ifcount = %d", bridge_name, ifcount);
-	    for(j = 0; j < ifcount; ++j)
-		free(namelist[j]);
-	    free(namelist);
-	    ifcount = -1;
-	    goto ifaces_error_exit;
-	}
+    /* Create directory for MSTP instance */
+    snprintf (filename, sizeof (filename), "%s/%d", MSTP_STATUS_PATH, 0);
+    mkdir(filename, 0755);
 
-	ifaces_lists[i - 1][0] = ifcount;
-	for(j = 1; j <= ifcount; ++j)
-	{
-	    ifaces_lists[i - 1][j] = get_index(namelist[j - 1]->d_name, "port");
-	    free(namelist[j - 1]);
+    if(0 > (ifcount = get_port_list(br_index, &ports)))
+	return ifcount;
 
-	    /* Create file structure for status for each bridge port */
-	    snprintf(filename, sizeof(filename), "%s/%d/%s", MSTP_STATUS_PATH, i-1, namelist[j - 1]->d_name);
-	    mkdir(filename, 0755);
-	}
-	free(namelist);
+    for(j = 0; j < ifcount; ++j)
+    {
+	/* Create file structure for status for each bridge port */
+	snprintf(filename, sizeof(filename), "%s/%d/%s", MSTP_STATUS_PATH, 0, ports[j].name);
+	mkdir(filename, 0755);
     }
 
-    res = CTL_add_bridges(br_array, ifaces_lists);
-
-    for(i = 0; i < brcount; ++i)
-	free(ifaces_lists[i]);
-    free(ifaces_lists);
-    free(br_array);
+    /* The dump has all the bridge needs, the ports which are up are
+     * enabled at once */
+    res = bridge_add_ports(br_index, ports, ifcount);
+    free(ports);
 
     return res;
 }
@@ -482,20 +487,33 @@ int mstp_force_protocol_version(int br_index, int proto)
 static int reconfig(void)
 {
     cfg_t *parse_cfg;
+    struct spanning_conf_t *conf;
     char *br_name = INTERFACE_BRIDGE;
     int sd = socket(AF_INET, SOCK_STREAM, 0);
     int br_index;
     size_t i;
 
     LOG("Entering reconfig");
-    memset(&stp_port_conf, 0, sizeof(stp_port_conf));
-   
+    /* Read into a new table, the management thread reads the old one
+     * until it is replaced */
+    if(!(conf = calloc(1, sizeof(*conf))))
+    {
+	ERROR("Out of memory for the configuration");
+	close(sd);
+	return 1;
+    }
     parse_cfg = parse_conf(MSTPD_CONFIG_FILE);
-    if(!parse_cfg || read_config(parse_cfg))
+    if(!parse_cfg || read_config(parse_cfg, conf))
     {
 	ERROR("Couldn't read configuration from file!!!");
+	free(conf);
+	close(sd);
 	return 1;
     }
+    pthread_mutex_lock(&conf_lock);
+    stp_port_conf = *conf;
+    pthread_mutex_unlock(&conf_lock);
+    free(conf);
 
     br_index = if_nametoindex(br_name);
     LOG("br_name=%s index=%d\n", br_name, br_index);
@@ -577,6 +595,12 @@ static void delete_folder_tree (const char* directory_name)
     rmdir(directory_name);
 }
 
+static void write_status(void *arg)
+{
+    mstp_write_status_file(1);
+    mstp_update_status ();
+}
+
 static void signal_handler_cb(uint32_t events, struct epoll_event_handler *h)
 {
     struct signalfd_siginfo info;
@@ -605,11 +629,9 @@ static void signal_handler_cb(uint32_t events, struct epoll_event_handler *h)
 	if(sig == SIGHUP)
 	    reconfig ();
 	
+	/* Status files are written from the snapshot, off the event loop */
 	if (sig == SIGUSR1)
-	{
-	    mstp_write_status_file(1);
-	    mstp_update_status ();
-	}
+	    mgmt_call(write_status, NULL);
     }
 }
 
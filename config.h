@@ -85,6 +85,7 @@
 
 int  config(void);
 cfg_t *parse_conf(char *conf);
+cfg_t *parse_conf_cached(void);
 int  get_index(const char *ifname, const char *doc);
 int  mstp_write_status_file(int display);
 void mstp_update_status(void);
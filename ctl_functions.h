@@ -34,6 +34,9 @@
 #include <asm/byteorder.h>
 
 #include "mstp.h"
+#include "trace.h"
+#include "stats.h"
+#include "epoll_loop.h"
 
 struct ctl_msg_hdr
 {
@@ -451,6 +454,164 @@ struct set_fids2mstids_OUT
 #define set_fids2mstids_CALL (in->br_index, in->fids2mstids)
 CTL_DECLARE(set_fids2mstids);
 
+/* get_memory_status */
+#define CMD_CODE_get_memory_status  124
+#define get_memory_status_ARGS (int br_index, Bridge_MemoryStatus *status)
+struct get_memory_status_IN
+{
+    int br_index;
+};
+struct get_memory_status_OUT
+{
+    Bridge_MemoryStatus status;
+};
+#define get_memory_status_COPY_IN  ({ in->br_index = br_index; })
+#define get_memory_status_COPY_OUT ({ *status = out->status; })
+#define get_memory_status_CALL (in->br_index, &out->status)
+CTL_DECLARE(get_memory_status);
+
+/* get_trace */
+#define CMD_CODE_get_trace  125
+#define get_trace_ARGS (__u32 seq, __u32 *next_seq, int *num, trace_rec_t *recs)
+struct get_trace_IN
+{
+    __u32 seq;
+};
+struct get_trace_OUT
+{
+    __u32 next_seq;
+    int num;
+    trace_rec_t recs[TRACE_CHUNK_SIZE];
+};
+#define get_trace_COPY_IN  ({ in->seq = seq; })
+#define get_trace_COPY_OUT ({ *next_seq = out->next_seq; *num = out->num; \
+    memcpy(recs, out->recs, out->num * sizeof(out->recs[0])); })
+#define get_trace_CALL (in->seq, &out->next_seq, &out->num, out->recs)
+CTL_DECLARE(get_trace);
+
+/* get_stats */
+#define CMD_CODE_get_stats  126
+#define get_stats_ARGS (int id, stats_hist_t *hist, __u64 *sm_run_timeouts, \
+                        epoll_stats_t *loop)
+struct get_stats_IN
+{
+    int id;
+};
+struct get_stats_OUT
+{
+    stats_hist_t hist;
+    __u64 sm_run_timeouts;
+    epoll_stats_t loop;
+};
+#define get_stats_COPY_IN  ({ in->id = id; })
+#define get_stats_COPY_OUT ({ *hist = out->hist; \
+                              *sm_run_timeouts = out->sm_run_timeouts; \
+                              *loop = out->loop; })
+#define get_stats_CALL (in->id, &out->hist, &out->sm_run_timeouts, &out->loop)
+CTL_DECLARE(get_stats);
+
+/* reset_stats */
+#define CMD_CODE_reset_stats    127
+#define reset_stats_ARGS (void)
+struct reset_stats_IN
+{
+};
+struct reset_stats_OUT
+{
+};
+#define reset_stats_COPY_IN  ({ (void)0; })
+#define reset_stats_COPY_OUT ({ (void)0; })
+#define reset_stats_CALL ()
+CTL_DECLARE(reset_stats);
+
+/* get_port_counters
+ * Variable size reply: PortCounters_Header, then Port_Counters of every
+ * port, each followed by TreePort_Counters of every tree of the bridge.
+ * The reply holds as many ports as fit in its size, starting from the
+ * port number "first" in the bridge's list of ports.
+ */
+#define CMD_CODE_get_port_counters  128
+#define get_port_counters_ARGS (int br_index, int first, void *buf, int len)
+typedef struct
+{
+    int num_ports;  /* total in the bridge */
+    int first;
+    int count;      /* in this reply */
+    int num_trees;
+} PortCounters_Header;
+typedef struct
+{
+    int if_index;
+    port_counters_t counters;
+} Port_Counters;
+typedef struct
+{
+    __u16 mstid;
+    ptp_counters_t counters;
+} TreePort_Counters;
+#define PORT_COUNTERS_SIZE(num_trees) \
+    (sizeof(Port_Counters) + (num_trees) * sizeof(TreePort_Counters))
+/* Limit of the reply size. Replies longer than MSG_BUF_LEN of the server
+ * use temporary buffer. */
+#define PORT_COUNTERS_MAX_LEN   (128 * 1024)
+struct get_port_counters_IN
+{
+    int br_index;
+    int first;
+};
+CTL_DECLARE(get_port_counters);
+
+/* subscribe
+ * Registers the client socket for the events matching the filter:
+ * br_index and port_index 0 - any, mstid -1 - any, events - bitmask of
+ * (1 << mstp_event_t), 0 - unsubscribe. The events are pushed to the
+ * client as CMD_CODE_events messages with CTL_EventsHeader followed by
+ * CTL_Event records.
+ */
+#define CMD_CODE_subscribe  129
+#define subscribe_ARGS (int br_index, int port_index, int mstid, __u32 events)
+struct subscribe_IN
+{
+    int br_index;
+    int port_index;
+    int mstid;
+    __u32 events;
+};
+struct subscribe_OUT
+{
+};
+#define subscribe_COPY_IN  ({ in->br_index = br_index; \
+    in->port_index = port_index; in->mstid = mstid; in->events = events; })
+#define subscribe_COPY_OUT ({ (void)0; })
+#define subscribe_CALL (in->br_index, in->port_index, in->mstid, in->events)
+CTL_DECLARE(subscribe);
+
+#define CMD_CODE_events     130
+#define CTL_MAX_SUBSCRIBERS 16
+#define CTL_EVENTS_QUEUE    256 /* per subscriber, events over it are lost */
+#define CTL_EVENTS_MAX      64  /* per message */
+typedef struct
+{
+    __u32 lost;     /* events dropped since the previous message */
+    int count;
+} CTL_EventsHeader;
+typedef struct
+{
+    __u64 ts;       /* CLOCK_REALTIME, ns */
+    int br_index;
+    int if_index;   /* 0 - none */
+    __u16 mstid;
+    __u8 event;     /* mstp_event_t */
+    __u8 pad;
+    __u32 arg;
+    bridge_identifier_t root;           /* MSTP_EVENT_ROOT */
+} CTL_Event;
+#define CTL_EVENTS_MSG_LEN \
+    (sizeof(CTL_EventsHeader) + CTL_EVENTS_MAX * sizeof(CTL_Event))
+/* Server side, in ctl_socket_server.c */
+extern int ctl_num_subscribers;
+void ctl_socket_notify(const CTL_Event *ev);
+
 /* add bridges */
 #define CMD_CODE_add_bridges    (122 | RESPONSE_FIRST_HANDLE_LATER)
 #define add_bridges_ARGS (int *br_array, int* *ifaces_lists)
@@ -462,7 +623,10 @@ CTL_DECLARE(add_bridges);
 CTL_DECLARE(del_bridges);
 
 /* General case part in ctl command server switch */
-#define SERVER_MESSAGE_CASE(name)                            \
+#define SERVER_MESSAGE_CASE(name) SERVER_MESSAGE_CASE_FUNC(name, CTL_ ## name)
+
+/* Same, calling func instead of CTL_name */
+#define SERVER_MESSAGE_CASE_FUNC(name, func)                 \
     case CMD_CODE_ ## name : do                              \
     {                                                        \
         struct name ## _IN in0, *in = &in0;                  \
@@ -474,7 +638,7 @@ CTL_DECLARE(del_bridges);
             return -1;                                       \
         }                                                    \
         memcpy(in, inbuf, lin);                              \
-        int r = CTL_ ## name name ## _CALL;                  \
+        int r = func name ## _CALL;                          \
         if(r)                                                \
             return r;                                        \
         if(outbuf)                                           \
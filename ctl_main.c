@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <sys/stat.h>
+#include <signal.h>
 
 #include "ctl_socket_client.h"
 #include "log.h"
@@ -575,12 +576,12 @@ static int do_showport(int br_index, const char *bridge_name,
                        BOOL_STR(s.network_port));
                 printf("BA inconsistent      %s\n",
                        BOOL_STR(s.ba_inconsistent));
-                printf("  Num TX BPDU        %-23u ", s.num_tx_bpdu);
-                printf("Num TX TCN           %u\n", s.num_tx_tcn);
-                printf("  Num RX BPDU        %-23u ", s.num_rx_bpdu);
-                printf("Num RX TCN           %u\n", s.num_rx_tcn);
-                printf("  Num Transition FWD %-23u ", s.num_trans_fwd);
-                printf("Num Transition BLK   %u\n", s.num_trans_blk);
+                printf("  Num TX BPDU        %-23llu ", s.num_tx_bpdu);
+                printf("Num TX TCN           %llu\n", s.num_tx_tcn);
+                printf("  Num RX BPDU        %-23llu ", s.num_rx_bpdu);
+                printf("Num RX TCN           %llu\n", s.num_rx_tcn);
+                printf("  Num Transition FWD %-23llu ", s.num_trans_fwd);
+                printf("Num Transition BLK   %llu\n", s.num_trans_blk);
                 printf("  Rcvd BPDU          %-23s ", BOOL_STR(s.rcvdBpdu));
                 printf("Rcvd STP             %s\n", BOOL_STR(s.rcvdSTP));
                 printf("  Rcvd RSTP          %-23s ", BOOL_STR(s.rcvdRSTP));
@@ -1255,6 +1256,516 @@ static int cmd_showmstconfid(int argc, char *const *argv)
     return 0;
 }
 
+#define POOL_FMT "%-6u %-6u %-9u %-5u %u\n"
+#define POOL_ARGS(p) (p).object_size, (p).objects_in_use, \
+    (p).objects_allocated, (p).slabs, (p).bytes
+
+static int cmd_showmem(int argc, char *const *argv)
+{
+    Bridge_MemoryStatus s;
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+
+    if(CTL_get_memory_status(br_index, &s))
+        return -1;
+
+    printf("%s memory usage (bytes):\n", argv[1]);
+    printf("  ports %u, trees %u\n", s.num_ports, s.num_trees);
+    printf("  bridge          %u\n", s.bridge_size);
+    printf("  port bitmaps    %u\n", s.bitmaps_size);
+    printf("  VLAN tables     %u\n", s.vlan_tables_size);
+    printf("  received BPDUs  %u\n", s.rcvd_bpdu_size);
+    printf("  pool    objsz  in use allocated slabs bytes\n");
+    printf("  port    "POOL_FMT, POOL_ARGS(s.ports));
+    printf("  tree    "POOL_FMT, POOL_ARGS(s.trees));
+    printf("  treeprt "POOL_FMT, POOL_ARGS(s.ptps));
+    printf("  per port        %u\n", s.per_port);
+    printf("  per MSTI        %u\n", s.per_msti);
+    printf("  total           %u\n", s.total);
+
+    return 0;
+}
+
+static const struct
+{
+    const char *name;
+    bool ns; /* values are times in ns */
+} stats_names[STATS_NUM_HISTS] =
+{
+    [STATS_RX_BPDU]       = { "bpdu-rx-to-settle",  true },
+    [STATS_SM_ITERATIONS] = { "sm-iterations",      false },
+    [STATS_ROLE_TO_STATE] = { "role-to-port-state", true },
+    [STATS_BR_SET_STATE]  = { "kernel-set-state",   true },
+    [STATS_BR_FLUSH_PORT] = { "kernel-flush-port",  true },
+    [STATS_BR_FDB_AGEING] = { "kernel-fdb-ageing",  true },
+    [STATS_TICK_LAG]      = { "tick-lag",           true },
+    [STATS_DRIVER_SET_STATE] = { "driver-set-state", true },
+    [STATS_DRIVER_FLUSH]  = { "driver-flush",       true },
+};
+
+static const char *stats_value_str(char *buf, size_t size, __u64 value,
+                                   bool ns)
+{
+    if(!ns || (1000 > value))
+        snprintf(buf, size, "%llu", value);
+    else if(1000000 > value)
+        snprintf(buf, size, "%.1fus", value / 1e3);
+    else if(1000000000 > value)
+        snprintf(buf, size, "%.1fms", value / 1e6);
+    else
+        snprintf(buf, size, "%.2fs", value / 1e9);
+    return buf;
+}
+
+/* Highest value of the bucket where the given fraction of values ends */
+static __u64 stats_percentile(const stats_hist_t *h, double fraction)
+{
+    __u64 target = h->count * fraction, sum = 0;
+    int i;
+
+    if(target >= h->count)
+        return h->max;
+    for(i = 0; i < STATS_BUCKETS; ++i)
+    {
+        if((sum += h->buckets[i]) > target)
+            break;
+    }
+    return (stats_bucket_value(i) < h->max) ? stats_bucket_value(i) : h->max;
+}
+
+static int cmd_showstats(int argc, char *const *argv)
+{
+    static const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char *const prio_names[EPOLL_NUM_PRIOS] =
+    {
+        [EPOLL_PRIO_PACKET] = "packet",
+        [EPOLL_PRIO_NETLINK] = "netlink",
+        [EPOLL_PRIO_MGMT] = "mgmt",
+    };
+    stats_hist_t h;
+    epoll_stats_t loop;
+    __u64 sm_run_timeouts = 0;
+    char buf[16];
+    bool ns;
+    int id, i;
+
+    printf("%-20s %10s %8s %8s %8s %8s %8s %8s %8s\n", "", "count", "min",
+           "mean", "p50", "p90", "p99", "p99.9", "max");
+    for(id = 0; id < STATS_NUM_HISTS; ++id)
+    {
+        if(CTL_get_stats(id, &h, &sm_run_timeouts, &loop))
+            return -1;
+        ns = stats_names[id].ns;
+        printf("%-20s %10llu", stats_names[id].name, h.count);
+        if(!h.count)
+        {
+            printf("\n");
+            continue;
+        }
+        printf(" %8s", stats_value_str(buf, sizeof(buf), h.min, ns));
+        printf(" %8s", stats_value_str(buf, sizeof(buf), h.sum / h.count, ns));
+        for(i = 0; i < COUNT_OF(fractions); ++i)
+            printf(" %8s", stats_value_str(buf, sizeof(buf),
+                               stats_percentile(&h, fractions[i]), ns));
+        printf(" %8s\n", stats_value_str(buf, sizeof(buf), h.max, ns));
+    }
+    printf("state machines did not settle in 1 s: %llu times\n",
+           sm_run_timeouts);
+    printf("\n%-20s %10s %10s %8s\n", "event loop", "dispatched", "deferred",
+           "max");
+    for(i = EPOLL_NUM_PRIOS - 1; i >= 0; --i)
+        printf("%-20s %10llu %10llu %8s\n", prio_names[i],
+               loop.dispatched[i], loop.deferred[i],
+               stats_value_str(buf, sizeof(buf), loop.max_us[i] * 1000, true));
+
+    return 0;
+}
+
+static int cmd_resetstats(int argc, char *const *argv)
+{
+    return CTL_reset_stats();
+}
+
+static const char *const PRTSM_names[] =
+{
+    "INIT_PORT", "DISABLE_PORT", "DISABLED_PORT",
+    "MASTER_PROPOSED", "MASTER_AGREED", "MASTER_SYNCED", "MASTER_RETIRED",
+    "MASTER_FORWARD", "MASTER_LEARN", "MASTER_DISCARD", "MASTER_PORT",
+    "ROOT_PROPOSED", "ROOT_AGREED", "ROOT_SYNCED", "REROOT", "ROOT_FORWARD",
+    "ROOT_LEARN", "REROOTED", "ROOT_PORT",
+    "DESIGNATED_PROPOSE", "DESIGNATED_AGREED", "DESIGNATED_SYNCED",
+    "DESIGNATED_RETIRED", "DESIGNATED_FORWARD", "DESIGNATED_LEARN",
+    "DESIGNATED_DISCARD", "DESIGNATED_PORT",
+    "BLOCK_PORT", "BACKUP_PORT", "ALTERNATE_PROPOSED", "ALTERNATE_AGREED",
+    "ALTERNATE_PORT"
+};
+static const char *const PSTSM_names[] =
+{
+    "DISCARDING", "LEARNING", "FORWARDING"
+};
+static const char *const TCSM_names[] =
+{
+    "INACTIVE", "LEARNING", "DETECTED", "NOTIFIED_TCN", "NOTIFIED_TC",
+    "PROPAGATING", "ACKNOWLEDGED", "ACTIVE"
+};
+static const char *const PISM_names[] =
+{
+    "DISABLED", "AGED", "UPDATE", "SUPERIOR_DESIGNATED",
+    "REPEATED_DESIGNATED", "INFERIOR_DESIGNATED", "NOT_DESIGNATED", "OTHER",
+    "CURRENT", "RECEIVE"
+};
+static const char *const port_state_names[] =
+{
+    "disabled", "listening", "learning", "forwarding", "blocking"
+};
+
+#define TRACE_NAME(_names, _i) \
+    (((_i) < COUNT_OF(_names)) ? (_names)[_i] : "unknown")
+
+static const char *trace_bpdu_str(unsigned int type, unsigned int version)
+{
+    switch(type)
+    {
+        case bpduTypeTCN:
+            return "TCN";
+        case bpduTypeConfig:
+            return "Config";
+        case bpduTypeRST:
+            return (protoMSTP <= version) ? "MST" : "RST";
+    }
+    return "unknown";
+}
+
+static void print_trace_rec(const trace_rec_t *rec, __u64 prev_ts)
+{
+    char ifname[IF_NAMESIZE];
+    __u64 delta = prev_ts ? rec->ts - prev_ts : 0;
+
+    if(!if_indextoname(rec->if_index, ifname))
+        snprintf(ifname, sizeof(ifname), "if%u", rec->if_index);
+    printf("%llu.%09llu +%llu.%09llu %-10s %4hu ",
+           rec->ts / 1000000000ULL, rec->ts % 1000000000ULL,
+           delta / 1000000000ULL, delta % 1000000000ULL, ifname, rec->mstid);
+    switch(rec->event)
+    {
+        case TRACE_PRTSM:
+            printf("PRTSM %s\n", TRACE_NAME(PRTSM_names, rec->state));
+            break;
+        case TRACE_PSTSM:
+            printf("PSTSM %s\n", TRACE_NAME(PSTSM_names, rec->state));
+            break;
+        case TRACE_TCSM:
+            printf("TCSM  %s\n", TRACE_NAME(TCSM_names, rec->state));
+            break;
+        case TRACE_PISM:
+            printf("PISM  %s\n", TRACE_NAME(PISM_names, rec->state));
+            break;
+        case TRACE_RX_BPDU:
+        case TRACE_TX_BPDU:
+            printf("%s    %s v%u flags 0x%02X size %u\n",
+                   (TRACE_RX_BPDU == rec->event) ? "rx" : "tx",
+                   trace_bpdu_str(rec->state, TRACE_BPDU_VERSION(rec->arg)),
+                   TRACE_BPDU_VERSION(rec->arg), TRACE_BPDU_FLAGS(rec->arg),
+                   TRACE_BPDU_SIZE(rec->arg));
+            break;
+        case TRACE_SET_STATE:
+            printf("set   state %s", TRACE_NAME(port_state_names, rec->state));
+            if(rec->arg != rec->state)
+                printf(" (requested %s)",
+                       TRACE_NAME(port_state_names, rec->arg));
+            printf("\n");
+            break;
+        case TRACE_FLUSH:
+            printf("set   flush\n");
+            break;
+        case TRACE_SET_AGEING:
+            printf("set   ageing time %u\n", rec->arg);
+            break;
+        case TRACE_SHUTDOWN:
+            printf("set   shutdown\n");
+            break;
+        default:
+            printf("event %hhu state %hhu arg %u\n",
+                   rec->event, rec->state, rec->arg);
+            break;
+    }
+}
+
+static int cmd_dumptrace(int argc, char *const *argv)
+{
+    trace_rec_t recs[TRACE_CHUNK_SIZE];
+    __u32 seq = 0, next_seq = 0;
+    __u64 prev_ts = 0;
+    int num, i, total = 0;
+    bool binary = false;
+
+    if(1 < argc)
+    {
+        if(strcmp(argv[1], "binary"))
+        {
+            fprintf(stderr, "Bad format %s\n", argv[1]);
+            return -1;
+        }
+        binary = true;
+    }
+
+    /* Stop after one ring size, in case events keep coming */
+    do
+    {
+        if(CTL_get_trace(seq, &seq, &num, recs))
+            return -1;
+        if(binary && (num != fwrite(recs, sizeof(recs[0]), num, stdout)))
+            return -1;
+        for(i = 0; !binary && (i < num); ++i)
+        {
+            if(prev_ts && (recs[i].seq != next_seq))
+                printf("... %u events lost\n", recs[i].seq - next_seq);
+            next_seq = recs[i].seq + 1;
+            print_trace_rec(&recs[i], prev_ts);
+            prev_ts = recs[i].ts;
+        }
+        total += num;
+    } while(num && (TRACE_RING_SIZE > total));
+
+    return 0;
+}
+
+static void print_counters_pair(const char *name1, __u64 val1,
+                                const char *name2, __u64 val2)
+{
+    printf("  %-18s %-23llu %-20s %llu\n", name1, val1, name2, val2);
+}
+
+static int cmd_showcounters(int argc, char *const *argv)
+{
+    PortCounters_Header *hdr;
+    Port_Counters *pc;
+    TreePort_Counters *tpc;
+    port_counters_t *c;
+    char ifname[IFNAMSIZ];
+    unsigned char *p;
+    int first = 0, i, j;
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+
+    if(NULL == (hdr = malloc(PORT_COUNTERS_MAX_LEN)))
+    {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    do
+    {
+        if(CTL_get_port_counters(br_index, first, hdr, PORT_COUNTERS_MAX_LEN))
+            goto out_err;
+        /* Port list changed under us */
+        if(!hdr->count && (hdr->num_ports > first))
+            goto out_err;
+        p = (unsigned char *)(hdr + 1);
+        for(i = 0; i < hdr->count; ++i)
+        {
+            pc = (Port_Counters *)p;
+            c = &pc->counters;
+            if(!if_indextoname(pc->if_index, ifname))
+                snprintf(ifname, sizeof(ifname), "if%d", pc->if_index);
+            printf("%s:%s\n", argv[1], ifname);
+            print_counters_pair("RX BPDU", c->rx_bpdu, "TX BPDU", c->tx_bpdu);
+            print_counters_pair("RX Config", c->rx_config,
+                                "TX Config", c->tx_config);
+            print_counters_pair("RX RST", c->rx_rst, "TX RST", c->tx_rst);
+            print_counters_pair("RX MST", c->rx_mst, "TX MST", c->tx_mst);
+            print_counters_pair("RX TCN", c->rx_tcn, "TX TCN", c->tx_tcn);
+            print_counters_pair("RX TC", c->rx_tc, "TX TC", c->tx_tc);
+            print_counters_pair("RX bad size", c->rx_bad_size,
+                                "RX bad protocol", c->rx_bad_protocol);
+            print_counters_pair("RX bad version", c->rx_bad_version,
+                                "RX bad type", c->rx_bad_type);
+            print_counters_pair("RX pending", c->rx_pending,
+                                "RX port disabled", c->rx_disabled);
+            print_counters_pair("RX no memory", c->rx_no_memory,
+                                "TX hold", c->tx_hold);
+            print_counters_pair("BPDU guard", c->bpdu_guard,
+                                "Transition FWD", c->trans_fwd);
+            print_counters_pair("BA inconsistent", c->ba_inconsistent,
+                                "Transition BLK", c->trans_blk);
+            printf("  %-18s %llu\n", "BA cleared", c->ba_cleared);
+            tpc = (TreePort_Counters *)(pc + 1);
+            for(j = 0; j < hdr->num_trees; ++j, ++tpc)
+                printf("  MSTI %-4hu TC detected %-10llu TC rcvd %-10llu"
+                       " flushes %llu\n", tpc->mstid,
+                       tpc->counters.tc_detected, tpc->counters.tc_rcvd,
+                       tpc->counters.flushes);
+            p += PORT_COUNTERS_SIZE(hdr->num_trees);
+        }
+        first += hdr->count;
+    } while(first < hdr->num_ports);
+
+    free(hdr);
+    return 0;
+
+out_err:
+    free(hdr);
+    return -1;
+}
+
+static const struct
+{
+    const char *name;
+    __u32 mask;
+} monitor_classes[] =
+{
+    {"state", 1 << MSTP_EVENT_PORT_STATE},
+    {"role", 1 << MSTP_EVENT_PORT_ROLE},
+    {"tc", (1 << MSTP_EVENT_TC_DETECTED) | (1 << MSTP_EVENT_TC_RCVD)},
+    {"root", 1 << MSTP_EVENT_ROOT},
+    {"bpduguard", 1 << MSTP_EVENT_BPDU_GUARD},
+    {"ba", 1 << MSTP_EVENT_BA_INCONSISTENT},
+};
+
+static volatile sig_atomic_t monitor_stop;
+
+static void monitor_signal(int sig)
+{
+    monitor_stop = 1;
+}
+
+static void print_event(const CTL_Event *ev)
+{
+    char brname[IF_NAMESIZE], ifname[IF_NAMESIZE], timebuf[32];
+    time_t t = ev->ts / 1000000000ULL;
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    strftime(timebuf, sizeof(timebuf), "%T", &tm);
+    if(!if_indextoname(ev->br_index, brname))
+        snprintf(brname, sizeof(brname), "if%d", ev->br_index);
+    ifname[0] = 0;
+    if(ev->if_index && !if_indextoname(ev->if_index, ifname))
+        snprintf(ifname, sizeof(ifname), "if%d", ev->if_index);
+    printf("%s.%03llu %s:%s:%hu ", timebuf,
+           (ev->ts % 1000000000ULL) / 1000000, brname, ifname, ev->mstid);
+    switch(ev->event)
+    {
+        case MSTP_EVENT_PORT_STATE:
+            printf("state %s\n", STATE_STR(ev->arg));
+            break;
+        case MSTP_EVENT_PORT_ROLE:
+            printf("role %s\n", ROLE_STR(ev->arg));
+            break;
+        case MSTP_EVENT_TC_DETECTED:
+            printf("topology change detected\n");
+            break;
+        case MSTP_EVENT_TC_RCVD:
+            printf("topology change received\n");
+            break;
+        case MSTP_EVENT_ROOT:
+            printf("root "BR_ID_FMT" root port %s\n", BR_ID_ARGS(ev->root),
+                   ev->if_index ? ifname : "none");
+            break;
+        case MSTP_EVENT_BPDU_GUARD:
+            printf("bpdu guard error, port down\n");
+            break;
+        case MSTP_EVENT_BA_INCONSISTENT:
+            printf("bridge assurance %s\n",
+                   ev->arg ? "inconsistent" : "consistent");
+            break;
+        default:
+            printf("event %hhu arg %u\n", ev->event, ev->arg);
+            break;
+    }
+}
+
+static int cmd_monitor(int argc, char *const *argv)
+{
+    unsigned char buf[CTL_EVENTS_MSG_LEN];
+    CTL_EventsHeader *hdr = (CTL_EventsHeader *)buf;
+    CTL_Event *ev = (CTL_Event *)(hdr + 1);
+    int br_index = 0, port_index = 0, mstid = -1;
+    __u32 events = 0;
+    struct sigaction sa;
+    char *list, *p;
+    int i, j, len;
+
+    for(i = 1; i < argc; i += 2)
+    {
+        if(i + 1 == argc)
+        {
+            fprintf(stderr, "Missing value of %s\n", argv[i]);
+            return -1;
+        }
+        if(!strcmp(argv[i], "bridge"))
+        {
+            if(0 > (br_index = get_index(argv[i + 1], "bridge")))
+                return br_index;
+        }
+        else if(!strcmp(argv[i], "port"))
+        {
+            if(0 > (port_index = get_index(argv[i + 1], "port")))
+                return port_index;
+        }
+        else if(!strcmp(argv[i], "mstid"))
+        {
+            if(0 > (mstid = get_id(argv[i + 1], "mstid", MAX_MSTID)))
+                return mstid;
+        }
+        else if(!strcmp(argv[i], "event"))
+        {
+            if(!(list = strdup(argv[i + 1])))
+                return -1;
+            for(p = strtok(list, ","); p; p = strtok(NULL, ","))
+            {
+                for(j = 0; j < COUNT_OF(monitor_classes); ++j)
+                    if(!strcmp(p, monitor_classes[j].name))
+                        break;
+                if(COUNT_OF(monitor_classes) == j)
+                {
+                    fprintf(stderr, "Bad event class %s\n", p);
+                    free(list);
+                    return -1;
+                }
+                events |= monitor_classes[j].mask;
+            }
+            free(list);
+        }
+        else
+        {
+            fprintf(stderr, "Bad argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+    if(!events)
+        events = (1 << MSTP_NUM_EVENTS) - 1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = monitor_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if(CTL_subscribe(br_index, port_index, mstid, events))
+        return -1;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    while(!monitor_stop)
+    {
+        if(0 > (len = recv_ctl_notification(CMD_CODE_events, buf,
+                                            sizeof(buf))))
+            break;
+        if((sizeof(*hdr) > len)
+           || (len != sizeof(*hdr) + hdr->count * sizeof(*ev)))
+        {
+            fprintf(stderr, "Bad events message\n");
+            break;
+        }
+        if(hdr->lost)
+            printf("... %u events lost\n", hdr->lost);
+        for(i = 0; i < hdr->count; ++i)
+            print_event(ev + i);
+    }
+    CTL_subscribe(br_index, port_index, mstid, 0);
+
+    return 0;
+}
+
 static int cmd_createtree(int argc, char *const *argv)
 {
     int br_index = get_index(argv[1], "bridge");
@@ -1521,6 +2032,19 @@ static const struct command commands[] =
      "<bridge>", "Show VID-to-FID allocation table"},
     {1, 0, "showfid2mstid", cmd_showfid2mstid,
      "<bridge>", "Show FID-to-MSTID allocation table"},
+    {1, 0, "showmem", cmd_showmem,
+     "<bridge>", "Show memory used by the bridge"},
+    {0, 1, "dumptrace", cmd_dumptrace,
+     "[binary]", "Dump trace of the state machine events"},
+    {0, 0, "showstats", cmd_showstats,
+     "", "Show latency histograms of the daemon"},
+    {0, 0, "resetstats", cmd_resetstats,
+     "", "Reset latency histograms of the daemon"},
+    {0, 8, "monitor", cmd_monitor,
+     "[bridge <bridge>] [port <port>] [mstid <mstid>] [event <class>,...]",
+     "Print protocol events as they happen"},
+    {1, 0, "showcounters", cmd_showcounters,
+     "<bridge>", "Show protocol counters of all ports of the bridge"},
     /* Show global port */
     {1, 32, "showport", cmd_showport,
      "<bridge> [<port> ... [param]]", "Show port state for the CIST"},
@@ -1714,6 +2238,10 @@ CLIENT_SIDE_FUNCTION(set_vid2fid)
 CLIENT_SIDE_FUNCTION(set_fid2mstid)
 CLIENT_SIDE_FUNCTION(set_vids2fids)
 CLIENT_SIDE_FUNCTION(set_fids2mstids)
+CLIENT_SIDE_FUNCTION(get_memory_status)
+CLIENT_SIDE_FUNCTION(get_trace)
+CLIENT_SIDE_FUNCTION(get_stats)
+CLIENT_SIDE_FUNCTION(reset_stats)
 
 CTL_DECLARE(add_bridges)
 {
@@ -1753,6 +2281,25 @@ CTL_DECLARE(add_bridges)
     return 0;
 }
 
+CLIENT_SIDE_FUNCTION(subscribe)
+
+CTL_DECLARE(get_port_counters)
+{
+    struct get_port_counters_IN in = { .br_index = br_index, .first = first };
+    int res = 0;
+    LogString log = { .buf = "" };
+
+    int r = send_ctl_message(CMD_CODE_get_port_counters, &in, sizeof(in),
+                             buf, len, &log, &res);
+    if(r || res)
+        LOG("Got return code %d, %d\n%s", r, res, log.buf);
+    if(r)
+        return r;
+    if(res)
+        return res;
+    return 0;
+}
+
 CTL_DECLARE(del_bridges)
 {
     int res = 0;
@@ -1771,6 +2318,8 @@ CTL_DECLARE(del_bridges)
 
 /*********************** Logging *********************/
 
+int log_level = LOG_LEVEL_MAX;
+
 void Dprintf(int level, const char *fmt, ...)
 {
     char logbuf[LOG_STRING_LEN];
@@ -27,6 +27,7 @@
 #include <sys/un.h>
 #include <unistd.h>
 #include <poll.h>
+#include <errno.h>
 
 #include "ctl_functions.h"
 #define NO_DAEMON
@@ -82,6 +83,45 @@ void ctl_client_cleanup(void)
     }
 }
 
+/* Waits for a message pushed by the server (e.g. CMD_CODE_events).
+ * Returns length of its payload, -1 on error or interrupt.
+ */
+int recv_ctl_notification(int cmd, void *buf, int len)
+{
+    struct ctl_msg_hdr mhdr;
+    struct msghdr msg;
+    struct iovec iov[2];
+    int l;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    iov[0].iov_base = &mhdr;
+    iov[0].iov_len = sizeof(mhdr);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = len;
+
+    while(true)
+    {
+        l = recvmsg(fd, &msg, 0);
+        if(0 > l)
+        {
+            if(EINTR != errno)
+                ERROR("Error getting message from server: %m");
+            return -1;
+        }
+        if((sizeof(mhdr) > l) || (l != sizeof(mhdr) + mhdr.lout)
+           || (msg.msg_flags & MSG_TRUNC))
+        {
+            ERROR("Error getting message from server: Bad format");
+            return -1;
+        }
+        /* Late replies to the requests are skipped */
+        if(mhdr.cmd == cmd)
+            return mhdr.lout;
+    }
+}
+
 int send_ctl_message(int cmd, void *inbuf, int lin, void *outbuf, int lout,
                      LogString *log, int *res)
 {
@@ -31,6 +31,7 @@
 
 int send_ctl_message(int cmd, void *inbuf, int lin, void *outbuf, int lout,
                      LogString *log, int *res);
+int recv_ctl_notification(int cmd, void *buf, int len);
 int ctl_client_init(void);
 void ctl_client_cleanup(void);
 
@@ -26,9 +26,12 @@
 
 #include <sys/un.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <pthread.h>
 
 #include "ctl_socket_client.h"
 #include "epoll_loop.h"
+#include "snapshot.h"
 #include "log.h"
 
 static int server_socket(void)
@@ -82,6 +85,11 @@ static int handle_message(int cmd, void *inbuf, int lin,
         SERVER_MESSAGE_CASE(set_fid2mstid);
         SERVER_MESSAGE_CASE(set_vids2fids);
         SERVER_MESSAGE_CASE(set_fids2mstids);
+        SERVER_MESSAGE_CASE(get_memory_status);
+        SERVER_MESSAGE_CASE(get_trace);
+        SERVER_MESSAGE_CASE(get_stats);
+        SERVER_MESSAGE_CASE(reset_stats);
+        SERVER_MESSAGE_CASE(subscribe);
 
         case CMD_CODE_add_bridges:
         {
@@ -168,15 +176,87 @@ bad_lin1:       LOG("Bad sizes: lin %d < %d", lin,
             return r;
         }
 
+        case CMD_CODE_get_port_counters:
+        {
+            struct get_port_counters_IN *in = inbuf;
+            if(sizeof(*in) != lin || sizeof(PortCounters_Header) > lout)
+            {
+                LOG("Bad sizes lin %d != %zd or lout %d < %zd", lin,
+                    sizeof(*in), lout, sizeof(PortCounters_Header));
+                return -1;
+            }
+            return CTL_get_port_counters(in->br_index, in->first,
+                                         outbuf, lout);
+        }
+
         default:
             ERROR("CTL: Unknown command %d", cmd);
             return -1;
     }
 }
 
-int ctl_in_handler = 0;
-static unsigned char msg_logbuf[LOG_STRING_LEN];
-static unsigned int msg_log_offset;
+/* Status reads served on the management thread from the snapshot */
+static int handle_snapshot_message(int cmd, void *inbuf, int lin,
+                                   void *outbuf, int lout)
+{
+    switch(cmd)
+    {
+        SERVER_MESSAGE_CASE_FUNC(get_cist_bridge_status,
+                                 snapshot_get_cist_bridge_status);
+        SERVER_MESSAGE_CASE_FUNC(get_msti_bridge_status,
+                                 snapshot_get_msti_bridge_status);
+        SERVER_MESSAGE_CASE_FUNC(get_cist_port_status,
+                                 snapshot_get_cist_port_status);
+        SERVER_MESSAGE_CASE_FUNC(get_msti_port_status,
+                                 snapshot_get_msti_port_status);
+        SERVER_MESSAGE_CASE_FUNC(get_mstilist, snapshot_get_mstilist);
+
+        default:
+            ERROR("CTL: Unknown command %d", cmd);
+            return -1;
+    }
+}
+
+static bool is_snapshot_command(int cmd)
+{
+    switch(cmd)
+    {
+        case CMD_CODE_get_cist_bridge_status:
+        case CMD_CODE_get_msti_bridge_status:
+        case CMD_CODE_get_cist_port_status:
+        case CMD_CODE_get_msti_port_status:
+        case CMD_CODE_get_mstilist:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Commands forwarded to the event loop which don't change the state */
+static bool is_read_command(int cmd)
+{
+    switch(cmd)
+    {
+        case CMD_CODE_get_mstconfid:
+        case CMD_CODE_get_vids2fids:
+        case CMD_CODE_get_fids2mstids:
+        case CMD_CODE_get_memory_status:
+        case CMD_CODE_get_trace:
+        case CMD_CODE_get_stats:
+        case CMD_CODE_reset_stats:
+        case CMD_CODE_get_port_counters:
+        case CMD_CODE_subscribe:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Messages are handled on both threads, the state of the message being
+ * handled is per thread */
+__thread int ctl_in_handler = 0;
+static __thread unsigned char msg_logbuf[LOG_STRING_LEN];
+static __thread unsigned int msg_log_offset;
 void _ctl_err_log(char *fmt, ...)
 {
     if((sizeof(msg_logbuf) - 1) <= msg_log_offset)
@@ -197,61 +277,87 @@ void _ctl_err_log(char *fmt, ...)
 }
 
 #define MSG_BUF_LEN 10000
-static unsigned char msg_inbuf[MSG_BUF_LEN];
-static unsigned char msg_outbuf[MSG_BUF_LEN];
+static __thread unsigned char msg_outbuf[MSG_BUF_LEN];
+/* Sender of the message being handled */
+static __thread struct sockaddr_un msg_sa;
+static __thread socklen_t msg_salen;
 
-static void ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
+typedef struct
 {
     struct ctl_msg_hdr mhdr;
-    struct msghdr msg;
     struct sockaddr_un sa;
+    socklen_t salen;
+    unsigned char inbuf[MSG_BUF_LEN];
+} ctl_request_t;
+
+static struct epoll_event_handler ctl_handler = {0};
+/* Requests from the management thread to the event loop */
+static epoll_queue_t ctl_queue;
+/* Forwarded requests not completed yet. Status reads are forwarded too
+ * while there are any, so that they see the changes made by them. */
+static unsigned int ctl_in_flight;
+
+/* Handles the request and sends the response */
+static void process_request(ctl_request_t *req, bool snapshot)
+{
+    struct ctl_msg_hdr mhdr = req->mhdr;
+    struct msghdr msg;
     struct iovec iov[3];
+    unsigned char *outbuf = msg_outbuf;
     int l;
 
-    msg.msg_name = &sa;
-    msg.msg_namelen = sizeof(sa);
-    msg.msg_iov = iov;
-    msg.msg_iovlen = 3;
-    msg.msg_control = NULL;
-    msg.msg_controllen = 0;
-    iov[0].iov_base = &mhdr;
-    iov[0].iov_len = sizeof(mhdr);
-    iov[1].iov_base = msg_inbuf;
-    iov[1].iov_len = MSG_BUF_LEN;
-    iov[2].iov_base = NULL;
-    iov[2].iov_len = 0;
-    l = recvmsg(p->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
-    TST(l > 0,);
-    if((0 != msg.msg_flags) || (sizeof(mhdr) > l)
-       || (l != sizeof(mhdr) + mhdr.lin)
-       || (MSG_BUF_LEN < mhdr.lout)
-       || (0 > mhdr.cmd)
-      )
+    /* Bulk replies don't fit in the static buffer */
+    if(MSG_BUF_LEN < mhdr.lout)
     {
-        ERROR("CTL: Unexpected message. Ignoring");
-        return;
+        if(!(outbuf = malloc(mhdr.lout)))
+        {
+            ERROR("CTL: Out of memory for reply of %d bytes", mhdr.lout);
+            return;
+        }
     }
 
     msg_log_offset = 0;
     ctl_in_handler = 1;
-
-    if(!(mhdr.cmd & RESPONSE_FIRST_HANDLE_LATER))
-        mhdr.res = handle_message(mhdr.cmd, msg_inbuf, mhdr.lin,
-                                  msg_outbuf, mhdr.lout);
+    msg_sa = req->sa;
+    msg_salen = req->salen;
+
+    if(snapshot)
+        mhdr.res = handle_snapshot_message(mhdr.cmd, req->inbuf, mhdr.lin,
+                                           outbuf, mhdr.lout);
+    else if(!(mhdr.cmd & RESPONSE_FIRST_HANDLE_LATER))
+        mhdr.res = handle_message(mhdr.cmd, req->inbuf, mhdr.lin,
+                                  outbuf, mhdr.lout);
     else
         mhdr.res = 0;
 
     ctl_in_handler = 0;
     if(0 > mhdr.res)
-        memset(msg_outbuf, 0, mhdr.lout);
+        memset(outbuf, 0, mhdr.lout);
     if(msg_log_offset < mhdr.llog)
         mhdr.llog = msg_log_offset;
+    /* The next status read of the client must see the change */
+    if(!snapshot && !(mhdr.cmd & RESPONSE_FIRST_HANDLE_LATER)
+       && !is_snapshot_command(mhdr.cmd) && !is_read_command(mhdr.cmd))
+    {
+        snapshot_invalidate();
+        snapshot_update();
+    }
 
-    iov[1].iov_base = msg_outbuf;
+    msg.msg_name = &req->sa;
+    msg.msg_namelen = req->salen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    msg.msg_control = NULL;
+    msg.msg_controllen = 0;
+    msg.msg_flags = 0;
+    iov[0].iov_base = &mhdr;
+    iov[0].iov_len = sizeof(mhdr);
+    iov[1].iov_base = outbuf;
     iov[1].iov_len = mhdr.lout;
     iov[2].iov_base = msg_logbuf;
     iov[2].iov_len = mhdr.llog;
-    l = sendmsg(p->fd, &msg, MSG_NOSIGNAL);
+    /* Never wait for a client which doesn't read its replies */
+    l = sendmsg(ctl_handler.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
     if(0 > l)
         ERROR("CTL: Couldn't send response: %m");
     else if(l != sizeof(mhdr) + mhdr.lout + mhdr.llog)
@@ -260,12 +366,268 @@ static void ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
             ("CTL: Couldn't send full response, sent %d bytes instead of %zd.",
              l, sizeof(mhdr) + mhdr.lout + mhdr.llog);
     }
+    if(msg_outbuf != outbuf)
+        free(outbuf);
 
     if(mhdr.cmd & RESPONSE_FIRST_HANDLE_LATER)
-        handle_message(mhdr.cmd, msg_inbuf, mhdr.lin, msg_outbuf, mhdr.lout);
+    {
+        handle_message(mhdr.cmd, req->inbuf, mhdr.lin, msg_outbuf, mhdr.lout);
+        snapshot_invalidate();
+        snapshot_update();
+    }
 }
 
-static struct epoll_event_handler ctl_handler = {0};
+/* Event loop side of ctl_queue */
+static void ctl_forwarded(void *item)
+{
+    process_request(item, false);
+    free(item);
+    __atomic_sub_fetch(&ctl_in_flight, 1, __ATOMIC_RELEASE);
+}
+
+/* Receives on the management thread */
+static void ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
+{
+    static ctl_request_t rx;
+    ctl_request_t *req;
+    struct msghdr msg;
+    struct iovec iov[2];
+    int l;
+
+    msg.msg_name = &rx.sa;
+    msg.msg_namelen = sizeof(rx.sa);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = NULL;
+    msg.msg_controllen = 0;
+    iov[0].iov_base = &rx.mhdr;
+    iov[0].iov_len = sizeof(rx.mhdr);
+    iov[1].iov_base = rx.inbuf;
+    iov[1].iov_len = MSG_BUF_LEN;
+    l = recvmsg(p->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    TST(l > 0,);
+    if((0 != msg.msg_flags) || (sizeof(rx.mhdr) > l)
+       || (l != sizeof(rx.mhdr) + rx.mhdr.lin)
+       || (0 > rx.mhdr.lout) || (0 > rx.mhdr.cmd)
+      )
+    {
+        ERROR("CTL: Unexpected message. Ignoring");
+        return;
+    }
+    if((MSG_BUF_LEN < rx.mhdr.lout)
+       && ((CMD_CODE_get_port_counters != rx.mhdr.cmd)
+           || (PORT_COUNTERS_MAX_LEN < rx.mhdr.lout)))
+    {
+        ERROR("CTL: Unexpected reply size %d. Ignoring", rx.mhdr.lout);
+        return;
+    }
+    rx.salen = msg.msg_namelen;
+
+    if(is_snapshot_command(rx.mhdr.cmd)
+       && !__atomic_load_n(&ctl_in_flight, __ATOMIC_ACQUIRE))
+    {
+        process_request(&rx, true);
+        return;
+    }
+
+    l = offsetof(ctl_request_t, inbuf) + rx.mhdr.lin;
+    if(!(req = malloc(l)))
+    {
+        ERROR("CTL: Out of memory for request of %d bytes", l);
+        return;
+    }
+    memcpy(req, &rx, l);
+    __atomic_add_fetch(&ctl_in_flight, 1, __ATOMIC_RELAXED);
+    if(!epoll_queue_push(&ctl_queue, req))
+    {
+        ERROR("CTL: Request queue is full. Ignoring");
+        __atomic_sub_fetch(&ctl_in_flight, 1, __ATOMIC_RELAXED);
+        free(req);
+    }
+}
+
+
+/*********************** Event subscriptions *********************/
+
+typedef struct
+{
+    bool used;
+    struct sockaddr_un sa;
+    socklen_t salen;
+    int br_index;
+    int port_index;
+    int mstid;
+    __u32 events;
+    __u32 lost;
+    unsigned int head;
+    unsigned int count;
+    CTL_Event queue[CTL_EVENTS_QUEUE];
+} subscriber_t;
+
+static subscriber_t subscribers[CTL_MAX_SUBSCRIBERS];
+int ctl_num_subscribers;
+static bool events_pending;
+/* Workers notify concurrently with the event loop */
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static subscriber_t *find_subscriber(struct sockaddr_un *sa, socklen_t salen)
+{
+    int i;
+
+    for(i = 0; i < CTL_MAX_SUBSCRIBERS; ++i)
+        if(subscribers[i].used && (subscribers[i].salen == salen)
+           && !memcmp(&subscribers[i].sa, sa, salen))
+            return subscribers + i;
+    return NULL;
+}
+
+static void remove_subscriber(subscriber_t *sub)
+{
+    INFO("CTL: Subscriber is gone: %m");
+    sub->used = false;
+    --ctl_num_subscribers;
+}
+
+static bool send_events(subscriber_t *sub);
+
+int CTL_subscribe(int br_index, int port_index, int mstid, __u32 events)
+{
+    subscriber_t *sub;
+    int i, r = 0;
+
+    pthread_mutex_lock(&events_lock);
+    sub = find_subscriber(&msg_sa, msg_salen);
+    if(!events)
+    {
+        if(sub)
+        {
+            sub->used = false;
+            --ctl_num_subscribers;
+        }
+        goto out;
+    }
+    if(!sub)
+    {
+        for(i = 0; i < CTL_MAX_SUBSCRIBERS; ++i)
+            if(!subscribers[i].used)
+            {
+                sub = subscribers + i;
+                break;
+            }
+        if(!sub)
+        {
+            ERROR("CTL: Too many subscribers");
+            r = -1;
+            goto out;
+        }
+        memset(sub, 0, offsetof(subscriber_t, queue));
+        sub->used = true;
+        sub->sa = msg_sa;
+        sub->salen = msg_salen;
+        ++ctl_num_subscribers;
+    }
+    sub->br_index = br_index;
+    sub->port_index = port_index;
+    sub->mstid = mstid;
+    sub->events = events;
+out:
+    pthread_mutex_unlock(&events_lock);
+    return r;
+}
+
+void ctl_socket_notify(const CTL_Event *ev)
+{
+    subscriber_t *sub;
+    int i;
+
+    pthread_mutex_lock(&events_lock);
+    for(i = 0, sub = subscribers; i < CTL_MAX_SUBSCRIBERS; ++i, ++sub)
+    {
+        if(!sub->used || !(sub->events & (1 << ev->event))
+           || (sub->br_index && (sub->br_index != ev->br_index))
+           || (sub->port_index && (sub->port_index != ev->if_index))
+           || ((0 <= sub->mstid) && (sub->mstid != ev->mstid)))
+            continue;
+        if(CTL_EVENTS_QUEUE == sub->count)
+        { /* Slow reader, don't let it grow */
+            ++(sub->lost);
+            continue;
+        }
+        sub->queue[(sub->head + sub->count++) % CTL_EVENTS_QUEUE] = *ev;
+        __atomic_store_n(&events_pending, true, __ATOMIC_RELAXED);
+        /* Send full messages right away, so that a burst longer than the
+         * queue is not lost for a fast reader */
+        if((CTL_EVENTS_MAX <= sub->count) && !send_events(sub))
+            remove_subscriber(sub);
+    }
+    pthread_mutex_unlock(&events_lock);
+}
+
+/* Returns false if the subscriber is gone */
+static bool send_events(subscriber_t *sub)
+{
+    struct ctl_msg_hdr mhdr;
+    struct
+    {
+        CTL_EventsHeader hdr;
+        CTL_Event events[CTL_EVENTS_MAX];
+    } out;
+    struct msghdr msg;
+    struct iovec iov[2];
+    int n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &sub->sa;
+    msg.msg_namelen = sub->salen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    iov[0].iov_base = &mhdr;
+    iov[0].iov_len = sizeof(mhdr);
+    iov[1].iov_base = &out;
+    mhdr.cmd = CMD_CODE_events;
+    mhdr.lin = 0;
+    mhdr.llog = 0;
+    mhdr.res = 0;
+    while(sub->count || sub->lost)
+    {
+        for(n = 0; (n < CTL_EVENTS_MAX) && (n < sub->count); ++n)
+            out.events[n] = sub->queue[(sub->head + n) % CTL_EVENTS_QUEUE];
+        out.hdr.lost = sub->lost;
+        out.hdr.count = n;
+        mhdr.lout = iov[1].iov_len = sizeof(out.hdr) + n * sizeof(out.events[0]);
+        if(0 > sendmsg(ctl_handler.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT))
+            return (EAGAIN == errno) || (EINTR == errno);
+        sub->head = (sub->head + n) % CTL_EVENTS_QUEUE;
+        sub->count -= n;
+        sub->lost = 0;
+    }
+    return true;
+}
+
+void ctl_socket_flush_events(void)
+{
+    subscriber_t *sub;
+    int i;
+
+    if(!__atomic_load_n(&events_pending, __ATOMIC_RELAXED))
+        return;
+    pthread_mutex_lock(&events_lock);
+    events_pending = false;
+    for(i = 0, sub = subscribers; i < CTL_MAX_SUBSCRIBERS; ++i, ++sub)
+    {
+        if(!sub->used)
+            continue;
+        if(!send_events(sub))
+        {
+            remove_subscriber(sub);
+            continue;
+        }
+        /* Socket of the subscriber is full, retry on the next call */
+        if(sub->count || sub->lost)
+            events_pending = true;
+    }
+    pthread_mutex_unlock(&events_lock);
+}
 
 int ctl_socket_init(void)
 {
@@ -276,12 +638,13 @@ int ctl_socket_init(void)
     ctl_handler.fd = s;
     ctl_handler.handler = ctl_rcv_handler;
 
-    TST(add_epoll(&ctl_handler) == 0, -1);
+    TST(epoll_queue_init(&ctl_queue, false, ctl_forwarded, 8) == 0, -1);
+    TST(add_mgmt_epoll(&ctl_handler) == 0, -1);
     return 0;
 }
 
 void ctl_socket_cleanup(void)
 {
-    remove_epoll(&ctl_handler);
+    remove_mgmt_epoll(&ctl_handler);
     close(ctl_handler.fd);
 }
@@ -29,8 +29,10 @@
 
 int ctl_socket_init(void);
 void ctl_socket_cleanup(void);
+/* Sends the queued events to the subscribers */
+void ctl_socket_flush_events(void);
 
-extern int ctl_in_handler;
+extern __thread int ctl_in_handler;
 void _ctl_err_log(char *fmt, ...);
 
 #define ctl_err_log(_fmt...) ({ if (ctl_in_handler) _ctl_err_log(_fmt); })
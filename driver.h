@@ -12,6 +12,10 @@
 #ifndef _MSTP_DRIVER_H
 #define _MSTP_DRIVER_H
 
+/* Synchronous hooks, one call per port and tree. Implemented in
+ * driver_deps.c, they are used unless driver_mstp_init() registers
+ * batched operations with driver_ops_register().
+ */
 int driver_set_new_state(per_tree_port_t *ptp, int new_state);
 void driver_flush_all_fids(per_tree_port_t *ptp);
 unsigned int driver_set_ageing_time(port_t *prt, unsigned int ageingTime);
@@ -24,4 +28,114 @@ bool driver_create_port(port_t *prt, __u16 portno);
 void driver_delete_bridge(bridge_t *br);
 void driver_delete_port(port_t *prt);
 
+/* Batched asynchronous operations (driver_ops.c).
+ *
+ * Port states and flushes requested by the state machines are collected
+ * while an event is handled and passed to the driver in one submit() call
+ * before the bridges are unlocked. The driver finishes every operation
+ * with driver_op_done(), from any thread and at any time, also before
+ * submit() returns. Completions are handled on the event loop: a flush of
+ * a port in a tree is signalled to the state machines when all of its
+ * operations are done, and a port state the driver could not set replaces
+ * the requested one.
+ *
+ * The kernel bridge is programmed by bridge_track.c as before, the driver
+ * is for the hardware below it.
+ */
+
+/* What the driver can flush with one operation */
+typedef enum
+{
+    DRIVER_FLUSH_PORT,  /* all FIDs of the port */
+    DRIVER_FLUSH_MSTI,  /* the FIDs of one MSTI on the port */
+    DRIVER_FLUSH_FID,   /* one FID on the port */
+} driver_flush_t;
+
+typedef struct
+{
+    bool msti_states;   /* port states per MSTI, else only the CIST */
+    driver_flush_t flush;
+    unsigned int ageing_granularity; /* seconds, 0 - same as 1 */
+    unsigned int max_batch; /* operations per submit(), 0 - no limit */
+} driver_caps_t;
+
+typedef enum
+{
+    DRIVER_OP_SET_STATE,
+    DRIVER_OP_FLUSH,
+} driver_op_type_t;
+
+typedef struct driver_op
+{
+    /* Set by driver_ops.c, read-only for the driver */
+    driver_op_type_t type;
+    int br_index;
+    int if_index;
+    char ifname[IFNAMSIZ];
+    __u16 mstid;
+    __u16 fid;          /* DRIVER_FLUSH_FID only */
+    bool running;       /* the port is up and has a carrier */
+    /* DRIVER_OP_SET_STATE: BR_STATE_xxx requested, the driver replaces it
+     * with the actual state if that differs */
+    int state;
+    /* Set by the driver before driver_op_done(): 0 or -errno */
+    int result;
+    void *driver_data;  /* free for the driver */
+
+    /* Private to driver_ops.c */
+    struct list_head list;
+    struct driver_op *next_done;
+    __u64 start;
+    int requested;
+    bridge_t *br;
+    port_t *prt;
+    per_tree_port_t *ptp;
+    struct driver_flush_group *group;
+    bool cancelled;
+} driver_op_t;
+
+typedef struct
+{
+    const char *name;
+    /* Optional, called on the event loop once add_epoll() can be used */
+    int (*start)(void);
+    void (*get_caps)(driver_caps_t *caps);
+    /* Optional, false for the ports the driver does not program: their
+     * states are taken as requested and their flushes are done at once */
+    bool (*handles_port)(port_t *prt);
+    /* Start n operations, finish each one with driver_op_done() */
+    void (*submit)(driver_op_t **ops, int n);
+    /* Optional, synchronous. Return the actual ageing time */
+    unsigned int (*set_ageing_time)(port_t *prt, unsigned int ageingTime);
+    /* Optional, synchronous */
+    bool (*create_msti)(bridge_t *br, __u16 mstid);
+    bool (*delete_msti)(bridge_t *br, __u16 mstid);
+} driver_ops_t;
+
+/* Called from driver_mstp_init() */
+void driver_ops_register(const driver_ops_t *ops);
+/* Called by the driver for every submitted operation */
+void driver_op_done(driver_op_t *op);
+
+/* For bridge_track.c. Called after init_epoll() */
+int driver_ops_init(void);
+const driver_caps_t *driver_ops_caps(void);
+/* Queue the operations, return the state to assume until completion */
+int driver_ops_set_state(per_tree_port_t *ptp, int new_state);
+void driver_ops_flush(per_tree_port_t *ptp);
+unsigned int driver_ops_set_ageing_time(port_t *prt, unsigned int ageingTime);
+bool driver_ops_create_msti(bridge_t *br, __u16 mstid);
+bool driver_ops_delete_msti(bridge_t *br, __u16 mstid);
+/* Pass the queued operations of the calling thread to the driver, called
+ * before the bridges they belong to are unlocked */
+void driver_ops_submit(void);
+/* Forget the operations of the port, of the MSTI (prt NULL) or of the
+ * whole bridge (prt NULL, mstid -1) after it is deleted, before the
+ * bridge is unlocked */
+void driver_ops_cancel(bridge_t *br, port_t *prt, int mstid);
+
+/* Implemented in bridge_track.c: the driver has set the port to state
+ * instead of the requested one */
+void bridge_driver_state(per_tree_port_t *ptp, int requested, int state);
+
 #endif /* _MSTP_DRIVER_H */
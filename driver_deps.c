@@ -16,10 +16,18 @@
 
 #include "log.h"
 #include "mstp.h"
-
-/* Initialize driver objects & states */
+#include "switchdev.h"
+
+/* Initialize driver objects & states.
+ * A driver with batched operations registers them here with
+ * driver_ops_register(), the hooks below are not used then.
+ * By default that is the switchdev driver, which waits for the kernel to
+ * report the operations of offloaded ports done and does nothing for
+ * the ports of software bridges.
+ */
 int driver_mstp_init()
 {
+    switchdev_register();
     return 0;
 }
 
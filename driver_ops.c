@@ -0,0 +1,420 @@
+/*
+ * driver_ops.c   Batched asynchronous driver operations.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+#include "driver.h"
+#include "epoll_loop.h"
+#include "stats.h"
+#include "log.h"
+
+/* The operations flushing one port in one tree */
+struct driver_flush_group
+{
+    per_tree_port_t *ptp;
+    int pending;            /* operations not done yet */
+    bool superseded;        /* by a newer flush of the same ptp */
+    bool cancelled;
+};
+
+static const driver_ops_t *ops;    /* NULL - synchronous hooks */
+static driver_caps_t caps;
+
+/* All operations from queueing until their completion is handled. Locked,
+ * as the workers queue operations of their bridges. cancelled is only
+ * changed with the bridge of the operation locked, though. */
+static LIST_HEAD(live_ops);
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Completions from other threads and from later events, handled on the
+ * event loop */
+static driver_op_t *done_head, **done_tail = &done_head;
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct epoll_event_handler done_event;
+
+/* Operations queued by this thread */
+static __thread struct
+{
+    driver_op_t **ops;
+    int num, size;
+} batch;
+
+/* Set while this thread is in the submit() of the driver, completions are
+ * handled right after it returns then */
+static __thread bool submitting;
+static __thread driver_op_t *inline_head, **inline_tail;
+
+static const char *const flush_names[] =
+{
+    [DRIVER_FLUSH_PORT] = "port",
+    [DRIVER_FLUSH_MSTI] = "MSTI",
+    [DRIVER_FLUSH_FID]  = "FID",
+};
+
+void driver_ops_register(const driver_ops_t *driver_ops)
+{
+    ops = driver_ops;
+}
+
+const driver_caps_t *driver_ops_caps(void)
+{
+    return ops ? &caps : NULL;
+}
+
+/* Remove the operation from the live list and free it, returns whether it
+ * was cancelled */
+static bool release_op(driver_op_t *op)
+{
+    bool cancelled;
+
+    pthread_mutex_lock(&live_lock);
+    list_del(&op->list);
+    cancelled = op->cancelled;
+    pthread_mutex_unlock(&live_lock);
+    free(op);
+    return cancelled;
+}
+
+static void flush_group_done(struct driver_flush_group *group)
+{
+    if(--group->pending)
+        return;
+    if(!group->cancelled && !group->superseded)
+        MSTP_IN_all_fids_flushed(group->ptp);
+    free(group);
+}
+
+/* Called with the bridge of the operation locked */
+static void finish_op(driver_op_t *op)
+{
+    per_tree_port_t *ptp = op->ptp;
+    struct driver_flush_group *group = op->group;
+    driver_op_t done = *op;
+
+    if(release_op(op))
+    {
+        if(group)
+            flush_group_done(group);
+        return;
+    }
+
+    switch(done.type)
+    {
+        case DRIVER_OP_SET_STATE:
+            stats_record_since(STATS_DRIVER_SET_STATE, done.start);
+            if(done.result)
+                ERROR_MSTINAME(done.br, done.prt, ptp,
+                               "Driver couldn't set port state: %s",
+                               strerror(-done.result));
+            else if(done.state != done.requested)
+                bridge_driver_state(ptp, done.requested, done.state);
+            break;
+        case DRIVER_OP_FLUSH:
+            stats_record_since(STATS_DRIVER_FLUSH, done.start);
+            if(done.result)
+                ERROR_MSTINAME(done.br, done.prt, ptp,
+                               "Driver couldn't flush forwarding database: %s",
+                               strerror(-done.result));
+            /* Never leave the state machines waiting for the flush */
+            flush_group_done(group);
+            break;
+    }
+}
+
+void driver_op_done(driver_op_t *op)
+{
+    __u64 one = 1;
+
+    op->next_done = NULL;
+    if(submitting)
+    {
+        *inline_tail = op;
+        inline_tail = &op->next_done;
+        return;
+    }
+    pthread_mutex_lock(&done_lock);
+    *done_tail = op;
+    done_tail = &op->next_done;
+    pthread_mutex_unlock(&done_lock);
+    if(0 > write(done_event.fd, &one, sizeof(one)))
+        ERROR("eventfd write: %m");
+}
+
+/* Event loop, all workers stopped */
+static void done_handler(uint32_t events, struct epoll_event_handler *h)
+{
+    driver_op_t *op, *next;
+    __u64 count;
+
+    if(0 > read(h->fd, &count, sizeof(count)) && EAGAIN != errno)
+        ERROR("eventfd read: %m");
+    pthread_mutex_lock(&done_lock);
+    op = done_head;
+    done_head = NULL;
+    done_tail = &done_head;
+    pthread_mutex_unlock(&done_lock);
+    for(; op; op = next)
+    {
+        next = op->next_done;
+        finish_op(op);
+    }
+}
+
+int driver_ops_init(void)
+{
+    if(!ops)
+        return 0;
+    memset(&caps, 0, sizeof(caps));
+    if(ops->get_caps)
+        ops->get_caps(&caps);
+    done_event.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(0 > done_event.fd)
+    {
+        ERROR("eventfd: %m");
+        return -1;
+    }
+    done_event.arg = NULL;
+    done_event.handler = done_handler;
+    /* Completions are handled with the workers stopped */
+    done_event.prio = EPOLL_PRIO_NETLINK;
+    TST(0 == add_epoll(&done_event), -1);
+    if(ops->start && ops->start())
+    {
+        ERROR("Couldn't start driver %s", ops->name);
+        return -1;
+    }
+    INFO("Driver %s: port states %s, flush by %s, ageing granularity %u s",
+         ops->name, caps.msti_states ? "per MSTI" : "of the CIST only",
+         flush_names[caps.flush],
+         caps.ageing_granularity ? caps.ageing_granularity : 1);
+    return 0;
+}
+
+static driver_op_t *queue_op(per_tree_port_t *ptp, driver_op_type_t type)
+{
+    port_t *prt = ptp->port;
+    driver_op_t *op, **ops_new;
+    int size;
+
+    if(batch.num == batch.size)
+    {
+        size = batch.size ? 2 * batch.size : 64;
+        if(!(ops_new = realloc(batch.ops, size * sizeof(*ops_new))))
+            return NULL;
+        batch.ops = ops_new;
+        batch.size = size;
+    }
+    if(!(op = calloc(1, sizeof(*op))))
+        return NULL;
+    op->type = type;
+    op->br = prt->bridge;
+    op->prt = prt;
+    op->ptp = ptp;
+    op->br_index = prt->bridge->sysdeps.if_index;
+    op->if_index = prt->sysdeps.if_index;
+    strncpy(op->ifname, prt->sysdeps.name, IFNAMSIZ);
+    op->running = prt->sysdeps.up;
+    op->mstid = __be16_to_cpu(ptp->MSTID);
+    pthread_mutex_lock(&live_lock);
+    list_add_tail(&op->list, &live_ops);
+    pthread_mutex_unlock(&live_lock);
+    batch.ops[batch.num++] = op;
+    return op;
+}
+
+int driver_ops_set_state(per_tree_port_t *ptp, int new_state)
+{
+    driver_op_t *op;
+
+    if(!ops)
+        return driver_set_new_state(ptp, new_state);
+    if(ptp->MSTID && !caps.msti_states)
+        return new_state;
+    if(ops->handles_port && !ops->handles_port(ptp->port))
+        return new_state;
+    if(!(op = queue_op(ptp, DRIVER_OP_SET_STATE)))
+    {
+        ERROR_MSTINAME(ptp->port->bridge, ptp->port, ptp,
+                       "Out of memory for driver port state");
+        return new_state;
+    }
+    op->state = op->requested = new_state;
+    return new_state;
+}
+
+/* Mark FIDs with at least one VID which belong to the MSTI */
+static void msti_fids(bridge_t *br, __be16 MSTID, unsigned char *fids)
+{
+    int vid, fid;
+
+    memset(fids, 0, MAX_FID + 1);
+    if(!br->vid2fid)
+        fids[0] = 1;
+    else
+        for(vid = 0; vid <= MAX_VID; ++vid)
+            fids[br->vid2fid[vid]] = 1;
+    for(fid = 0; fid <= MAX_FID; ++fid)
+        if(fids[fid] && (GET_FID2MSTID(br, fid) != MSTID))
+            fids[fid] = 0;
+}
+
+void driver_ops_flush(per_tree_port_t *ptp)
+{
+    bridge_t *br = ptp->port->bridge;
+    struct driver_flush_group *group;
+    unsigned char fids[MAX_FID + 1];
+    driver_op_t *op;
+    int fid;
+
+    if(!ops)
+    {
+        driver_flush_all_fids(ptp);
+        return;
+    }
+    if(ops->handles_port && !ops->handles_port(ptp->port))
+    {
+        MSTP_IN_all_fids_flushed(ptp);
+        return;
+    }
+
+    /* Completions of an earlier flush don't complete this one */
+    pthread_mutex_lock(&live_lock);
+    list_for_each_entry(op, &live_ops, list)
+        if(op->group && (op->ptp == ptp))
+            op->group->superseded = true;
+    pthread_mutex_unlock(&live_lock);
+
+    if(!(group = calloc(1, sizeof(*group))))
+        goto oom;
+    group->ptp = ptp;
+    /* Held until all operations are queued */
+    group->pending = 1;
+    if(DRIVER_FLUSH_FID != caps.flush)
+        fids[0] = 1;
+    else
+        msti_fids(br, ptp->MSTID, fids);
+    for(fid = 0; fid <= ((DRIVER_FLUSH_FID == caps.flush) ? MAX_FID : 0);
+        ++fid)
+    {
+        if(!fids[fid])
+            continue;
+        if(!(op = queue_op(ptp, DRIVER_OP_FLUSH)))
+        {
+            /* The queued part is submitted, but not waited for */
+            group->superseded = true;
+            flush_group_done(group);
+            goto oom;
+        }
+        op->fid = fid;
+        op->group = group;
+        ++group->pending;
+    }
+    flush_group_done(group);
+    return;
+
+oom:
+    ERROR_MSTINAME(br, ptp->port, ptp, "Out of memory for driver flush");
+    MSTP_IN_all_fids_flushed(ptp);
+}
+
+unsigned int driver_ops_set_ageing_time(port_t *prt, unsigned int ageingTime)
+{
+    unsigned int granularity;
+
+    if(!ops)
+        return driver_set_ageing_time(prt, ageingTime);
+    if(1 < (granularity = caps.ageing_granularity))
+        ageingTime = (ageingTime + granularity - 1) / granularity
+                     * granularity;
+    if(ops->set_ageing_time)
+        ageingTime = ops->set_ageing_time(prt, ageingTime);
+    return ageingTime;
+}
+
+bool driver_ops_create_msti(bridge_t *br, __u16 mstid)
+{
+    if(!ops)
+        return driver_create_msti(br, mstid);
+    return ops->create_msti ? ops->create_msti(br, mstid) : true;
+}
+
+bool driver_ops_delete_msti(bridge_t *br, __u16 mstid)
+{
+    if(!ops)
+        return driver_delete_msti(br, mstid);
+    return ops->delete_msti ? ops->delete_msti(br, mstid) : true;
+}
+
+void driver_ops_submit(void)
+{
+    driver_op_t **queued, *op, *next;
+    int num, i, n, chunk;
+
+    while(batch.num)
+    {
+        queued = batch.ops;
+        num = batch.num;
+        batch.ops = NULL;
+        batch.num = batch.size = 0;
+
+        /* Drop the operations cancelled while queued */
+        for(i = n = 0; i < num; ++i)
+        {
+            if(queued[i]->cancelled)
+                finish_op(queued[i]);
+            else
+            {
+                queued[i]->start = stats_now();
+                queued[n++] = queued[i];
+            }
+        }
+
+        chunk = (caps.max_batch && (caps.max_batch < n)) ? caps.max_batch : n;
+        inline_head = NULL;
+        inline_tail = &inline_head;
+        submitting = true;
+        for(i = 0; i < n; i += chunk)
+            ops->submit(queued + i, (n - i < chunk) ? n - i : chunk);
+        submitting = false;
+        free(queued);
+
+        /* This may queue more operations */
+        for(op = inline_head; op; op = next)
+        {
+            next = op->next_done;
+            finish_op(op);
+        }
+    }
+}
+
+void driver_ops_cancel(bridge_t *br, port_t *prt, int mstid)
+{
+    driver_op_t *op;
+
+    if(!ops)
+        return;
+    pthread_mutex_lock(&live_lock);
+    list_for_each_entry(op, &live_ops, list)
+    {
+        if((op->br != br) || (prt && (op->prt != prt))
+           || (!prt && (0 <= mstid) && (op->mstid != mstid)))
+            continue;
+        op->cancelled = true;
+        if(op->group)
+            op->group->cancelled = true;
+    }
+    pthread_mutex_unlock(&live_lock);
+}
@@ -25,7 +25,12 @@
 ******************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 #if defined HAVE_SNMP
 #include <sys/queue.h>
@@ -38,11 +43,26 @@
 #include "log.h"
 #include "epoll_loop.h"
 #include "bridge_ctl.h"
+#include "mstp.h"
+#include "driver.h"
 #include "snmp.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "worker.h"
 
 /* globals */
 static int epoll_fd = -1;
+static int mgmt_epoll_fd = -1;
 static struct timeval nexttimeout;
+epoll_stats_t epoll_stats;
+
+/* Time budget per loop iteration, us */
+static const unsigned int prio_budget[EPOLL_NUM_PRIOS] =
+{
+    [EPOLL_PRIO_PACKET]  = 20000,
+    [EPOLL_PRIO_NETLINK] = 10000,
+    [EPOLL_PRIO_MGMT]    = 5000,
+};
 
 #if defined HAVE_SNMP
 struct epoll_handler_entry {
@@ -63,18 +83,25 @@ int init_epoll(void)
         return -1;
     }
     epoll_fd = r;
+    r = epoll_create(128);
+    if(r < 0)
+    {
+        ERROR("epoll_create failed: %m\n");
+        return -1;
+    }
+    mgmt_epoll_fd = r;
     return 0;
 }
 
-int add_epoll(struct epoll_event_handler *h)
+static int epoll_add(int efd, struct epoll_event_handler *h, uint32_t events)
 {
     struct epoll_event ev =
     {
-        .events = EPOLLIN,
+        .events = events,
         .data.ptr = h,
     };
     h->ref_ev = NULL;
-    int r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, h->fd, &ev);
+    int r = epoll_ctl(efd, EPOLL_CTL_ADD, h->fd, &ev);
     if(r < 0)
     {
         ERROR("epoll_ctl_add: %m\n");
@@ -83,9 +110,9 @@ int add_epoll(struct epoll_event_handler *h)
     return 0;
 }
 
-int remove_epoll(struct epoll_event_handler *h)
+static int epoll_remove(int efd, struct epoll_event_handler *h)
 {
-    int r = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, h->fd, NULL);
+    int r = epoll_ctl(efd, EPOLL_CTL_DEL, h->fd, NULL);
     if(r < 0)
     {
         ERROR("epoll_ctl_del: %m\n");
@@ -99,10 +126,122 @@ int remove_epoll(struct epoll_event_handler *h)
     return 0;
 }
 
+int add_epoll(struct epoll_event_handler *h)
+{
+    return epoll_add(epoll_fd, h, EPOLLIN);
+}
+
+int add_epoll_events(struct epoll_event_handler *h, uint32_t events)
+{
+    return epoll_add(epoll_fd, h, events);
+}
+
+int remove_epoll(struct epoll_event_handler *h)
+{
+    return epoll_remove(epoll_fd, h);
+}
+
+int add_epoll_fd(int efd, struct epoll_event_handler *h)
+{
+    return epoll_add(efd, h, EPOLLIN);
+}
+
+int add_mgmt_epoll(struct epoll_event_handler *h)
+{
+    return epoll_add(mgmt_epoll_fd, h, EPOLLIN);
+}
+
+int remove_mgmt_epoll(struct epoll_event_handler *h)
+{
+    return epoll_remove(mgmt_epoll_fd, h);
+}
+
 void clear_epoll(void)
 {
     if(epoll_fd >= 0)
         close(epoll_fd);
+    if(mgmt_epoll_fd >= 0)
+        close(mgmt_epoll_fd);
+}
+
+/*********************** Queues *********************/
+
+static void queue_handler(uint32_t events, struct epoll_event_handler *h)
+{
+    epoll_queue_t *q = h->arg;
+    unsigned int tail = q->tail;
+    __u64 count;
+    int n;
+
+    /* Reset the eventfd before taking the items, a push to the emptied
+     * queue after this wakes us up again */
+    if(0 > read(h->fd, &count, sizeof(count)) && EAGAIN != errno)
+        ERROR("eventfd read: %m");
+    for(n = 0; n < q->batch; ++n, ++tail)
+    {
+        /* Pairs with epoll_queue_push(): either we see the new head here
+         * or the producer sees our tail and wakes us up */
+        if(tail == __atomic_load_n(&q->head, __ATOMIC_SEQ_CST))
+            return;
+        void *item = q->items[tail & (EPOLL_QUEUE_SIZE - 1)];
+        __atomic_store_n(&q->tail, tail + 1, __ATOMIC_SEQ_CST);
+        q->func(item);
+    }
+    /* Batch is over and there is more, come back on the next iteration */
+    if(tail != __atomic_load_n(&q->head, __ATOMIC_SEQ_CST))
+    {
+        count = 1;
+        if(0 > write(h->fd, &count, sizeof(count)))
+            ERROR("eventfd write: %m");
+    }
+}
+
+int epoll_queue_init(epoll_queue_t *q, bool mgmt, void (*func)(void *item),
+                     int batch)
+{
+    return epoll_queue_init_fd(q, mgmt ? mgmt_epoll_fd : epoll_fd, func, batch);
+}
+
+int epoll_queue_init_fd(epoll_queue_t *q, int efd, void (*func)(void *item),
+                        int batch)
+{
+    q->head = q->tail = 0;
+    q->func = func;
+    q->batch = batch;
+    q->handler.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(0 > q->handler.fd)
+    {
+        ERROR("eventfd: %m");
+        return -1;
+    }
+    q->handler.arg = q;
+    q->handler.handler = queue_handler;
+    q->handler.prio = EPOLL_PRIO_MGMT;
+    if(0 > epoll_add(efd, &q->handler, EPOLLIN))
+    {
+        close(q->handler.fd);
+        return -1;
+    }
+    return 0;
+}
+
+bool epoll_queue_push(epoll_queue_t *q, void *item)
+{
+    unsigned int head = q->head;
+    __u64 one = 1;
+
+    if(head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)
+       >= EPOLL_QUEUE_SIZE)
+        return false;
+    q->items[head & (EPOLL_QUEUE_SIZE - 1)] = item;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_SEQ_CST);
+    /* The consumer is busy with earlier items and will get to this one,
+     * save the syscall */
+    if(head != __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST))
+        return true;
+    if(0 > write(q->handler.fd, &one, sizeof(one)))
+        ERROR("eventfd write: %m");
+    return true;
 }
 
 static inline int time_diff(struct timeval *second, struct timeval *first)
@@ -115,11 +254,6 @@ static inline void run_timeouts(void)
 {
     bridge_one_second();
     ++(nexttimeout.tv_sec);
-#if defined HAVE_SNMP
-    snmp_timeout();
-    run_alarms();
-    event_snmp_update();
-#endif
 }
 
 #if defined HAVE_SNMP
@@ -152,7 +286,7 @@ static void event_snmp_update(void)
 
         if (!FD_ISSET(snmpfd->handler.fd, &fdset))
         {
-            remove_epoll(&snmpfd->handler);
+            remove_mgmt_epoll(&snmpfd->handler);
             TAILQ_REMOVE(&snmp_fds, snmpfd, next);
             free(snmpfd);
         }
@@ -172,57 +306,96 @@ static void event_snmp_update(void)
             snmpfd->handler.fd = fd;
 	    snmpfd->handler.arg = NULL;
 	    snmpfd->handler.handler = event_snmp_read;
-	    add_epoll(&snmpfd->handler);
+	    add_mgmt_epoll(&snmpfd->handler);
 	    TAILQ_INSERT_TAIL(&snmp_fds, snmpfd, next);
 	}
     }
 }
 #endif
 
+/* Runs the one second timer if it is due,
+ * returns the time until it is due next, ms */
+static int check_timeouts(void)
+{
+    struct timeval tv;
+    int timeout;
+
+    gettimeofday(&tv, NULL);
+    timeout = time_diff(&nexttimeout, &tv);
+    if(timeout < 0 || timeout > 1000)
+    {
+        if(timeout < 0 && timeout >= -4000)
+            stats_record(STATS_TICK_LAG,
+                         ((tv.tv_sec - nexttimeout.tv_sec) * 1000000LL
+                          + tv.tv_usec - nexttimeout.tv_usec) * 1000);
+        run_timeouts();
+        /*
+         * Check if system time has changed.
+         * NOTE: we can not differentiate reliably if system
+         * time has changed or we have spent too much time
+         * inside event handlers and run_timeouts().
+         * Fix: use clock_gettime(CLOCK_MONOTONIC, ) instead of
+         * gettimeofday, if it is available.
+         * If it is not available on given system -
+         * the following is the best we can do.
+         */
+        if(timeout < -4000 || timeout > 1000)
+        {
+            /* Most probably, system time has changed */
+            nexttimeout.tv_usec = tv.tv_usec;
+            nexttimeout.tv_sec = tv.tv_sec + 1;
+        }
+        timeout = 0;
+    }
+    return timeout;
+}
+
+/* Calls the handlers of the ready events of the given priority until its
+ * budget is used up. At least one handler is called, so that every
+ * priority makes progress. */
+static void dispatch(struct epoll_event *ev, int r, epoll_prio_t prio)
+{
+    __u64 start = 0, spent = 0;
+    int i, n = 0;
+
+    for(i = 0; i < r; ++i)
+    {
+        struct epoll_event_handler *p = ev[i].data.ptr;
+        if(!p || !p->handler || (p->prio != prio))
+            continue;
+        if(!n)
+            start = stats_now();
+        else if(spent >= prio_budget[prio])
+        {
+            ++epoll_stats.deferred[prio];
+            continue;
+        }
+        p->handler(ev[i].events, p);
+        ++n;
+        spent = (stats_now() - start) / 1000;
+    }
+    if(spent > epoll_stats.max_us[prio])
+        epoll_stats.max_us[prio] = spent;
+    epoll_stats.dispatched[prio] += n;
+}
+
+#define EV_SIZE 32
+
 int epoll_main_loop(void)
 {
     gettimeofday(&nexttimeout, NULL);
     ++(nexttimeout.tv_sec);
-#define EV_SIZE 8
     struct epoll_event ev[EV_SIZE];
 
-#if defined HAVE_SNMP
-    TAILQ_INIT(&snmp_fds);
-#endif
-
     while(1)
     {
         int r, i;
         int timeout;
 
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        timeout = time_diff(&nexttimeout, &tv);
-        if(timeout < 0 || timeout > 1000)
-        {
-            run_timeouts();
-            /*
-             * Check if system time has changed.
-             * NOTE: we can not differentiate reliably if system
-             * time has changed or we have spent too much time
-             * inside event handlers and run_timeouts().
-             * Fix: use clock_gettime(CLOCK_MONOTONIC, ) instead of
-             * gettimeofday, if it is available.
-             * If it is not available on given system -
-             * the following is the best we can do.
-             */
-            if(timeout < -4000 || timeout > 1000)
-            {
-                /* Most probably, system time has changed */
-                nexttimeout.tv_usec = tv.tv_usec;
-                nexttimeout.tv_sec = tv.tv_sec + 1;
-            }
-            timeout = 0;
-        }
-#if defined HAVE_SNMP
-        netsnmp_check_outstanding_agent_requests();
-        event_snmp_update();
-#endif
+        timeout = check_timeouts();
+        driver_ops_submit();
+        snapshot_update();
+        ctl_socket_flush_events();
         r = epoll_wait(epoll_fd, ev, EV_SIZE, timeout);
         if(r < 0 && errno != EINTR)
         {
@@ -235,12 +408,17 @@ int epoll_main_loop(void)
             if(p != NULL)
                 p->ref_ev = &ev[i];
         }
-        for (i = 0; i < r; ++i)
-        {
-            struct epoll_event_handler *p = ev[i].data.ptr;
-            if(p && p->handler)
-                p->handler(ev[i].events, p);
-        }
+        /* With workers BPDUs are only routed here, everything else
+         * touches bridges of all workers */
+        dispatch(ev, r, EPOLL_PRIO_PACKET);
+        check_timeouts();
+        /* Before the link notifications, which may report them done */
+        driver_ops_submit();
+        worker_lock_all();
+        dispatch(ev, r, EPOLL_PRIO_NETLINK);
+        dispatch(ev, r, EPOLL_PRIO_MGMT);
+        driver_ops_submit();
+        worker_unlock_all();
         for (i = 0; i < r; ++i)
         {
             struct epoll_event_handler *p = ev[i].data.ptr;
@@ -251,3 +429,126 @@ int epoll_main_loop(void)
 
     return 0;
 }
+
+void epoll_run_handlers(struct epoll_event *ev, int r)
+{
+    int i;
+
+    for(i = 0; i < r; ++i)
+    {
+        struct epoll_event_handler *p = ev[i].data.ptr;
+        if(p != NULL)
+            p->ref_ev = &ev[i];
+    }
+    for(i = 0; i < r; ++i)
+    {
+        struct epoll_event_handler *p = ev[i].data.ptr;
+        if(p && p->handler)
+            p->handler(ev[i].events, p);
+    }
+    for(i = 0; i < r; ++i)
+    {
+        struct epoll_event_handler *p = ev[i].data.ptr;
+        if(p != NULL)
+            p->ref_ev = NULL;
+    }
+}
+
+/*********************** Management thread *********************/
+
+typedef struct
+{
+    void (*func)(void *arg);
+    void *arg;
+} mgmt_call_t;
+
+static epoll_queue_t mgmt_calls;
+
+static void mgmt_call_handler(void *item)
+{
+    mgmt_call_t *call = item;
+
+    call->func(call->arg);
+    free(call);
+}
+
+int mgmt_call(void (*func)(void *arg), void *arg)
+{
+    mgmt_call_t *call = malloc(sizeof(*call));
+
+    if(!call)
+    {
+        ERROR("Out of memory");
+        return -1;
+    }
+    call->func = func;
+    call->arg = arg;
+    if(!epoll_queue_push(&mgmt_calls, call))
+    {
+        ERROR("Management thread queue is full");
+        free(call);
+        return -1;
+    }
+    return 0;
+}
+
+static void *mgmt_main_loop(void *arg)
+{
+    struct epoll_event ev[EV_SIZE];
+    struct timeval next, tv;
+    int r, timeout;
+
+#if defined HAVE_SNMP
+    TAILQ_INIT(&snmp_fds);
+#endif
+    gettimeofday(&next, NULL);
+    while(1)
+    {
+        gettimeofday(&tv, NULL);
+        timeout = time_diff(&next, &tv);
+        if(timeout <= 0 || timeout > 1000)
+        {
+#if defined HAVE_SNMP
+            snmp_timeout();
+            run_alarms();
+#endif
+            next = tv;
+            ++(next.tv_sec);
+            timeout = 1000;
+        }
+#if defined HAVE_SNMP
+        netsnmp_check_outstanding_agent_requests();
+        event_snmp_update();
+#endif
+        r = epoll_wait(mgmt_epoll_fd, ev, EV_SIZE, timeout);
+        if(r < 0 && errno != EINTR)
+        {
+            ERROR("epoll_wait: %m\n");
+            return NULL;
+        }
+        epoll_run_handlers(ev, r);
+    }
+
+    return NULL;
+}
+
+int mgmt_thread_start(void)
+{
+    pthread_t thread;
+    sigset_t all, old;
+    int err;
+
+    TST(epoll_queue_init(&mgmt_calls, true, mgmt_call_handler, 16) == 0, -1);
+    /* Signals are handled by the main thread through signalfd */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    err = pthread_create(&thread, NULL, mgmt_main_loop, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(err)
+    {
+        ERROR("Couldn't start management thread: %s", strerror(err));
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -30,6 +30,22 @@
 #include <sys/epoll.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <stdbool.h>
+#include <linux/types.h>
+
+/* Ready events are dispatched by priority: BPDUs first, then the one
+ * second timer, then link events, then management (ctl socket, SNMP,
+ * metrics, signals). Every priority has a time budget per loop iteration,
+ * events left over when it is used up are deferred to the next iteration,
+ * where higher priority events go first again.
+ */
+typedef enum
+{
+    EPOLL_PRIO_MGMT,    /* default */
+    EPOLL_PRIO_NETLINK,
+    EPOLL_PRIO_PACKET,
+    EPOLL_NUM_PRIOS
+} epoll_prio_t;
 
 struct epoll_event_handler
 {
@@ -38,8 +54,54 @@ struct epoll_event_handler
     void (*handler) (uint32_t events, struct epoll_event_handler * p);
     struct epoll_event *ref_ev; /* if set, epoll loop has reference to this,
                                    so mark that ref as NULL while freeing */
+    int prio; /* epoll_prio_t */
 };
 
+typedef struct
+{
+    __u64 dispatched[EPOLL_NUM_PRIOS];  /* handler calls */
+    __u64 deferred[EPOLL_NUM_PRIOS];    /* ready events left over */
+    __u64 max_us[EPOLL_NUM_PRIOS];      /* longest time spent per iteration */
+} epoll_stats_t;
+
+extern epoll_stats_t epoll_stats;
+
+/* The management thread serves the ctl socket and the SNMP subagent from
+ * its own epoll, so that slow management work does not delay the event
+ * loop. Handlers added with add_mgmt_epoll() are called on that thread.
+ */
+int mgmt_thread_start(void);
+int add_mgmt_epoll(struct epoll_event_handler *h);
+int remove_mgmt_epoll(struct epoll_event_handler *h);
+/* Call func(arg) on the management thread */
+int mgmt_call(void (*func)(void *arg), void *arg);
+
+/* Lock-free queue of pointers from one thread to another: one producer,
+ * one consumer. The consumer is woken up through an eventfd in its epoll
+ * and gets up to batch items per wakeup. Pushes to a queue the consumer
+ * is still busy with don't touch the eventfd.
+ */
+#define EPOLL_QUEUE_SIZE    256 /* power of two */
+
+typedef struct
+{
+    void *items[EPOLL_QUEUE_SIZE];
+    unsigned int head;      /* written by the producer only */
+    unsigned int tail;      /* written by the consumer only */
+    void (*func)(void *item);
+    int batch;
+    struct epoll_event_handler handler;
+} epoll_queue_t;
+
+/* Consumer is the event loop, or the management thread if mgmt is set */
+int epoll_queue_init(epoll_queue_t *q, bool mgmt, void (*func)(void *item),
+                     int batch);
+/* Consumer is the thread waiting on the epoll efd */
+int epoll_queue_init_fd(epoll_queue_t *q, int efd, void (*func)(void *item),
+                        int batch);
+/* Returns false if the queue is full */
+bool epoll_queue_push(epoll_queue_t *q, void *item);
+
 int init_epoll(void);
 
 void clear_epoll(void);
@@ -48,6 +110,13 @@ int epoll_main_loop(void);
 
 int add_epoll(struct epoll_event_handler *h);
 
+int add_epoll_events(struct epoll_event_handler *h, uint32_t events);
+
 int remove_epoll(struct epoll_event_handler *h);
 
+/* For the event loops of other threads, which own their epoll efd */
+int add_epoll_fd(int efd, struct epoll_event_handler *h);
+/* Calls the handlers of all ready events in order */
+void epoll_run_handlers(struct epoll_event *ev, int r);
+
 #endif /* EPOLL_LOOP_H */
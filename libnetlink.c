@@ -96,6 +96,21 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions,
 	return 0;
 }
 
+/* SO_RCVBUFFORCE lets a privileged process exceed net.core.rmem_max */
+int rtnl_set_rcvbuf(struct rtnl_handle *rth, int size)
+{
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size))
+	    == 0)
+		return 0;
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size))
+	    < 0) {
+		ERROR("SO_RCVBUF: %m");
+		return -1;
+	}
+	INFO("Netlink receive buffer limited by net.core.rmem_max");
+	return 0;
+}
+
 int rtnl_open(struct rtnl_handle *rth, unsigned subscriptions)
 {
 	return rtnl_open_byproto(rth, subscriptions, NETLINK_ROUTE);
@@ -372,9 +387,12 @@ int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
 	}
 }
 
-int rtnl_listen(struct rtnl_handle *rtnl, rtnl_filter_t handler, void *jarg)
+/* Sends all requests in buf with one sendmsg(), each one with NLM_F_ACK
+ * and its own sequence number, and waits for all the acks. Returns the
+ * number of failed requests, failures with -ignore_err are not counted. */
+int rtnl_talk_batch(struct rtnl_handle *rtnl, char *buf, int len,
+		    int ignore_err)
 {
-	int status;
 	struct nlmsghdr *h;
 	struct sockaddr_nl nladdr;
 	struct iovec iov;
@@ -384,67 +402,152 @@ int rtnl_listen(struct rtnl_handle *rtnl, rtnl_filter_t handler, void *jarg)
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
-	char buf[8192];
-
-	memset(&nladdr, 0, sizeof(nladdr));
-	nladdr.nl_family = AF_NETLINK;
-	nladdr.nl_pid = 0;
-	nladdr.nl_groups = 0;
+	char rbuf[16384];
+	unsigned first = rtnl->seq + 1;
+	int count = 0, acked = 0, failed = 0, status, left;
+
+	for (h = (struct nlmsghdr *)buf, left = len; NLMSG_OK(h, left);
+	     h = NLMSG_NEXT(h, left)) {
+		h->nlmsg_seq = ++rtnl->seq;
+		h->nlmsg_flags |= NLM_F_ACK;
+		++count;
+	}
+	if (rtnl_send(rtnl, buf, len) < 0) {
+		ERROR("Cannot talk to rtnetlink: %m");
+		return count;
+	}
 
-	iov.iov_base = buf;
-	while (1) {
-		iov.iov_len = sizeof(buf);
+	iov.iov_base = rbuf;
+	while (acked < count) {
+		iov.iov_len = sizeof(rbuf);
 		status = recvmsg(rtnl->fd, &msg, 0);
-
 		if (status < 0) {
 			if (errno == EINTR)
 				continue;
-			if (errno == EAGAIN)
-				return 0;
-			ERROR("OVERRUN: recvmsg(): error %d : %s\n", errno, strerror(errno));
-			return -1;
+			ERROR("OVERRUN");
+			return failed + count - acked;
 		}
 		if (status == 0) {
 			ERROR("EOF on netlink\n");
-			return -1;
+			return failed + count - acked;
 		}
-		if (msg.msg_namelen != sizeof(nladdr)) {
-			ERROR("Sender address length == %d\n",
-				msg.msg_namelen);
-			return -1;
-		}
-		for (h = (struct nlmsghdr *)buf; status >= sizeof(*h);) {
-			int err;
-			int len = h->nlmsg_len;
-			int l = len - sizeof(*h);
+		for (h = (struct nlmsghdr *)rbuf; NLMSG_OK(h, status);
+		     h = NLMSG_NEXT(h, status)) {
+			struct nlmsgerr *err = NLMSG_DATA(h);
 
-			if (l < 0 || len > status) {
-				if (msg.msg_flags & MSG_TRUNC) {
-					ERROR("Truncated message\n");
-					return -1;
-				}
-				ERROR(
-					"!!!malformed message: len=%d\n", len);
-				return -1;
+			if (nladdr.nl_pid != 0 ||
+			    h->nlmsg_pid != rtnl->local.nl_pid ||
+			    h->nlmsg_seq - first >= count ||
+			    h->nlmsg_type != NLMSG_ERROR)
+				continue;
+			++acked;
+			if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+				ERROR("ERROR truncated\n");
+				++failed;
+			} else if (err->error && err->error != -ignore_err) {
+				errno = -err->error;
+				LOG("RTNETLINK answers: %m");
+				++failed;
 			}
+		}
+	}
+	return failed;
+}
 
-			err = handler(&nladdr, h, jarg);
-			if (err < 0) {
-				ERROR("Handler returned %d\n", err);
-				return err;
+/* Calls handler for every message of one received datagram */
+static int rtnl_listen_msg(struct msghdr *msg, int status,
+			   rtnl_filter_t handler, void *jarg)
+{
+	struct nlmsghdr *h;
+
+	if (status == 0) {
+		ERROR("EOF on netlink\n");
+		return -1;
+	}
+	if (msg->msg_namelen != sizeof(struct sockaddr_nl)) {
+		ERROR("Sender address length == %d\n",
+			msg->msg_namelen);
+		return -1;
+	}
+	for (h = (struct nlmsghdr *)msg->msg_iov->iov_base;
+	     status >= sizeof(*h);) {
+		int err;
+		int len = h->nlmsg_len;
+		int l = len - sizeof(*h);
+
+		if (l < 0 || len > status) {
+			if (msg->msg_flags & MSG_TRUNC) {
+				ERROR("Truncated message\n");
+				return -1;
 			}
+			ERROR(
+				"!!!malformed message: len=%d\n", len);
+			return -1;
+		}
 
-			status -= NLMSG_ALIGN(len);
-			h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
+		err = handler(msg->msg_name, h, jarg);
+		if (err < 0) {
+			ERROR("Handler returned %d\n", err);
+			return err;
 		}
-		if (msg.msg_flags & MSG_TRUNC) {
-			ERROR("Message truncated\n");
-			continue;
+
+		status -= NLMSG_ALIGN(len);
+		h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
+	}
+	if (msg->msg_flags & MSG_TRUNC) {
+		ERROR("Message truncated\n");
+		return 0;
+	}
+	if (status) {
+		ERROR("!!!Remnant of size %d\n", status);
+		return -1;
+	}
+	return 0;
+}
+
+/* Drains the socket, RTNL_LISTEN_BATCH datagrams per recvmmsg() */
+int rtnl_listen(struct rtnl_handle *rtnl, rtnl_filter_t handler, void *jarg)
+{
+	static char bufs[RTNL_LISTEN_BATCH][RTNL_LISTEN_BUFSIZE];
+	struct sockaddr_nl addrs[RTNL_LISTEN_BATCH];
+	struct iovec iovs[RTNL_LISTEN_BATCH];
+	struct mmsghdr msgs[RTNL_LISTEN_BATCH];
+	int i, n, err;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < RTNL_LISTEN_BATCH; ++i) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = sizeof(bufs[i]);
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (1) {
+		for (i = 0; i < RTNL_LISTEN_BATCH; ++i) {
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_flags = 0;
 		}
-		if (status) {
-			ERROR("!!!Remnant of size %d\n", status);
+		n = recvmmsg(rtnl->fd, msgs, RTNL_LISTEN_BATCH, MSG_DONTWAIT,
+			     NULL);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+			ERROR("OVERRUN: recvmmsg(): error %d : %s\n", errno, strerror(errno));
+			/* Notifications were lost, the socket is still usable */
+			if (errno == ENOBUFS)
+				return -ENOBUFS;
 			return -1;
 		}
+		for (i = 0; i < n; ++i) {
+			err = rtnl_listen_msg(&msgs[i].msg_hdr, msgs[i].msg_len,
+					      handler, jarg);
+			if (err < 0)
+				return err;
+		}
 	}
 }
 
@@ -613,10 +716,14 @@ int rta_addattr_l(struct rtattr *rta, int maxlen, int type,
 
 int parse_rtattr(struct rtattr *tb[], int max, struct rtattr *rta, int len)
 {
+	unsigned short type;
+
 	memset(tb, 0, sizeof(struct rtattr *) * (max + 1));
 	while (RTA_OK(rta, len)) {
-		if (rta->rta_type <= max)
-			tb[rta->rta_type] = rta;
+		/* Newer kernels flag nested attributes */
+		type = rta->rta_type & ~NLA_F_NESTED;
+		if (type <= max)
+			tb[type] = rta;
 		rta = RTA_NEXT(rta, len);
 	}
 	if (len)
@@ -18,6 +18,7 @@ int rtnl_open(struct rtnl_handle *rth, unsigned subscriptions);
 int rtnl_open_byproto(struct rtnl_handle *rth, unsigned subscriptions,
                       int protocol);
 void rtnl_close(struct rtnl_handle *rth);
+int rtnl_set_rcvbuf(struct rtnl_handle *rth, int size);
 int rtnl_wilddump_request(struct rtnl_handle *rth, int fam, int type);
 int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len);
 
@@ -28,6 +29,8 @@ int rtnl_dump_filter(struct rtnl_handle *rth, rtnl_filter_t filter,
 int rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, pid_t peer,
               unsigned groups, struct nlmsghdr *answer, rtnl_filter_t junk,
               void *jarg);
+int rtnl_talk_batch(struct rtnl_handle *rtnl, char *buf, int len,
+                    int ignore_err);
 int rtnl_send(struct rtnl_handle *rth, const char *buf, int);
 
 int addattr8(struct nlmsghdr *n, int maxlen, int type, __u8 data);
@@ -46,6 +49,11 @@ int parse_rtattr_byindex(struct rtattr *tb[], int max, struct rtattr *rta,
 #define parse_rtattr_nested(tb, max, rta) \
     (parse_rtattr((tb), (max), RTA_DATA(rta), RTA_PAYLOAD(rta)))
 
+#define RTNL_LISTEN_BATCH   16      /* datagrams per recvmmsg() */
+#define RTNL_LISTEN_BUFSIZE 8192
+
+/* Returns 0 when the socket is drained, -ENOBUFS if notifications were
+ * lost (call again to go on), -1 or the handler error otherwise */
 int rtnl_listen(struct rtnl_handle *, rtnl_filter_t handler, void *jarg);
 int rtnl_from_file(FILE *, rtnl_filter_t handler, void *jarg);
 
@@ -43,7 +43,11 @@ extern void Dprintf(int level, const char *fmt, ...);
 extern void vDprintf(int level, const char *fmt, va_list ap);
 extern int log_level;
 
-#define PRINT(_level, _fmt, _args...) Dprintf(_level, _fmt, ##_args)
+/* Check the level before the call, so that disabled messages cost neither
+ * the varargs call nor evaluation of the arguments.
+ * This is an expression, as TST() returns it. */
+#define PRINT(_level, _fmt, _args...)                                   \
+    (((_level) <= log_level) ? Dprintf(_level, _fmt, ##_args) : (void)0)
 
 #define TSTM(x, y, _fmt, _args...)                                         \
     do if(!(x))                                                            \
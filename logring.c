@@ -0,0 +1,359 @@
+/*
+ * logring.c   In-memory ring buffer sink for the log messages.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "logring.h"
+#include "log.h"
+
+#define LOGRING_MAX_ARGS    10
+#define LOGRING_STR_SIZE    96  /* copies of %s arguments */
+#define LOGRING_TEXT_SIZE   256 /* formatted record */
+#define LOGRING_DRAIN_MS    50
+
+typedef struct
+{
+    struct timespec ts;
+    const char *fmt;        /* NULL - record is preformatted in str */
+    int level;
+    unsigned int num_args;
+    unsigned long long args[LOGRING_MAX_ARGS]; /* %s - offset in str */
+    char str[LOGRING_STR_SIZE];
+} logring_rec_t;
+
+static struct
+{
+    logring_rec_t *recs;
+    unsigned int mask;
+    unsigned int head;      /* written by producer only */
+    unsigned int tail;      /* written by consumer only */
+    unsigned int dropped;
+    logring_output_t output;
+    pthread_t producer;     /* thread which may record */
+    pthread_t thread;
+    bool thread_running;
+    bool stop;
+} ring;
+
+typedef enum
+{
+    ARG_NONE,   /* "%%" */
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,   /* size_t, ptrdiff_t */
+    ARG_INTMAX,
+    ARG_PTR,
+    ARG_STR,
+    ARG_BAD,    /* not supported, format immediately */
+} arg_type_t;
+
+/* p points to '%'. Returns pointer past the conversion specification */
+static const char *parse_conv(const char *p, arg_type_t *type)
+{
+    int len = 0;
+
+    ++p;
+    if('%' == *p)
+    {
+        *type = ARG_NONE;
+        return p + 1;
+    }
+    while(*p && strchr("-+ #0'", *p))
+        ++p;
+    while(isdigit(*p))
+        ++p;
+    if('.' == *p)
+    {
+        ++p;
+        while(isdigit(*p))
+            ++p;
+    }
+    while(true)
+    {
+        if('h' == *p)
+            ;
+        else if('l' == *p)
+            ++len;
+        else if(('z' == *p) || ('t' == *p))
+            len = 3;
+        else if('j' == *p)
+            len = 4;
+        else
+            break;
+        ++p;
+    }
+    switch(*p)
+    {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            *type = (0 == len) ? ARG_INT : (1 == len) ? ARG_LONG
+                    : (2 == len) ? ARG_LLONG : (3 == len) ? ARG_SIZE
+                    : ARG_INTMAX;
+            break;
+        case 'p':
+            *type = ARG_PTR;
+            break;
+        case 's':
+            *type = len ? ARG_BAD : ARG_STR;
+            break;
+        case 0:
+            *type = ARG_BAD;
+            return p;
+        default: /* floating point, '*' width, %n ... */
+            *type = ARG_BAD;
+            break;
+    }
+    return p + 1;
+}
+
+static bool capture_args(logring_rec_t *rec, const char *fmt, va_list ap)
+{
+    const char *p = fmt, *s;
+    unsigned int n = 0, used = 0, len;
+    arg_type_t type;
+
+    while((p = strchr(p, '%')))
+    {
+        p = parse_conv(p, &type);
+        if(ARG_NONE == type)
+            continue;
+        if((ARG_BAD == type) || (LOGRING_MAX_ARGS == n))
+            return false;
+        switch(type)
+        {
+            case ARG_INT:
+                rec->args[n] = va_arg(ap, int);
+                break;
+            case ARG_LONG:
+                rec->args[n] = va_arg(ap, long);
+                break;
+            case ARG_LLONG:
+                rec->args[n] = va_arg(ap, long long);
+                break;
+            case ARG_SIZE:
+                rec->args[n] = va_arg(ap, size_t);
+                break;
+            case ARG_INTMAX:
+                rec->args[n] = va_arg(ap, intmax_t);
+                break;
+            case ARG_PTR:
+                rec->args[n] = (uintptr_t)va_arg(ap, void *);
+                break;
+            case ARG_STR:
+                if(!(s = va_arg(ap, const char *)))
+                    s = "(null)";
+                if(LOGRING_STR_SIZE == used)
+                    return false;
+                len = strnlen(s, LOGRING_STR_SIZE - used - 1);
+                memcpy(rec->str + used, s, len);
+                rec->str[used + len] = 0;
+                rec->args[n] = used;
+                used += len + 1;
+                break;
+            default:
+                return false;
+        }
+        ++n;
+    }
+    rec->fmt = fmt;
+    rec->num_args = n;
+    return true;
+}
+
+static void format_rec(logring_rec_t *rec, char *buf, size_t size)
+{
+    const char *p = rec->fmt, *conv;
+    char spec[32];
+    size_t l = 0;
+    unsigned int n = 0;
+    unsigned long long a;
+    arg_type_t type;
+    int r;
+
+    if(!p)
+    {
+        snprintf(buf, size, "%s", rec->str);
+        return;
+    }
+    while(*p && (l < size - 1))
+    {
+        if('%' != *p)
+        {
+            buf[l++] = *p++;
+            continue;
+        }
+        conv = p;
+        p = parse_conv(p, &type);
+        if(ARG_NONE == type)
+        {
+            buf[l++] = '%';
+            continue;
+        }
+        if((n == rec->num_args) || ((p - conv) >= sizeof(spec)))
+            break;
+        memcpy(spec, conv, p - conv);
+        spec[p - conv] = 0;
+        a = rec->args[n++];
+        switch(type)
+        {
+            case ARG_INT:
+                r = snprintf(buf + l, size - l, spec, (int)a);
+                break;
+            case ARG_LONG:
+                r = snprintf(buf + l, size - l, spec, (long)a);
+                break;
+            case ARG_LLONG:
+                r = snprintf(buf + l, size - l, spec, (long long)a);
+                break;
+            case ARG_SIZE:
+                r = snprintf(buf + l, size - l, spec, (size_t)a);
+                break;
+            case ARG_INTMAX:
+                r = snprintf(buf + l, size - l, spec, (intmax_t)a);
+                break;
+            case ARG_PTR:
+                r = snprintf(buf + l, size - l, spec, (void *)(uintptr_t)a);
+                break;
+            case ARG_STR:
+                r = snprintf(buf + l, size - l, spec, rec->str + a);
+                break;
+            default:
+                r = -1;
+                break;
+        }
+        if(0 > r)
+            break;
+        l += r;
+        if(l >= size)
+            l = size - 1;
+    }
+    buf[l] = 0;
+}
+
+bool logring_init(unsigned int size, logring_output_t output)
+{
+    unsigned int n = 1;
+
+    while(n < size)
+        n <<= 1;
+    if(!(ring.recs = calloc(n, sizeof(*ring.recs))))
+        return false;
+    ring.mask = n - 1;
+    ring.head = ring.tail = ring.dropped = 0;
+    ring.output = output;
+    ring.producer = pthread_self();
+    return true;
+}
+
+bool logring_enabled(void)
+{
+    return NULL != ring.recs;
+}
+
+bool logring_record(int level, const char *fmt, va_list ap)
+{
+    unsigned int head = ring.head;
+    logring_rec_t *rec;
+    va_list aq;
+
+    if(!pthread_equal(pthread_self(), ring.producer))
+        return false;
+    if(head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) > ring.mask)
+    {
+        __atomic_add_fetch(&ring.dropped, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    rec = ring.recs + (head & ring.mask);
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    rec->level = level;
+    va_copy(aq, ap);
+    if(!capture_args(rec, fmt, aq))
+    {
+        rec->fmt = NULL;
+        vsnprintf(rec->str, sizeof(rec->str), fmt, ap);
+    }
+    va_end(aq);
+    __atomic_store_n(&ring.head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+unsigned int logring_drain(void)
+{
+    unsigned int tail = ring.tail, n = 0, dropped;
+    unsigned int head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+    char text[LOGRING_TEXT_SIZE];
+    logring_rec_t *rec;
+    struct timespec now;
+
+    for(; tail != head; ++n)
+    {
+        rec = ring.recs + (tail & ring.mask);
+        format_rec(rec, text, sizeof(text));
+        ring.output(rec->level, &rec->ts, text);
+        __atomic_store_n(&ring.tail, ++tail, __ATOMIC_RELEASE);
+    }
+    if((dropped = __atomic_exchange_n(&ring.dropped, 0, __ATOMIC_RELAXED)))
+    {
+        clock_gettime(CLOCK_REALTIME, &now);
+        snprintf(text, sizeof(text), "logring: %u records dropped", dropped);
+        ring.output(LOG_LEVEL_ERROR, &now, text);
+    }
+    return n;
+}
+
+static void *logring_thread(void *arg)
+{
+    struct timespec interval = {0, LOGRING_DRAIN_MS * 1000000L};
+
+    while(!__atomic_load_n(&ring.stop, __ATOMIC_ACQUIRE))
+    {
+        logring_drain();
+        nanosleep(&interval, NULL);
+    }
+    logring_drain();
+    return NULL;
+}
+
+bool logring_start_thread(void)
+{
+    sigset_t all, old;
+    int err;
+
+    if(!ring.recs || ring.thread_running)
+        return false;
+    /* Signals are handled by the main thread through signalfd */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    err = pthread_create(&ring.thread, NULL, logring_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(err)
+        return false;
+    ring.thread_running = true;
+    return true;
+}
+
+void logring_stop(void)
+{
+    if(!ring.recs)
+        return;
+    if(ring.thread_running)
+    {
+        __atomic_store_n(&ring.stop, true, __ATOMIC_RELEASE);
+        pthread_join(ring.thread, NULL);
+        ring.thread_running = false;
+    }
+    else
+        logring_drain();
+}
@@ -0,0 +1,46 @@
+/*
+ * logring.h   In-memory ring buffer sink for the log messages.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_LOGRING_H
+#define _MSTP_LOGRING_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* The event loop only stores binary records: timestamp, format string
+ * (which is the event id) and raw arguments. String arguments are copied,
+ * as the objects they belong to may be gone by the time of formatting.
+ * Records are formatted later, by logring_drain(), normally called from
+ * the background thread.
+ *
+ * There is one producer (the thread which called logring_init) and one
+ * consumer (the thread calling logring_drain), no locks are taken.
+ * When the ring is full new records are dropped and counted.
+ */
+
+/* Called for every formatted record with the time it was recorded at
+ * (CLOCK_REALTIME), text has no trailing newline */
+typedef void (*logring_output_t)(int level, const struct timespec *ts,
+                                 const char *text);
+
+/* size is the number of records, rounded up to a power of two */
+bool logring_init(unsigned int size, logring_output_t output);
+bool logring_enabled(void);
+/* Returns false if called from another thread than the producer, the
+ * message is not recorded then */
+bool logring_record(int level, const char *fmt, va_list ap);
+/* Format and output all pending records, returns their number */
+unsigned int logring_drain(void);
+/* Drain the ring periodically from a separate thread */
+bool logring_start_thread(void);
+/* Stop the thread and output what is left */
+void logring_stop(void);
+
+#endif /* _MSTP_LOGRING_H */
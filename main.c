@@ -40,12 +40,18 @@
 #include "driver.h"
 #include "config.h"
 #include "snmp.h"
+#include "logring.h"
+#include "metrics.h"
+#include "worker.h"
+#include "checkpoint.h"
 
 #define APP_NAME    "mstpd"
 
 static int print_to_syslog = 0;
 int log_level = LOG_LEVEL_DEFAULT;
 
+static void log_output(int level, const struct timespec *ts, const char *text);
+
 #ifdef MISC_TEST_FUNCS
 static bool test_ports_trees_mesh(void);
 #endif /* MISC_TEST_FUNCS */
@@ -54,6 +60,11 @@ int main(int argc, char *argv[])
 {
     int c, pid;
     int daemonize = 1;
+    const char *metrics_path = NULL;
+    int num_workers = 0;
+    const char *checkpoint_path = NULL;
+    unsigned int checkpoint_interval = CHECKPOINT_INTERVAL_DEFAULT;
+    int netlink_rcvbuf = MONITOR_RCVBUF_DEFAULT;
     FILE *f;
 
     /* This should be 1 for displaying the ERRORS.*/
@@ -80,7 +91,7 @@ int main(int argc, char *argv[])
         INFO("Sanity checks succeeded");
     }
 
-    while((c = getopt(argc, argv, "disv:")) != -1)
+    while((c = getopt(argc, argv, "disv:c:k:l:m:n:w:")) != -1)
     {
         switch (c)
         {
@@ -119,6 +130,69 @@ int main(int argc, char *argv[])
                 log_level = l;
                 break;
             }
+            case 'c':
+                checkpoint_path = optarg;
+                break;
+            case 'k':
+            {
+                char *end;
+                unsigned long l;
+                l = strtoul(optarg, &end, 0);
+                if(*optarg == 0 || *end != 0 || l > 3600)
+                {
+                    ERROR("Invalid checkpoint interval %s", optarg);
+                    exit(1);
+                }
+                checkpoint_interval = l;
+                break;
+            }
+            case 'l':
+            {
+                char *end;
+                unsigned long l;
+                l = strtoul(optarg, &end, 0);
+                if(*optarg == 0 || *end != 0 || l == 0 || l > (1 << 24))
+                {
+                    ERROR("Invalid log ring size %s", optarg);
+                    exit(1);
+                }
+                if(!logring_init(l, log_output))
+                {
+                    ERROR("Can't allocate log ring of %lu records", l);
+                    exit(1);
+                }
+                break;
+            }
+            case 'm':
+                metrics_path = optarg;
+                break;
+            case 'n':
+            {
+                char *end;
+                unsigned long l;
+                l = strtoul(optarg, &end, 0);
+                if(*optarg == 0 || *end != 0 || l < MONITOR_RCVBUF_MIN
+                   || l > MONITOR_RCVBUF_MAX)
+                {
+                    ERROR("Invalid netlink receive buffer size %s", optarg);
+                    exit(1);
+                }
+                netlink_rcvbuf = l;
+                break;
+            }
+            case 'w':
+            {
+                char *end;
+                long l;
+                l = strtol(optarg, &end, 0);
+                if(*optarg == 0 || *end != 0 || l < 0 || l > WORKERS_MAX)
+                {
+                    ERROR("Invalid number of workers %s", optarg);
+                    exit(1);
+                }
+                num_workers = l;
+                break;
+            }
             default:
                 return -1;
         }
@@ -146,18 +220,41 @@ int main(int argc, char *argv[])
     if(print_to_syslog)
         openlog(APP_NAME, 0, LOG_DAEMON);
 
+    /* Start after daemon(), the thread would not survive the fork */
+    if(logring_enabled())
+    {
+        TST(logring_start_thread(), -1);
+        atexit(logring_stop);
+    }
+
     TST(driver_mstp_init() == 0, -1);
     TST(init_epoll() == 0, -1);
+    TST(driver_ops_init() == 0, -1);
+    if(num_workers)
+        TST(worker_pool_init(num_workers) == 0, -1);
     TST(ctl_socket_init() == 0, -1);
+    if(metrics_path)
+    {
+        TST(metrics_socket_init(metrics_path) == 0, -1);
+        atexit(metrics_socket_cleanup);
+    }
     TST(packet_sock_init() == 0, -1);
     TST(netsock_init() == 0, -1);
-    TST(init_bridge_ops() == 0, -1);
+    TST(init_bridge_ops(netlink_rcvbuf) == 0, -1);
+    if(checkpoint_path)
+    {
+        TST(checkpoint_init(checkpoint_path, checkpoint_interval) == 0, -1);
+        atexit(checkpoint_save);
+    }
 
+    worker_lock_all();
     config();
+    worker_unlock_all();
 #if defined HAVE_SNMP
     snmp_init();
 #endif
-    
+    TST(mgmt_thread_start() == 0, -1);
+
     c = epoll_main_loop();
     driver_mstp_fini();
 #if defined HAVE_SNMP
@@ -172,20 +269,41 @@ int main(int argc, char *argv[])
 #include <stdarg.h>
 #include <time.h>
 
+/* Output of the log ring, called from its thread */
+static void log_output(int level, const struct timespec *ts, const char *text)
+{
+    if(!print_to_syslog)
+    {
+        char timebuf[32];
+        struct tm local_tm;
+        localtime_r(&ts->tv_sec, &local_tm);
+        strftime(timebuf, sizeof(timebuf), "%F %T", &local_tm);
+        printf("%s.%03ld %s\n", timebuf, ts->tv_nsec / 1000000, text);
+        fflush(stdout);
+    }
+    else
+    {
+        syslog((level <= LOG_LEVEL_INFO) ? LOG_INFO : LOG_DEBUG, "%s", text);
+    }
+}
+
 void vDprintf(int level, const char *fmt, va_list ap)
 {
     if(level > log_level)
         return;
 
+    if(logring_enabled() && logring_record(level, fmt, ap))
+        return;
+
     if(!print_to_syslog)
     {
         char logbuf[256];
         logbuf[255] = 0;
         time_t clock;
-        struct tm *local_tm;
+        struct tm local_tm;
         time(&clock);
-        local_tm = localtime(&clock);
-        int l = strftime(logbuf, sizeof(logbuf) - 1, "%F %T ", local_tm);
+        localtime_r(&clock, &local_tm); /* logged from several threads */
+        int l = strftime(logbuf, sizeof(logbuf) - 1, "%F %T ", &local_tm);
         vsnprintf(logbuf + l, sizeof(logbuf) - l - 1, fmt, ap);
         printf("%s\n", logbuf);
     }
@@ -253,9 +371,8 @@ static bool test_ports_trees_mesh(void)
 
     for(i = 0; i < 5; ++i)
     {
-        if(!(prt[i] = calloc(1, sizeof(port_t))))
+        if(!(prt[i] = MSTP_IN_alloc_port(br)))
             return false;
-        prt[i]->bridge = br;
     }
 
     if(!MSTP_IN_create_msti(br, 0xF91))
@@ -0,0 +1,115 @@
+/*
+ * mempool.c   Fixed-size object pools for the per-bridge MSTP objects.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mempool.h"
+
+#define MEMPOOL_ALIGN   sizeof(long long)
+
+typedef struct slab_hdr
+{
+    struct slab_hdr *next;
+    size_t size;
+    /* keep objects aligned */
+    long long objs[0];
+} slab_hdr_t;
+
+void mempool_init(mempool_t *pool, size_t obj_size, unsigned int slab_objs)
+{
+    memset(pool, 0, sizeof(*pool));
+    if(obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    pool->obj_size = (obj_size + MEMPOOL_ALIGN - 1) & ~(MEMPOOL_ALIGN - 1);
+    pool->slab_objs = slab_objs ? slab_objs : 1;
+}
+
+void mempool_destroy(mempool_t *pool)
+{
+    slab_hdr_t *slab, *next;
+
+    for(slab = pool->slabs; slab; slab = next)
+    {
+        next = slab->next;
+        free(slab);
+    }
+    mempool_init(pool, pool->obj_size, pool->slab_objs);
+}
+
+/* Allocate one slab of count objects and put them all on the free list */
+static bool mempool_grow(mempool_t *pool, unsigned int count)
+{
+    slab_hdr_t *slab;
+    char *obj;
+    unsigned int i;
+    size_t size = sizeof(*slab) + count * pool->obj_size;
+
+    if(!(slab = malloc(size)))
+        return false;
+    slab->size = size;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    ++(pool->num_slabs);
+    pool->bytes += size;
+    pool->allocated += count;
+
+    /* Push in reverse order, so that objects are handed out in address
+     * order and neighbours in lists are neighbours in memory */
+    for(i = count; i-- > 0;)
+    {
+        obj = (char *)slab->objs + i * pool->obj_size;
+        *(void **)obj = pool->free_list;
+        pool->free_list = obj;
+    }
+    return true;
+}
+
+void *mempool_alloc(mempool_t *pool)
+{
+    void *obj;
+
+    if(!pool->free_list && !mempool_grow(pool, pool->slab_objs))
+        return NULL;
+    obj = pool->free_list;
+    pool->free_list = *(void **)obj;
+    ++(pool->in_use);
+    memset(obj, 0, pool->obj_size);
+    return obj;
+}
+
+void mempool_free(mempool_t *pool, void *obj)
+{
+    if(!obj)
+        return;
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    --(pool->in_use);
+}
+
+bool mempool_reserve(mempool_t *pool, unsigned int count)
+{
+    unsigned int free_objs = pool->allocated - pool->in_use;
+
+    if(count <= free_objs)
+        return true;
+    count -= free_objs;
+    if(count < pool->slab_objs)
+        count = pool->slab_objs;
+    return mempool_grow(pool, count);
+}
+
+void mempool_get_status(mempool_t *pool, mempool_status_t *status)
+{
+    status->object_size = pool->obj_size;
+    status->objects_in_use = pool->in_use;
+    status->objects_allocated = pool->allocated;
+    status->slabs = pool->num_slabs;
+    status->bytes = pool->bytes;
+}
@@ -0,0 +1,50 @@
+/*
+ * mempool.h   Fixed-size object pools for the per-bridge MSTP objects.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_MEMPOOL_H
+#define _MSTP_MEMPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Objects are carved from slabs, freed objects are kept on the free list
+ * and reused. Slabs are returned to the system only by mempool_destroy().
+ */
+typedef struct
+{
+    size_t obj_size;    /* rounded up to MEMPOOL_ALIGN */
+    unsigned int slab_objs; /* default number of objects per slab */
+    void *slabs;        /* list of slabs, linked through the slab header */
+    void *free_list;    /* list of free objects, linked through first word */
+    unsigned int in_use;
+    unsigned int allocated;
+    unsigned int num_slabs;
+    size_t bytes;       /* total size of all slabs */
+} mempool_t;
+
+/* Memory usage of one pool, as reported to the user */
+typedef struct
+{
+    unsigned int object_size;
+    unsigned int objects_in_use;
+    unsigned int objects_allocated;
+    unsigned int slabs;
+    unsigned int bytes;
+} mempool_status_t;
+
+void mempool_init(mempool_t *pool, size_t obj_size, unsigned int slab_objs);
+void mempool_destroy(mempool_t *pool);
+/* Returns zeroed object or NULL */
+void *mempool_alloc(mempool_t *pool);
+void mempool_free(mempool_t *pool, void *obj);
+/* Make sure that next count allocations are served without malloc */
+bool mempool_reserve(mempool_t *pool, unsigned int count);
+void mempool_get_status(mempool_t *pool, mempool_status_t *status);
+
+#endif /* _MSTP_MEMPOOL_H */
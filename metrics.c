@@ -0,0 +1,663 @@
+/*
+ * metrics.c   OpenMetrics text exposition on a unix stream socket.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <asm/byteorder.h>
+#include <linux/if_bridge.h>
+
+#include "metrics.h"
+#include "epoll_loop.h"
+#include "log.h"
+#include "stats.h"
+
+#define BR_ID_FMT "%01hhX.%03hX.%02hhX:%02hhX:%02hhX:%02hhX:%02hhX:%02hhX"
+#define BR_ID_ARGS(x) ((GET_PRIORITY_FROM_IDENTIFIER(x) >> 4) & 0x0F), \
+    (__be16_to_cpu((x).s.priority) & 0x0FFF), \
+    x.s.mac_address[0], x.s.mac_address[1], x.s.mac_address[2], \
+    x.s.mac_address[3], x.s.mac_address[4], x.s.mac_address[5]
+
+typedef struct
+{
+    char *buf;
+    size_t len;
+    size_t size;
+    bool nomem;
+} metrics_buf_t;
+
+/* Metric families. All samples of a family must be contiguous in the
+ * exposition, so each family is rendered into its own buffer and the
+ * buffers are joined at the end.
+ */
+typedef enum
+{
+    MF_ROOT,
+    MF_ROOT_PATH_COST,
+    MF_TC,
+    MF_TC_AGE,
+    MF_PORT,
+    MF_RX_BPDUS,
+    MF_TX_BPDUS,
+    MF_TC_BPDUS,
+    MF_RX_DROPPED,
+    MF_BPDU_GUARD,
+    MF_BA_INCONSISTENT,
+    MF_TX_HOLD,
+    MF_TRANSITIONS,
+    MF_TC_DETECTED,
+    MF_TC_RCVD,
+    MF_FLUSHES,
+    MF_NUM_FAMILIES
+} metrics_family_t;
+
+static const struct
+{
+    const char *name;
+    const char *type;
+    const char *help;
+} families[MF_NUM_FAMILIES] =
+{
+    [MF_ROOT] = {"mstp_root", "info",
+        "Designated root (CIST) or regional root (MSTI)"},
+    [MF_ROOT_PATH_COST] = {"mstp_root_path_cost", "gauge",
+        "External root path cost (CIST) or internal root path cost (MSTI)"},
+    [MF_TC] = {"mstp_topology_changes", "counter",
+        "Topology changes"},
+    [MF_TC_AGE] = {"mstp_time_since_topology_change_seconds", "gauge",
+        "Time since the last topology change"},
+    [MF_PORT] = {"mstp_port", "info",
+        "Port role and state"},
+    [MF_RX_BPDUS] = {"mstp_port_rx_bpdus", "counter",
+        "Received BPDUs by type"},
+    [MF_TX_BPDUS] = {"mstp_port_tx_bpdus", "counter",
+        "Transmitted BPDUs by type"},
+    [MF_TC_BPDUS] = {"mstp_port_tc_bpdus", "counter",
+        "Received and transmitted BPDUs with the TC flag"},
+    [MF_RX_DROPPED] = {"mstp_port_rx_dropped_bpdus", "counter",
+        "Received BPDUs dropped before the state machines"},
+    [MF_BPDU_GUARD] = {"mstp_port_bpdu_guard_events", "counter",
+        "Ports shut down by the BPDU guard"},
+    [MF_BA_INCONSISTENT] = {"mstp_port_bridge_assurance_events", "counter",
+        "Bridge assurance inconsistencies, detected and cleared"},
+    [MF_TX_HOLD] = {"mstp_port_tx_hold", "counter",
+        "Transmissions delayed by the transmit hold count"},
+    [MF_TRANSITIONS] = {"mstp_port_transitions", "counter",
+        "Port transitions to forwarding and to blocking"},
+    [MF_TC_DETECTED] = {"mstp_port_tc_detected", "counter",
+        "Topology changes detected on the port"},
+    [MF_TC_RCVD] = {"mstp_port_tc_received", "counter",
+        "Topology changes received on the port"},
+    [MF_FLUSHES] = {"mstp_port_flushes", "counter",
+        "Filtering database flushes of the port"},
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+    bool ns;
+} hist_names[STATS_NUM_HISTS] =
+{
+    [STATS_RX_BPDU] = {"mstp_bpdu_processing_seconds",
+        "BPDU reception until the state machines settle", true},
+    [STATS_SM_ITERATIONS] = {"mstp_sm_iterations",
+        "State machine iterations per event", false},
+    [STATS_ROLE_TO_STATE] = {"mstp_role_to_state_seconds",
+        "Port role change until the next port state change", true},
+    [STATS_BR_SET_STATE] = {"mstp_kernel_set_state_seconds",
+        "Kernel call setting the port state", true},
+    [STATS_BR_FLUSH_PORT] = {"mstp_kernel_flush_seconds",
+        "Kernel call flushing the port", true},
+    [STATS_BR_FDB_AGEING] = {"mstp_kernel_fdb_ageing_seconds",
+        "Rapid ageing pass over the forwarding database of a bridge", true},
+    [STATS_TICK_LAG] = {"mstp_tick_lag_seconds",
+        "Lag of the one second tick behind its schedule", true},
+    [STATS_DRIVER_SET_STATE] = {"mstp_driver_set_state_seconds",
+        "Driver setting the port state, from submission until done", true},
+    [STATS_DRIVER_FLUSH] = {"mstp_driver_flush_seconds",
+        "Driver flushing the port, from submission until done", true},
+};
+
+static const char *const role_names[] =
+{
+    [roleDisabled] = "disabled", [roleRoot] = "root",
+    [roleDesignated] = "designated", [roleAlternate] = "alternate",
+    [roleBackup] = "backup", [roleMaster] = "master"
+};
+
+static const char *const state_names[] =
+{
+    [BR_STATE_DISABLED] = "disabled", [BR_STATE_LISTENING] = "listening",
+    [BR_STATE_LEARNING] = "learning", [BR_STATE_FORWARDING] = "forwarding",
+    [BR_STATE_BLOCKING] = "blocking"
+};
+
+static metrics_buf_t sections[MF_NUM_FAMILIES];
+static metrics_buf_t output;
+
+static bool mb_reserve(metrics_buf_t *b, size_t len)
+{
+    size_t size;
+    char *p;
+
+    if(b->nomem)
+        return false;
+    if(b->len + len < b->size)
+        return true;
+    size = b->size ? b->size : 1024;
+    while(size <= b->len + len)
+        size *= 2;
+    if(!(p = realloc(b->buf, size)))
+    {
+        b->nomem = true;
+        return false;
+    }
+    b->buf = p;
+    b->size = size;
+    return true;
+}
+
+static void mb_printf(metrics_buf_t *b, const char *fmt, ...)
+{
+    va_list ap;
+    int r;
+
+    while(!b->nomem)
+    {
+        va_start(ap, fmt);
+        r = vsnprintf(b->buf + b->len, b->size - b->len, fmt, ap);
+        va_end(ap);
+        if(0 > r)
+            return;
+        if(b->len + r < b->size)
+        {
+            b->len += r;
+            return;
+        }
+        if(!mb_reserve(b, r))
+            return;
+    }
+}
+
+/* Fast paths for the samples, vsnprintf is the bulk of the rendering */
+static void mb_puts(metrics_buf_t *b, const char *str)
+{
+    size_t len = strlen(str);
+
+    if(!mb_reserve(b, len))
+        return;
+    memcpy(b->buf + b->len, str, len + 1);
+    b->len += len;
+}
+
+static void mb_u64(metrics_buf_t *b, __u64 value)
+{
+    char digits[20];
+    int i = sizeof(digits);
+
+    do
+        digits[--i] = '0' + value % 10;
+    while((value /= 10));
+    if(!mb_reserve(b, sizeof(digits) - i))
+        return;
+    memcpy(b->buf + b->len, digits + i, sizeof(digits) - i);
+    b->len += sizeof(digits) - i;
+    b->buf[b->len] = 0;
+}
+
+/* Label values are interface names: escape backslash, quote and newline */
+static void mb_label(metrics_buf_t *b, const char *name, const char *value)
+{
+    char esc[2 * IFNAMSIZ + 1];
+    int i = 0;
+
+    for(; *value && (i < sizeof(esc) - 2); ++value)
+    {
+        if(('\\' == *value) || ('"' == *value))
+            esc[i++] = '\\';
+        else if('\n' == *value)
+        {
+            esc[i++] = '\\';
+            esc[i++] = 'n';
+            continue;
+        }
+        esc[i++] = *value;
+    }
+    esc[i] = 0;
+    mb_printf(b, "%s=\"%s\"", name, esc);
+}
+
+static void sample(metrics_family_t id, const char *suffix,
+                   const char *labels, const char *extra, __u64 value)
+{
+    metrics_buf_t *b = sections + id;
+
+    mb_puts(b, families[id].name);
+    mb_puts(b, suffix);
+    mb_puts(b, "{");
+    mb_puts(b, labels);
+    mb_puts(b, extra);
+    mb_puts(b, "} ");
+    mb_u64(b, value);
+    mb_puts(b, "\n");
+}
+
+static void render_tree(const char *labels, bridge_identifier_t root,
+                        unsigned int root_path_cost,
+                        unsigned int topology_change_count,
+                        unsigned int time_since_topology_change)
+{
+    mb_printf(sections + MF_ROOT, "mstp_root_info{%s,root=\""BR_ID_FMT"\"} 1\n",
+              labels, BR_ID_ARGS(root));
+    sample(MF_ROOT_PATH_COST, "", labels, "", root_path_cost);
+    sample(MF_TC, "_total", labels, "", topology_change_count);
+    sample(MF_TC_AGE, "", labels, "", time_since_topology_change);
+}
+
+static void render_port(const char *labels, const port_counters_t *c)
+{
+    sample(MF_RX_BPDUS, "_total", labels, ",type=\"config\"", c->rx_config);
+    sample(MF_RX_BPDUS, "_total", labels, ",type=\"rst\"", c->rx_rst);
+    sample(MF_RX_BPDUS, "_total", labels, ",type=\"mst\"", c->rx_mst);
+    sample(MF_RX_BPDUS, "_total", labels, ",type=\"tcn\"", c->rx_tcn);
+    sample(MF_TX_BPDUS, "_total", labels, ",type=\"config\"", c->tx_config);
+    sample(MF_TX_BPDUS, "_total", labels, ",type=\"rst\"", c->tx_rst);
+    sample(MF_TX_BPDUS, "_total", labels, ",type=\"mst\"", c->tx_mst);
+    sample(MF_TX_BPDUS, "_total", labels, ",type=\"tcn\"", c->tx_tcn);
+    sample(MF_TC_BPDUS, "_total", labels, ",direction=\"rx\"", c->rx_tc);
+    sample(MF_TC_BPDUS, "_total", labels, ",direction=\"tx\"", c->tx_tc);
+    sample(MF_RX_DROPPED, "_total", labels, ",reason=\"size\"",
+           c->rx_bad_size);
+    sample(MF_RX_DROPPED, "_total", labels, ",reason=\"protocol\"",
+           c->rx_bad_protocol);
+    sample(MF_RX_DROPPED, "_total", labels, ",reason=\"version\"",
+           c->rx_bad_version);
+    sample(MF_RX_DROPPED, "_total", labels, ",reason=\"type\"",
+           c->rx_bad_type);
+    sample(MF_RX_DROPPED, "_total", labels, ",reason=\"pending\"",
+           c->rx_pending);
+    sample(MF_RX_DROPPED, "_total", labels, ",reason=\"disabled\"",
+           c->rx_disabled);
+    sample(MF_RX_DROPPED, "_total", labels, ",reason=\"no_memory\"",
+           c->rx_no_memory);
+    sample(MF_BPDU_GUARD, "_total", labels, "", c->bpdu_guard);
+    sample(MF_BA_INCONSISTENT, "_total", labels, ",event=\"detected\"",
+           c->ba_inconsistent);
+    sample(MF_BA_INCONSISTENT, "_total", labels, ",event=\"cleared\"",
+           c->ba_cleared);
+    sample(MF_TX_HOLD, "_total", labels, "", c->tx_hold);
+    sample(MF_TRANSITIONS, "_total", labels, ",to=\"forwarding\"",
+           c->trans_fwd);
+    sample(MF_TRANSITIONS, "_total", labels, ",to=\"blocking\"",
+           c->trans_blk);
+}
+
+static void render_bridge(bridge_t *br)
+{
+    metrics_buf_t labels = {0};
+    CIST_BridgeStatus cist;
+    MSTI_BridgeStatus msti;
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+    size_t br_len, prt_len;
+    unsigned int role, state;
+    __u16 mstid;
+
+    /* labels.buf holds 'bridge="br0"', then ',port="eth0"' and then
+     * ',mstid="1"' are appended and cut off again */
+    mb_label(&labels, "bridge", br->sysdeps.name);
+    if(labels.nomem)
+        goto out;
+    br_len = labels.len;
+    list_for_each_entry(tree, &br->trees, bridge_list)
+    {
+        mstid = __be16_to_cpu(tree->MSTID);
+        labels.len = br_len;
+        mb_printf(&labels, ",mstid=\"%hu\"", mstid);
+        if(labels.nomem)
+            goto out;
+        if(0 == mstid)
+        {
+            MSTP_IN_get_cist_bridge_status(br, &cist);
+            render_tree(labels.buf, cist.designated_root, cist.root_path_cost,
+                        cist.topology_change_count,
+                        cist.time_since_topology_change);
+        }
+        else
+        {
+            MSTP_IN_get_msti_bridge_status(tree, &msti);
+            render_tree(labels.buf, msti.regional_root,
+                        msti.internal_path_cost, msti.topology_change_count,
+                        msti.time_since_topology_change);
+        }
+    }
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        labels.len = br_len;
+        mb_printf(&labels, ",");
+        mb_label(&labels, "port", prt->sysdeps.name);
+        if(labels.nomem)
+            goto out;
+        render_port(labels.buf, &prt->counters);
+        prt_len = labels.len;
+        list_for_each_entry(ptp, &prt->trees, port_list)
+        {
+            labels.len = prt_len;
+            mb_printf(&labels, ",mstid=\"%hu\"", __be16_to_cpu(ptp->MSTID));
+            if(labels.nomem)
+                goto out;
+            role = ptp->role;
+            state = ptp->state;
+            mb_printf(sections + MF_PORT,
+                      "mstp_port_info{%s,role=\"%s\",state=\"%s\"} 1\n",
+                      labels.buf,
+                      (role < COUNT_OF(role_names)) ? role_names[role] : "",
+                      (state < COUNT_OF(state_names)) ? state_names[state] : "");
+            sample(MF_TC_DETECTED, "_total", labels.buf, "",
+                   ptp->counters.tc_detected);
+            sample(MF_TC_RCVD, "_total", labels.buf, "",
+                   ptp->counters.tc_rcvd);
+            sample(MF_FLUSHES, "_total", labels.buf, "",
+                   ptp->counters.flushes);
+        }
+    }
+out:
+    free(labels.buf);
+}
+
+static void render_value(metrics_buf_t *b, __u64 value, bool ns)
+{
+    char frac[11];
+    int i;
+
+    mb_u64(b, ns ? value / 1000000000ULL : value);
+    if(!ns)
+        return;
+    value %= 1000000000ULL;
+    frac[0] = '.';
+    for(i = 9; i > 0; --i, value /= 10)
+        frac[i] = '0' + value % 10;
+    frac[10] = 0;
+    mb_puts(b, frac);
+}
+
+/* Buckets of the exposition are the power of two boundaries of the
+ * log-linear histogram, the same set on every scrape */
+static void render_hist(stats_hist_id_t id)
+{
+    stats_hist_t hist, *h = &hist;
+    const char *name = hist_names[id].name;
+    bool ns = hist_names[id].ns;
+    unsigned int bucket;
+    __u64 cumulative = 0;
+
+    stats_get(id, h);
+    mb_printf(&output, "# TYPE %s histogram\n# HELP %s %s.\n", name, name,
+              hist_names[id].help);
+    for(bucket = 0; bucket < STATS_BUCKETS - 1; ++bucket)
+    {
+        cumulative += h->buckets[bucket];
+        if((STATS_SUB - 1) != (bucket % STATS_SUB))
+            continue;
+        mb_puts(&output, name);
+        mb_puts(&output, "_bucket{le=\"");
+        render_value(&output, stats_bucket_value(bucket), ns);
+        mb_puts(&output, "\"} ");
+        mb_u64(&output, cumulative);
+        mb_puts(&output, "\n");
+    }
+    mb_printf(&output, "%s_bucket{le=\"+Inf\"} %llu\n", name, h->count);
+    mb_printf(&output, "%s_sum ", name);
+    render_value(&output, h->sum, ns);
+    mb_printf(&output, "\n%s_count %llu\n", name, h->count);
+}
+
+static void render_loop(void)
+{
+    static const char *const prio_names[EPOLL_NUM_PRIOS] =
+    {
+        [EPOLL_PRIO_PACKET] = "packet",
+        [EPOLL_PRIO_NETLINK] = "netlink",
+        [EPOLL_PRIO_MGMT] = "mgmt",
+    };
+    int i;
+
+    mb_puts(&output, "# TYPE mstp_loop_dispatched counter\n"
+            "# HELP mstp_loop_dispatched Events dispatched by the event"
+            " loop.\n");
+    for(i = 0; i < EPOLL_NUM_PRIOS; ++i)
+        mb_printf(&output, "mstp_loop_dispatched_total{class=\"%s\"} %llu\n",
+                  prio_names[i], epoll_stats.dispatched[i]);
+    mb_puts(&output, "# TYPE mstp_loop_deferred counter\n"
+            "# HELP mstp_loop_deferred Ready events deferred to the next"
+            " loop iteration because the class used up its time budget.\n");
+    for(i = 0; i < EPOLL_NUM_PRIOS; ++i)
+        mb_printf(&output, "mstp_loop_deferred_total{class=\"%s\"} %llu\n",
+                  prio_names[i], epoll_stats.deferred[i]);
+}
+
+int metrics_render(const char **text)
+{
+    int i;
+
+    for(i = 0; i < MF_NUM_FAMILIES; ++i)
+        sections[i].len = 0;
+    output.len = 0;
+    bridge_for_each(render_bridge);
+
+    for(i = 0; i < MF_NUM_FAMILIES; ++i)
+    {
+        mb_printf(&output, "# TYPE %s %s\n# HELP %s %s.\n",
+                  families[i].name, families[i].type, families[i].name,
+                  families[i].help);
+        if(sections[i].len && mb_reserve(&output, sections[i].len))
+        {
+            memcpy(output.buf + output.len, sections[i].buf,
+                   sections[i].len + 1);
+            output.len += sections[i].len;
+        }
+    }
+    for(i = 0; i < STATS_NUM_HISTS; ++i)
+        render_hist(i);
+    mb_printf(&output, "# TYPE mstp_sm_run_timeouts counter\n"
+              "# HELP mstp_sm_run_timeouts State machines that did not"
+              " settle in one second.\n"
+              "mstp_sm_run_timeouts_total %llu\n",
+              stats_sm_run_timeouts);
+    render_loop();
+    mb_puts(&output, "# EOF\n");
+
+    for(i = 0; i < MF_NUM_FAMILIES; ++i)
+    {
+        if(sections[i].nomem)
+            output.nomem = true;
+        sections[i].nomem = false;
+    }
+    if(output.nomem)
+    {
+        output.nomem = false;
+        return -1;
+    }
+    *text = output.buf;
+    return output.len;
+}
+
+/*********************** Socket *********************/
+
+typedef struct
+{
+    struct epoll_event_handler handler;
+    char *data;     /* unsent part of the exposition */
+    size_t len;
+} metrics_client_t;
+
+static struct epoll_event_handler listen_handler = { .fd = -1 };
+static metrics_client_t clients[METRICS_MAX_CLIENTS];
+static char *socket_path;
+
+static void client_close(metrics_client_t *cl)
+{
+    remove_epoll(&cl->handler);
+    close(cl->handler.fd);
+    free(cl->data);
+    cl->handler.fd = -1;
+    cl->data = NULL;
+}
+
+static void client_handler(uint32_t events, struct epoll_event_handler *p)
+{
+    metrics_client_t *cl = p->arg;
+    ssize_t l;
+
+    l = send(p->fd, cl->data, cl->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(0 > l)
+    {
+        if((EAGAIN == errno) || (EINTR == errno))
+            return;
+        client_close(cl);
+        return;
+    }
+    cl->len -= l;
+    if(cl->len)
+        memmove(cl->data, cl->data + l, cl->len);
+    else
+        client_close(cl);
+}
+
+static void listen_handler_fn(uint32_t events, struct epoll_event_handler *p)
+{
+    metrics_client_t *cl = NULL;
+    const char *text;
+    ssize_t l;
+    int fd, len, i;
+
+    if(0 > (fd = accept4(p->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)))
+    {
+        ERROR("metrics: accept: %m");
+        return;
+    }
+    if(0 > (len = metrics_render(&text)))
+    {
+        ERROR("metrics: out of memory");
+        close(fd);
+        return;
+    }
+    l = send(fd, text, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if((0 > l) && (EAGAIN != errno) && (EINTR != errno))
+        goto out_close;
+    if(0 > l)
+        l = 0;
+    if(len == l)
+        goto out_close;
+
+    /* Slow reader: keep the rest, but never block on it */
+    for(i = 0; i < METRICS_MAX_CLIENTS; ++i)
+        if(0 > clients[i].handler.fd)
+        {
+            cl = clients + i;
+            break;
+        }
+    if(!cl)
+    {
+        ERROR("metrics: too many slow clients, dropping connection");
+        goto out_close;
+    }
+    if(!(cl->data = malloc(len - l)))
+        goto out_close;
+    memcpy(cl->data, text + l, len - l);
+    cl->len = len - l;
+    cl->handler.fd = fd;
+    cl->handler.arg = cl;
+    cl->handler.handler = client_handler;
+    if(add_epoll_events(&cl->handler, EPOLLOUT))
+    {
+        free(cl->data);
+        cl->data = NULL;
+        cl->handler.fd = -1;
+        goto out_close;
+    }
+    return;
+
+out_close:
+    close(fd);
+}
+
+int metrics_socket_init(const char *path)
+{
+    struct sockaddr_un sa;
+    int s, i;
+
+    for(i = 0; i < METRICS_MAX_CLIENTS; ++i)
+        clients[i].handler.fd = -1;
+
+    if(strlen(path) >= sizeof(sa.sun_path))
+    {
+        ERROR("metrics: socket path %s is too long", path);
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+
+    if(0 > (s = socket(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       0)))
+    {
+        ERROR("metrics: couldn't open unix socket: %m");
+        return -1;
+    }
+    unlink(path);
+    if(bind(s, (struct sockaddr *)&sa, sizeof(sa)) || listen(s, 16))
+    {
+        ERROR("metrics: couldn't bind socket %s: %m", path);
+        close(s);
+        return -1;
+    }
+    if(!(socket_path = strdup(path)))
+    {
+        close(s);
+        unlink(path);
+        return -1;
+    }
+
+    listen_handler.fd = s;
+    listen_handler.handler = listen_handler_fn;
+    if(add_epoll(&listen_handler))
+    {
+        close(s);
+        listen_handler.fd = -1;
+        unlink(path);
+        free(socket_path);
+        socket_path = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_socket_cleanup(void)
+{
+    int i;
+
+    if(0 > listen_handler.fd)
+        return;
+    for(i = 0; i < METRICS_MAX_CLIENTS; ++i)
+        if(0 <= clients[i].handler.fd)
+            client_close(clients + i);
+    remove_epoll(&listen_handler);
+    close(listen_handler.fd);
+    listen_handler.fd = -1;
+    unlink(socket_path);
+    free(socket_path);
+    socket_path = NULL;
+}
@@ -0,0 +1,31 @@
+/*
+ * metrics.h   OpenMetrics text exposition on a unix stream socket.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_METRICS_H
+#define _MSTP_METRICS_H
+
+#include "mstp.h"
+
+/* Every connection to the socket gets the exposition of the current state
+ * and is closed. The exposition is rendered in the event loop from the
+ * in-memory state, in one pass over the bridges, into buffers which are
+ * reused between scrapes.
+ */
+
+#define METRICS_MAX_CLIENTS 8   /* connections with unsent data */
+
+int metrics_socket_init(const char *path);
+void metrics_socket_cleanup(void);
+
+/* Renders the exposition, returns its length or -1 if out of memory.
+ * *text is valid until the next call.
+ */
+int metrics_render(const char **text);
+
+#endif /* _MSTP_METRICS_H */
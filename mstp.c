@@ -36,7 +36,6 @@
  */
 
 #include <string.h>
-#include <sys/time.h>
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
 #include <asm/byteorder.h>
@@ -45,6 +44,33 @@
 #include "log.h"
 #include "driver.h"
 #include "config.h"
+#include "trace.h"
+#include "stats.h"
+
+/* Number of objects in one slab of the per-bridge pools */
+#define PORT_POOL_SLAB  8
+#define TREE_POOL_SLAB  4
+#define PTP_POOL_SLAB   32
+
+/* Cross-checks, built by "make check" (-DPTP_BITMAPS_CHECK
+ * -DPRIO_KEYS_CHECK) and off otherwise. Mismatches are logged as errors
+ * and counted in mstp_check_mismatches.
+ * PTP_BITMAPS_CHECK: bitmap-based tree-wide predicates against walking the
+ * list of ports.
+ * PRIO_KEYS_CHECK: packed priority keys against field-by-field comparison
+ * of the priority vectors.
+ */
+#if defined(PTP_BITMAPS_CHECK) || defined(PRIO_KEYS_CHECK)
+unsigned long mstp_check_mismatches;
+#endif
+
+/* Enter new state of the per-tree port state machine _sm
+ * and record the transition in the trace */
+#define SM_SET_STATE(_ptp, _sm, _st) do                 \
+    {                                                   \
+        (_ptp)->_sm ## _state = (_st);                  \
+        TRACE_PTP((_ptp), TRACE_ ## _sm, (_st), 0);     \
+    } while(0)
 
 static void PTSM_tick(port_t *prt);
 static bool TCSM_run(per_tree_port_t *ptp, bool dry_run);
@@ -54,6 +80,7 @@ static void prt_state_machines_begin(port_t *prt);
 static void tree_state_machines_begin(tree_t *tree);
 static void br_state_machines_run(bridge_t *br);
 static void updtbrAssuRcvdInfoWhile(port_t *prt);
+static void updtRcvdInfoWhile(per_tree_port_t *ptp);
 
 #define FOREACH_PORT_IN_BRIDGE(port, bridge) \
     list_for_each_entry((port), &(bridge)->ports, br_list)
@@ -82,7 +109,7 @@ static void RecalcConfigDigest(bridge_t *br)
 
     vid2mstid[0] = vid2mstid[MAX_VID + 1] = 0;
     for(vid = 1; vid <= MAX_VID; ++vid)
-        vid2mstid[vid] = br->fid2mstid[br->vid2fid[vid]];
+        vid2mstid[vid] = GET_FID2MSTID(br, GET_VID2FID(br, vid));
 
     hmac_md5((void *)vid2mstid, sizeof(vid2mstid), mstp_key, sizeof(mstp_key),
              (caddr_t)br->MstConfigId.s.configuration_digest);
@@ -100,6 +127,302 @@ static __u32 compute_pcost(int speed)
     return MAX_PATH_COST;
 }
 
+/*
+ * Per-tree port flag bitmaps (see ptp_bitmap_row_t in mstp.h).
+ * All writes to the mirrored per_tree_port_t variables go through the
+ * ptp_set_xxx() helpers below, which keep the bitmaps in sync.
+ */
+#define BITS_PER_WORD   (8 * sizeof(unsigned long))
+#define PTP_BITMAP_WORDS(nbits) (((nbits) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+#define PTP_BITMAP_ROW(tree, row) \
+    ((tree)->ptp_bitmaps + (row) * (tree)->bridge->ptp_bitmap_words)
+#define PTP_BIT_INDEX(prt)  (__be16_to_cpu((prt)->port_number) - 1)
+
+static inline void ptp_bitmap_assign(per_tree_port_t *ptp,
+                                     ptp_bitmap_row_t row, bool val)
+{
+    unsigned int idx = PTP_BIT_INDEX(ptp->port);
+    unsigned long *word = PTP_BITMAP_ROW(ptp->tree, row)
+                          + idx / BITS_PER_WORD;
+    unsigned long mask = 1UL << (idx % BITS_PER_WORD);
+
+    if(val)
+        *word |= mask;
+    else
+        *word &= ~mask;
+}
+
+/* Set all bits of the row for the ports which belong to the tree */
+static void ptp_bitmap_fill_row(tree_t *tree, ptp_bitmap_row_t row)
+{
+    memcpy(PTP_BITMAP_ROW(tree, row), PTP_BITMAP_ROW(tree, PTPBIT_PRESENT),
+           tree->bridge->ptp_bitmap_words * sizeof(unsigned long));
+}
+
+static void ptp_bitmap_clear_row(tree_t *tree, ptp_bitmap_row_t row)
+{
+    memset(PTP_BITMAP_ROW(tree, row), 0,
+           tree->bridge->ptp_bitmap_words * sizeof(unsigned long));
+}
+
+static inline void ptp_update_role_bits(per_tree_port_t *ptp)
+{
+    ptp_bitmap_assign(ptp, PTPBIT_ROLE_ROOT, roleRoot == ptp->role);
+    ptp_bitmap_assign(ptp, PTPBIT_ROLE_SETTLED,
+                      (ptp->role == ptp->selectedRole) && !ptp->updtInfo);
+}
+
+static inline void ptp_set_selected(per_tree_port_t *ptp, bool val)
+{
+    ptp->selected = val;
+    ptp_bitmap_assign(ptp, PTPBIT_SELECTED, val);
+}
+
+static inline void ptp_set_reselect(per_tree_port_t *ptp, bool val)
+{
+    ptp->reselect = val;
+    ptp_bitmap_assign(ptp, PTPBIT_RESELECT, val);
+}
+
+static inline void ptp_set_synced(per_tree_port_t *ptp, bool val)
+{
+    ptp->synced = val;
+    ptp_bitmap_assign(ptp, PTPBIT_SYNCED, val);
+}
+
+static inline void ptp_set_reRoot(per_tree_port_t *ptp, bool val)
+{
+    ptp->reRoot = val;
+    ptp_bitmap_assign(ptp, PTPBIT_REROOT, val);
+}
+
+static inline void ptp_set_rrWhile(per_tree_port_t *ptp, unsigned int val)
+{
+    ptp->rrWhile = val;
+    ptp_bitmap_assign(ptp, PTPBIT_RRWHILE, 0 != val);
+}
+
+static inline void ptp_set_role(per_tree_port_t *ptp, port_role_t role)
+{
+    bool changed = (ptp->role != role);
+    bool forward = (roleRoot == role) || (roleDesignated == role)
+                   || (roleMaster == role);
+    bool takes_state = forward ? (BR_STATE_FORWARDING != ptp->state)
+                               : ((BR_STATE_LEARNING == ptp->state)
+                                  || (BR_STATE_FORWARDING == ptp->state));
+
+    /* Time to the next port state change, only if the role takes one */
+    if(changed)
+        ptp->roleChangeTime = takes_state ? stats_now() : 0;
+    ptp->role = role;
+    ptp_update_role_bits(ptp);
+    if(changed)
+        MSTP_OUT_notify(ptp->tree, ptp->port, MSTP_EVENT_PORT_ROLE, role);
+}
+
+static inline void ptp_set_selectedRole(per_tree_port_t *ptp,
+                                        port_role_t role)
+{
+    ptp->selectedRole = role;
+    ptp_update_role_bits(ptp);
+}
+
+static inline void ptp_set_updtInfo(per_tree_port_t *ptp, bool val)
+{
+    ptp->updtInfo = val;
+    ptp_update_role_bits(ptp);
+}
+
+/* Load all bits of the ptp from its variables, mark it present in the tree */
+static void ptp_bitmap_load(per_tree_port_t *ptp)
+{
+    ptp_bitmap_assign(ptp, PTPBIT_PRESENT, true);
+    ptp_bitmap_assign(ptp, PTPBIT_SELECTED, ptp->selected);
+    ptp_bitmap_assign(ptp, PTPBIT_RESELECT, ptp->reselect);
+    ptp_bitmap_assign(ptp, PTPBIT_SYNCED, ptp->synced);
+    ptp_bitmap_assign(ptp, PTPBIT_REROOT, ptp->reRoot);
+    ptp_bitmap_assign(ptp, PTPBIT_RRWHILE, 0 != ptp->rrWhile);
+    ptp_update_role_bits(ptp);
+}
+
+/* Clear all bits of the ptp before it is freed */
+static void ptp_bitmap_release(per_tree_port_t *ptp)
+{
+    ptp_bitmap_row_t row;
+
+    for(row = 0; row < PTPBIT_ROWS; ++row)
+        ptp_bitmap_assign(ptp, row, false);
+}
+
+/* Grow bitmaps of all trees so that they can hold port number portno */
+static bool ptp_bitmaps_fit(bridge_t *br, __u16 portno)
+{
+    unsigned long *bitmaps[MAX_IMPLEMENTATION_MSTIS + 1];
+    unsigned int old_words = br->ptp_bitmap_words;
+    unsigned int new_words = PTP_BITMAP_WORDS(portno);
+    ptp_bitmap_row_t row;
+    tree_t *tree;
+    int i;
+
+    if(new_words <= old_words)
+        return true;
+
+    /* Allocate everything first, so that failure leaves bitmaps intact */
+    i = 0;
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+    {
+        if(!(bitmaps[i] = calloc(PTPBIT_ROWS * new_words,
+                                 sizeof(unsigned long))))
+        {
+            ERROR_BRNAME(br, "Out of memory");
+            while(0 < i)
+                free(bitmaps[--i]);
+            return false;
+        }
+        ++i;
+    }
+
+    i = 0;
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+    {
+        for(row = 0; row < PTPBIT_ROWS; ++row)
+            memcpy(bitmaps[i] + row * new_words,
+                   tree->ptp_bitmaps + row * old_words,
+                   old_words * sizeof(unsigned long));
+        free(tree->ptp_bitmaps);
+        tree->ptp_bitmaps = bitmaps[i++];
+    }
+    br->ptp_bitmap_words = new_words;
+    return true;
+}
+
+/* Tree-wide predicates over the bitmaps */
+
+/* 13.25.1 allSynced */
+static bool ptp_bitmap_allSynced(per_tree_port_t *ptp)
+{
+    tree_t *tree = ptp->tree;
+    unsigned int i, words = tree->bridge->ptp_bitmap_words;
+    unsigned int idx = PTP_BIT_INDEX(ptp->port);
+    unsigned long *present = PTP_BITMAP_ROW(tree, PTPBIT_PRESENT);
+    unsigned long *selected = PTP_BITMAP_ROW(tree, PTPBIT_SELECTED);
+    unsigned long *settled = PTP_BITMAP_ROW(tree, PTPBIT_ROLE_SETTLED);
+    unsigned long *synced = PTP_BITMAP_ROW(tree, PTPBIT_SYNCED);
+    unsigned long *rootRole = PTP_BITMAP_ROW(tree, PTPBIT_ROLE_ROOT);
+    unsigned long unsynced;
+    bool skipRoots;
+
+    switch(ptp->role)
+    {
+        case roleRoot:
+        case roleAlternate:
+            skipRoots = true;
+            break;
+        case roleDesignated:
+        case roleMaster:
+            skipRoots = false;
+            break;
+        default:
+            return false;
+    }
+
+    for(i = 0; i < words; ++i)
+    {
+        /* a) all ports have selected, role == selectedRole, !updtInfo */
+        if(present[i] & ~(selected[i] & settled[i]))
+            return false;
+        /* b) all ports (except Root ports or except this port) synced */
+        unsynced = present[i] & ~synced[i];
+        if(skipRoots)
+            unsynced &= ~rootRole[i];
+        else if((idx / BITS_PER_WORD) == i)
+            unsynced &= ~(1UL << (idx % BITS_PER_WORD));
+        if(unsynced)
+            return false;
+    }
+    return true;
+}
+
+/* 17.20.10 of 802.1D : reRooted */
+static bool ptp_bitmap_reRooted(per_tree_port_t *ptp)
+{
+    tree_t *tree = ptp->tree;
+    unsigned int i, words = tree->bridge->ptp_bitmap_words;
+    unsigned int idx = PTP_BIT_INDEX(ptp->port);
+    unsigned long *rrWhile = PTP_BITMAP_ROW(tree, PTPBIT_RRWHILE);
+    unsigned long running;
+
+    for(i = 0; i < words; ++i)
+    {
+        running = rrWhile[i];
+        if((idx / BITS_PER_WORD) == i)
+            running &= ~(1UL << (idx % BITS_PER_WORD));
+        if(running)
+            return false;
+    }
+    return true;
+}
+
+/* true if reselect is set for any port of the tree */
+static bool ptp_bitmap_anyReselect(tree_t *tree)
+{
+    unsigned int i, words = tree->bridge->ptp_bitmap_words;
+    unsigned long *reselect = PTP_BITMAP_ROW(tree, PTPBIT_RESELECT);
+
+    for(i = 0; i < words; ++i)
+        if(reselect[i])
+            return true;
+    return false;
+}
+
+#ifdef PTP_BITMAPS_CHECK
+/* Reference implementations of the above, walking the list of ports */
+static bool allSynced_by_list(per_tree_port_t *ptp)
+{
+    per_tree_port_t *ptp_1;
+
+    FOREACH_PTP_IN_TREE(ptp_1, ptp->tree)
+    {
+        /* a) */
+        if(!ptp_1->selected
+           || (ptp_1->role != ptp_1->selectedRole)
+           || ptp_1->updtInfo
+          )
+            return false;
+
+        /* b) */
+        switch(ptp->role)
+        {
+            case roleRoot:
+            case roleAlternate:
+                if((roleRoot != ptp_1->role) && !ptp_1->synced)
+                    return false;
+                break;
+            case roleDesignated:
+            case roleMaster:
+                if((ptp != ptp_1) && !ptp_1->synced)
+                    return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool reRooted_by_list(per_tree_port_t *ptp)
+{
+    per_tree_port_t *ptp_1;
+
+    FOREACH_PTP_IN_TREE(ptp_1, ptp->tree)
+    {
+        if((ptp != ptp_1) && (0 != ptp_1->rrWhile))
+            return false;
+    }
+    return true;
+}
+#endif /* PTP_BITMAPS_CHECK */
+
 static void bridge_default_internal_vars(bridge_t *br)
 {
     br->uptime = 0;
@@ -128,12 +451,8 @@ static void port_default_internal_vars(port_t *prt)
     assign(prt->rapidAgeingWhile, 0u);
     assign(prt->brAssuRcvdInfoWhile, 0u);
     prt->BaInconsistent = false;
-    prt->num_rx_bpdu = 0;
-    prt->num_rx_tcn = 0;
-    prt->num_tx_bpdu = 0;
-    prt->num_tx_tcn = 0;
-    prt->num_trans_fwd = 0;
-    prt->num_trans_blk = 0;
+    prt->txHeld = false;
+    prt->restored = false;
 
     /* The following are initialized in BEGIN state:
      * - mdelayWhile. mcheck, sendRSTP: in Port Protocol Migration SM
@@ -148,7 +467,7 @@ static void ptp_default_internal_vars(per_tree_port_t *ptp)
 {
     ptp->rcvdTc = false;
     ptp->tcProp = false;
-    ptp->updtInfo = false;
+    ptp_set_updtInfo(ptp, false);
     ptp->master = false; /* 13.24.5 */
     ptp->disputed = false;
     assign(ptp->rcvdInfo, (port_info_t)0);
@@ -171,7 +490,7 @@ static void ptp_default_internal_vars(per_tree_port_t *ptp)
 static tree_t * create_tree(bridge_t *br, __u8 *macaddr, __be16 MSTID)
 {
     /* Initialize all fields except anchor */
-    tree_t *tree = calloc(1, sizeof(*tree));
+    tree_t *tree = mempool_alloc(&br->tree_pool);
     if(!tree)
     {
         ERROR_BRNAME(br, "Out of memory");
@@ -180,6 +499,13 @@ static tree_t * create_tree(bridge_t *br, __u8 *macaddr, __be16 MSTID)
     tree->bridge = br;
     tree->MSTID = MSTID;
     INIT_LIST_HEAD(&tree->ports);
+    if(!(tree->ptp_bitmaps = calloc(PTPBIT_ROWS * br->ptp_bitmap_words,
+                                    sizeof(unsigned long))))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        mempool_free(&br->tree_pool, tree);
+        return NULL;
+    }
 
     memcpy(tree->BridgeIdentifier.s.mac_address, macaddr, ETH_ALEN);
     /* 0x8000 = default bridge priority (17.14 of 802.1D) */
@@ -202,7 +528,7 @@ static tree_t * create_tree(bridge_t *br, __u8 *macaddr, __be16 MSTID)
 static per_tree_port_t * create_ptp(tree_t *tree, port_t *prt)
 {
     /* Initialize all fields except anchors */
-    per_tree_port_t *ptp = calloc(1, sizeof(*ptp));
+    per_tree_port_t *ptp = mempool_alloc(&tree->bridge->ptp_pool);
     if(!ptp)
     {
         ERROR_PRTNAME(prt->bridge, prt, "Out of memory");
@@ -224,6 +550,7 @@ static per_tree_port_t * create_ptp(tree_t *tree, port_t *prt)
     ptp->calledFromFlushRoutine = false;
 
     ptp_default_internal_vars(ptp);
+    ptp_bitmap_load(ptp);
 
     return ptp;
 }
@@ -240,9 +567,12 @@ bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr)
     /* Initialize all fields except sysdeps and anchor */
     INIT_LIST_HEAD(&br->ports);
     INIT_LIST_HEAD(&br->trees);
+    mempool_init(&br->port_pool, sizeof(port_t), PORT_POOL_SLAB);
+    mempool_init(&br->tree_pool, sizeof(tree_t), TREE_POOL_SLAB);
+    mempool_init(&br->ptp_pool, sizeof(per_tree_port_t), PTP_POOL_SLAB);
     br->bridgeEnabled = false;
-    memset(br->vid2fid, 0, sizeof(br->vid2fid));
-    memset(br->fid2mstid, 0, sizeof(br->fid2mstid));
+    br->vid2fid = NULL; /* all VIDs are allocated to FID 0 */
+    br->fid2mstid = NULL; /* all FIDs are allocated to CIST */
     assign(br->MstConfigId.s.selector, (__u8)0);
     sprintf((char *)br->MstConfigId.s.configuration_name,
             "%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX",
@@ -260,15 +590,57 @@ bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr)
     assign(br->Hello_Time, (__u8)2);     /* 17.14 of 802.1D */
 
     bridge_default_internal_vars(br);
+    br->ptp_bitmap_words = PTP_BITMAP_WORDS(1);
 
     /* Create CIST */
     if(!(cist = create_tree(br, macaddr, 0)))
+    {
+        mempool_destroy(&br->port_pool);
+        mempool_destroy(&br->tree_pool);
+        mempool_destroy(&br->ptp_pool);
         return false;
+    }
     list_add_tail(&cist->bridge_list, &br->trees);
 
     return true;
 }
 
+/* port_t structures are kept in the per-bridge pool, as well as
+ * tree_t and per_tree_port_t. Caller fills sysdeps and then calls
+ * MSTP_IN_port_create_and_add_tail. */
+port_t *MSTP_IN_alloc_port(bridge_t *br)
+{
+    port_t *prt = mempool_alloc(&br->port_pool);
+
+    if(!prt)
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return NULL;
+    }
+    prt->bridge = br;
+    return prt;
+}
+
+void MSTP_IN_free_port(port_t *prt)
+{
+    free(prt->rcvdBpduData);
+    mempool_free(&prt->bridge->port_pool, prt);
+}
+
+/* Preallocate memory for count new ports (and their per-tree data),
+ * so that adding many ports does not allocate memory for each of them */
+bool MSTP_IN_reserve_ports(bridge_t *br, unsigned int count)
+{
+    tree_t *tree;
+    unsigned int num_trees = 0;
+
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        ++num_trees;
+
+    return mempool_reserve(&br->port_pool, count)
+           && mempool_reserve(&br->ptp_pool, count * num_trees);
+}
+
 bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
 {
     tree_t *tree;
@@ -278,6 +650,18 @@ bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
     if (!driver_create_port(prt, portno))
         return false;
 
+    if(!ptp_bitmaps_fit(br, portno))
+        return false;
+
+    /* Room for the BPDU without MSTI messages, grows on reception */
+    if(!prt->rcvdBpduData
+       && !(prt->rcvdBpduData = malloc(MST_BPDU_SIZE_WO_MSTI_MSGS)))
+    {
+        ERROR_PRTNAME(br, prt, "Out of memory");
+        return false;
+    }
+    prt->rcvdBpduMstiCapacity = 0;
+
     /* Initialize all fields except sysdeps and bridge */
     INIT_LIST_HEAD(&prt->trees);
     prt->port_number = __cpu_to_be16(portno);
@@ -313,7 +697,8 @@ bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
             {
                 list_del(&ptp->port_list);
                 list_del(&ptp->tree_list);
-                free(ptp);
+                ptp_bitmap_release(ptp);
+                mempool_free(&br->ptp_pool, ptp);
             }
             return false;
         }
@@ -350,7 +735,8 @@ void MSTP_IN_delete_port(port_t *prt)
     {
         list_del(&ptp->port_list);
         list_del(&ptp->tree_list);
-        free(ptp);
+        ptp_bitmap_release(ptp);
+        mempool_free(&br->ptp_pool, ptp);
     }
 
     list_del(&prt->br_list);
@@ -376,14 +762,23 @@ void MSTP_IN_delete_bridge(bridge_t *br)
     list_for_each_entry_safe(prt, nxt_prt, &br->ports, br_list)
     {
         MSTP_IN_delete_port(prt);
-        free(prt);
+        MSTP_IN_free_port(prt);
     }
 
     list_for_each_entry_safe(tree, nxt_tree, &br->trees, bridge_list)
     {
         list_del(&tree->bridge_list);
-        free(tree);
+        free(tree->ptp_bitmaps);
+        mempool_free(&br->tree_pool, tree);
     }
+
+    mempool_destroy(&br->port_pool);
+    mempool_destroy(&br->tree_pool);
+    mempool_destroy(&br->ptp_pool);
+    free(br->vid2fid);
+    br->vid2fid = NULL;
+    free(br->fid2mstid);
+    br->fid2mstid = NULL;
 }
 
 void MSTP_IN_set_bridge_address(bridge_t *br, __u8 *macaddr)
@@ -445,7 +840,8 @@ void MSTP_IN_set_bridge_enable(bridge_t *br, bool up)
     br_state_machines_begin(br);
 }
 
-void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
+/* Returns true if anything changed, the state machines are not run */
+static bool set_port_enable(port_t *prt, bool up, int speed, int duplex)
 {
     __u32 computed_pcost, new_ExternalPathCost, new_InternalPathCost;
     per_tree_port_t *ptp;
@@ -499,10 +895,6 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
             prt->portEnabled = true;
             prt->BpduGuardError = false;
             prt->BaInconsistent = false;
-            prt->num_rx_bpdu = 0;
-            prt->num_rx_tcn = 0;
-            prt->num_tx_bpdu = 0;
-            prt->num_tx_tcn = 0;
             changed = true;
             /* When port is enabled, initialize bridge assurance timer,
              * so that enough time is given before port is put in
@@ -520,10 +912,265 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
         }
     }
 
-    if(changed)
+    return changed;
+}
+
+void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
+{
+    if(set_port_enable(prt, up, speed, duplex))
         br_state_machines_run(prt->bridge);
 }
 
+/* Enable count ports of the bridge with the speed and duplex of their
+ * sysdeps. The state machines run for all of them at once, instead of once
+ * per port, when a new bridge comes up. */
+void MSTP_IN_enable_ports(bridge_t *br, port_t **prts, unsigned int count)
+{
+    bool changed = false;
+    unsigned int i;
+
+    for(i = 0; i < count; ++i)
+        if(set_port_enable(prts[i], true, GET_PORT_SPEED(prts[i]),
+                           GET_PORT_DUPLEX(prts[i])))
+            changed = true;
+    if(!changed)
+        return;
+    /* All ports settle their roles first and then send one BPDU each,
+     * instead of the first ports sending again when the later ones sync */
+    br->txDeferred = true;
+    br_state_machines_run(br);
+    br->txDeferred = false;
+    br_state_machines_run(br);
+}
+
+/* Not in standard. Warm restart */
+
+void MSTP_IN_save_tree(tree_t *tree, tree_state_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->rootPriority = tree->rootPriority;
+    s->rootTimes = tree->rootTimes;
+    s->rootPortId = tree->rootPortId;
+    s->topology_change = tree->topology_change;
+    s->PRSSM_state = tree->PRSSM_state;
+    s->time_since_topology_change = tree->time_since_topology_change;
+    s->topology_change_count = tree->topology_change_count;
+    strncpy(s->topology_change_port, tree->topology_change_port, IFNAMSIZ);
+    strncpy(s->last_topology_change_port, tree->last_topology_change_port,
+            IFNAMSIZ);
+}
+
+void MSTP_IN_save_port(port_t *prt, port_state_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->mdelayWhile = prt->mdelayWhile;
+    s->helloWhen = prt->helloWhen;
+    s->edgeDelayWhile = prt->edgeDelayWhile;
+    s->rapidAgeingWhile = prt->rapidAgeingWhile;
+    s->operEdge = prt->operEdge;
+    s->infoInternal = prt->infoInternal;
+    s->rcvdInternal = prt->rcvdInternal;
+    s->mcheck = prt->mcheck;
+    s->rcvdRSTP = prt->rcvdRSTP;
+    s->rcvdSTP = prt->rcvdSTP;
+    s->sendRSTP = prt->sendRSTP;
+    s->tcAck = prt->tcAck;
+    s->BpduGuardError = prt->BpduGuardError;
+    s->BaInconsistent = prt->BaInconsistent;
+    s->PRSM_state = prt->PRSM_state;
+    s->PPMSM_state = prt->PPMSM_state;
+    s->BDSM_state = prt->BDSM_state;
+    s->PTSM_state = prt->PTSM_state;
+}
+
+void MSTP_IN_save_ptp(per_tree_port_t *ptp, ptp_state_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->designatedPriority = ptp->designatedPriority;
+    s->msgPriority = ptp->msgPriority;
+    s->portPriority = ptp->portPriority;
+    s->designatedTimes = ptp->designatedTimes;
+    s->msgTimes = ptp->msgTimes;
+    s->portTimes = ptp->portTimes;
+    s->fdWhile = ptp->fdWhile;
+    s->rrWhile = ptp->rrWhile;
+    s->rbWhile = ptp->rbWhile;
+    s->tcWhile = ptp->tcWhile;
+    s->rcvdInfoWhile = ptp->rcvdInfoWhile;
+    s->state = ptp->state;
+    s->agree = ptp->agree;
+    s->agreed = ptp->agreed;
+    s->disputed = ptp->disputed;
+    s->forward = ptp->forward;
+    s->forwarding = ptp->forwarding;
+    s->learn = ptp->learn;
+    s->learning = ptp->learning;
+    s->proposed = ptp->proposed;
+    s->proposing = ptp->proposing;
+    s->reRoot = ptp->reRoot;
+    s->reselect = ptp->reselect;
+    s->selected = ptp->selected;
+    s->fdbFlush = ptp->fdbFlush;
+    s->tcProp = ptp->tcProp;
+    s->updtInfo = ptp->updtInfo;
+    s->sync = ptp->sync;
+    s->synced = ptp->synced;
+    s->master = ptp->master;
+    s->mastered = ptp->mastered;
+    s->rcvdInfo = ptp->rcvdInfo;
+    s->infoIs = ptp->infoIs;
+    s->role = ptp->role;
+    s->selectedRole = ptp->selectedRole;
+    s->PISM_state = ptp->PISM_state;
+    s->PRTSM_state = ptp->PRTSM_state;
+    s->PSTSM_state = ptp->PSTSM_state;
+    s->TCSM_state = ptp->TCSM_state;
+}
+
+void MSTP_IN_restore_tree(tree_t *tree, const tree_state_t *s)
+{
+    tree->rootPriority = s->rootPriority;
+    tree->rootTimes = s->rootTimes;
+    tree->rootPortId = s->rootPortId;
+    tree->topology_change = s->topology_change;
+    tree->PRSSM_state = s->PRSSM_state;
+    tree->time_since_topology_change = s->time_since_topology_change;
+    tree->topology_change_count = s->topology_change_count;
+    strncpy(tree->topology_change_port, s->topology_change_port, IFNAMSIZ);
+    tree->topology_change_port[IFNAMSIZ - 1] = '\0';
+    strncpy(tree->last_topology_change_port, s->last_topology_change_port,
+            IFNAMSIZ);
+    tree->last_topology_change_port[IFNAMSIZ - 1] = '\0';
+}
+
+/* Received events (rcvdBpdu, rcvdTcn, ...) are not restored, the BPDUs
+ * which caused them are gone */
+void MSTP_IN_restore_port(port_t *prt, const port_state_t *s)
+{
+    port_default_internal_vars(prt);
+    prt->mdelayWhile = s->mdelayWhile;
+    prt->helloWhen = s->helloWhen;
+    prt->edgeDelayWhile = s->edgeDelayWhile;
+    /* The ageing time of the port is set with the CIST in
+     * MSTP_IN_restore_ptp, which restores the FwdDelay it takes */
+    prt->rapidAgeingWhile = s->rapidAgeingWhile;
+    prt->operEdge = s->operEdge;
+    prt->infoInternal = s->infoInternal;
+    prt->rcvdInternal = s->rcvdInternal;
+    prt->mcheck = s->mcheck;
+    prt->rcvdBpdu = false;
+    prt->rcvdRSTP = s->rcvdRSTP;
+    prt->rcvdSTP = s->rcvdSTP;
+    prt->sendRSTP = s->sendRSTP;
+    prt->tcAck = s->tcAck;
+    prt->BpduGuardError = s->BpduGuardError;
+    prt->BaInconsistent = s->BaInconsistent;
+    prt->PRSM_state = s->PRSM_state;
+    prt->PPMSM_state = s->PPMSM_state;
+    prt->BDSM_state = s->BDSM_state;
+    prt->PTSM_state = s->PTSM_state;
+    prt->restored = true;
+}
+
+/* ptp->state must be the state of the port in the kernel */
+void MSTP_IN_restore_ptp(per_tree_port_t *ptp, const ptp_state_t *s)
+{
+    ptp_default_internal_vars(ptp);
+    ptp->designatedPriority = s->designatedPriority;
+    ptp->msgPriority = s->msgPriority;
+    ptp->portPriority = s->portPriority;
+    ptp->designatedTimes = s->designatedTimes;
+    ptp->msgTimes = s->msgTimes;
+    ptp->portTimes = s->portTimes;
+    ptp->fdWhile = s->fdWhile;
+    ptp->rrWhile = s->rrWhile;
+    ptp->rbWhile = s->rbWhile;
+    ptp->tcWhile = s->tcWhile;
+    ptp->rcvdInfoWhile = s->rcvdInfoWhile;
+    ptp->state = s->state;
+    ptp->agree = s->agree;
+    ptp->agreed = s->agreed;
+    ptp->disputed = s->disputed;
+    ptp->forward = s->forward;
+    ptp->forwarding = s->forwarding;
+    ptp->learn = s->learn;
+    ptp->learning = s->learning;
+    ptp->proposed = s->proposed;
+    ptp->proposing = s->proposing;
+    ptp->rcvdMsg = false;
+    ptp->reRoot = s->reRoot;
+    ptp->reselect = s->reselect;
+    ptp->selected = s->selected;
+    ptp->fdbFlush = s->fdbFlush;
+    ptp->tcProp = s->tcProp;
+    ptp->updtInfo = s->updtInfo;
+    ptp->sync = s->sync;
+    ptp->synced = s->synced;
+    ptp->master = s->master;
+    ptp->mastered = s->mastered;
+    ptp->rcvdInfo = s->rcvdInfo;
+    ptp->infoIs = s->infoIs;
+    ptp->role = s->role;
+    ptp->selectedRole = s->selectedRole;
+    ptp->PISM_state = s->PISM_state;
+    ptp->PRTSM_state = s->PRTSM_state;
+    ptp->PSTSM_state = s->PSTSM_state;
+    ptp->TCSM_state = s->TCSM_state;
+    ptp->roleChangeTime = 0;
+
+    /* Go on with rapid ageing, FwdDelay is in the restored CIST times */
+    if((0 == ptp->MSTID) && ptp->port->rapidAgeingWhile)
+        MSTP_OUT_set_ageing_time(ptp->port,
+                                 ptp->designatedTimes.Forward_Delay);
+}
+
+void MSTP_IN_resume_bridge(bridge_t *br)
+{
+    port_t *prt;
+    per_tree_port_t *ptp;
+
+    if(br->bridgeEnabled)
+        return;
+    br->bridgeEnabled = true;
+    bridge_default_internal_vars(br);
+
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(!prt->restored)
+            continue;
+        /* Give the neighbours time to confirm what was received before
+         * the restart, and tell them at once that we are back */
+        if(prt->portEnabled)
+            updtbrAssuRcvdInfoWhile(prt);
+        prt->newInfo = prt->newInfoMsti = true;
+        assign(prt->txCount, 0u);
+        FOREACH_PTP_IN_PORT(ptp, prt)
+        {
+            ptp->start_time = br->uptime;
+            if(ioReceived == ptp->infoIs)
+                updtRcvdInfoWhile(ptp);
+            ptp_bitmap_load(ptp);
+        }
+    }
+    /* Like MSTP_IN_enable_ports(), one BPDU per port when all settled */
+    br->txDeferred = true;
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(prt->restored)
+        {
+            prt->restored = false;
+            continue;
+        }
+        port_default_internal_vars(prt);
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            ptp_default_internal_vars(ptp);
+        prt_state_machines_begin(prt);
+    }
+    br_state_machines_run(br);
+    br->txDeferred = false;
+    br_state_machines_run(br);
+}
+
 void MSTP_IN_one_second(bridge_t *br)
 {
     port_t *prt;
@@ -568,6 +1215,50 @@ void MSTP_IN_all_fids_flushed(per_tree_port_t *ptp)
     }
 }
 
+/* Copy validated BPDU to prt->rcvdBpduData. Only the received MSTI
+ * Configuration Messages are stored, the buffer grows if needed.
+ */
+static bool store_rcvd_bpdu(port_t *prt, bpdu_t *bpdu)
+{
+    per_tree_port_t *ptp;
+    bpdu_t *data;
+    int num = prt->rcvdBpduNumOfMstis;
+
+    if(num > prt->rcvdBpduMstiCapacity)
+    {
+        /* Old contents are overwritten below, no need for realloc */
+        data = malloc(MST_BPDU_SIZE_WO_MSTI_MSGS
+                      + num * sizeof(msti_configuration_message_t));
+        if(!data)
+        {
+            ERROR_PRTNAME(prt->bridge, prt, "Out of memory, BPDU dropped");
+            return false;
+        }
+        /* Don't leave rcvdMstiConfig pointing to the old buffer */
+        FOREACH_PTP_IN_PORT(ptp, prt)
+        {
+            if(ptp->rcvdMstiConfig)
+                ptp->rcvdMstiConfig = data->mstConfiguration
+                    + (ptp->rcvdMstiConfig
+                       - prt->rcvdBpduData->mstConfiguration);
+        }
+        free(prt->rcvdBpduData);
+        prt->rcvdBpduData = data;
+        prt->rcvdBpduMstiCapacity = num;
+    }
+
+    memcpy(prt->rcvdBpduData, bpdu, MST_BPDU_SIZE_WO_MSTI_MSGS
+                              + num * sizeof(msti_configuration_message_t));
+    return true;
+}
+
+/* Count the validation failure and drop the BPDU */
+#define BPDU_INVALID(_reason) do                        \
+    {                                                   \
+        ++(prt->counters.rx_bad_ ## _reason);           \
+        goto bpdu_validation_failed;                    \
+    } while(0)
+
 /* NOTE: bpdu pointer is unaligned, but it works because
  * bpdu_t is packed. Don't try to cast bpdu to non-packed type ;)
  */
@@ -576,11 +1267,14 @@ void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
     int mstis_size;
     bridge_t *br = prt->bridge;
 
-    ++(prt->num_rx_bpdu);
+    ++(prt->counters.rx_bpdu);
+    TRACE_PRT(prt, TRACE_RX_BPDU, bpdu->bpduType, TRACE_BPDU_ARG(bpdu, size));
 
     if(prt->BpduGuardPort)
     {
+        ++(prt->counters.bpdu_guard);
         prt->BpduGuardError = true;
+        MSTP_OUT_notify(NULL, prt, MSTP_EVENT_BPDU_GUARD, 0);
         ERROR_PRTNAME(br, prt,
                       "Received BPDU on BPDU Guarded Port - Port Down");
         MSTP_OUT_shutdown_port(prt);
@@ -589,23 +1283,23 @@ void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
 
     if(!br->bridgeEnabled)
     {
+        ++(prt->counters.rx_disabled);
         INFO_PRTNAME(br, prt, "Received BPDU while bridge is disabled");
         return;
     }
 
     if(prt->rcvdBpdu)
     {
+        ++(prt->counters.rx_pending);
         ERROR_PRTNAME(br, prt, "Port hasn't processed previous BPDU");
         return;
     }
 
     /* 14.4 Validation */
-    if((TCN_BPDU_SIZE > size) || (0 != bpdu->protocolIdentifier))
-    {
-bpdu_validation_failed:
-        INFO_PRTNAME(br, prt, "BPDU validation failed");
-        return;
-    }
+    if(TCN_BPDU_SIZE > size)
+        BPDU_INVALID(size);
+    if(0 != bpdu->protocolIdentifier)
+        BPDU_INVALID(protocol);
     switch(bpdu->bpduType)
     {
         case bpduTypeTCN:
@@ -617,7 +1311,7 @@ bpdu_validation_failed:
         case bpduTypeConfig:
             /* 14.4.a) */
             if(CONFIG_BPDU_SIZE > size)
-                goto bpdu_validation_failed;
+                BPDU_INVALID(size);
             /* Valid Config BPDU */
             bpdu->protocolVersion = protoSTP;
             LOG_PRTNAME(br, prt, "received Config BPDU%s",
@@ -628,7 +1322,7 @@ bpdu_validation_failed:
             if(protoRSTP == bpdu->protocolVersion)
             { /* 14.4.c) */
                 if(RST_BPDU_SIZE > size)
-                    goto bpdu_validation_failed;
+                    BPDU_INVALID(size);
                 /* Valid RST BPDU */
                 /* bpdu->protocolVersion = protoRSTP; */
                 LOG_PRTNAME(br, prt, "received RST BPDU%s",
@@ -637,14 +1331,14 @@ bpdu_validation_failed:
                 break;
             }
             if(protoMSTP > bpdu->protocolVersion)
-                goto bpdu_validation_failed;
+                BPDU_INVALID(version);
             /* Yes, 802.1Q-2005 says here to check if it contains
              * "35 or more octets", not 36! (see 14.4.d).1) )
              * That's why I check size against CONFIG_BPDU_SIZE
              * and not RST_BPDU_SIZE.
              */
             if(CONFIG_BPDU_SIZE > size)
-                goto bpdu_validation_failed;
+                BPDU_INVALID(size);
             mstis_size = __be16_to_cpu(bpdu->version3_len)
                          - MST_BPDU_VER3LEN_WO_MSTI_MSGS;
             if((MST_BPDU_SIZE_WO_MSTI_MSGS > size) || (0 != bpdu->version1_len)
@@ -670,31 +1364,50 @@ bpdu_validation_failed:
                        );
             break;
         default:
-            goto bpdu_validation_failed;
+            BPDU_INVALID(type);
     }
 
     if((protoSTP == bpdu->protocolVersion) && (bpduTypeTCN == bpdu->bpduType))
     {
-        ++(prt->num_rx_tcn);
+        ++(prt->counters.rx_tcn);
+        ++(prt->counters.rx_tc);
     }
     else
     {
+        if(protoSTP == bpdu->protocolVersion)
+            ++(prt->counters.rx_config);
+        else if(protoRSTP == bpdu->protocolVersion)
+            ++(prt->counters.rx_rst);
+        else
+            ++(prt->counters.rx_mst);
         if(bpdu->flags & (1 << offsetTc))
-            ++(prt->num_rx_tcn);
+            ++(prt->counters.rx_tc);
     }
 
-    assign(prt->rcvdBpduData, *bpdu);
+    if(protoMSTP != bpdu->protocolVersion)
+        prt->rcvdBpduNumOfMstis = 0;
+    if(!store_rcvd_bpdu(prt, bpdu))
+    {
+        ++(prt->counters.rx_no_memory);
+        return;
+    }
     prt->rcvdBpdu = true;
 
     /* Reset bridge assurance on receipt of valid BPDU */
     if(prt->BaInconsistent)
     {
+        ++(prt->counters.ba_cleared);
         prt->BaInconsistent = false;
         INFO_PRTNAME(br, prt, "Clear Bridge assurance inconsistency");
+        MSTP_OUT_notify(NULL, prt, MSTP_EVENT_BA_INCONSISTENT, 0);
     }
     updtbrAssuRcvdInfoWhile(prt);
 
     br_state_machines_run(br);
+    return;
+
+bpdu_validation_failed:
+    INFO_PRTNAME(br, prt, "BPDU validation failed");
 }
 
 /* 12.8.1.1 Read CIST Bridge Protocol Parameters */
@@ -911,6 +1624,7 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
             INFO_BRNAME(br, "bridge ageing_time new=%u, old=%u",
                         cfg->bridge_ageing_time, br->Ageing_Time);
             assign(br->Ageing_Time, cfg->bridge_ageing_time);
+            MSTP_OUT_set_bridge_ageing_time(br, br->Ageing_Time);
         }
     }
 
@@ -931,8 +1645,8 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
          */
             FOREACH_PTP_IN_TREE(ptp, tree)
             {
-                ptp->selected = false;
-                ptp->reselect = true;
+                ptp_set_selected(ptp, false);
+                ptp_set_reselect(ptp, true);
                 /* TODO: change this when Hello_Time will be configurable
                  *   per-port. For now, copy Bridge's Hello_Time
                  *   to the port's Hello_Time.
@@ -977,8 +1691,8 @@ int MSTP_IN_set_msti_bridge_config(tree_t *tree, __u8 bridge_priority)
      *  because 12.8.1.3.4.c) requires it */
     FOREACH_PTP_IN_TREE(ptp, tree)
     {
-        ptp->selected = false;
-        ptp->reselect = true;
+        ptp_set_selected(ptp, false);
+        ptp_set_reselect(ptp, true);
     }
     return 0;
 }
@@ -1022,12 +1736,12 @@ void MSTP_IN_get_cist_port_status(port_t *prt, CIST_PortStatus *status)
     status->bpdu_guard_error = prt->BpduGuardError;
     status->network_port = prt->NetworkPort;
     status->ba_inconsistent = prt->BaInconsistent;
-    status->num_rx_bpdu = prt->num_rx_bpdu;
-    status->num_rx_tcn = prt->num_rx_tcn;
-    status->num_tx_bpdu = prt->num_tx_bpdu;
-    status->num_tx_tcn = prt->num_tx_tcn;
-    status->num_trans_fwd = prt->num_trans_fwd;
-    status->num_trans_blk = prt->num_trans_blk;
+    status->num_rx_bpdu = prt->counters.rx_bpdu;
+    status->num_rx_tcn = prt->counters.rx_tc;
+    status->num_tx_bpdu = prt->counters.tx_bpdu;
+    status->num_tx_tcn = prt->counters.tx_tc;
+    status->num_trans_fwd = prt->counters.trans_fwd;
+    status->num_trans_blk = prt->counters.trans_blk;
     status->rcvdBpdu = prt->rcvdBpdu;
     status->rcvdRSTP = prt->rcvdRSTP;
     status->rcvdSTP = prt->rcvdSTP;
@@ -1094,8 +1808,8 @@ int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg)
             changed = true;
             /* 12.8.2.3.4 */
             cist = GET_CIST_PTP_FROM_PORT(prt);
-            cist->selected = false;
-            cist->reselect = true;
+            ptp_set_selected(cist, false);
+            ptp_set_reselect(cist, true);
         }
     }
 
@@ -1179,8 +1893,10 @@ int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg)
              */
             if(!prt->NetworkPort && prt->BaInconsistent)
             {
+                ++(prt->counters.ba_cleared);
                 prt->BaInconsistent = false;
                 INFO_PRTNAME(br, prt, "Clear Bridge assurance inconsistency");
+                MSTP_OUT_notify(NULL, prt, MSTP_EVENT_BA_INCONSISTENT, 0);
             }
             changed = true;
         }
@@ -1242,8 +1958,8 @@ int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg)
     if(changed && prt->portEnabled)
     {
         /* 12.8.2.4.4 */
-        ptp->selected = false;
-        ptp->reselect = true;
+        ptp_set_selected(ptp, false);
+        ptp_set_reselect(ptp, true);
 
         br_state_machines_run(br);
     }
@@ -1267,6 +1983,67 @@ int MSTP_IN_port_mcheck(port_t *prt)
     return 0;
 }
 
+/* Not in standard. Memory used by the bridge */
+void MSTP_IN_get_memory_status(bridge_t *br, Bridge_MemoryStatus *status)
+{
+    port_t *prt;
+    tree_t *tree;
+    unsigned int bitmap_row = br->ptp_bitmap_words * sizeof(unsigned long);
+
+    memset(status, 0, sizeof(*status));
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        ++(status->num_ports);
+        status->rcvd_bpdu_size += MST_BPDU_SIZE_WO_MSTI_MSGS
+            + prt->rcvdBpduMstiCapacity * sizeof(msti_configuration_message_t);
+    }
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        ++(status->num_trees);
+
+    status->bridge_size = sizeof(*br);
+    status->bitmaps_size = status->num_trees * PTPBIT_ROWS * bitmap_row;
+    if(br->vid2fid)
+        status->vlan_tables_size += (MAX_VID + 1) * sizeof(__u16);
+    if(br->fid2mstid)
+        status->vlan_tables_size += (MAX_FID + 1) * sizeof(__be16);
+    mempool_get_status(&br->port_pool, &status->ports);
+    mempool_get_status(&br->tree_pool, &status->trees);
+    mempool_get_status(&br->ptp_pool, &status->ptps);
+
+    status->per_port = status->ports.object_size + MST_BPDU_SIZE_WO_MSTI_MSGS
+                       + status->num_trees * status->ptps.object_size;
+    status->per_msti = status->trees.object_size + PTPBIT_ROWS * bitmap_row
+                       + status->num_ports * status->ptps.object_size;
+    status->total = status->bridge_size + status->bitmaps_size
+                    + status->vlan_tables_size + status->rcvd_bpdu_size
+                    + status->ports.bytes + status->trees.bytes
+                    + status->ptps.bytes;
+}
+
+/* VID-to-FID and FID-to-MSTID tables are allocated on the first non-zero
+ * value, until then all VIDs are allocated to FID 0 and all FIDs to CIST.
+ */
+static bool alloc_vid2fid(bridge_t *br)
+{
+    if(!br->vid2fid && !(br->vid2fid = calloc(MAX_VID + 1, sizeof(__u16))))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return false;
+    }
+    return true;
+}
+
+static bool alloc_fid2mstid(bridge_t *br)
+{
+    if(!br->fid2mstid
+       && !(br->fid2mstid = calloc(MAX_FID + 1, sizeof(__be16))))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return false;
+    }
+    return true;
+}
+
 /* 12.10.3.8 Set VID to FID allocation */
 bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid)
 {
@@ -1278,8 +2055,12 @@ bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid)
         return false;
     }
 
+    if(GET_VID2FID(br, vid) == fid)
+        return true;
+    if(!alloc_vid2fid(br))
+        return false;
     vid2mstid_changed =
-        (br->fid2mstid[fid] != br->fid2mstid[br->vid2fid[vid]]);
+        (GET_FID2MSTID(br, fid) != GET_FID2MSTID(br, br->vid2fid[vid]));
     br->vid2fid[vid] = fid;
     if(vid2mstid_changed)
     {
@@ -1293,21 +2074,34 @@ bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid)
 /* Set all VID-to-FID mappings at once */
 bool MSTP_IN_set_all_vids2fids(bridge_t *br, __u16 *vids2fids)
 {
-    bool vid2mstid_changed;
+    bool vid2mstid_changed, all_zero;
     int vid;
 
     vid2mstid_changed = false;
+    all_zero = true;
     for(vid = 1; vid <= MAX_VID; ++vid)
     {
         if(vids2fids[vid] > MAX_FID)
         { /* Incorrect value == keep prev value */
-            vids2fids[vid] = br->vid2fid[vid];
-            continue;
+            vids2fids[vid] = GET_VID2FID(br, vid);
         }
-        if(br->fid2mstid[vids2fids[vid]] != br->fid2mstid[br->vid2fid[vid]])
+        else if(GET_FID2MSTID(br, vids2fids[vid])
+                != GET_FID2MSTID(br, GET_VID2FID(br, vid)))
             vid2mstid_changed = true;
+        if(vids2fids[vid])
+            all_zero = false;
+    }
+    if(all_zero)
+    {
+        free(br->vid2fid);
+        br->vid2fid = NULL;
+    }
+    else
+    {
+        if(!alloc_vid2fid(br))
+            return false;
+        memcpy(br->vid2fid, vids2fids, (MAX_VID + 1) * sizeof(__u16));
     }
-    memcpy(br->vid2fid, vids2fids, sizeof(br->vid2fid));
     if(vid2mstid_changed)
     {
         RecalcConfigDigest(br);
@@ -1347,13 +2141,15 @@ bool MSTP_IN_set_fid2mstid(bridge_t *br, __u16 fid, __u16 mstid)
         return false;
     }
 
-    if(br->fid2mstid[fid] != MSTID)
+    if(GET_FID2MSTID(br, fid) != MSTID)
     {
+        if(!alloc_fid2mstid(br))
+            return false;
         br->fid2mstid[fid] = MSTID;
         /* check if there are VLANs using this FID */
         for(vid = 1; vid <= MAX_VID; ++vid)
         {
-            if(br->vid2fid[vid] == fid)
+            if(GET_VID2FID(br, vid) == fid)
             {
                 RecalcConfigDigest(br);
                 br_state_machines_begin(br);
@@ -1370,18 +2166,22 @@ bool MSTP_IN_set_all_fids2mstids(bridge_t *br, __u16 *fids2mstids)
 {
     tree_t *tree;
     __be16 MSTID[MAX_FID + 1];
-    bool found, vid2mstid_changed;
+    bool found, vid2mstid_changed, all_zero;
     int fid, vid;
     __be16 prev_vid2mstid[MAX_VID + 2];
 
+    all_zero = true;
     for(fid = 0; fid <= MAX_FID; ++fid)
     {
         if(fids2mstids[fid] > MAX_MSTID)
         { /* Incorrect value == keep prev value */
-            fids2mstids[fid] = __be16_to_cpu(MSTID[fid] = br->fid2mstid[fid]);
+            MSTID[fid] = GET_FID2MSTID(br, fid);
+            fids2mstids[fid] = __be16_to_cpu(MSTID[fid]);
         }
         else
             MSTID[fid] = __cpu_to_be16(fids2mstids[fid]);
+        if(fids2mstids[fid])
+            all_zero = false;
         found = false;
         FOREACH_TREE_IN_BRIDGE(tree, br)
         {
@@ -1401,12 +2201,22 @@ bool MSTP_IN_set_all_fids2mstids(bridge_t *br, __u16 *fids2mstids)
     }
 
     for(vid = 1; vid <= MAX_VID; ++vid)
-        prev_vid2mstid[vid] = br->fid2mstid[br->vid2fid[vid]];
-    memcpy(br->fid2mstid, MSTID, sizeof(br->fid2mstid));
+        prev_vid2mstid[vid] = GET_FID2MSTID(br, GET_VID2FID(br, vid));
+    if(all_zero)
+    {
+        free(br->fid2mstid);
+        br->fid2mstid = NULL;
+    }
+    else
+    {
+        if(!alloc_fid2mstid(br))
+            return false;
+        memcpy(br->fid2mstid, MSTID, sizeof(MSTID));
+    }
     vid2mstid_changed = false;
     for(vid = 1; vid <= MAX_VID; ++vid)
     {
-        if(prev_vid2mstid[vid] != br->fid2mstid[br->vid2fid[vid]])
+        if(prev_vid2mstid[vid] != GET_FID2MSTID(br, GET_VID2FID(br, vid)))
         {
             vid2mstid_changed = true;
             break;
@@ -1443,7 +2253,7 @@ bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid)
 {
     tree_t *tree, *tree_after, *new_tree;
     per_tree_port_t *ptp, *nxt, *ptp_after, *new_ptp;
-    int num_of_mstis;
+    int num_of_mstis, num_of_ports;
     __be16 MSTID;
 
     if((mstid < 1) || (mstid > MAX_MSTID))
@@ -1486,8 +2296,17 @@ bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid)
         return false;
     }
 
-    /* Create new tree and its list of PerTreePort structures */
+    /* Create new tree and its list of PerTreePort structures.
+     * Allocate PerTreePort structures for all ports in one go. */
     tree = GET_CIST_TREE(br);
+    num_of_ports = 0;
+    FOREACH_PTP_IN_TREE(ptp, tree)
+        ++num_of_ports;
+    if(!mempool_reserve(&br->ptp_pool, num_of_ports))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return false;
+    }
     if(!(new_tree=create_tree(br,tree->BridgeIdentifier.s.mac_address,MSTID)))
         return false;
 
@@ -1500,8 +2319,11 @@ bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid)
             {
                 list_del(&ptp->port_list);
                 list_del(&ptp->tree_list);
-                free(ptp);
+                ptp_bitmap_release(ptp);
+                mempool_free(&br->ptp_pool, ptp);
             }
+            free(new_tree->ptp_bitmaps);
+            mempool_free(&br->tree_pool, new_tree);
             return false;
         }
         list_add(&new_ptp->port_list, &ptp_after->port_list);
@@ -1535,7 +2357,7 @@ bool MSTP_IN_delete_msti(bridge_t *br, __u16 mstid)
     /* Check if there are FIDs associated with this MSTID */
     for(fid = 0; fid <= MAX_FID; ++fid)
     {
-        if(br->fid2mstid[fid] == MSTID)
+        if(GET_FID2MSTID(br, fid) == MSTID)
         {
             ERROR_BRNAME(br,
                 "Can't delete MSTID(%hu): there are FIDs allocated to it",
@@ -1564,9 +2386,10 @@ bool MSTP_IN_delete_msti(bridge_t *br, __u16 mstid)
     {
         list_del(&ptp->port_list);
         list_del(&ptp->tree_list);
-        free(ptp);
+        mempool_free(&br->ptp_pool, ptp);
     }
-    free(tree);
+    free(tree->ptp_bitmaps);
+    mempool_free(&br->tree_pool, tree);
 
     /* There are no FIDs allocated to this MSTID, so VID-to-MSTID mapping
      *  did not change. So, no need in RecalcConfigDigest.
@@ -1635,13 +2458,59 @@ static void set_TopologyChange(tree_t *tree, bool hint_SetToYes, port_t *port)
     }
 }
 
-/* Helper functions, compare two priority vectors */
+/* Helper functions, compare two priority vectors.
+ * The vector (plus the port ID tie-breaker) is packed into host-order
+ * integers, most significant component first, so that comparison of
+ * two vectors is a lexicographic comparison of a few words instead of
+ * a chain of memcmp calls on big-endian fields.
+ *   k[0] = RootID
+ *   k[1] = ExtRootPathCost : RRootID[63..32]
+ *   k[2] = RRootID[31..0] : IntRootPathCost
+ *   k[3] = DesignatedBridgeID
+ *   k[4] = DesignatedPortID : port ID tie-breaker : 0
+ * For MSTIs RootID and ExtRootPathCost are not compared and packed as 0.
+ */
+#define PRIO_KEY_WORDS  5
+typedef struct
+{
+    __u64 k[PRIO_KEY_WORDS];
+} prio_key_t;
+
+static inline void prio_key_pack(prio_key_t *key, port_priority_vector_t *vec,
+                                 port_identifier_t pId, bool cist)
+{
+    __u64 rrootid = __be64_to_cpu(vec->RRootID.u);
+
+    key->k[0] = cist ? __be64_to_cpu(vec->RootID.u) : 0;
+    key->k[1] = (cist ? ((__u64)__be32_to_cpu(vec->ExtRootPathCost) << 32) : 0)
+                | (rrootid >> 32);
+    key->k[2] = (rrootid << 32) | __be32_to_cpu(vec->IntRootPathCost);
+    key->k[3] = __be64_to_cpu(vec->DesignatedBridgeID.u);
+    key->k[4] = ((__u64)__be16_to_cpu(vec->DesignatedPortID) << 48)
+                | ((__u64)__be16_to_cpu(pId) << 32);
+}
+
+/* <0 if key1 is better, 0 if the same, >0 if key1 is worse */
+static inline int prio_key_cmp(const prio_key_t *key1, const prio_key_t *key2)
+{
+    int i;
+
+    for(i = 0; i < PRIO_KEY_WORDS; ++i)
+    {
+        if(key1->k[i] != key2->k[i])
+            return (key1->k[i] < key2->k[i]) ? -1 : 1;
+    }
+    return 0;
+}
+
 static bool samePriorityAndTimers(port_priority_vector_t *vec1,
                                   port_priority_vector_t *vec2,
                                   times_t *time1,
                                   times_t *time2,
                                   bool cist)
 {
+    prio_key_t key1, key2;
+
     if(cist)
     {
         if(cmp(time1->Forward_Delay, !=, time2->Forward_Delay))
@@ -1652,26 +2521,14 @@ static bool samePriorityAndTimers(port_priority_vector_t *vec1,
             return false;
         if(cmp(time1->Hello_Time, !=, time2->Hello_Time))
             return false;
-
-        if(cmp(vec1->RootID, !=, vec2->RootID))
-            return false;
-        if(cmp(vec1->ExtRootPathCost, !=, vec2->ExtRootPathCost))
-            return false;
     }
 
     if(cmp(time1->remainingHops, !=, time2->remainingHops))
         return false;
 
-    if(cmp(vec1->RRootID, !=, vec2->RRootID))
-        return false;
-    if(cmp(vec1->IntRootPathCost, !=, vec2->IntRootPathCost))
-        return false;
-    if(cmp(vec1->DesignatedBridgeID, !=, vec2->DesignatedBridgeID))
-        return false;
-    if(cmp(vec1->DesignatedPortID, !=, vec2->DesignatedPortID))
-        return false;
-
-    return true;
+    prio_key_pack(&key1, vec1, 0, cist);
+    prio_key_pack(&key2, vec2, 0, cist);
+    return 0 == prio_key_cmp(&key1, &key2);
 }
 
 static bool betterorsamePriority(port_priority_vector_t *vec1,
@@ -1679,51 +2536,95 @@ static bool betterorsamePriority(port_priority_vector_t *vec1,
                                  port_identifier_t pId1,
                                  port_identifier_t pId2,
                                  bool cist)
+{
+    prio_key_t key1, key2;
+
+    /* Port ID is a tie-breaker, it is packed as the least significant part */
+    prio_key_pack(&key1, vec1, pId1, cist);
+    prio_key_pack(&key2, vec2, pId2, cist);
+    return 0 >= prio_key_cmp(&key1, &key2);
+}
+
+#ifdef PRIO_KEYS_CHECK
+/* Reference implementation, comparing the vectors field by field */
+static bool betterorsamePriority_by_fields(port_priority_vector_t *vec1,
+                                           port_priority_vector_t *vec2,
+                                           port_identifier_t pId1,
+                                           port_identifier_t pId2,
+                                           bool cist)
 {
     int result;
 
     if(cist)
     {
-        if(0 < (result = _ncmp(vec1->RootID, vec2->RootID)))
-            return false; /* worse */
-        else if(0 > result)
-            return true; /* better */
-        /* The same. Check further. */
-        if(0 < (result = _ncmp(vec1->ExtRootPathCost, vec2->ExtRootPathCost)))
-            return false; /* worse */
-        else if(0 > result)
-            return true; /* better */
-        /* The same. Check further. */
-    }
-
-    if(0 < (result = _ncmp(vec1->RRootID, vec2->RRootID)))
-        return false; /* worse */
-    else if(0 > result)
-        return true; /* better */
-    /* The same. Check further. */
-
-    if(0 < (result = _ncmp(vec1->IntRootPathCost, vec2->IntRootPathCost)))
-        return false; /* worse */
-    else if(0 > result)
-        return true; /* better */
-    /* The same. Check further. */
-
-    if(0 < (result = _ncmp(vec1->DesignatedBridgeID, vec2->DesignatedBridgeID)))
-        return false; /* worse */
-    else if(0 > result)
-        return true; /* better */
-    /* The same. Check further. */
-
-    if(0 < (result = _ncmp(vec1->DesignatedPortID, vec2->DesignatedPortID)))
-        return false; /* worse */
-    else if(0 > result)
-        return true; /* better */
-    /* The same. Check further. */
-
+        if(0 != (result = _ncmp(vec1->RootID, vec2->RootID)))
+            return 0 > result;
+        if(0 != (result = _ncmp(vec1->ExtRootPathCost, vec2->ExtRootPathCost)))
+            return 0 > result;
+    }
+    if(0 != (result = _ncmp(vec1->RRootID, vec2->RRootID)))
+        return 0 > result;
+    if(0 != (result = _ncmp(vec1->IntRootPathCost, vec2->IntRootPathCost)))
+        return 0 > result;
+    if(0 != (result = _ncmp(vec1->DesignatedBridgeID, vec2->DesignatedBridgeID)))
+        return 0 > result;
+    if(0 != (result = _ncmp(vec1->DesignatedPortID, vec2->DesignatedPortID)))
+        return 0 > result;
     /* Port ID is a tie-breaker */
     return cmp(pId1, <=, pId2);
 }
 
+static bool checked_betterorsamePriority(port_priority_vector_t *vec1,
+                                         port_priority_vector_t *vec2,
+                                         port_identifier_t pId1,
+                                         port_identifier_t pId2,
+                                         bool cist)
+{
+    bool result = betterorsamePriority(vec1, vec2, pId1, pId2, cist);
+
+    if(result != betterorsamePriority_by_fields(vec1, vec2, pId1, pId2, cist))
+    {
+        ERROR("betterorsamePriority key mismatch (%d)", result);
+        ++mstp_check_mismatches;
+    }
+    return result;
+}
+#define betterorsamePriority checked_betterorsamePriority
+
+/* Reference implementation of the vector part of samePriorityAndTimers */
+static bool samePriority_by_fields(port_priority_vector_t *vec1,
+                                   port_priority_vector_t *vec2, bool cist)
+{
+    if(cist && (cmp(vec1->RootID, !=, vec2->RootID)
+                || cmp(vec1->ExtRootPathCost, !=, vec2->ExtRootPathCost)))
+        return false;
+    return cmp(vec1->RRootID, ==, vec2->RRootID)
+           && cmp(vec1->IntRootPathCost, ==, vec2->IntRootPathCost)
+           && cmp(vec1->DesignatedBridgeID, ==, vec2->DesignatedBridgeID)
+           && cmp(vec1->DesignatedPortID, ==, vec2->DesignatedPortID);
+}
+
+static bool checked_samePriorityAndTimers(port_priority_vector_t *vec1,
+                                          port_priority_vector_t *vec2,
+                                          times_t *time1, times_t *time2,
+                                          bool cist)
+{
+    times_t same;
+    bool result = samePriorityAndTimers(vec1, vec2, time1, time2, cist);
+
+    /* The vectors alone, with equal timers */
+    memset(&same, 0, sizeof(same));
+    if(samePriorityAndTimers(vec1, vec2, &same, &same, cist)
+       != samePriority_by_fields(vec1, vec2, cist))
+    {
+        ERROR("samePriorityAndTimers key mismatch (%d)", result);
+        ++mstp_check_mismatches;
+    }
+    return result;
+}
+#define samePriorityAndTimers checked_samePriorityAndTimers
+#endif /* PRIO_KEYS_CHECK */
+
 /* 13.26.1 betterorsameInfo */
 static bool betterorsameInfo(per_tree_port_t *ptp, port_info_origin_t newInfoIs)
 {
@@ -1764,16 +2665,17 @@ static void clearReselectTree(tree_t *tree)
 
     FOREACH_PTP_IN_TREE(ptp, tree)
         ptp->reselect = false;
+    ptp_bitmap_clear_row(tree, PTPBIT_RESELECT);
 }
 
 /* 13.26.4 fromSameRegion */
 static bool fromSameRegion(port_t *prt)
 {
     /* Check for rcvdRSTP is superfluous here */
-    if((protoMSTP > prt->rcvdBpduData.protocolVersion)/* || (!prt->rcvdRSTP)*/)
+    if((protoMSTP > prt->rcvdBpduData->protocolVersion)/* || (!prt->rcvdRSTP)*/)
         return false;
     return cmp(prt->bridge->MstConfigId,
-               ==, prt->rcvdBpduData.mstConfigurationIdentifier);
+               ==, prt->rcvdBpduData->mstConfigurationIdentifier);
 }
 
 /* 13.26.5 newTcWhile */
@@ -1815,7 +2717,7 @@ static port_info_t rcvInfo(per_tree_port_t *ptp)
     port_priority_vector_t *mPri = &(ptp->msgPriority);
     times_t *mTimes = &(ptp->msgTimes);
     port_t *prt = ptp->port;
-    bpdu_t *b = &(prt->rcvdBpduData);
+    bpdu_t *b = prt->rcvdBpduData;
 
     if(bpduTypeTCN == b->bpduType)
     {
@@ -1982,7 +2884,7 @@ static void recordAgreement(per_tree_port_t *ptp)
     bool cist_agreed, cist_proposing;
     per_tree_port_t *cist;
     port_t *prt = ptp->port;
-    bpdu_t *b = &(prt->rcvdBpduData);
+    bpdu_t *b = prt->rcvdBpduData;
 
     if(0 == ptp->MSTID)
     { /* CIST */
@@ -2038,7 +2940,7 @@ static void recordDispute(per_tree_port_t *ptp)
          *  setTcFlags() we do the same.
          * But that is only a guess and I could be wrong here ;)
          */
-        if(prt->rcvdBpduData.flags & (1 << offsetLearnig))
+        if(prt->rcvdBpduData->flags & (1 << offsetLearnig))
         {
             ptp->disputed = true;
             ptp->agreed = false;
@@ -2100,7 +3002,7 @@ static void recordProposal(per_tree_port_t *ptp)
     if(0 == ptp->MSTID)
     { /* CIST */
         prt = ptp->port;
-        if(prt->rcvdBpduData.flags & (1 << offsetProposal))
+        if(prt->rcvdBpduData->flags & (1 << offsetProposal))
             ptp->proposed = true;
         cist_proposed = ptp->proposed;
         if(!prt->rcvdInternal)
@@ -2147,6 +3049,7 @@ static void set_fdbFlush(per_tree_port_t *ptp)
     {
         ptp->fdbFlush = true;
         ptp->calledFromFlushRoutine = true;
+        ++(ptp->counters.flushes);
         MSTP_OUT_flush_all_fids(ptp);
         ptp->calledFromFlushRoutine = false;
     }
@@ -2183,7 +3086,7 @@ static void setRcvdMsgs(port_t *prt)
         {
             found = false;
             /* Find if message for this MSTI is conveyed in the BPDU */
-            for(i = 0, msti_msg = prt->rcvdBpduData.mstConfiguration;
+            for(i = 0, msti_msg = prt->rcvdBpduData->mstConfiguration;
                 i < prt->rcvdBpduNumOfMstis;
                 ++i, ++msti_msg)
             {
@@ -2221,6 +3124,7 @@ static void setReRootTree(tree_t *tree)
 
     FOREACH_PTP_IN_TREE(ptp, tree)
         ptp->reRoot = true;
+    ptp_bitmap_fill_row(tree, PTPBIT_REROOT);
 }
 
 /* 13.26.14 setSelectedTree */
@@ -2242,6 +3146,7 @@ static void setSelectedTree(tree_t *tree)
      */
     FOREACH_PTP_IN_TREE(ptp, tree)
         ptp->selected = true;
+    ptp_bitmap_fill_row(tree, PTPBIT_SELECTED);
 }
 
 /* 13.26.15 setSyncTree */
@@ -2262,7 +3167,7 @@ static void setTcFlags(per_tree_port_t *ptp)
     if(0 == ptp->MSTID)
     { /* CIST */
         prt = ptp->port;
-        cistFlags = prt->rcvdBpduData.flags;
+        cistFlags = prt->rcvdBpduData->flags;
         if(cistFlags & (1 << offsetTcAck))
             prt->rcvdTcAck = true;
         if(cistFlags & (1 << offsetTc))
@@ -2310,7 +3215,7 @@ static void syncMaster(bridge_t *br)
             {
                 ptp->agree = false;
                 ptp->agreed = false;
-                ptp->synced = false;
+                ptp_set_synced(ptp, false);
                 ptp->sync = true;
             }
         }
@@ -2495,7 +3400,7 @@ static void txTcn(port_t *prt)
 /* 13.26.21 updtBPDUVersion */
 static void updtBPDUVersion(port_t *prt)
 {
-    if(protoRSTP <= prt->rcvdBpduData.protocolVersion)
+    if(protoRSTP <= prt->rcvdBpduData->protocolVersion)
         prt->rcvdRSTP = true;
     else
         prt->rcvdSTP = true;
@@ -2555,7 +3460,7 @@ static void updtRolesDisabledTree(tree_t *tree)
     per_tree_port_t *ptp;
 
     FOREACH_PTP_IN_TREE(ptp, tree)
-        ptp->selectedRole = roleDisabled;
+        ptp_set_selectedRole(ptp, roleDisabled);
 }
 
 /* Aux function, not in standard.
@@ -2567,7 +3472,7 @@ static void reselectMSTIs(port_t *prt)
 
     /* For each non-CIST ptp */
     list_for_each_entry_continue(ptp, &prt->trees, port_list)
-        ptp->reselect = true;
+        ptp_set_reselect(ptp, true);
 }
 
 /* 13.26.23 updtRolesTree */
@@ -2575,16 +3480,21 @@ static void updtRolesTree(tree_t *tree)
 {
     per_tree_port_t *ptp, *root_ptp = NULL;
     port_priority_vector_t root_path_priority;
+    prio_key_t root_key, root_path_key;
     bridge_identifier_t prevRRootID = tree->rootPriority.RRootID;
+    bridge_identifier_t prevRootID = tree->rootPriority.RootID;
     __be32 prevExtRootPathCost = tree->rootPriority.ExtRootPathCost;
+    port_identifier_t prevRootPortId = tree->rootPortId;
     bool cist = (0 == tree->MSTID);
 
     /* a), b) Select new root priority vector = {rootPriority, rootPortId} */
       /* Initial value = bridge priority vector = {BridgePriority, 0} */
     assign(tree->rootPriority, tree->BridgePriority);
     assign(tree->rootPortId, __constant_cpu_to_be16(0));
+    prio_key_pack(&root_key, &tree->rootPriority, tree->rootPortId, cist);
       /* Now check root path priority vectors of all ports in tree and see if
-       * there is a better vector */
+       * there is a better vector. Keep the best one as packed key, so that
+       * each candidate costs only one key comparison. */
     FOREACH_PTP_IN_TREE(ptp, tree)
     {
         port_t *prt = ptp->port;
@@ -2616,9 +3526,22 @@ static void updtRolesTree(tree_t *tree)
                 assign(root_path_priority.IntRootPathCost,
                        __constant_cpu_to_be32(0));
             }
-            if(betterorsamePriority(&root_path_priority, &tree->rootPriority,
-                                    ptp->portId, tree->rootPortId, cist))
+            prio_key_pack(&root_path_key, &root_path_priority, ptp->portId,
+                          cist);
+#ifdef PRIO_KEYS_CHECK
+            if((0 >= prio_key_cmp(&root_path_key, &root_key))
+               != betterorsamePriority_by_fields(&root_path_priority,
+                                                 &tree->rootPriority,
+                                                 ptp->portId,
+                                                 tree->rootPortId, cist))
             {
+                ERROR("root priority key mismatch");
+                ++mstp_check_mismatches;
+            }
+#endif
+            if(0 >= prio_key_cmp(&root_path_key, &root_key))
+            {
+                root_key = root_path_key;
                 assign(tree->rootPriority, root_path_priority);
                 assign(tree->rootPortId, ptp->portId);
                 root_ptp = ptp;
@@ -2626,6 +3549,11 @@ static void updtRolesTree(tree_t *tree)
         }
     }
     set_mstp_root_port (tree->MSTID, GET_NUM_FROM_PRIO(tree->rootPortId), 0);
+    if(cmp(tree->rootPortId, !=, prevRootPortId)
+       || (cist ? cmp(tree->rootPriority.RootID, !=, prevRootID)
+                : cmp(tree->rootPriority.RRootID, !=, prevRRootID)))
+        MSTP_OUT_notify(tree, root_ptp ? root_ptp->port : NULL,
+                        MSTP_EVENT_ROOT, 0);
 
     /* 802.1q-2005 says, that at some point we need compare portTimes with
      * "... one for the Root Port ...". Bad IEEE! Why not mention explicit
@@ -2702,7 +3630,7 @@ static void updtRolesTree(tree_t *tree)
         /* f) Set Disabled role */
         if(ioDisabled == ptp->infoIs)
         {
-            ptp->selectedRole = roleDisabled;
+            ptp_set_selectedRole(ptp, roleDisabled);
             continue;
         }
 
@@ -2711,13 +3639,13 @@ static void updtRolesTree(tree_t *tree)
             /* g) Set role for the boundary port in MSTI */
             if(roleRoot == cist_tree->selectedRole)
             {
-                ptp->selectedRole = roleMaster;
+                ptp_set_selectedRole(ptp, roleMaster);
                 if(!samePriorityAndTimers(&ptp->portPriority,
                                           &ptp->designatedPriority,
                                           &ptp->portTimes,
                                           &ptp->designatedTimes,
                                           /*cist*/ false))
-                    ptp->updtInfo = true;
+                    ptp_set_updtInfo(ptp, true);
                 continue;
             }
             /* Bad IEEE again! It says in 13.26.23 g) 2) that
@@ -2735,13 +3663,13 @@ static void updtRolesTree(tree_t *tree)
              */
             /* if(roleAlternate == cist_tree->selectedRole) */
             {
-                ptp->selectedRole = cist_tree->selectedRole;
+                ptp_set_selectedRole(ptp, cist_tree->selectedRole);
                 if(!samePriorityAndTimers(&ptp->portPriority,
                                           &ptp->designatedPriority,
                                           &ptp->portTimes,
                                           &ptp->designatedTimes,
                                           /*cist*/ false))
-                    ptp->updtInfo = true;
+                    ptp_set_updtInfo(ptp, true);
                 continue;
             }
         }
@@ -2751,20 +3679,20 @@ static void updtRolesTree(tree_t *tree)
             /* h) Set role for the aged info */
             if(ioAged == ptp->infoIs)
             {
-                ptp->selectedRole = roleDesignated;
-                ptp->updtInfo = true;
+                ptp_set_selectedRole(ptp, roleDesignated);
+                ptp_set_updtInfo(ptp, true);
                 continue;
             }
             /* i) Set role for the mine info */
             if(ioMine == ptp->infoIs)
             {
-                ptp->selectedRole = roleDesignated;
+                ptp_set_selectedRole(ptp, roleDesignated);
                 if(!samePriorityAndTimers(&ptp->portPriority,
                                           &ptp->designatedPriority,
                                           &ptp->portTimes,
                                           &ptp->designatedTimes,
                                           cist))
-                    ptp->updtInfo = true;
+                    ptp_set_updtInfo(ptp, true);
                 continue;
             }
             if(ioReceived == ptp->infoIs)
@@ -2772,8 +3700,8 @@ static void updtRolesTree(tree_t *tree)
                 /* j) Set Root role */
                 if(root_ptp == ptp)
                 {
-                    ptp->selectedRole = roleRoot;
-                    ptp->updtInfo = false;
+                    ptp_set_selectedRole(ptp, roleRoot);
+                    ptp_set_updtInfo(ptp, false);
                 }
                 else
                 {
@@ -2785,21 +3713,21 @@ static void updtRolesTree(tree_t *tree)
                                tree->BridgeIdentifier))
                         {
                             /* k) Set Alternate role */
-                            ptp->selectedRole = roleAlternate;
+                            ptp_set_selectedRole(ptp, roleAlternate);
                         }
                         else
                         {
                             /* l) Set Backup role */
-                            ptp->selectedRole = roleBackup;
+                            ptp_set_selectedRole(ptp, roleBackup);
                         }
                         /* reset updtInfo for both k) and l) */
-                        ptp->updtInfo = false;
+                        ptp_set_updtInfo(ptp, false);
                     }
                     else /* designatedPriority is better than portPriority */
                     {
                         /* m) Set Designated role */
-                        ptp->selectedRole = roleDesignated;
-                        ptp->updtInfo = true;
+                        ptp_set_selectedRole(ptp, roleDesignated);
+                        ptp_set_updtInfo(ptp, true);
                     }
                 }
                 /* This is not in standard. But we really should set here
@@ -2841,7 +3769,7 @@ static void PTSM_tick(port_t *prt)
         if(ptp->fdWhile)
             --(ptp->fdWhile);
         if(ptp->rrWhile)
-            --(ptp->rrWhile);
+            ptp_set_rrWhile(ptp, ptp->rrWhile - 1);
         if(ptp->rbWhile)
             --(ptp->rbWhile);
         if(ptp->tcWhile)
@@ -3126,6 +4054,7 @@ static void PTSM_to_TRANSMIT_CONFIG(port_t *prt)
     prt->PTSM_state = PTSM_TRANSMIT_CONFIG;
 
     prt->newInfo = false;
+    prt->txHeld = false;
     txConfig(prt);
     ++(prt->txCount);
     prt->tcAck = false;
@@ -3138,6 +4067,7 @@ static void PTSM_to_TRANSMIT_TCN(port_t *prt)
     prt->PTSM_state = PTSM_TRANSMIT_TCN;
 
     prt->newInfo = false;
+    prt->txHeld = false;
     txTcn(prt);
     ++(prt->txCount);
 
@@ -3149,6 +4079,7 @@ static void PTSM_to_TRANSMIT_RSTP(port_t *prt)
     prt->PTSM_state = PTSM_TRANSMIT_RSTP;
 
     prt->newInfo = false;
+    prt->txHeld = false;
     prt->newInfoMsti = false;
     txMstp(prt);
     ++(prt->txCount);
@@ -3243,6 +4174,8 @@ static bool PTSM_run(port_t *prt, bool dry_run)
                 if(roleMaster == ptp->role)
                     mstiMasterPort = true;
             }
+            if(prt->bridge->txDeferred)
+                return false;
             if(0 == prt->helloWhen)
             {
                 if(dry_run) /* state change */
@@ -3251,7 +4184,16 @@ static bool PTSM_run(port_t *prt, bool dry_run)
                 return false;
             }
             if(!(prt->txCount < prt->bridge->Transmit_Hold_Count))
+            {
+                /* Count each delayed transmission once */
+                if(!dry_run && !prt->txHeld
+                   && (prt->newInfo || prt->newInfoMsti))
+                {
+                    prt->txHeld = true;
+                    ++(prt->counters.tx_hold);
+                }
                 return false;
+            }
             if(prt->sendRSTP)
             { /* implement MSTP */
                 if(prt->newInfo || (prt->newInfoMsti && !mstiMasterPort)
@@ -3301,7 +4243,7 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run);
 static void PISM_to_DISABLED(per_tree_port_t *ptp, bool begin)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_DISABLED;
+    SM_SET_STATE(ptp, PISM, PISM_DISABLED);
 
     ptp->rcvdMsg = false;
     ptp->proposing = false;
@@ -3310,8 +4252,8 @@ static void PISM_to_DISABLED(per_tree_port_t *ptp, bool begin)
     ptp->agreed = false;
     assign(ptp->rcvdInfoWhile, 0u);
     ptp->infoIs = ioDisabled;
-    ptp->reselect = true;
-    ptp->selected = false;
+    ptp_set_reselect(ptp, true);
+    ptp_set_selected(ptp, false);
 
     if(!begin)
         PISM_run(ptp, false /* actual run */);
@@ -3320,11 +4262,11 @@ static void PISM_to_DISABLED(per_tree_port_t *ptp, bool begin)
 static void PISM_to_AGED(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_AGED;
+    SM_SET_STATE(ptp, PISM, PISM_AGED);
 
     ptp->infoIs = ioAged;
-    ptp->reselect = true;
-    ptp->selected = false;
+    ptp_set_reselect(ptp, true);
+    ptp_set_selected(ptp, false);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3332,15 +4274,15 @@ static void PISM_to_AGED(per_tree_port_t *ptp)
 static void PISM_to_UPDATE(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_UPDATE;
+    SM_SET_STATE(ptp, PISM, PISM_UPDATE);
 
     ptp->proposing = false;
     ptp->proposed = false;
     ptp->agreed = ptp->agreed && betterorsameInfo(ptp, ioMine);
-    ptp->synced = ptp->synced && ptp->agreed;
+    ptp_set_synced(ptp, ptp->synced && ptp->agreed);
     assign(ptp->portPriority, ptp->designatedPriority);
     assign(ptp->portTimes, ptp->designatedTimes);
-    ptp->updtInfo = false;
+    ptp_set_updtInfo(ptp, false);
     ptp->infoIs = ioMine;
     /* newInfoXst = TRUE; */
     port_t *prt = ptp->port;
@@ -3355,7 +4297,7 @@ static void PISM_to_UPDATE(per_tree_port_t *ptp)
 static void PISM_to_SUPERIOR_DESIGNATED(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_SUPERIOR_DESIGNATED;
+    SM_SET_STATE(ptp, PISM, PISM_SUPERIOR_DESIGNATED);
 
     port_t *prt = ptp->port;
 
@@ -3366,13 +4308,13 @@ static void PISM_to_SUPERIOR_DESIGNATED(per_tree_port_t *ptp)
     setTcFlags(ptp);
     ptp->agree = ptp->agree && betterorsameInfo(ptp, ioReceived);
     recordAgreement(ptp);
-    ptp->synced = ptp->synced && ptp->agreed;
+    ptp_set_synced(ptp, ptp->synced && ptp->agreed);
     recordPriority(ptp);
     recordTimes(ptp);
     updtRcvdInfoWhile(ptp);
     ptp->infoIs = ioReceived;
-    ptp->reselect = true;
-    ptp->selected = false;
+    ptp_set_reselect(ptp, true);
+    ptp_set_selected(ptp, false);
     ptp->rcvdMsg = false;
 
     PISM_run(ptp, false /* actual run */);
@@ -3381,7 +4323,7 @@ static void PISM_to_SUPERIOR_DESIGNATED(per_tree_port_t *ptp)
 static void PISM_to_REPEATED_DESIGNATED(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_REPEATED_DESIGNATED;
+    SM_SET_STATE(ptp, PISM, PISM_REPEATED_DESIGNATED);
 
     port_t *prt = ptp->port;
 
@@ -3398,7 +4340,7 @@ static void PISM_to_REPEATED_DESIGNATED(per_tree_port_t *ptp)
 static void PISM_to_INFERIOR_DESIGNATED(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_INFERIOR_DESIGNATED;
+    SM_SET_STATE(ptp, PISM, PISM_INFERIOR_DESIGNATED);
 
     recordDispute(ptp);
     ptp->rcvdMsg = false;
@@ -3409,7 +4351,7 @@ static void PISM_to_INFERIOR_DESIGNATED(per_tree_port_t *ptp)
 static void PISM_to_NOT_DESIGNATED(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_NOT_DESIGNATED;
+    SM_SET_STATE(ptp, PISM, PISM_NOT_DESIGNATED);
 
     recordAgreement(ptp);
     setTcFlags(ptp);
@@ -3421,7 +4363,7 @@ static void PISM_to_NOT_DESIGNATED(per_tree_port_t *ptp)
 static void PISM_to_OTHER(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_OTHER;
+    SM_SET_STATE(ptp, PISM, PISM_OTHER);
 
     ptp->rcvdMsg = false;
 
@@ -3431,7 +4373,7 @@ static void PISM_to_OTHER(per_tree_port_t *ptp)
 static void PISM_to_CURRENT(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_CURRENT;
+    SM_SET_STATE(ptp, PISM, PISM_CURRENT);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3439,7 +4381,7 @@ static void PISM_to_CURRENT(per_tree_port_t *ptp)
 static void PISM_to_RECEIVE(per_tree_port_t *ptp)
 {
     PISM_LOG("");
-    ptp->PISM_state = PISM_RECEIVE;
+    SM_SET_STATE(ptp, PISM, PISM_RECEIVE);
 
     ptp->rcvdInfo = rcvInfo(ptp);
     recordMastered(ptp);
@@ -3609,8 +4551,6 @@ static void PRSSM_to_ROLE_SELECTION(tree_t *tree)
 
 static bool PRSSM_run(tree_t *tree, bool dry_run)
 {
-    per_tree_port_t *ptp;
-
     switch(tree->PRSSM_state)
     {
         case PRSSM_INIT_TREE:
@@ -3619,14 +4559,13 @@ static bool PRSSM_run(tree_t *tree, bool dry_run)
             PRSSM_to_ROLE_SELECTION(tree);
             return false;
         case PRSSM_ROLE_SELECTION:
-            FOREACH_PTP_IN_TREE(ptp, tree)
-                if(ptp->reselect)
-                {
-                    if(dry_run) /* at least reselect will change */
-                        return true;
-                    PRSSM_to_ROLE_SELECTION(tree);
-                    return false;
-                }
+            if(ptp_bitmap_anyReselect(tree))
+            {
+                if(dry_run) /* at least reselect will change */
+                    return true;
+                PRSSM_to_ROLE_SELECTION(tree);
+                return false;
+            }
             return false;
     }
 
@@ -3650,20 +4589,20 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run);
 static void PRTSM_to_INIT_PORT(per_tree_port_t *ptp/*, bool begin*/)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_INIT_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_INIT_PORT);
 
     unsigned int MaxAge, FwdDelay;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(ptp->port);
 
-    ptp->role = roleDisabled;
+    ptp_set_role(ptp, roleDisabled);
     ptp->learn = false;
     ptp->forward = false;
-    ptp->synced = false;
+    ptp_set_synced(ptp, false);
     ptp->sync = true;
-    ptp->reRoot = true;
+    ptp_set_reRoot(ptp, true);
     /* 13.25.6 */
     FwdDelay = cist->designatedTimes.Forward_Delay;
-    assign(ptp->rrWhile, FwdDelay);
+    ptp_set_rrWhile(ptp, FwdDelay);
     /* 13.25.8 */
     MaxAge = cist->designatedTimes.Max_Age;
     assign(ptp->fdWhile, MaxAge);
@@ -3679,7 +4618,7 @@ static void PRTSM_to_INIT_PORT(per_tree_port_t *ptp/*, bool begin*/)
 static void PRTSM_to_DISABLE_PORT(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DISABLE_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DISABLE_PORT);
 
     /* Although 802.1Q-2005 says here to do role = selectedRole
      * I have difficulties with it in the next scenario:
@@ -3700,7 +4639,7 @@ static void PRTSM_to_DISABLE_PORT(per_tree_port_t *ptp)
      * Solution: do not follow the standard, and do role = roleDisabled
      *  instead of role = selectedRole.
      */
-    ptp->role = roleDisabled;
+    ptp_set_role(ptp, roleDisabled);
     ptp->learn = false;
     ptp->forward = false;
 
@@ -3710,13 +4649,13 @@ static void PRTSM_to_DISABLE_PORT(per_tree_port_t *ptp)
 static void PRTSM_to_DISABLED_PORT(per_tree_port_t *ptp, unsigned int MaxAge)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DISABLED_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DISABLED_PORT);
 
     assign(ptp->fdWhile, MaxAge);
-    ptp->synced = true;
-    assign(ptp->rrWhile, 0u);
+    ptp_set_synced(ptp, true);
+    ptp_set_rrWhile(ptp, 0u);
     ptp->sync = false;
-    ptp->reRoot = false;
+    ptp_set_reRoot(ptp, false);
 
     PRTSM_runr(ptp, true, false /* actual run */);
 }
@@ -3726,7 +4665,7 @@ static void PRTSM_to_DISABLED_PORT(per_tree_port_t *ptp, unsigned int MaxAge)
 static void PRTSM_to_MASTER_PROPOSED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_MASTER_PROPOSED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_MASTER_PROPOSED);
 
     setSyncTree(ptp->tree);
     ptp->proposed = false;
@@ -3737,7 +4676,7 @@ static void PRTSM_to_MASTER_PROPOSED(per_tree_port_t *ptp)
 static void PRTSM_to_MASTER_AGREED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_MASTER_AGREED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_MASTER_AGREED);
 
     ptp->proposed = false;
     ptp->sync = false;
@@ -3749,10 +4688,10 @@ static void PRTSM_to_MASTER_AGREED(per_tree_port_t *ptp)
 static void PRTSM_to_MASTER_SYNCED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_MASTER_SYNCED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_MASTER_SYNCED);
 
-    assign(ptp->rrWhile, 0u);
-    ptp->synced = true;
+    ptp_set_rrWhile(ptp, 0u);
+    ptp_set_synced(ptp, true);
     ptp->sync = false;
 
     PRTSM_runr(ptp, true, false /* actual run */);
@@ -3761,9 +4700,9 @@ static void PRTSM_to_MASTER_SYNCED(per_tree_port_t *ptp)
 static void PRTSM_to_MASTER_RETIRED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_MASTER_RETIRED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_MASTER_RETIRED);
 
-    ptp->reRoot = false;
+    ptp_set_reRoot(ptp, false);
 
     PRTSM_runr(ptp, true, false /* actual run */);
 }
@@ -3771,7 +4710,7 @@ static void PRTSM_to_MASTER_RETIRED(per_tree_port_t *ptp)
 static void PRTSM_to_MASTER_FORWARD(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_MASTER_FORWARD;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_MASTER_FORWARD);
 
     ptp->forward = true;
     assign(ptp->fdWhile, 0u);
@@ -3783,7 +4722,7 @@ static void PRTSM_to_MASTER_FORWARD(per_tree_port_t *ptp)
 static void PRTSM_to_MASTER_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_MASTER_LEARN;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_MASTER_LEARN);
 
     ptp->learn = true;
     assign(ptp->fdWhile, forwardDelay);
@@ -3794,7 +4733,7 @@ static void PRTSM_to_MASTER_LEARN(per_tree_port_t *ptp, unsigned int forwardDela
 static void PRTSM_to_MASTER_DISCARD(per_tree_port_t *ptp, unsigned int forwardDelay)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_MASTER_DISCARD;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_MASTER_DISCARD);
 
     ptp->learn = false;
     ptp->forward = false;
@@ -3807,9 +4746,9 @@ static void PRTSM_to_MASTER_DISCARD(per_tree_port_t *ptp, unsigned int forwardDe
 static void PRTSM_to_MASTER_PORT(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_MASTER_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_MASTER_PORT);
 
-    ptp->role = roleMaster;
+    ptp_set_role(ptp, roleMaster);
 
     PRTSM_runr(ptp, true, false /* actual run */);
 }
@@ -3819,7 +4758,7 @@ static void PRTSM_to_MASTER_PORT(per_tree_port_t *ptp)
 static void PRTSM_to_ROOT_PROPOSED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ROOT_PROPOSED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ROOT_PROPOSED);
 
     setSyncTree(ptp->tree);
     ptp->proposed = false;
@@ -3830,7 +4769,7 @@ static void PRTSM_to_ROOT_PROPOSED(per_tree_port_t *ptp)
 static void PRTSM_to_ROOT_AGREED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ROOT_AGREED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ROOT_AGREED);
 
     ptp->proposed = false;
     ptp->sync = false;
@@ -3848,9 +4787,9 @@ static void PRTSM_to_ROOT_AGREED(per_tree_port_t *ptp)
 static void PRTSM_to_ROOT_SYNCED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ROOT_SYNCED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ROOT_SYNCED);
 
-    ptp->synced = true;
+    ptp_set_synced(ptp, true);
     ptp->sync = false;
 
     PRTSM_runr(ptp, true, false /* actual run */);
@@ -3859,7 +4798,7 @@ static void PRTSM_to_ROOT_SYNCED(per_tree_port_t *ptp)
 static void PRTSM_to_REROOT(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_REROOT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_REROOT);
 
     setReRootTree(ptp->tree);
 
@@ -3869,7 +4808,7 @@ static void PRTSM_to_REROOT(per_tree_port_t *ptp)
 static void PRTSM_to_ROOT_FORWARD(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ROOT_FORWARD;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ROOT_FORWARD);
 
     assign(ptp->fdWhile, 0u);
     ptp->forward = true;
@@ -3880,7 +4819,7 @@ static void PRTSM_to_ROOT_FORWARD(per_tree_port_t *ptp)
 static void PRTSM_to_ROOT_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ROOT_LEARN;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ROOT_LEARN);
 
     assign(ptp->fdWhile, forwardDelay);
     ptp->learn = true;
@@ -3891,9 +4830,9 @@ static void PRTSM_to_ROOT_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
 static void PRTSM_to_REROOTED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_REROOTED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_REROOTED);
 
-    ptp->reRoot = false;
+    ptp_set_reRoot(ptp, false);
 
     PRTSM_runr(ptp, true, false /* actual run */);
 }
@@ -3901,10 +4840,10 @@ static void PRTSM_to_REROOTED(per_tree_port_t *ptp)
 static void PRTSM_to_ROOT_PORT(per_tree_port_t *ptp, unsigned int FwdDelay)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ROOT_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ROOT_PORT);
 
-    ptp->role = roleRoot;
-    assign(ptp->rrWhile, FwdDelay);
+    ptp_set_role(ptp, roleRoot);
+    ptp_set_rrWhile(ptp, FwdDelay);
 
     PRTSM_runr(ptp, true, false /* actual run */);
 }
@@ -3914,7 +4853,7 @@ static void PRTSM_to_ROOT_PORT(per_tree_port_t *ptp, unsigned int FwdDelay)
 static void PRTSM_to_DESIGNATED_PROPOSE(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DESIGNATED_PROPOSE;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DESIGNATED_PROPOSE);
 
     port_t *prt = ptp->port;
 
@@ -3940,7 +4879,7 @@ static void PRTSM_to_DESIGNATED_PROPOSE(per_tree_port_t *ptp)
 static void PRTSM_to_DESIGNATED_AGREED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DESIGNATED_AGREED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DESIGNATED_AGREED);
 
     ptp->proposed = false;
     ptp->sync = false;
@@ -3958,10 +4897,10 @@ static void PRTSM_to_DESIGNATED_AGREED(per_tree_port_t *ptp)
 static void PRTSM_to_DESIGNATED_SYNCED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DESIGNATED_SYNCED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DESIGNATED_SYNCED);
 
-    assign(ptp->rrWhile, 0u);
-    ptp->synced = true;
+    ptp_set_rrWhile(ptp, 0u);
+    ptp_set_synced(ptp, true);
     ptp->sync = false;
 
     PRTSM_runr(ptp, true, false /* actual run */);
@@ -3970,9 +4909,9 @@ static void PRTSM_to_DESIGNATED_SYNCED(per_tree_port_t *ptp)
 static void PRTSM_to_DESIGNATED_RETIRED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DESIGNATED_RETIRED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DESIGNATED_RETIRED);
 
-    ptp->reRoot = false;
+    ptp_set_reRoot(ptp, false);
 
     PRTSM_runr(ptp, true, false /* actual run */);
 }
@@ -3980,7 +4919,7 @@ static void PRTSM_to_DESIGNATED_RETIRED(per_tree_port_t *ptp)
 static void PRTSM_to_DESIGNATED_FORWARD(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DESIGNATED_FORWARD;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DESIGNATED_FORWARD);
 
     ptp->forward = true;
     assign(ptp->fdWhile, 0u);
@@ -3992,7 +4931,7 @@ static void PRTSM_to_DESIGNATED_FORWARD(per_tree_port_t *ptp)
 static void PRTSM_to_DESIGNATED_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DESIGNATED_LEARN;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DESIGNATED_LEARN);
 
     ptp->learn = true;
     assign(ptp->fdWhile, forwardDelay);
@@ -4003,7 +4942,7 @@ static void PRTSM_to_DESIGNATED_LEARN(per_tree_port_t *ptp, unsigned int forward
 static void PRTSM_to_DESIGNATED_DISCARD(per_tree_port_t *ptp, unsigned int forwardDelay)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DESIGNATED_DISCARD;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DESIGNATED_DISCARD);
 
     ptp->learn = false;
     ptp->forward = false;
@@ -4016,9 +4955,9 @@ static void PRTSM_to_DESIGNATED_DISCARD(per_tree_port_t *ptp, unsigned int forwa
 static void PRTSM_to_DESIGNATED_PORT(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_DESIGNATED_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_DESIGNATED_PORT);
 
-    ptp->role = roleDesignated;
+    ptp_set_role(ptp, roleDesignated);
 
     PRTSM_runr(ptp, true, false /* actual run */);
 }
@@ -4028,9 +4967,9 @@ static void PRTSM_to_DESIGNATED_PORT(per_tree_port_t *ptp)
 static void PRTSM_to_BLOCK_PORT(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_BLOCK_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_BLOCK_PORT);
 
-    ptp->role = ptp->selectedRole;
+    ptp_set_role(ptp, ptp->selectedRole);
     ptp->learn = false;
     ptp->forward = false;
 
@@ -4040,7 +4979,7 @@ static void PRTSM_to_BLOCK_PORT(per_tree_port_t *ptp)
 static void PRTSM_to_BACKUP_PORT(per_tree_port_t *ptp, unsigned int HelloTime)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_BACKUP_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_BACKUP_PORT);
 
     assign(ptp->rbWhile, 2 * HelloTime);
 
@@ -4050,7 +4989,7 @@ static void PRTSM_to_BACKUP_PORT(per_tree_port_t *ptp, unsigned int HelloTime)
 static void PRTSM_to_ALTERNATE_PROPOSED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ALTERNATE_PROPOSED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ALTERNATE_PROPOSED);
 
     setSyncTree(ptp->tree);
     ptp->proposed = false;
@@ -4061,7 +5000,7 @@ static void PRTSM_to_ALTERNATE_PROPOSED(per_tree_port_t *ptp)
 static void PRTSM_to_ALTERNATE_AGREED(per_tree_port_t *ptp)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ALTERNATE_AGREED;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ALTERNATE_AGREED);
 
     ptp->proposed = false;
     ptp->agree = true;
@@ -4078,34 +5017,31 @@ static void PRTSM_to_ALTERNATE_AGREED(per_tree_port_t *ptp)
 static void PRTSM_to_ALTERNATE_PORT(per_tree_port_t *ptp, unsigned int forwardDelay)
 {
     PRTSM_LOG("");
-    ptp->PRTSM_state = PRTSM_ALTERNATE_PORT;
+    SM_SET_STATE(ptp, PRTSM, PRTSM_ALTERNATE_PORT);
 
     assign(ptp->fdWhile, forwardDelay);
-    ptp->synced = true;
-    assign(ptp->rrWhile, 0u);
+    ptp_set_synced(ptp, true);
+    ptp_set_rrWhile(ptp, 0u);
     ptp->sync = false;
-    ptp->reRoot = false;
+    ptp_set_reRoot(ptp, false);
 
     PRTSM_runr(ptp, true, false /* actual run */);
 }
 
 static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
 {
-    /* Following vars do not need recalculating on recursive calls */
-    static unsigned int MaxAge, FwdDelay, forwardDelay, HelloTime;
-    static port_t *prt;
-    static tree_t *tree;
-    static per_tree_port_t *cist;
+    /* Following vars do not need recalculating on recursive calls.
+     * Bridges may run on different threads, hence per thread. */
+    static __thread unsigned int MaxAge, FwdDelay, forwardDelay, HelloTime;
+    static __thread port_t *prt;
+    static __thread per_tree_port_t *cist;
     /* Following vars are recalculated on each state transition */
     bool allSynced, reRooted;
-    /* Following vars are auxiliary and don't depend on recursive_call */
-    per_tree_port_t *ptp_1;
 
     if(!recursive_call)
     { /* calculate these intermediate vars only first time in chain of
        * recursive calls */
         prt = ptp->port;
-        tree = ptp->tree;
 
         cist = GET_CIST_PTP_FROM_PORT(prt);
 
@@ -4158,38 +5094,15 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
     }
 
     /* 13.25.1 */
-    allSynced = true;
-    FOREACH_PTP_IN_TREE(ptp_1, tree)
+    allSynced = ptp_bitmap_allSynced(ptp);
+#ifdef PTP_BITMAPS_CHECK
+    if(allSynced != allSynced_by_list(ptp))
     {
-        /* a) */
-        if(!ptp_1->selected
-           || (ptp_1->role != ptp_1->selectedRole)
-           || ptp_1->updtInfo
-          )
-        {
-            allSynced = false;
-            break;
-        }
-
-        /* b) */
-        switch(ptp->role)
-        {
-            case roleRoot:
-            case roleAlternate:
-                if((roleRoot != ptp_1->role) && !ptp_1->synced)
-                    allSynced = false;
-                break;
-            case roleDesignated:
-            case roleMaster:
-                if((ptp != ptp_1) && !ptp_1->synced)
-                    allSynced = false;
-                break;
-            default:
-                allSynced = false;
-        }
-        if(!allSynced)
-            break;
+        ERROR_MSTINAME(prt->bridge, prt, ptp,
+                       "allSynced bitmap mismatch (%d)", allSynced);
+        ++mstp_check_mismatches;
     }
+#endif
 
     switch(ptp->PRTSM_state)
     {
@@ -4356,15 +5269,15 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
                 return false;
             }
             /* 17.20.10 of 802.1D : reRooted */
-            reRooted = true;
-            FOREACH_PTP_IN_TREE(ptp_1, tree)
+            reRooted = ptp_bitmap_reRooted(ptp);
+#ifdef PTP_BITMAPS_CHECK
+            if(reRooted != reRooted_by_list(ptp))
             {
-                if((ptp != ptp_1) && (0 != ptp_1->rrWhile))
-                {
-                    reRooted = false;
-                    break;
-                }
+                ERROR_MSTINAME(prt->bridge, prt, ptp,
+                               "reRooted bitmap mismatch (%d)", reRooted);
+                ++mstp_check_mismatches;
             }
+#endif
             if((0 == ptp->fdWhile)
                || (reRooted && (0 == ptp->rbWhile) && rstpVersion(prt->bridge))
               )
@@ -4554,7 +5467,7 @@ static bool PSTSM_run(per_tree_port_t *ptp, bool dry_run);
 
 static void PSTSM_to_DISCARDING(per_tree_port_t *ptp, bool begin)
 {
-    ptp->PSTSM_state = PSTSM_DISCARDING;
+    SM_SET_STATE(ptp, PSTSM, PSTSM_DISCARDING);
 
     /* This effectively sets BLOCKING state:
     disableLearning();
@@ -4574,7 +5487,7 @@ static void PSTSM_to_DISCARDING(per_tree_port_t *ptp, bool begin)
 
 static void PSTSM_to_LEARNING(per_tree_port_t *ptp)
 {
-    ptp->PSTSM_state = PSTSM_LEARNING;
+    SM_SET_STATE(ptp, PSTSM, PSTSM_LEARNING);
 
     /* enableLearning(); */
     if(BR_STATE_LEARNING != ptp->state)
@@ -4589,7 +5502,7 @@ static void PSTSM_to_LEARNING(per_tree_port_t *ptp)
 
 static void PSTSM_to_FORWARDING(per_tree_port_t *ptp)
 {
-    ptp->PSTSM_state = PSTSM_FORWARDING;
+    SM_SET_STATE(ptp, PSTSM, PSTSM_FORWARDING);
 
     /* enableForwarding(); */
     if(BR_STATE_FORWARDING != ptp->state)
@@ -4648,7 +5561,7 @@ static bool PSTSM_run(per_tree_port_t *ptp, bool dry_run)
 
 static void TCSM_to_INACTIVE(per_tree_port_t *ptp, bool begin)
 {
-    ptp->TCSM_state = TCSM_INACTIVE;
+    SM_SET_STATE(ptp, TCSM, TCSM_INACTIVE);
 
     set_fdbFlush(ptp);
     assign(ptp->tcWhile, 0u);
@@ -4675,7 +5588,7 @@ static bool TCSM_to_LEARNING(per_tree_port_t *ptp, bool dry_run)
         return false;
     }
 
-    ptp->TCSM_state = TCSM_LEARNING;
+    SM_SET_STATE(ptp, TCSM, TCSM_LEARNING);
 
     if(0 == ptp->MSTID) /* CIST */
     {
@@ -4692,7 +5605,9 @@ static bool TCSM_to_LEARNING(per_tree_port_t *ptp, bool dry_run)
 
 static void TCSM_to_DETECTED(per_tree_port_t *ptp)
 {
-    ptp->TCSM_state = TCSM_DETECTED;
+    SM_SET_STATE(ptp, TCSM, TCSM_DETECTED);
+    ++(ptp->counters.tc_detected);
+    MSTP_OUT_notify(ptp->tree, ptp->port, MSTP_EVENT_TC_DETECTED, 0);
 
     newTcWhile(ptp);
     setTcPropTree(ptp);
@@ -4708,7 +5623,9 @@ static void TCSM_to_DETECTED(per_tree_port_t *ptp)
 
 static void TCSM_to_NOTIFIED_TCN(per_tree_port_t *ptp)
 {
-    ptp->TCSM_state = TCSM_NOTIFIED_TCN;
+    SM_SET_STATE(ptp, TCSM, TCSM_NOTIFIED_TCN);
+    ++(ptp->counters.tc_rcvd);
+    MSTP_OUT_notify(ptp->tree, ptp->port, MSTP_EVENT_TC_RCVD, 0);
 
     newTcWhile(ptp);
 
@@ -4717,7 +5634,9 @@ static void TCSM_to_NOTIFIED_TCN(per_tree_port_t *ptp)
 
 static void TCSM_to_NOTIFIED_TC(per_tree_port_t *ptp)
 {
-    ptp->TCSM_state = TCSM_NOTIFIED_TC;
+    SM_SET_STATE(ptp, TCSM, TCSM_NOTIFIED_TC);
+    ++(ptp->counters.tc_rcvd);
+    MSTP_OUT_notify(ptp->tree, ptp->port, MSTP_EVENT_TC_RCVD, 0);
 
     ptp->rcvdTc = false;
     if(0 == ptp->MSTID) /* CIST */
@@ -4734,7 +5653,7 @@ static void TCSM_to_NOTIFIED_TC(per_tree_port_t *ptp)
 
 static void TCSM_to_PROPAGATING(per_tree_port_t *ptp)
 {
-    ptp->TCSM_state = TCSM_PROPAGATING;
+    SM_SET_STATE(ptp, TCSM, TCSM_PROPAGATING);
 
     newTcWhile(ptp);
     set_fdbFlush(ptp);
@@ -4745,7 +5664,7 @@ static void TCSM_to_PROPAGATING(per_tree_port_t *ptp)
 
 static void TCSM_to_ACKNOWLEDGED(per_tree_port_t *ptp)
 {
-    ptp->TCSM_state = TCSM_ACKNOWLEDGED;
+    SM_SET_STATE(ptp, TCSM, TCSM_ACKNOWLEDGED);
 
     assign(ptp->tcWhile, 0u);
     set_TopologyChange(ptp->tree, false, ptp->port);
@@ -4756,7 +5675,7 @@ static void TCSM_to_ACKNOWLEDGED(per_tree_port_t *ptp)
 
 static void TCSM_to_ACTIVE(per_tree_port_t *ptp)
 {
-    ptp->TCSM_state = TCSM_ACTIVE;
+    SM_SET_STATE(ptp, TCSM, TCSM_ACTIVE);
 
     TCSM_run(ptp, false /* actual run */);
 }
@@ -5015,7 +5934,9 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
             if(dry_run) /* state change */
                 return true;
             prt->BaInconsistent = true;
+            ++(prt->counters.ba_inconsistent);
             ERROR_PRTNAME(prt->bridge, prt, "Bridge assurance inconsistent");
+            MSTP_OUT_notify(NULL, prt, MSTP_EVENT_BA_INCONSISTENT, 1);
         }
     }
 
@@ -5097,29 +6018,25 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
  */
 static void br_state_machines_run(bridge_t *br)
 {
-    struct timeval tv, tv_end;
-    signed long delta;
+    __u64 end;
+    unsigned int iterations = 0;
 
     if(!br->bridgeEnabled)
         return;
 
-    gettimeofday(&tv_end, NULL);
-    ++(tv_end.tv_sec);
+    end = stats_now() + 1000000000ULL;
 
-    do {
-        if(!__br_state_machines_run(br, true /* dry run */))
-            return;
+    while(__br_state_machines_run(br, true /* dry run */))
+    {
         __br_state_machines_run(br, false /* actual run */);
+        ++iterations;
 
         /* Check for the timeout */
-        gettimeofday(&tv, NULL);
-        if(0 < (delta = tv.tv_sec - tv_end.tv_sec))
-            return;
-        if(0 == delta)
+        if(stats_now() > end)
         {
-            delta = tv.tv_usec - tv_end.tv_usec;
-            if(0 < delta)
-                return;
+            __atomic_add_fetch(&stats_sm_run_timeouts, 1, __ATOMIC_RELAXED);
+            break;
         }
-    } while(true);
+    }
+    stats_record(STATS_SM_ITERATIONS, iterations);
 }
@@ -17,6 +17,7 @@
 
 #include "bridge_ctl.h"
 #include "list.h"
+#include "mempool.h"
 
 /* #define HMAC_MDS_TEST_FUNCTIONS */
 
@@ -364,6 +365,25 @@ typedef enum
     TCSM_ACTIVE
 } TCSM_states_t;
 
+/* Rows of the per-tree port flag bitmaps (tree_t.ptp_bitmaps).
+ * Each row holds one bit per port, indexed by (port_number - 1), and
+ * mirrors a per_tree_port_t variable so that the tree-wide conditions
+ * (allSynced, reRooted, "reselect for any port") are evaluated a word
+ * at a time instead of walking the list of ports.
+ */
+typedef enum
+{
+    PTPBIT_PRESENT,      /* port belongs to the tree */
+    PTPBIT_SELECTED,
+    PTPBIT_RESELECT,
+    PTPBIT_SYNCED,
+    PTPBIT_REROOT,
+    PTPBIT_RRWHILE,      /* rrWhile != 0 */
+    PTPBIT_ROLE_ROOT,    /* role == roleRoot */
+    PTPBIT_ROLE_SETTLED, /* role == selectedRole && !updtInfo */
+    PTPBIT_ROWS
+} ptp_bitmap_row_t;
+
 /*
  * Following standard-defined variables are not defined as variables.
  * Their functionality is implemented indirectly by other means:
@@ -379,8 +399,12 @@ typedef struct
     /* List of all tree instances, first in list (trees.next) is CIST */
     struct list_head trees;
 #define GET_CIST_TREE(br) list_entry((br)->trees.next, tree_t, bridge_list)
+#define GET_VID2FID(br, vid) ((br)->vid2fid ? (br)->vid2fid[vid] : 0)
+#define GET_FID2MSTID(br, fid) \
+    ((br)->fid2mstid ? (br)->fid2mstid[fid] : __constant_cpu_to_be16(0))
 
     bool bridgeEnabled;
+    bool txDeferred;    /* MSTP_IN_enable_ports(): no BPDUs until settled */
 
     /* Per-bridge configuration parameters */
     mst_configuration_identifier_t MstConfigId; /* 13.24.b */
@@ -397,11 +421,19 @@ typedef struct
     unsigned int Migrate_Time;        /* 13.22.h */
     unsigned int Ageing_Time;  /* 8.8.3 */
 
-    __u16 vid2fid[MAX_VID + 1];
-    __be16 fid2mstid[MAX_FID + 1];
+    /* VID-to-FID (MAX_VID + 1 entries) and FID-to-MSTID (MAX_FID + 1
+     * entries) tables. They are allocated on the first non-zero write,
+     * NULL table means that all its entries are zero.
+     * Use GET_VID2FID/GET_FID2MSTID to read them. */
+    __u16 *vid2fid;
+    __be16 *fid2mstid;
 
     /* not in standard */
     unsigned int uptime;
+    /* Size (in unsigned longs) of one row of tree_t.ptp_bitmaps */
+    unsigned int ptp_bitmap_words;
+    /* Pools for port_t, tree_t and per_tree_port_t of this bridge */
+    mempool_t port_pool, tree_pool, ptp_pool;
 
     sysdep_br_data_t sysdeps;
 } bridge_t;
@@ -438,8 +470,48 @@ typedef struct
     /* State machines */
     PRSSM_states_t PRSSM_state;
 
+    /* not in standard, PTPBIT_ROWS rows of bridge->ptp_bitmap_words each */
+    unsigned long *ptp_bitmaps;
 } tree_t;
 
+/* not in standard, protocol counters of the port */
+typedef struct
+{
+    __u64 rx_bpdu;          /* all received BPDUs */
+    __u64 rx_config;        /* valid BPDUs by type */
+    __u64 rx_rst;
+    __u64 rx_mst;
+    __u64 rx_tcn;
+    __u64 rx_tc;            /* TCN BPDUs and BPDUs with TC flag */
+    __u64 rx_bad_size;      /* validation failures by reason */
+    __u64 rx_bad_protocol;
+    __u64 rx_bad_version;
+    __u64 rx_bad_type;
+    __u64 rx_pending;       /* dropped, previous BPDU was not processed */
+    __u64 rx_disabled;      /* dropped, bridge is disabled */
+    __u64 rx_no_memory;     /* dropped, couldn't store the BPDU */
+    __u64 bpdu_guard;       /* BPDUs received on BPDU guarded port */
+    __u64 ba_inconsistent;  /* bridge assurance became inconsistent */
+    __u64 ba_cleared;       /* bridge assurance inconsistency cleared */
+    __u64 tx_bpdu;          /* all transmitted BPDUs */
+    __u64 tx_config;
+    __u64 tx_rst;
+    __u64 tx_mst;
+    __u64 tx_tcn;
+    __u64 tx_tc;            /* TCN BPDUs and BPDUs with TC flag */
+    __u64 tx_hold;          /* transmissions delayed by the hold count */
+    __u64 trans_fwd;        /* transitions to forwarding */
+    __u64 trans_blk;        /* transitions to blocking */
+} port_counters_t;
+
+/* not in standard, protocol counters of the port in one tree */
+typedef struct
+{
+    __u64 tc_detected;      /* TCSM entered DETECTED */
+    __u64 tc_rcvd;          /* TCSM entered NOTIFIED_TC or NOTIFIED_TCN */
+    __u64 flushes;          /* MSTP_OUT_flush_all_fids calls */
+} ptp_counters_t;
+
 typedef struct
 {
     struct list_head br_list; /* anchor in bridge's list of ports */
@@ -487,19 +559,23 @@ typedef struct
     BDSM_states_t BDSM_state;
     PTSM_states_t PTSM_state;
 
-    /* Copy of the received BPDU */
-    bpdu_t rcvdBpduData;
+    /* Copy of the received BPDU. Only MSTI Configuration Messages which
+     * were actually received are stored, the buffer has room for
+     * rcvdBpduMstiCapacity of them and grows when needed. */
+    bpdu_t *rcvdBpduData;
     int rcvdBpduNumOfMstis;
+    int rcvdBpduMstiCapacity;
 
     bool deleted;
 
+    /* not in standard, transmission is delayed by the hold count */
+    bool txHeld;
+
+    /* not in standard, state restored by MSTP_IN_restore_port() */
+    bool restored;
+
     sysdep_if_data_t sysdeps;
-    unsigned int num_rx_bpdu;
-    unsigned int num_rx_tcn;
-    unsigned int num_tx_bpdu;
-    unsigned int num_tx_tcn;
-    unsigned int num_trans_fwd;
-    unsigned int num_trans_blk;
+    port_counters_t counters;
 } port_t;
 
 typedef struct
@@ -545,6 +621,12 @@ typedef struct
     /* not in standard, used for calculation of port uptime */
     unsigned int start_time;
 
+    /* not in standard, CLOCK_MONOTONIC ns of the last role change which
+     * takes a port state change, 0 after that change or if none is due */
+    __u64 roleChangeTime;
+
+    ptp_counters_t counters;
+
     /* State machines */
     PISM_states_t PISM_state;
     PRTSM_states_t PRTSM_state;
@@ -561,16 +643,70 @@ typedef struct
 
 /* External events (inputs) */
 bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr);
+port_t *MSTP_IN_alloc_port(bridge_t *br);
+void MSTP_IN_free_port(port_t *prt);
+bool MSTP_IN_reserve_ports(bridge_t *br, unsigned int count);
 bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno);
 void MSTP_IN_delete_port(port_t *prt);
 void MSTP_IN_delete_bridge(bridge_t *br);
 void MSTP_IN_set_bridge_address(bridge_t *br, __u8 *macaddr);
 void MSTP_IN_set_bridge_enable(bridge_t *br, bool up);
 void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex);
+void MSTP_IN_enable_ports(bridge_t *br, port_t **prts, unsigned int count);
 void MSTP_IN_one_second(bridge_t *br);
 void MSTP_IN_all_fids_flushed(per_tree_port_t *ptp);
 void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size);
 
+/* Not in standard. Warm restart: protocol state of a tree, a port and a
+ * port in a tree as kept in a checkpoint. Configuration is not included,
+ * it goes through the 12.8 parameters.
+ */
+typedef struct
+{
+    port_priority_vector_t rootPriority;
+    times_t rootTimes;
+    port_identifier_t rootPortId;
+    bool topology_change;
+    __u8 PRSSM_state;
+    __u32 time_since_topology_change;
+    __u32 topology_change_count;
+    char topology_change_port[IFNAMSIZ];
+    char last_topology_change_port[IFNAMSIZ];
+} tree_state_t;
+
+typedef struct
+{
+    __u32 mdelayWhile, helloWhen, edgeDelayWhile, rapidAgeingWhile;
+    bool operEdge, infoInternal, rcvdInternal, mcheck, rcvdRSTP, rcvdSTP;
+    bool sendRSTP, tcAck, BpduGuardError, BaInconsistent;
+    __u8 PRSM_state, PPMSM_state, BDSM_state, PTSM_state;
+} port_state_t;
+
+typedef struct
+{
+    port_priority_vector_t designatedPriority, msgPriority, portPriority;
+    times_t designatedTimes, msgTimes, portTimes;
+    __u32 fdWhile, rrWhile, rbWhile, tcWhile, rcvdInfoWhile;
+    __u8 state; /* BR_STATE_xxx */
+    bool agree, agreed, disputed, forward, forwarding, learn, learning;
+    bool proposed, proposing, reRoot, reselect, selected;
+    bool fdbFlush, tcProp, updtInfo, sync, synced, master, mastered;
+    __u8 rcvdInfo, infoIs, role, selectedRole;
+    __u8 PISM_state, PRTSM_state, PSTSM_state, TCSM_state;
+} ptp_state_t;
+
+void MSTP_IN_save_tree(tree_t *tree, tree_state_t *s);
+void MSTP_IN_save_port(port_t *prt, port_state_t *s);
+void MSTP_IN_save_ptp(per_tree_port_t *ptp, ptp_state_t *s);
+/* Restore into a disabled bridge, after its configuration. A restored
+ * port must have all its trees restored. */
+void MSTP_IN_restore_tree(tree_t *tree, const tree_state_t *s);
+void MSTP_IN_restore_port(port_t *prt, const port_state_t *s);
+void MSTP_IN_restore_ptp(per_tree_port_t *ptp, const ptp_state_t *s);
+/* Enable the bridge without BEGIN for the restored ports, the others
+ * start as if they were added to the running bridge */
+void MSTP_IN_resume_bridge(bridge_t *br);
+
 bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid);
 bool MSTP_IN_set_all_vids2fids(bridge_t *br, __u16 *vids2fids);
 bool MSTP_IN_set_fid2mstid(bridge_t *br, __u16 fid, __u16 mstid);
@@ -580,13 +716,36 @@ bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid);
 bool MSTP_IN_delete_msti(bridge_t *br, __u16 mstid);
 void MSTP_IN_set_mst_config_id(bridge_t *br, __u16 revision, __u8 *name);
 
+#if defined(PTP_BITMAPS_CHECK) || defined(PRIO_KEYS_CHECK)
+/* Cross-check mismatches, see mstp.c */
+extern unsigned long mstp_check_mismatches;
+#endif
+
 /* External actions (outputs) */
 void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state);
 void MSTP_OUT_flush_all_fids(per_tree_port_t *ptp);
 void MSTP_OUT_set_ageing_time(port_t *prt, unsigned int ageingTime);
+void MSTP_OUT_set_bridge_ageing_time(bridge_t *br, unsigned int ageingTime);
 void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size);
 void MSTP_OUT_shutdown_port(port_t *prt);
 
+/* Not in standard. Events for the subscribers of the ctl socket */
+typedef enum
+{
+    MSTP_EVENT_PORT_STATE,      /* arg - BR_STATE_xxx */
+    MSTP_EVENT_PORT_ROLE,       /* arg - port_role_t */
+    MSTP_EVENT_TC_DETECTED,
+    MSTP_EVENT_TC_RCVD,
+    MSTP_EVENT_ROOT,            /* new root or root port, prt - root port */
+    MSTP_EVENT_BPDU_GUARD,
+    MSTP_EVENT_BA_INCONSISTENT, /* arg - 1 detected, 0 cleared */
+    MSTP_NUM_EVENTS
+} mstp_event_t;
+
+/* tree == NULL for the port events, prt == NULL for the tree events */
+void MSTP_OUT_notify(tree_t *tree, port_t *prt, mstp_event_t event,
+                     unsigned int arg);
+
 /* Structures for communicating with user */
  /* 12.8.1.1 Read CIST Bridge Protocol Parameters */
 typedef struct
@@ -702,12 +861,12 @@ typedef struct
     bool bpdu_guard_error;
     bool network_port;
     bool ba_inconsistent;
-    unsigned int num_rx_bpdu;
-    unsigned int num_rx_tcn;
-    unsigned int num_tx_bpdu;
-    unsigned int num_tx_tcn;
-    unsigned int num_trans_fwd;
-    unsigned int num_trans_blk;
+    __u64 num_rx_bpdu;
+    __u64 num_rx_tcn;
+    __u64 num_tx_bpdu;
+    __u64 num_tx_tcn;
+    __u64 num_trans_fwd;
+    __u64 num_trans_blk;
     bool rcvdBpdu;
     bool rcvdRSTP;
     bool rcvdSTP;
@@ -793,4 +952,25 @@ int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg);
 /* 12.8.2.5 Force BPDU Migration Check */
 int MSTP_IN_port_mcheck(port_t *prt);
 
+/* Not in standard. Memory used by the bridge */
+typedef struct
+{
+    unsigned int num_ports;
+    unsigned int num_trees;
+    unsigned int bridge_size;  /* sizeof(bridge_t) */
+    unsigned int bitmaps_size; /* per-tree port flag bitmaps, all trees */
+    unsigned int vlan_tables_size; /* VID-to-FID and FID-to-MSTID tables */
+    unsigned int rcvd_bpdu_size;   /* received BPDU copies, all ports */
+    mempool_status_t ports, trees, ptps;
+    unsigned int per_port;     /* port_t + BPDU copy + per_tree_port_t/tree */
+    unsigned int per_msti;     /* tree_t + per_tree_port_t for each port */
+    unsigned int total;
+} Bridge_MemoryStatus;
+
+void MSTP_IN_get_memory_status(bridge_t *br, Bridge_MemoryStatus *status);
+
+/* Not in standard. Calls func for every bridge, implemented by the
+ * system dependent part (bridge_track.c) */
+void bridge_for_each(void (*func)(bridge_t *br));
+
 #endif /* MSTP_H */
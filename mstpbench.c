@@ -0,0 +1,527 @@
+/*
+ * mstpbench.c   Microbenchmarks for the hot paths of mstp.c.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ * mstp.c and mempool.c are included here, so that static functions
+ * (txMstp, RecalcConfigDigest, br_state_machines_*) can be measured
+ * directly and memory allocations made by them can be counted.
+ *
+ * The device under test (DUT) is a bridge with P ports and M MSTIs.
+ * Where a partner is needed, port i of the DUT is connected to port i of
+ * a peer bridge with the same configuration. Results are printed as CSV,
+ * one line per benchmark and (ports, mstis) combination.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/* Count allocations made by the code under test */
+static unsigned long num_allocs, alloc_bytes;
+
+static void *bench_malloc(size_t size)
+{
+    ++num_allocs;
+    alloc_bytes += size;
+    return malloc(size);
+}
+
+static void *bench_calloc(size_t nmemb, size_t size)
+{
+    ++num_allocs;
+    alloc_bytes += nmemb * size;
+    return calloc(nmemb, size);
+}
+
+#define malloc(s)       bench_malloc(s)
+#define calloc(n, s)    bench_calloc(n, s)
+#include "mempool.c"
+#include "mstp.c"
+#undef malloc
+#undef calloc
+#include "mstpstubs.h"
+
+#define BENCH_LINK_SPEED    1000
+#define BENCH_MAX_PORTS     4096
+/* Queue room per port: more than any port may send in one second */
+#define BENCH_QUEUE_PER_PORT    16
+
+typedef struct
+{
+    int dst;    /* index in net.ports */
+    int size;
+    bpdu_t bpdu;
+} bench_bpdu_t;
+
+typedef struct
+{
+    bridge_t *dut, *peer;
+    port_t *ports[2 * BENCH_MAX_PORTS]; /* DUT ports, then peer ports */
+    int num_ports;
+    int num_mstis;
+    bench_bpdu_t last_tx[2 * BENCH_MAX_PORTS]; /* last BPDU sent by port */
+    bench_bpdu_t *queue;
+    int queue_head, queue_tail, queue_size;
+    bool deliver;   /* false - BPDUs are only remembered in last_tx */
+    unsigned long tx_count;
+} bench_net_t;
+
+static bench_net_t net;
+
+/* The hook of mstpstubs.c */
+static void bench_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
+{
+    int i = prt->sysdeps.if_index;
+    bench_bpdu_t *b;
+
+    ++net.tx_count;
+    net.last_tx[i].size = size;
+    memcpy(&net.last_tx[i].bpdu, bpdu, size);
+    if(!net.deliver || !net.peer || (net.queue_tail == net.queue_size))
+        return;
+    b = net.queue + net.queue_tail++;
+    b->dst = (i + net.num_ports) % (2 * net.num_ports);
+    b->size = size;
+    memcpy(&b->bpdu, bpdu, size);
+}
+
+/* Deliver queued BPDUs until the pair goes quiet. Transmission is
+ * limited by TxHoldCount, so the queue can't grow without bound. */
+static void bench_deliver(void)
+{
+    bench_bpdu_t *b;
+
+    while(net.queue_head < net.queue_tail)
+    {
+        b = net.queue + net.queue_head++;
+        MSTP_IN_rx_bpdu(net.ports[b->dst], &b->bpdu, b->size);
+    }
+    net.queue_head = net.queue_tail = 0;
+}
+
+static bridge_t *bench_bridge(int index, int num_ports, int num_mstis,
+                              protocol_version_t proto, bool up)
+{
+    CIST_BridgeConfig cfg;
+    bridge_t *br;
+    port_t *prt;
+    __u8 macaddr[ETH_ALEN] = {0x02, 0, 0, 0, 0, index + 1};
+    int i, mstid, first = index * num_ports;
+
+    if(!(br = calloc(1, sizeof(*br))))
+        return NULL;
+    snprintf(br->sysdeps.name, IFNAMSIZ, "br%d", index);
+    memcpy(br->sysdeps.macaddr, macaddr, ETH_ALEN);
+    br->sysdeps.up = true;
+    if(!MSTP_IN_bridge_create(br, macaddr))
+    {
+        free(br);
+        return NULL;
+    }
+    for(mstid = 1; mstid <= num_mstis; ++mstid)
+    {
+        MSTP_IN_create_msti(br, mstid);
+        MSTP_IN_set_fid2mstid(br, mstid, mstid);
+        MSTP_IN_set_vid2fid(br, mstid, mstid);
+    }
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.protocol_version = proto;
+    cfg.set_protocol_version = true;
+    cfg.bridge_hello_time = 1;
+    cfg.set_bridge_hello_time = true;
+    MSTP_IN_set_cist_bridge_config(br, &cfg);
+    MSTP_IN_set_bridge_enable(br, true);
+
+    for(i = 0; i < num_ports; ++i)
+    {
+        if(!(prt = MSTP_IN_alloc_port(br)))
+            break;
+        prt->sysdeps.if_index = first + i;
+        snprintf(prt->sysdeps.name, IFNAMSIZ, "br%dp%d", index, i + 1);
+        prt->sysdeps.up = true;
+        prt->sysdeps.speed = BENCH_LINK_SPEED;
+        prt->sysdeps.duplex = 1;
+        if(!MSTP_IN_port_create_and_add_tail(prt, i + 1))
+        {
+            MSTP_IN_free_port(prt);
+            break;
+        }
+        net.ports[prt->sysdeps.if_index] = prt;
+    }
+    /* All at once, as the daemon brings up a new bridge */
+    if(up)
+        MSTP_IN_enable_ports(br, net.ports + first, i);
+    return br;
+}
+
+static void bench_free_bridge(bridge_t *br)
+{
+    if(br)
+    {
+        MSTP_IN_delete_bridge(br);
+        free(br);
+    }
+}
+
+static void bench_teardown(void)
+{
+    bench_free_bridge(net.dut);
+    bench_free_bridge(net.peer);
+    net.dut = net.peer = NULL;
+    free(net.queue);
+    net.queue = NULL;
+}
+
+/* DUT and peer connected port-to-port, run until converged.
+ * peer_proto selects the kind of BPDUs the DUT receives. */
+static bool bench_setup_pair(int num_ports, int num_mstis,
+                             protocol_version_t peer_proto)
+{
+    tree_t *tree;
+    int t;
+
+    memset(&net, 0, sizeof(net));
+    net.num_ports = num_ports;
+    net.num_mstis = num_mstis;
+    net.queue_size = 2 * num_ports * BENCH_QUEUE_PER_PORT;
+    if(!(net.queue = malloc(net.queue_size * sizeof(*net.queue))))
+        return false;
+    /* peer first, so that DUT is not the root and has Alternate ports */
+    net.peer = bench_bridge(1, num_ports, num_mstis, peer_proto, false);
+    net.dut = bench_bridge(0, num_ports, num_mstis, protoMSTP, false);
+    if(!net.dut || !net.peer)
+        return false;
+    /* lower priority of the DUT, peer becomes root of all trees */
+    FOREACH_TREE_IN_BRIDGE(tree, net.dut)
+        MSTP_IN_set_msti_bridge_config(tree, 9);
+    net.deliver = true;
+    for(t = 0; t < num_ports; ++t)
+    {
+        MSTP_IN_set_port_enable(net.ports[t], true, BENCH_LINK_SPEED, 1);
+        MSTP_IN_set_port_enable(net.ports[num_ports + t], true,
+                                BENCH_LINK_SPEED, 1);
+    }
+    for(t = 0; t < 60; ++t)
+    {
+        bench_deliver();
+        MSTP_IN_one_second(net.dut);
+        MSTP_IN_one_second(net.peer);
+    }
+    bench_deliver();
+    net.deliver = false;
+    return true;
+}
+
+/* Single DUT, peer does not exist */
+static bool bench_setup_single(int num_ports, int num_mstis, bool up)
+{
+    int t;
+
+    memset(&net, 0, sizeof(net));
+    net.num_ports = num_ports;
+    net.num_mstis = num_mstis;
+    if(!(net.dut = bench_bridge(0, num_ports, num_mstis, protoMSTP, up)))
+        return false;
+    for(t = 0; t < 60; ++t)
+        MSTP_IN_one_second(net.dut);
+    return true;
+}
+
+/* Benchmarks. Each performs n operations. */
+
+static void bench_rx(unsigned long n)
+{
+    port_t **dut_ports = net.ports;
+    bench_bpdu_t *from_peer = net.last_tx + net.num_ports;
+    int i = 0;
+
+    while(n--)
+    {
+        MSTP_IN_rx_bpdu(dut_ports[i], &from_peer[i].bpdu, from_peer[i].size);
+        if(++i == net.num_ports)
+            i = 0;
+    }
+}
+
+static void bench_tx_mstp(unsigned long n)
+{
+    int i = 0;
+
+    while(n--)
+    {
+        txMstp(net.ports[i]);
+        if(++i == net.num_ports)
+            i = 0;
+    }
+}
+
+static void bench_converge(unsigned long n)
+{
+    net.deliver = true;
+    while(n--)
+    {
+        br_state_machines_begin(net.peer);
+        br_state_machines_begin(net.dut);
+        bench_deliver();
+    }
+    net.deliver = false;
+}
+
+static void bench_one_second(unsigned long n)
+{
+    while(n--)
+        MSTP_IN_one_second(net.dut);
+}
+
+static void bench_digest(unsigned long n)
+{
+    while(n--)
+        RecalcConfigDigest(net.dut);
+}
+
+/* Only creation is measured, deletion is excluded from the time */
+static unsigned long long created_ns;
+
+static inline unsigned long long clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_create_msti(unsigned long n)
+{
+    __u16 mstid = net.num_mstis + 1;
+    unsigned long long t;
+    unsigned long allocs, bytes;
+
+    while(n--)
+    {
+        t = clock_ns();
+        MSTP_IN_create_msti(net.dut, mstid);
+        created_ns += clock_ns() - t;
+        allocs = num_allocs;
+        bytes = alloc_bytes;
+        MSTP_IN_delete_msti(net.dut, mstid);
+        num_allocs = allocs;
+        alloc_bytes = bytes;
+    }
+}
+
+/* Cold start of a bridge: create it with all ports up and run the state
+ * machines until the first BPDUs are sent */
+static void bench_bring_up(unsigned long n)
+{
+    unsigned long long t;
+    bridge_t *br;
+
+    while(n--)
+    {
+        t = clock_ns();
+        br = bench_bridge(0, net.num_ports, net.num_mstis, protoMSTP, true);
+        created_ns += clock_ns() - t;
+        bench_free_bridge(br);
+    }
+}
+
+typedef enum
+{
+    SETUP_PAIR_STP,
+    SETUP_PAIR_RSTP,
+    SETUP_PAIR_MSTP,
+    SETUP_IDLE,
+    SETUP_BUSY,
+    SETUP_NONE,
+} bench_setup_t;
+
+typedef struct
+{
+    const char *name;
+    bench_setup_t setup;
+    void (*func)(unsigned long n);
+    int max_mstis;      /* create_msti needs room for one more */
+} bench_t;
+
+static const bench_t benchmarks[] =
+{
+    {"rx_bpdu_stp", SETUP_PAIR_STP, bench_rx, MAX_IMPLEMENTATION_MSTIS},
+    {"rx_bpdu_rst", SETUP_PAIR_RSTP, bench_rx, MAX_IMPLEMENTATION_MSTIS},
+    {"rx_bpdu_mst", SETUP_PAIR_MSTP, bench_rx, MAX_IMPLEMENTATION_MSTIS},
+    {"tx_mstp", SETUP_PAIR_MSTP, bench_tx_mstp, MAX_IMPLEMENTATION_MSTIS},
+    {"converge", SETUP_PAIR_MSTP, bench_converge, MAX_IMPLEMENTATION_MSTIS},
+    {"one_second_idle", SETUP_IDLE, bench_one_second, MAX_IMPLEMENTATION_MSTIS},
+    {"one_second_busy", SETUP_BUSY, bench_one_second, MAX_IMPLEMENTATION_MSTIS},
+    {"recalc_digest", SETUP_IDLE, bench_digest, MAX_IMPLEMENTATION_MSTIS},
+    {"create_msti", SETUP_IDLE, bench_create_msti,
+        MAX_IMPLEMENTATION_MSTIS - 1},
+    {"bring_up", SETUP_NONE, bench_bring_up, MAX_IMPLEMENTATION_MSTIS},
+};
+
+static unsigned long long min_time_ns = 200000000ULL;
+
+static bool bench_setup(bench_setup_t setup, int num_ports, int num_mstis)
+{
+    switch(setup)
+    {
+        case SETUP_PAIR_STP:
+            return bench_setup_pair(num_ports, num_mstis, protoSTP);
+        case SETUP_PAIR_RSTP:
+            return bench_setup_pair(num_ports, num_mstis, protoRSTP);
+        case SETUP_PAIR_MSTP:
+            return bench_setup_pair(num_ports, num_mstis, protoMSTP);
+        case SETUP_IDLE:
+            return bench_setup_single(num_ports, num_mstis, false);
+        case SETUP_BUSY:
+            return bench_setup_single(num_ports, num_mstis, true);
+        case SETUP_NONE:
+            memset(&net, 0, sizeof(net));
+            net.num_ports = num_ports;
+            net.num_mstis = num_mstis;
+            return true;
+    }
+    return false;
+}
+
+/* Run the benchmark with growing number of operations, until it takes
+ * at least min_time_ns */
+static void bench_run(const bench_t *b, int num_ports, int num_mstis)
+{
+    unsigned long long t, elapsed;
+    unsigned long n = 1, allocs, bytes, tx;
+
+    if(num_mstis > b->max_mstis)
+        return;
+    if(!bench_setup(b->setup, num_ports, num_mstis))
+    {
+        fprintf(stderr, "%s: setup failed\n", b->name);
+        bench_teardown();
+        return;
+    }
+
+    while(true)
+    {
+        num_allocs = alloc_bytes = 0;
+        created_ns = 0;
+        tx = net.tx_count;
+        t = clock_ns();
+        b->func(n);
+        elapsed = clock_ns() - t;
+        if((bench_create_msti == b->func) || (bench_bring_up == b->func))
+            elapsed = created_ns;
+        if((elapsed >= min_time_ns) || (n >= (1UL << 30)))
+            break;
+        /* aim at 1.2 * min_time, but do not grow more than 100 times */
+        if(elapsed * 100 <= min_time_ns)
+            n *= 100;
+        else
+            n = n * min_time_ns / elapsed * 6 / 5 + 1;
+    }
+    allocs = num_allocs;
+    bytes = alloc_bytes;
+    tx = net.tx_count - tx;
+
+    printf("%s,%d,%d,%lu,%.1f,%.3f,%.1f,%.3f\n", b->name, num_ports,
+           num_mstis, n, (double)elapsed / n, (double)allocs / n,
+           (double)bytes / n, (double)tx / n);
+    fflush(stdout);
+    bench_teardown();
+}
+
+/* Parse comma separated list of numbers */
+static int parse_list(char *s, int *list, int max, int limit)
+{
+    char *tok, *saveptr;
+    int n = 0;
+
+    for(tok = strtok_r(s, ",", &saveptr); tok && (n < max);
+        tok = strtok_r(NULL, ",", &saveptr))
+    {
+        list[n] = atoi(tok);
+        if((list[n] < 0) || (list[n] > limit))
+            return -1;
+        ++n;
+    }
+    return n;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "Usage: mstpbench [-p ports,...] [-m mstis,...] [-b name] [-t ms]\n"
+        "  -p  port counts (default 8,64)\n"
+        "  -m  MSTI counts (default 0,4,16,63)\n"
+        "  -b  run only benchmarks whose name starts with name\n"
+        "  -t  minimum run time of each benchmark, ms (default 200)\n"
+        "Output is CSV: benchmark,ports,mstis,iterations,ns_per_op,"
+        "allocs_per_op,bytes_per_op,tx_per_op\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int port_list[16] = {8, 64}, msti_list[16] = {0, 4, 16, 63};
+    int num_port_list = 2, num_msti_list = 4;
+    const char *only = NULL;
+    int c, i, p, m;
+
+    log_level = LOG_LEVEL_NONE;
+    stub_hooks.tx_bpdu = bench_tx_bpdu;
+
+    while((c = getopt(argc, argv, "p:m:b:t:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'p':
+                num_port_list = parse_list(optarg, port_list,
+                                           COUNT_OF(port_list),
+                                           BENCH_MAX_PORTS);
+                if(num_port_list <= 0)
+                {
+                    usage();
+                    return 2;
+                }
+                break;
+            case 'm':
+                num_msti_list = parse_list(optarg, msti_list,
+                                           COUNT_OF(msti_list),
+                                           MAX_IMPLEMENTATION_MSTIS);
+                if(num_msti_list <= 0)
+                {
+                    usage();
+                    return 2;
+                }
+                break;
+            case 'b':
+                only = optarg;
+                break;
+            case 't':
+                min_time_ns = atoi(optarg) * 1000000ULL;
+                break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+
+    printf("benchmark,ports,mstis,iterations,ns_per_op,allocs_per_op,"
+           "bytes_per_op,tx_per_op\n");
+    for(i = 0; i < COUNT_OF(benchmarks); ++i)
+    {
+        if(only && strncmp(benchmarks[i].name, only, strlen(only)))
+            continue;
+        for(p = 0; p < num_port_list; ++p)
+        {
+            if(port_list[p] < 1)
+                continue;
+            for(m = 0; m < num_msti_list; ++m)
+                bench_run(benchmarks + i, port_list[p], msti_list[m]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,777 @@
+/*
+ * mstpsim.c   In-process network simulator for the MSTP state machines.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ * mstp.c is linked against a simulated MSTP_OUT_* layer: N bridge_t
+ * instances are connected with point-to-point links, BPDUs sent by
+ * MSTP_OUT_tx_bpdu are delivered to MSTP_IN_rx_bpdu of the peer port and
+ * a virtual clock drives MSTP_IN_one_second. Nothing touches the system:
+ * there are no sockets, no netlink and no kernel bridge.
+ *
+ * Time is counted in virtual milliseconds. Every BPDU takes hop_delay ms
+ * from MSTP_OUT_tx_bpdu to MSTP_IN_rx_bpdu of the peer, so convergence
+ * time includes the BPDU round trips, and BPDUs are delivered in the
+ * order they were sent. MSTP_IN_one_second runs on every full second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <asm/byteorder.h>
+#include <linux/if_bridge.h>
+
+#include "mstp.h"
+#include "log.h"
+#include "mstpstubs.h"
+
+#define SIM_LINK_SPEED  1000 /* Mb/s, all links are full duplex */
+
+typedef struct
+{
+    port_t *prt;
+    int bridge;     /* index of the owner bridge */
+    bool up;
+} sim_port_t;
+
+/* Ports are created in pairs: link k connects ports 2k and 2k+1 */
+#define SIM_PEER(i) ((i) ^ 1)
+
+typedef struct
+{
+    int dst;        /* index of the receiving sim port */
+    unsigned int due; /* delivery time */
+    int size;
+    bpdu_t bpdu;
+} sim_bpdu_t;
+
+/* Counters of one simulation phase (one "converge" or "run" command) */
+typedef struct
+{
+    unsigned long bpdus;        /* BPDUs delivered */
+    unsigned long dropped;      /* BPDUs sent to a link which went down */
+    unsigned long ticks;        /* MSTP_IN_one_second calls */
+    unsigned long state_changes;
+    unsigned long flushes;
+    unsigned long long rx_ns;   /* time spent in MSTP_IN_rx_bpdu */
+    unsigned long long tick_ns; /* time spent in MSTP_IN_one_second */
+    unsigned long long cpu_ns;  /* CPU time of the whole phase */
+} sim_stats_t;
+
+static bridge_t **bridges;
+static int num_bridges;
+static int *bridge_ports; /* number of ports in each bridge */
+
+static sim_port_t *ports;
+static int num_ports, ports_size;
+
+static sim_bpdu_t *queue;
+static int queue_head, queue_tail, queue_size;
+
+static int num_mstis;
+static unsigned int now;         /* virtual clock, ms */
+static unsigned int last_change; /* time of the last role/state change */
+static __u8 *prev_roles;         /* role and state of each ptp, last tick */
+static int prev_roles_size;
+static sim_stats_t stats;
+
+static unsigned int hop_delay = 1; /* ms */
+static unsigned int settle_time = 10;
+static unsigned int timeout = 600;
+static int max_hops = 0;
+static bool own_regions = false;
+static bool pending_shutdown = false;
+
+static void sim_log_prefix(void)
+{
+    printf("%4u.%03u ", now / 1000, now % 1000);
+}
+
+static inline unsigned long long clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Simulated MSTP_OUT_* layer, the hooks of mstpstubs.c */
+
+static void sim_state_changed(per_tree_port_t *ptp)
+{
+    ++(stats.state_changes);
+    last_change = now;
+}
+
+static void sim_flush(per_tree_port_t *ptp)
+{
+    ++(stats.flushes);
+}
+
+static void sim_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
+{
+    int src = prt->sysdeps.if_index;
+    sim_bpdu_t *q;
+
+    if(!ports[src].up || !ports[SIM_PEER(src)].up)
+    {
+        ++(stats.dropped);
+        return;
+    }
+    if(queue_tail == queue_size)
+    {
+        if(queue_head)
+        { /* reuse the space of already delivered BPDUs */
+            memmove(queue, queue + queue_head,
+                    (queue_tail - queue_head) * sizeof(*queue));
+            queue_tail -= queue_head;
+            queue_head = 0;
+        }
+        else
+        {
+            q = realloc(queue, (queue_size * 2 + 64) * sizeof(*queue));
+            if(!q)
+            {
+                ERROR("Out of memory, BPDU dropped");
+                ++(stats.dropped);
+                return;
+            }
+            queue = q;
+            queue_size = queue_size * 2 + 64;
+        }
+    }
+    q = queue + queue_tail++;
+    q->dst = SIM_PEER(src);
+    q->due = now + hop_delay;
+    q->size = size;
+    memcpy(&q->bpdu, bpdu, size);
+}
+
+/* BPDU Guard: the daemon sets the interface down, do it after the current
+ * state machines run has finished. */
+static void sim_shutdown_port(port_t *prt)
+{
+    ports[prt->sysdeps.if_index].up = false;
+    pending_shutdown = true;
+}
+
+/* Topology */
+
+static bool sim_create_bridges(int count)
+{
+    CIST_BridgeConfig cfg;
+    tree_t *tree;
+    bridge_t *br;
+    __u8 macaddr[ETH_ALEN];
+    int i, mstid;
+
+    TST(bridges = calloc(count, sizeof(*bridges)), false);
+    TST(bridge_ports = calloc(count, sizeof(*bridge_ports)), false);
+    for(i = 0; i < count; ++i)
+    {
+        TST(br = calloc(1, sizeof(*br)), false);
+        snprintf(br->sysdeps.name, IFNAMSIZ, "b%d", i);
+        macaddr[0] = 0x02;
+        macaddr[1] = macaddr[2] = macaddr[3] = 0;
+        macaddr[4] = (i + 1) >> 8;
+        macaddr[5] = i + 1;
+        memcpy(br->sysdeps.macaddr, macaddr, ETH_ALEN);
+        br->sysdeps.up = true;
+        TST(MSTP_IN_bridge_create(br, macaddr), false);
+        bridges[i] = br;
+        ++num_bridges;
+
+        if(max_hops)
+        {
+            memset(&cfg, 0, sizeof(cfg));
+            cfg.max_hops = max_hops;
+            cfg.set_max_hops = true;
+            TST(0 == MSTP_IN_set_cist_bridge_config(br, &cfg), false);
+        }
+        if(own_regions)
+        {
+            __u8 name[CONFIGURATION_NAME_LEN];
+
+            memset(name, 0, sizeof(name));
+            snprintf((char *)name, sizeof(name), "region%d", i);
+            MSTP_IN_set_mst_config_id(br, 0, name);
+        }
+        /* MSTI n serves FID n, which serves VID n. MSTI priorities are
+         * random, so that each MSTI has its own active topology. */
+        for(mstid = 1; mstid <= num_mstis; ++mstid)
+        {
+            TST(MSTP_IN_create_msti(br, mstid), false);
+            TST(MSTP_IN_set_fid2mstid(br, mstid, mstid), false);
+            TST(MSTP_IN_set_vid2fid(br, mstid, mstid), false);
+        }
+        list_for_each_entry(tree, &br->trees, bridge_list)
+        {
+            if(tree->MSTID)
+                MSTP_IN_set_msti_bridge_config(tree, rand() % 16);
+        }
+    }
+    return true;
+}
+
+static int sim_create_port(int b)
+{
+    bridge_t *br = bridges[b];
+    sim_port_t *p;
+    port_t *prt;
+
+    if(num_ports == ports_size)
+    {
+        TST(p = realloc(ports, (ports_size * 2 + 64) * sizeof(*ports)), -1);
+        ports = p;
+        ports_size = ports_size * 2 + 64;
+    }
+    TST(prt = MSTP_IN_alloc_port(br), -1);
+    prt->sysdeps.if_index = num_ports;
+    snprintf(prt->sysdeps.name, IFNAMSIZ, "b%dp%d", b, bridge_ports[b] + 1);
+    prt->sysdeps.up = true;
+    prt->sysdeps.speed = SIM_LINK_SPEED;
+    prt->sysdeps.duplex = 1;
+    if(!MSTP_IN_port_create_and_add_tail(prt, ++bridge_ports[b]))
+    {
+        MSTP_IN_free_port(prt);
+        return -1;
+    }
+    p = ports + num_ports;
+    p->prt = prt;
+    p->bridge = b;
+    p->up = false;
+    return num_ports++;
+}
+
+static bool sim_connect(int b1, int b2)
+{
+    if(b1 == b2)
+        return true;
+    return (0 <= sim_create_port(b1)) && (0 <= sim_create_port(b2));
+}
+
+static bool sim_set_port(int i, bool up)
+{
+    if(ports[i].up == up)
+        return false;
+    ports[i].up = up;
+    MSTP_IN_set_port_enable(ports[i].prt, up, SIM_LINK_SPEED, 1);
+    return true;
+}
+
+static void sim_set_link(int link, bool up)
+{
+    sim_set_port(2 * link, up);
+    sim_set_port(2 * link + 1, up);
+}
+
+static int sim_find_link(int b1, int b2)
+{
+    int i;
+
+    for(i = 0; i < num_ports; i += 2)
+    {
+        if(((ports[i].bridge == b1) && (ports[i + 1].bridge == b2))
+           || ((ports[i].bridge == b2) && (ports[i + 1].bridge == b1)))
+            return i / 2;
+    }
+    return -1;
+}
+
+/* Fat tree of k-port switches: k*k/4 core, k pods of k/2 aggregation and
+ * k/2 edge switches. */
+static bool sim_build_fattree(int k)
+{
+    int pods = k, half = k / 2, core = half * half;
+    int pod, a, e, c, agg_base, edge_base;
+
+    if((k < 2) || (k % 2))
+    {
+        fprintf(stderr, "fattree size must be even\n");
+        return false;
+    }
+    if(!sim_create_bridges(core + pods * k))
+        return false;
+    for(pod = 0; pod < pods; ++pod)
+    {
+        agg_base = core + pod * k;
+        edge_base = agg_base + half;
+        for(a = 0; a < half; ++a)
+        {
+            for(c = 0; c < half; ++c)
+                TST(sim_connect(agg_base + a, a * half + c), false);
+            for(e = 0; e < half; ++e)
+                TST(sim_connect(agg_base + a, edge_base + e), false);
+        }
+    }
+    return true;
+}
+
+static bool sim_build(const char *topology, int n)
+{
+    int i, j;
+
+    if(!strcmp(topology, "fattree"))
+        return sim_build_fattree(n);
+    if(n < 2)
+    {
+        fprintf(stderr, "Need at least 2 bridges\n");
+        return false;
+    }
+    if(!sim_create_bridges(n))
+        return false;
+    if(!strcmp(topology, "line") || !strcmp(topology, "ring"))
+    {
+        for(i = 1; i < n; ++i)
+            TST(sim_connect(i - 1, i), false);
+        if(!strcmp(topology, "ring") && (n > 2))
+            TST(sim_connect(n - 1, 0), false);
+    }
+    else if(!strcmp(topology, "mesh"))
+    {
+        for(i = 0; i < n; ++i)
+            for(j = i + 1; j < n; ++j)
+                TST(sim_connect(i, j), false);
+    }
+    else if(!strcmp(topology, "random"))
+    {
+        /* random spanning tree plus n/2 redundant links */
+        for(i = 1; i < n; ++i)
+            TST(sim_connect(rand() % i, i), false);
+        for(i = 0; i < n / 2; ++i)
+            TST(sim_connect(rand() % n, rand() % n), false);
+    }
+    else
+    {
+        fprintf(stderr, "Unknown topology %s\n", topology);
+        return false;
+    }
+    return true;
+}
+
+/* Running */
+
+/* Deliver the BPDUs which are due, those sent meanwhile are due later */
+static void sim_deliver(void)
+{
+    sim_bpdu_t b;
+    unsigned long long t;
+    int i;
+
+    while((queue_head < queue_tail) && (queue[queue_head].due <= now))
+    {
+        /* tx during rx may move the queue, so work on a copy */
+        b = queue[queue_head++];
+        if(!ports[b.dst].up || !ports[SIM_PEER(b.dst)].up)
+        {
+            ++(stats.dropped);
+            continue;
+        }
+        t = clock_ns(CLOCK_MONOTONIC);
+        MSTP_IN_rx_bpdu(ports[b.dst].prt, &b.bpdu, b.size);
+        stats.rx_ns += clock_ns(CLOCK_MONOTONIC) - t;
+        ++(stats.bpdus);
+    }
+    if(queue_head == queue_tail)
+        queue_head = queue_tail = 0;
+
+    if(pending_shutdown)
+    {
+        pending_shutdown = false;
+        for(i = 0; i < num_ports; ++i)
+        {
+            if(!ports[i].up && ports[i].prt->portEnabled)
+                MSTP_IN_set_port_enable(ports[i].prt, false, 0, 0);
+        }
+    }
+}
+
+/* Role changes are not counted in MSTP_OUT_notify, compare them with the
+ * previous tick. */
+static void sim_check_roles(void)
+{
+    per_tree_port_t *ptp;
+    int i, n = 0, size = num_ports * (num_mstis + 1) * 2;
+    __u8 *p;
+
+    if(size > prev_roles_size)
+    {
+        if(!(p = realloc(prev_roles, size)))
+            return;
+        memset(p + prev_roles_size, 0xFF, size - prev_roles_size);
+        prev_roles = p;
+        prev_roles_size = size;
+    }
+    for(i = 0; i < num_ports; ++i)
+    {
+        list_for_each_entry(ptp, &ports[i].prt->trees, port_list)
+        {
+            if((prev_roles[n] != ptp->role) || (prev_roles[n + 1] != ptp->state))
+            {
+                prev_roles[n] = ptp->role;
+                prev_roles[n + 1] = ptp->state;
+                last_change = now;
+            }
+            n += 2;
+        }
+    }
+}
+
+/* Advance the clock to the next BPDU delivery or full second, whichever
+ * comes first, but not beyond end */
+static void sim_step(unsigned int end)
+{
+    unsigned long long t;
+    unsigned int next = (now / 1000 + 1) * 1000;
+    int i;
+
+    if((queue_head < queue_tail) && (queue[queue_head].due < next))
+        next = queue[queue_head].due;
+    now = (next < end) ? next : end;
+    sim_deliver();
+    if(0 == now % 1000)
+    {
+        for(i = 0; i < num_bridges; ++i)
+        {
+            t = clock_ns(CLOCK_MONOTONIC);
+            MSTP_IN_one_second(bridges[i]);
+            stats.tick_ns += clock_ns(CLOCK_MONOTONIC) - t;
+            ++(stats.ticks);
+        }
+    }
+    sim_check_roles();
+}
+
+static int sim_find(int *parent, int x)
+{
+    while(parent[x] != x)
+        x = parent[x] = parent[parent[x]];
+    return x;
+}
+
+static int port_state(int i, __u16 mstid)
+{
+    per_tree_port_t *ptp;
+
+    list_for_each_entry(ptp, &ports[i].prt->trees, port_list)
+    {
+        if(ptp->MSTID == __cpu_to_be16(mstid))
+            return ptp->state;
+    }
+    return BR_STATE_DISABLED;
+}
+
+/* Check that forwarding ports of the tree form a spanning tree of every
+ * connected part of the network. Returns number of problems found. */
+static int sim_verify_tree(__u16 mstid)
+{
+    int *phys, *active;
+    int i, a, b, loops = 0, phys_parts = num_bridges, parts = num_bridges;
+
+    phys = malloc(num_bridges * sizeof(int));
+    active = malloc(num_bridges * sizeof(int));
+    if(!phys || !active)
+    {
+        free(phys);
+        free(active);
+        return 0;
+    }
+    for(i = 0; i < num_bridges; ++i)
+        phys[i] = active[i] = i;
+    for(i = 0; i < num_ports; i += 2)
+    {
+        if(!ports[i].up || !ports[i + 1].up)
+            continue;
+        a = sim_find(phys, ports[i].bridge);
+        b = sim_find(phys, ports[i + 1].bridge);
+        if(a != b)
+        {
+            phys[a] = b;
+            --phys_parts;
+        }
+        if((BR_STATE_FORWARDING != port_state(i, mstid))
+           || (BR_STATE_FORWARDING != port_state(i + 1, mstid)))
+            continue;
+        a = sim_find(active, ports[i].bridge);
+        b = sim_find(active, ports[i + 1].bridge);
+        if(a == b)
+            ++loops;
+        else
+        {
+            active[a] = b;
+            --parts;
+        }
+    }
+    free(phys);
+    free(active);
+
+    if(loops)
+        printf("  tree %hu: LOOP, %d redundant forwarding links\n",
+               mstid, loops);
+    if(parts != phys_parts)
+        printf("  tree %hu: PARTITIONED, %d active parts, %d physical\n",
+               mstid, parts, phys_parts);
+    return loops + (parts != phys_parts);
+}
+
+static void sim_report(const char *what, unsigned int start,
+                       bool converged)
+{
+    int mstid, problems = 0;
+
+    if(converged)
+        printf("%s: converged in %u.%03u s", what,
+               (last_change - start) / 1000, (last_change - start) % 1000);
+    else
+        printf("%s: %u s", what, (now - start) / 1000);
+    printf(", %lu BPDUs, %lu dropped, %lu state changes, %lu flushes\n",
+           stats.bpdus, stats.dropped, stats.state_changes, stats.flushes);
+    printf("  cpu %.3f ms, rx %.0f ns/BPDU, one_second %.0f ns/bridge\n",
+           stats.cpu_ns / 1e6,
+           stats.bpdus ? (double)stats.rx_ns / stats.bpdus : 0.0,
+           stats.ticks ? (double)stats.tick_ns / stats.ticks : 0.0);
+    for(mstid = 0; mstid <= num_mstis; ++mstid)
+        problems += sim_verify_tree(mstid);
+    if(!problems)
+        printf("  active topology: ok\n");
+}
+
+/* Run for secs virtual seconds, or until the network is stable for
+ * settle_time seconds if secs == 0 */
+static bool sim_run(const char *what, unsigned int secs)
+{
+    unsigned int start = now;
+    unsigned int end = start + 1000 * (secs ? secs : timeout);
+    unsigned long long cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    bool converged = false;
+
+    memset(&stats, 0, sizeof(stats));
+    /* changes made by the command itself count as the first change */
+    last_change = now;
+    while(now < end)
+    {
+        sim_step(end);
+        if(!secs && (now - last_change >= 1000 * settle_time))
+        {
+            converged = true;
+            break;
+        }
+    }
+    stats.cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    sim_report(what, start, converged);
+    return secs || converged;
+}
+
+/* Script commands:
+ *   converge                   run until stable
+ *   run <secs>                 run for the given time
+ *   link up|down <b1> <b2>     change state of the link between b1 and b2
+ *   bridge up|down <b>         change state of all links of the bridge
+ *   priority <b> <mstid> <p>   set bridge priority (0..15) for the tree
+ */
+static int sim_command(char *cmd)
+{
+    char word[16], op[16];
+    int a, b, p, i, link, n;
+    bool up;
+    tree_t *tree;
+
+    while((*cmd == ' ') || (*cmd == '\t'))
+        ++cmd;
+    if(!*cmd || (*cmd == '#') || (*cmd == '\n'))
+        return 0;
+    printf("%4u.%03u > %s%s", now / 1000, now % 1000, cmd, strchr(cmd, '\n') ? "" : "\n");
+
+    n = sscanf(cmd, "%15s %15s %d %d", word, op, &a, &b);
+    up = (n >= 2) && !strcmp(op, "up");
+    if(!strcmp(word, "converge"))
+        return sim_run("converge", 0) ? 0 : 1;
+    if(!strcmp(word, "run") && (1 == sscanf(cmd, "run %d", &a)) && (a > 0))
+    {
+        sim_run("run", a);
+        return 0;
+    }
+    if(!strcmp(word, "link") && (4 == n) && (up || !strcmp(op, "down")))
+    {
+        if(0 > (link = sim_find_link(a, b)))
+        {
+            fprintf(stderr, "No link between b%d and b%d\n", a, b);
+            return -1;
+        }
+        sim_set_link(link, up);
+        return 0;
+    }
+    if(!strcmp(word, "bridge") && (3 == n) && (up || !strcmp(op, "down"))
+       && (a >= 0) && (a < num_bridges))
+    {
+        for(i = 0; i < num_ports; i += 2)
+        {
+            if((ports[i].bridge == a) || (ports[i + 1].bridge == a))
+                sim_set_link(i / 2, up);
+        }
+        return 0;
+    }
+    if((3 == sscanf(cmd, "priority %d %d %d", &a, &b, &p))
+       && (a >= 0) && (a < num_bridges))
+    {
+        list_for_each_entry(tree, &bridges[a]->trees, bridge_list)
+        {
+            if(tree->MSTID == __cpu_to_be16(b))
+            {
+                return MSTP_IN_set_msti_bridge_config(tree, p) ? -1 : 0;
+            }
+        }
+        fprintf(stderr, "No tree %d in b%d\n", b, a);
+        return -1;
+    }
+    fprintf(stderr, "Bad command: %s", cmd);
+    return -1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "Usage: mstpsim [options] [-e commands] [-f script]\n"
+        "  -t line|ring|mesh|random|fattree  topology (default ring)\n"
+        "  -n N        number of bridges, or k for fattree (default 8)\n"
+        "  -m N        number of MSTIs (default 0)\n"
+        "  -H N        MaxHops (6..40)\n"
+        "  -R          every bridge is in its own MST region\n"
+        "  -s N        random seed (default 1)\n"
+        "  -d N        BPDU delay per hop in ms (default 1)\n"
+        "  -w N        seconds without changes to consider converged (10)\n"
+        "  -T N        give up converging after N seconds (600)\n"
+        "  -v N        log level\n"
+        "  -e cmds     commands separated by ';'\n"
+        "  -f file     commands, one per line\n"
+        "Commands: converge | run <secs> | link up|down <b1> <b2> |\n"
+        "          bridge up|down <b> | priority <b> <mstid> <0..15>\n"
+        "Without commands the network is brought up and run to convergence.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *topology = "ring", *commands = NULL, *script = NULL;
+    char line[256], *cmds, *cmd, *saveptr;
+    int c, i, n = 8, r = 0;
+    FILE *f;
+
+    stub_hooks.log_prefix = sim_log_prefix;
+    stub_hooks.state_changed = sim_state_changed;
+    stub_hooks.flush = sim_flush;
+    stub_hooks.tx_bpdu = sim_tx_bpdu;
+    stub_hooks.shutdown_port = sim_shutdown_port;
+
+    while((c = getopt(argc, argv, "t:n:m:H:Rs:d:w:T:v:e:f:h")) != -1)
+    {
+        switch(c)
+        {
+            case 't':
+                topology = optarg;
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'm':
+                num_mstis = atoi(optarg);
+                if((num_mstis < 0) || (num_mstis > MAX_IMPLEMENTATION_MSTIS))
+                {
+                    fprintf(stderr, "Too many MSTIs\n");
+                    return 2;
+                }
+                break;
+            case 'H':
+                max_hops = atoi(optarg);
+                break;
+            case 'R':
+                own_regions = true;
+                break;
+            case 's':
+                srand(atoi(optarg));
+                break;
+            case 'd':
+                if(1 > atoi(optarg))
+                {
+                    fprintf(stderr, "BPDU delay must be at least 1 ms\n");
+                    return 2;
+                }
+                hop_delay = atoi(optarg);
+                break;
+            case 'w':
+                settle_time = atoi(optarg);
+                break;
+            case 'T':
+                timeout = atoi(optarg);
+                break;
+            case 'v':
+                log_level = atoi(optarg);
+                break;
+            case 'e':
+                commands = optarg;
+                break;
+            case 'f':
+                script = optarg;
+                break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+
+    if(!sim_build(topology, n))
+        return 2;
+    printf("%s: %d bridges, %d links, %d MSTIs\n",
+           topology, num_bridges, num_ports / 2, num_mstis);
+
+    for(i = 0; i < num_bridges; ++i)
+        MSTP_IN_set_bridge_enable(bridges[i], true);
+    for(i = 0; i < num_ports / 2; ++i)
+        sim_set_link(i, true);
+
+    if(commands)
+    {
+        if(!(cmds = strdup(commands)))
+            return 2;
+        for(cmd = strtok_r(cmds, ";", &saveptr); cmd && (0 <= r);
+            cmd = strtok_r(NULL, ";", &saveptr))
+            r |= sim_command(cmd);
+        free(cmds);
+    }
+    else if(script)
+    {
+        if(!(f = fopen(script, "r")))
+        {
+            perror(script);
+            return 2;
+        }
+        while((0 <= r) && fgets(line, sizeof(line), f))
+            r |= sim_command(line);
+        fclose(f);
+    }
+    else
+        r = sim_command("converge");
+
+    for(i = 0; i < num_bridges; ++i)
+    {
+        MSTP_IN_delete_bridge(bridges[i]);
+        free(bridges[i]);
+    }
+    free(bridges);
+    free(bridge_ports);
+    free(ports);
+    free(queue);
+    free(prev_roles);
+
+#if defined(PTP_BITMAPS_CHECK) || defined(PRIO_KEYS_CHECK)
+    printf("cross-checks: %lu mismatches\n", mstp_check_mismatches);
+    if(mstp_check_mismatches)
+        return 3;
+#endif
+    /* 0 - ok, 1 - did not converge, 2 - error, 3 - cross-check mismatch */
+    return (0 > r) ? 2 : r;
+}
@@ -0,0 +1,103 @@
+/*
+ * mstpstubs.c   Stand-ins for the daemon around mstp.c, for the tools
+ *               which run the state machines without it.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "mstpstubs.h"
+#include "log.h"
+#include "driver.h"
+
+stub_hooks_t stub_hooks;
+
+int log_level = LOG_LEVEL_ERROR;
+__thread int ctl_in_handler = 0;
+
+void Dprintf(int level, const char *fmt, ...)
+{
+    va_list ap;
+
+    if(level > log_level)
+        return;
+    if(stub_hooks.log_prefix)
+        stub_hooks.log_prefix();
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+void _ctl_err_log(char *fmt, ...)
+{
+}
+
+int set_mstp_root_port(int instance_num, int value, int touch)
+{
+    return 0;
+}
+
+bool driver_create_bridge(bridge_t *br, __u8 *macaddr)
+{
+    return true;
+}
+
+bool driver_create_port(port_t *prt, __u16 portno)
+{
+    return true;
+}
+
+void driver_delete_bridge(bridge_t *br)
+{
+}
+
+void driver_delete_port(port_t *prt)
+{
+}
+
+void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
+{
+    if(ptp->state == new_state)
+        return;
+    ptp->state = new_state;
+    if(stub_hooks.state_changed)
+        stub_hooks.state_changed(ptp);
+}
+
+void MSTP_OUT_flush_all_fids(per_tree_port_t *ptp)
+{
+    if(stub_hooks.flush)
+        stub_hooks.flush(ptp);
+    MSTP_IN_all_fids_flushed(ptp);
+}
+
+void MSTP_OUT_set_ageing_time(port_t *prt, unsigned int ageingTime)
+{
+}
+
+void MSTP_OUT_set_bridge_ageing_time(bridge_t *br, unsigned int ageingTime)
+{
+}
+
+void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
+{
+    if(stub_hooks.tx_bpdu)
+        stub_hooks.tx_bpdu(prt, bpdu, size);
+}
+
+void MSTP_OUT_shutdown_port(port_t *prt)
+{
+    if(stub_hooks.shutdown_port)
+        stub_hooks.shutdown_port(prt);
+}
+
+void MSTP_OUT_notify(tree_t *tree, port_t *prt, mstp_event_t event,
+                     unsigned int arg)
+{
+}
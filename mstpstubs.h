@@ -0,0 +1,34 @@
+/*
+ * mstpstubs.h   Stand-ins for the daemon around mstp.c, for the tools
+ *               which run the state machines without it.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef MSTP_STUBS_H
+#define MSTP_STUBS_H
+
+#include "mstp.h"
+
+/* mstpstubs.c provides the logging, driver and MSTP_OUT_* functions mstp.c
+ * calls. Port states are set and FIDs are flushed at once, everything
+ * else is dropped. The tools (mstpsim, mstpbench, mstptest) set the hooks
+ * they need, unset hooks are not called. */
+typedef struct
+{
+    /* Printed before each message which is logged */
+    void (*log_prefix)(void);
+    /* After the state of the port in the tree has changed */
+    void (*state_changed)(per_tree_port_t *ptp);
+    /* Before the flush is signalled to the state machines */
+    void (*flush)(per_tree_port_t *ptp);
+    void (*tx_bpdu)(port_t *prt, bpdu_t *bpdu, int size);
+    void (*shutdown_port)(port_t *prt);
+} stub_hooks_t;
+
+extern stub_hooks_t stub_hooks;
+
+#endif /* MSTP_STUBS_H */
@@ -0,0 +1,255 @@
+/*
+ * mstptest.c   Unit tests for the priority vector comparisons of mstp.c.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ * mstp.c is included here with the cross-checks compiled in, so that the
+ * packed priority keys (betterorsamePriority, samePriorityAndTimers) can
+ * be compared with the field-by-field reference implementations and with
+ * the expected results of boundary vectors. Run by "make check".
+ */
+
+#define PTP_BITMAPS_CHECK
+#define PRIO_KEYS_CHECK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mempool.c"
+#include "mstp.c"
+
+/* Random vectors over a few values per field, for many ties */
+#define TEST_RANDOM_PAIRS   200000
+
+static unsigned int tests, failures;
+
+static bridge_identifier_t bid(__u16 prio, __u64 mac)
+{
+    bridge_identifier_t id;
+
+    id.u = __cpu_to_be64(((__u64)prio << 48) | (mac & 0xFFFFFFFFFFFFULL));
+    return id;
+}
+
+/* Vector with every field set, the test cases change one or two of them */
+static port_priority_vector_t vec(void)
+{
+    port_priority_vector_t v;
+
+    memset(&v, 0, sizeof(v));
+    v.RootID = bid(0x8000, 0x020000000001ULL);
+    v.ExtRootPathCost = __cpu_to_be32(20000);
+    v.RRootID = bid(0x8000, 0x020000000002ULL);
+    v.IntRootPathCost = __cpu_to_be32(20000);
+    v.DesignatedBridgeID = bid(0x8000, 0x020000000003ULL);
+    v.DesignatedPortID = __cpu_to_be16(0x8001);
+    return v;
+}
+
+static void check(const char *name, bool got, bool expected)
+{
+    ++tests;
+    if(got == expected)
+        return;
+    ++failures;
+    printf("FAIL %s: got %d, expected %d\n", name, got, expected);
+}
+
+/* betterorsamePriority of v1 against v2 and of v2 against v1, by key and
+ * by fields */
+static void better(const char *name, port_priority_vector_t v1,
+                   port_priority_vector_t v2, __u16 pId1, __u16 pId2,
+                   bool cist, bool expected12, bool expected21)
+{
+    port_identifier_t p1 = __cpu_to_be16(pId1), p2 = __cpu_to_be16(pId2);
+    char what[128];
+
+    snprintf(what, sizeof(what), "%s (key 1-2)", name);
+    check(what, betterorsamePriority(&v1, &v2, p1, p2, cist), expected12);
+    snprintf(what, sizeof(what), "%s (key 2-1)", name);
+    check(what, betterorsamePriority(&v2, &v1, p2, p1, cist), expected21);
+    snprintf(what, sizeof(what), "%s (fields 1-2)", name);
+    check(what, betterorsamePriority_by_fields(&v1, &v2, p1, p2, cist),
+          expected12);
+    snprintf(what, sizeof(what), "%s (fields 2-1)", name);
+    check(what, betterorsamePriority_by_fields(&v2, &v1, p2, p1, cist),
+          expected21);
+}
+
+static void same(const char *name, port_priority_vector_t v1,
+                 port_priority_vector_t v2, bool cist, bool expected)
+{
+    times_t t;
+    char what[128];
+
+    memset(&t, 0, sizeof(t));
+    snprintf(what, sizeof(what), "%s (key)", name);
+    check(what, samePriorityAndTimers(&v1, &v2, &t, &t, cist), expected);
+    snprintf(what, sizeof(what), "%s (fields)", name);
+    check(what, samePriority_by_fields(&v1, &v2, cist), expected);
+}
+
+static void test_boundaries(void)
+{
+    port_priority_vector_t a = vec(), b = vec();
+
+    better("identical", a, b, 0x8001, 0x8001, true, true, true);
+
+    b.ExtRootPathCost = __cpu_to_be32(20001);
+    better("equal roots, external cost", a, b, 0, 0, true, true, false);
+    a.ExtRootPathCost = __cpu_to_be32(0x00FFFFFF);
+    b.ExtRootPathCost = __cpu_to_be32(0x01000000);
+    better("external cost byte carry", a, b, 0, 0, true, true, false);
+    a.ExtRootPathCost = __cpu_to_be32(0x7FFFFFFF);
+    b.ExtRootPathCost = __cpu_to_be32(0x80000000);
+    better("external cost sign bit", a, b, 0, 0, true, true, false);
+
+    a = vec(); b = vec();
+    a.RootID = bid(0x7000, 0xFFFFFFFFFFFFULL);
+    b.RootID = bid(0x8000, 0x000000000000ULL);
+    better("root priority over address", a, b, 0, 0, true, true, false);
+    a.RootID = bid(0x8000, 0x010000000000ULL);
+    b.RootID = bid(0x8000, 0x00FFFFFFFFFFULL);
+    better("root address first byte", a, b, 0, 0, true, false, true);
+    /* A better root wins over a worse cost */
+    a.ExtRootPathCost = __cpu_to_be32(0);
+    b.ExtRootPathCost = __cpu_to_be32(0xFFFFFFFF);
+    better("root over external cost", a, b, 0, 0, true, false, true);
+
+    a = vec(); b = vec();
+    b.IntRootPathCost = __cpu_to_be32(20001);
+    better("equal regional roots, internal cost", a, b, 0, 0, true, true,
+           false);
+    a.IntRootPathCost = __cpu_to_be32(0xFFFFFFFE);
+    b.IntRootPathCost = __cpu_to_be32(0xFFFFFFFF);
+    better("internal cost maximum", a, b, 0, 0, true, true, false);
+    a.IntRootPathCost = b.IntRootPathCost;
+    a.RRootID = bid(0x8000, 0x020000000001ULL);
+    better("regional root over internal cost", a, b, 0, 0, true, true,
+           false);
+
+    a = vec(); b = vec();
+    b.DesignatedBridgeID = bid(0x8000, 0x020000000004ULL);
+    better("designated bridge", a, b, 0, 0, true, true, false);
+
+    a = vec(); b = vec();
+    b.DesignatedPortID = __cpu_to_be16(0x8002);
+    better("designated port", a, b, 0x8002, 0x8001, true, true, false);
+    b.DesignatedPortID = __cpu_to_be16(0x9001);
+    better("designated port priority", a, b, 0, 0, true, true, false);
+
+    a = vec(); b = vec();
+    better("port ID tie-break", a, b, 0x8001, 0x8002, true, true, false);
+    better("port ID priority tie-break", a, b, 0x8002, 0x9001, true, true,
+           false);
+    better("port ID tie-break, MSTI", a, b, 0x8001, 0x8002, false, true,
+           false);
+
+    /* MSTIs don't compare the CIST root and external cost */
+    a = vec(); b = vec();
+    a.RootID = bid(0x1000, 0x020000000001ULL);
+    b.ExtRootPathCost = __cpu_to_be32(0);
+    better("MSTI ignores CIST fields", a, b, 0, 0, false, true, true);
+    better("CIST compares CIST fields", a, b, 0, 0, true, true, false);
+    b.RRootID = bid(0x7000, 0x020000000002ULL);
+    better("MSTI regional root", a, b, 0, 0, false, false, true);
+
+    a = vec(); b = vec();
+    same("same vectors", a, b, true, true);
+    b.DesignatedPortID = __cpu_to_be16(0x8002);
+    same("designated port differs", a, b, true, false);
+    b = vec();
+    b.ExtRootPathCost = __cpu_to_be32(20001);
+    same("external cost differs", a, b, true, false);
+    same("external cost differs, MSTI", a, b, false, true);
+    b = vec();
+    b.RootID = bid(0x8000, 0x020000000009ULL);
+    same("root differs", a, b, true, false);
+    same("root differs, MSTI", a, b, false, true);
+    b = vec();
+    b.IntRootPathCost = __cpu_to_be32(0x01004E20);
+    same("internal cost high byte differs", a, b, false, false);
+}
+
+static bridge_identifier_t random_bid(void)
+{
+    static const __u16 prios[] = { 0x0000, 0x7FFF, 0x8000, 0xF000 };
+    static const __u64 macs[] = { 0, 1, 0x0100000000ULL, 0xFFFFFFFFFFFFULL };
+
+    return bid(prios[rand() % 4], macs[rand() % 4]);
+}
+
+static __be32 random_cost(void)
+{
+    static const __u32 costs[] = { 0, 1, 0xFF, 0x100, 0x7FFFFFFF,
+                                   0x80000000, 0xFFFFFFFF };
+
+    return __cpu_to_be32(costs[rand() % 7]);
+}
+
+static port_identifier_t random_pid(void)
+{
+    static const __u16 pids[] = { 0x0001, 0x80FF, 0x8100, 0xF001 };
+
+    return __cpu_to_be16(pids[rand() % 4]);
+}
+
+/* Randomize the fields from the from'th on, in order of precedence */
+static void random_vec(port_priority_vector_t *v, int from)
+{
+    switch(from)
+    {
+        case 0:
+            v->RootID = random_bid();
+        case 1:
+            v->ExtRootPathCost = random_cost();
+        case 2:
+            v->RRootID = random_bid();
+        case 3:
+            v->IntRootPathCost = random_cost();
+        case 4:
+            v->DesignatedBridgeID = random_bid();
+        case 5:
+            v->DesignatedPortID = random_pid();
+    }
+}
+
+/* Every comparison goes through the checked versions, which count the
+ * mismatches with the reference implementations */
+static void test_random(void)
+{
+    port_priority_vector_t v1, v2;
+    times_t t;
+    unsigned long before = mstp_check_mismatches;
+    int i;
+
+    srand(1);
+    memset(&t, 0, sizeof(t));
+    memset(&v1, 0, sizeof(v1));
+    memset(&v2, 0, sizeof(v2));
+    for(i = 0; i < TEST_RANDOM_PAIRS; ++i)
+    {
+        random_vec(&v1, 0);
+        /* The pairs share the fields up to a random one */
+        v2 = v1;
+        random_vec(&v2, rand() % 7);
+        betterorsamePriority(&v1, &v2, random_pid(), random_pid(),
+                             rand() % 2);
+        samePriorityAndTimers(&v1, &v2, &t, &t, rand() % 2);
+        samePriorityAndTimers(&v1, &v1, &t, &t, rand() % 2);
+    }
+    tests += 3 * TEST_RANDOM_PAIRS;
+    failures += mstp_check_mismatches - before;
+}
+
+int main(int argc, char *argv[])
+{
+    test_boundaries();
+    test_random();
+    printf("priority keys: %u tests, %u failures\n", tests, failures);
+    return failures ? 1 : 0;
+}
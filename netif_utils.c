@@ -102,50 +102,78 @@ int if_shutdown(char *ifname)
     return 0;
 }
 
-int ethtool_get_speed_duplex(char *ifname, int *speed, int *duplex)
+/* Upper bound of link_mode_masks_nwords, the kernel reports it as __s8 */
+#define LINK_MODE_MASK_MAX_NWORDS   127
+
+/* ETHTOOL_GSET, for drivers without link settings. The speed is split in
+ * two 16 bit fields, the upper one was added for links beyond 65535 Mb/s.
+ */
+static int ethtool_gset(struct ifreq *ifr, int *speed, int *duplex,
+                        __u32 *supported)
 {
-    struct ifreq ifr;
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
     struct ethtool_cmd ecmd;
+    __u32 s;
 
-    /* Do not check cpu port */
-    if (!strncmp(ifname, "cpu", 3))
-	return 0;
-
+    memset(&ecmd, 0, sizeof(ecmd));
     ecmd.cmd = ETHTOOL_GSET;
-    ifr.ifr_data = (caddr_t)&ecmd;
-    if(0 > ioctl(netsock, SIOCETHTOOL, &ifr))
-    {
-        ERROR("Cannot get speed/duplex for %s: %m\n", ifname);
+    ifr->ifr_data = (caddr_t)&ecmd;
+    if(0 > ioctl(netsock, SIOCETHTOOL, ifr))
         return -1;
-    }
-    *speed = ecmd.speed;   /* Ethtool speed is in Mbps */
-    *duplex = ecmd.duplex; /* We have same convention as ethtool.
-			      0 = half, 1 = full */
+    s = ethtool_cmd_speed(&ecmd);
+    *speed = (s <= INT_MAX) ? (int)s : -1;
+    *duplex = ecmd.duplex;
+    *supported = ecmd.supported;
     return 0;
 }
 
-__u32 ethtool_supported_media (char *ifname)
+/* Speed (in Mb/s, -1 if unknown), duplex (0 = half, 1 = full, the ethtool
+ * convention) and the legacy SUPPORTED_xxx mask of the port.
+ *
+ * ETHTOOL_GLINKSETTINGS takes two calls: the first one with zero words of
+ * link mode masks gets the number of words the kernel uses, negated.
+ */
+int ethtool_get_link_settings(char *ifname, int *speed, int *duplex,
+                              __u32 *supported)
 {
     struct ifreq ifr;
-    memset(&ifr, 0, sizeof(ifr));
-    strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
-    struct ethtool_cmd ecmd;
+    struct
+    {
+        struct ethtool_link_settings req;
+        __u32 masks[3 * LINK_MODE_MASK_MAX_NWORDS];
+    } ecmd;
+    __s8 nwords;
 
     /* Do not check cpu port */
     if (!strncmp(ifname, "cpu", 3))
 	return 0;
 
-    ecmd.cmd = ETHTOOL_GSET;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
+    memset(&ecmd, 0, sizeof(ecmd));
+    ecmd.req.cmd = ETHTOOL_GLINKSETTINGS;
     ifr.ifr_data = (caddr_t)&ecmd;
-    if(0 > ioctl(netsock, SIOCETHTOOL, &ifr))
+    if(0 > ioctl(netsock, SIOCETHTOOL, &ifr)
+       || 0 <= (nwords = ecmd.req.link_mode_masks_nwords))
+        goto gset;
+
+    ecmd.req.cmd = ETHTOOL_GLINKSETTINGS;
+    ecmd.req.link_mode_masks_nwords = -nwords;
+    if(0 > ioctl(netsock, SIOCETHTOOL, &ifr)
+       || ecmd.req.link_mode_masks_nwords != -nwords)
+        goto gset;
+
+    *speed = (ecmd.req.speed <= INT_MAX) ? (int)ecmd.req.speed : -1;
+    *duplex = ecmd.req.duplex;
+    *supported = ecmd.masks[0]; /* the first word is the legacy mask */
+    return 0;
+
+gset:
+    if(0 > ethtool_gset(&ifr, speed, duplex, supported))
     {
-	ERROR("Cannot get port type for %s: %m\n", ifname);
-	return -1;
+        ERROR("Cannot get link settings for %s: %m\n", ifname);
+        return -1;
     }
-
-    return ecmd.supported;
+    return 0;
 }
 
 char *index_to_name(int index, char *name)
@@ -168,6 +196,20 @@ bool is_bridge(char *if_name)
     return (0 == access(path, R_OK));
 }
 
+/* phys_switch_id can only be read for ports of switchdev hardware */
+bool is_switchdev_port(char *if_name)
+{
+    char path[32 + IFNAMSIZ], buf[64];
+    int fd, l;
+
+    sprintf(path, SYSFS_CLASS_NET "/%s/phys_switch_id", if_name);
+    if(0 > (fd = open(path, O_RDONLY)))
+        return false;
+    l = read(fd, buf, sizeof(buf));
+    close(fd);
+    return (1 < l);
+}
+
 int get_bridge_portno(char *if_name)
 {
     char path[32 + IFNAMSIZ];
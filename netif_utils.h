@@ -34,10 +34,11 @@ int get_hwaddr(char *ifname, unsigned char *hwaddr);
 int get_flags(char *ifname);
 int if_shutdown(char *ifname);
 
-int ethtool_get_speed_duplex(char *ifname, int *speed, int *duplex);
-__u32 ethtool_supported_media (char *ifname);
+int ethtool_get_link_settings(char *ifname, int *speed, int *duplex,
+                              __u32 *supported);
 
 bool is_bridge(char *if_name);
+bool is_switchdev_port(char *if_name);
 
 int get_bridge_portno(char *if_name);
 
@@ -109,18 +109,23 @@ void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len)
         ERROR("short write in sendto: %d instead of %d", l, len);
 }
 
-static void packet_rcv(uint32_t events, struct epoll_event_handler *h)
+/* BPDUs received per wakeup, before the event loop gets to other events */
+#define PACKET_RX_BATCH 32
+
+/* Returns false if there is nothing more to receive */
+static bool packet_rcv_one(int fd, bool first)
 {
     int cc;
     unsigned char buf[2048];
     struct sockaddr_ll sl;
     socklen_t salen = sizeof sl;
 
-    cc = recvfrom(h->fd, &buf, sizeof(buf), 0, (struct sockaddr *) &sl, &salen);
+    cc = recvfrom(fd, &buf, sizeof(buf), 0, (struct sockaddr *) &sl, &salen);
     if(cc <= 0)
     {
-        ERROR("recvfrom failed: %m");
-        return;
+        if(first || (cc == 0) || (errno != EAGAIN && errno != EINTR))
+            ERROR("recvfrom failed: %m");
+        return false;
     }
 
 #ifdef PACKET_DEBUG
@@ -133,6 +138,15 @@ static void packet_rcv(uint32_t events, struct epoll_event_handler *h)
 #endif
 
     bridge_bpdu_rcv(sl.sll_ifindex, buf, cc);
+    return true;
+}
+
+static void packet_rcv(uint32_t events, struct epoll_event_handler *h)
+{
+    int n = 0;
+
+    while(packet_rcv_one(h->fd, !n) && (++n < PACKET_RX_BATCH))
+        ;
 }
 
 /* Berkeley Packet filter code to filter out spanning tree packets.
@@ -178,6 +192,7 @@ int packet_sock_init(void)
     {
         packet_event.fd = s;
         packet_event.handler = packet_rcv;
+        packet_event.prio = EPOLL_PRIO_PACKET;
 
         if(0 == add_epoll(&packet_event))
             return 0;
@@ -0,0 +1,401 @@
+/*
+ * snapshot.c   Status snapshots for the management thread.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <string.h>
+#include <asm/byteorder.h>
+
+#include "snapshot.h"
+#include "worker.h"
+#include "log.h"
+
+typedef struct
+{
+    __u16 mstid;
+    MSTI_PortStatus status;
+} snap_ptp_t;
+
+typedef struct
+{
+    int if_index;
+    char name[IFNAMSIZ];
+    __u32 supported;            /* ethtool SUPPORTED_xxx of the port */
+    CIST_PortStatus cist;
+    int num_trees;
+    snap_ptp_t *trees;
+} snap_port_t;
+
+typedef struct
+{
+    __u16 mstid;
+    MSTI_BridgeStatus status;
+    char root_port_name[IFNAMSIZ];
+} snap_tree_t;
+
+typedef struct
+{
+    int if_index;
+    char name[IFNAMSIZ];
+    CIST_BridgeStatus cist;
+    char root_port_name[IFNAMSIZ];
+    int num_trees;              /* including the CIST */
+    snap_tree_t *trees;
+    int num_ports;
+    snap_port_t *ports;
+} snap_bridge_t;
+
+typedef struct snapshot
+{
+    struct snapshot *next_retired;
+    unsigned int epoch;         /* reader_epoch when retired */
+    int num_bridges;
+    snap_bridge_t *bridges;
+} snapshot_t;
+
+static snapshot_t *current;     /* written by the event loop only */
+static snapshot_t *retired;     /* event loop only */
+static bool dirty = true;       /* set by the workers too */
+
+/* Written by the reader only */
+static unsigned int reader_active;
+static unsigned int reader_epoch; /* completed read sections */
+
+/*********************** Publication (event loop) *********************/
+
+#define SNAP_ALIGN(_size)   (((_size) + 7) & ~(size_t)7)
+
+/* Build state, bridge_for_each() callbacks take no argument */
+static struct
+{
+    size_t size;
+    int num_bridges;
+    snapshot_t *snap;
+    char *next;                 /* free space in snap */
+} build;
+
+static void *build_alloc(size_t size)
+{
+    void *p = build.next;
+
+    build.next += SNAP_ALIGN(size);
+    return p;
+}
+
+static void count_bridge(bridge_t *br)
+{
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+
+    ++build.num_bridges;
+    list_for_each_entry(tree, &br->trees, bridge_list)
+        build.size += SNAP_ALIGN(sizeof(snap_tree_t));
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        build.size += SNAP_ALIGN(sizeof(snap_port_t));
+        list_for_each_entry(ptp, &prt->trees, port_list)
+            build.size += SNAP_ALIGN(sizeof(snap_ptp_t));
+    }
+}
+
+static void root_port_name(tree_t *tree, port_identifier_t root_port_id,
+                           char *name)
+{
+    per_tree_port_t *ptp;
+
+    *name = '\0';
+    list_for_each_entry(ptp, &tree->ports, tree_list)
+        if(ptp->portId == root_port_id)
+        {
+            strncpy(name, ptp->port->sysdeps.name, IFNAMSIZ);
+            break;
+        }
+}
+
+static void fill_bridge(bridge_t *br)
+{
+    snap_bridge_t *sbr = build.snap->bridges + build.snap->num_bridges++;
+    snap_tree_t *stree;
+    snap_port_t *sprt;
+    snap_ptp_t *sptp;
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+
+    sbr->if_index = br->sysdeps.if_index;
+    strncpy(sbr->name, br->sysdeps.name, IFNAMSIZ);
+    MSTP_IN_get_cist_bridge_status(br, &sbr->cist);
+    root_port_name(GET_CIST_TREE(br), sbr->cist.root_port_id,
+                   sbr->root_port_name);
+
+    sbr->num_trees = 0;
+    sbr->trees = (snap_tree_t *)build.next;
+    list_for_each_entry(tree, &br->trees, bridge_list)
+    {
+        stree = build_alloc(sizeof(*stree));
+        stree->mstid = __be16_to_cpu(tree->MSTID);
+        MSTP_IN_get_msti_bridge_status(tree, &stree->status);
+        root_port_name(tree, stree->status.root_port_id,
+                       stree->root_port_name);
+        ++sbr->num_trees;
+    }
+
+    sbr->num_ports = 0;
+    sbr->ports = (snap_port_t *)build.next;
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        sprt = build_alloc(sizeof(*sprt));
+        ++sbr->num_ports;
+    }
+    sprt = sbr->ports;
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        sprt->if_index = prt->sysdeps.if_index;
+        strncpy(sprt->name, prt->sysdeps.name, IFNAMSIZ);
+        sprt->supported = prt->sysdeps.supported;
+        MSTP_IN_get_cist_port_status(prt, &sprt->cist);
+        sprt->num_trees = 0;
+        sprt->trees = (snap_ptp_t *)build.next;
+        list_for_each_entry(ptp, &prt->trees, port_list)
+        {
+            sptp = build_alloc(sizeof(*sptp));
+            sptp->mstid = __be16_to_cpu(ptp->MSTID);
+            MSTP_IN_get_msti_port_status(ptp, &sptp->status);
+            ++sprt->num_trees;
+        }
+        ++sprt;
+    }
+}
+
+static void reclaim(void)
+{
+    snapshot_t **prev = &retired, *snap;
+    unsigned int active = __atomic_load_n(&reader_active, __ATOMIC_SEQ_CST);
+    unsigned int epoch = __atomic_load_n(&reader_epoch, __ATOMIC_SEQ_CST);
+
+    while((snap = *prev))
+    {
+        /* The read section which could see snap has ended */
+        if(!active || (epoch != snap->epoch))
+        {
+            *prev = snap->next_retired;
+            free(snap);
+        }
+        else
+            prev = &snap->next_retired;
+    }
+}
+
+void snapshot_invalidate(void)
+{
+    __atomic_store_n(&dirty, true, __ATOMIC_RELAXED);
+}
+
+void snapshot_update(void)
+{
+    snapshot_t *snap, *old;
+
+    if(retired)
+        reclaim();
+    if(!__atomic_load_n(&dirty, __ATOMIC_RELAXED))
+        return;
+
+    worker_lock_all();
+    dirty = false;
+    build.size = SNAP_ALIGN(sizeof(snapshot_t));
+    build.num_bridges = 0;
+    bridge_for_each(count_bridge);
+    build.size += SNAP_ALIGN(build.num_bridges * sizeof(snap_bridge_t));
+    if(!(snap = malloc(build.size)))
+    {
+        ERROR("Out of memory for status snapshot of %zu bytes", build.size);
+        dirty = true;
+        worker_unlock_all();
+        return;
+    }
+    build.snap = snap;
+    build.next = (char *)snap + SNAP_ALIGN(sizeof(snapshot_t));
+    snap->num_bridges = 0;
+    snap->bridges = build_alloc(build.num_bridges * sizeof(snap_bridge_t));
+    bridge_for_each(fill_bridge);
+    worker_unlock_all();
+
+    old = __atomic_exchange_n(&current, snap, __ATOMIC_SEQ_CST);
+    if(!old)
+        return;
+    if(!__atomic_load_n(&reader_active, __ATOMIC_SEQ_CST))
+    {
+        free(old);
+        return;
+    }
+    old->epoch = __atomic_load_n(&reader_epoch, __ATOMIC_SEQ_CST);
+    old->next_retired = retired;
+    retired = old;
+}
+
+/*********************** Readers (management thread) *********************/
+
+static const snapshot_t *read_lock(void)
+{
+    __atomic_store_n(&reader_active, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+}
+
+static void read_unlock(void)
+{
+    __atomic_store_n(&reader_epoch, reader_epoch + 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&reader_active, 0, __ATOMIC_SEQ_CST);
+}
+
+static const snap_bridge_t *find_bridge(const snapshot_t *snap, int br_index)
+{
+    int i;
+
+    for(i = 0; snap && (i < snap->num_bridges); ++i)
+        if(snap->bridges[i].if_index == br_index)
+            return snap->bridges + i;
+    ERROR("Couldn't find bridge with index %d", br_index);
+    return NULL;
+}
+
+static const snap_tree_t *find_tree(const snap_bridge_t *sbr, __u16 mstid)
+{
+    int i;
+
+    for(i = 0; i < sbr->num_trees; ++i)
+        if(sbr->trees[i].mstid == mstid)
+            return sbr->trees + i;
+    ERROR("%s Couldn't find MSTI with ID %hu", sbr->name, mstid);
+    return NULL;
+}
+
+static const snap_port_t *find_port(const snap_bridge_t *sbr, int port_index)
+{
+    int i;
+
+    for(i = 0; i < sbr->num_ports; ++i)
+        if(sbr->ports[i].if_index == port_index)
+            return sbr->ports + i;
+    ERROR("%s Couldn't find port with index %d", sbr->name, port_index);
+    return NULL;
+}
+
+int snapshot_get_cist_bridge_status(int br_index, CIST_BridgeStatus *status,
+                                    char *root_port_name)
+{
+    const snap_bridge_t *sbr;
+    int r = -1;
+
+    if((sbr = find_bridge(read_lock(), br_index)))
+    {
+        *status = sbr->cist;
+        strncpy(root_port_name, sbr->root_port_name, IFNAMSIZ);
+        r = 0;
+    }
+    read_unlock();
+    return r;
+}
+
+int snapshot_get_msti_bridge_status(int br_index, __u16 mstid,
+                                    MSTI_BridgeStatus *status,
+                                    char *root_port_name)
+{
+    const snap_bridge_t *sbr;
+    const snap_tree_t *stree;
+    int r = -1;
+
+    if((sbr = find_bridge(read_lock(), br_index))
+       && (stree = find_tree(sbr, mstid)))
+    {
+        *status = stree->status;
+        strncpy(root_port_name, stree->root_port_name, IFNAMSIZ);
+        r = 0;
+    }
+    read_unlock();
+    return r;
+}
+
+int snapshot_get_cist_port_status(int br_index, int port_index,
+                                  CIST_PortStatus *status)
+{
+    const snap_bridge_t *sbr;
+    const snap_port_t *sprt;
+    int r = -1;
+
+    if((sbr = find_bridge(read_lock(), br_index))
+       && (sprt = find_port(sbr, port_index)))
+    {
+        *status = sprt->cist;
+        r = 0;
+    }
+    read_unlock();
+    return r;
+}
+
+int snapshot_get_port_supported(int br_index, int port_index,
+                                __u32 *supported)
+{
+    const snap_bridge_t *sbr;
+    const snap_port_t *sprt;
+    int r = -1;
+
+    if((sbr = find_bridge(read_lock(), br_index))
+       && (sprt = find_port(sbr, port_index)))
+    {
+        *supported = sprt->supported;
+        r = 0;
+    }
+    read_unlock();
+    return r;
+}
+
+int snapshot_get_msti_port_status(int br_index, int port_index, __u16 mstid,
+                                  MSTI_PortStatus *status)
+{
+    const snap_bridge_t *sbr;
+    const snap_port_t *sprt;
+    int i, r = -1;
+
+    if((sbr = find_bridge(read_lock(), br_index))
+       && (sprt = find_port(sbr, port_index)))
+    {
+        for(i = 0; i < sprt->num_trees; ++i)
+            if(sprt->trees[i].mstid == mstid)
+            {
+                *status = sprt->trees[i].status;
+                r = 0;
+                break;
+            }
+        if(r)
+            ERROR("%s:%s Couldn't find MSTI with ID %hu", sbr->name,
+                  sprt->name, mstid);
+    }
+    read_unlock();
+    return r;
+}
+
+int snapshot_get_mstilist(int br_index, int *num_mstis, __u16 *mstids)
+{
+    const snap_bridge_t *sbr;
+    int r = -1;
+
+    *num_mstis = 0;
+    if((sbr = find_bridge(read_lock(), br_index)))
+    {
+        /* Same limit as MSTP_IN_get_mstilist(), num_mstis include CIST */
+        while((*num_mstis < sbr->num_trees)
+              && (*num_mstis <= MAX_IMPLEMENTATION_MSTIS))
+        {
+            mstids[*num_mstis] = sbr->trees[*num_mstis].mstid;
+            ++(*num_mstis);
+        }
+        r = 0;
+    }
+    read_unlock();
+    return r;
+}
@@ -0,0 +1,49 @@
+/*
+ * snapshot.h   Status snapshots for the management thread.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_SNAPSHOT_H
+#define _MSTP_SNAPSHOT_H
+
+#include "mstp.h"
+
+/* The event loop publishes an immutable copy of the bridge, port and tree
+ * status after the state machines have run. The management thread answers
+ * status reads (ctl socket, SNMP, status files) from the last published
+ * copy without touching the live state.
+ *
+ * Publication is RCU-like: the event loop swaps the pointer to the current
+ * snapshot and frees the old one once the reader is known to be done with
+ * it. There is exactly one reader thread, the management thread, and
+ * neither side takes locks.
+ */
+
+/* Mark the state as changed, called from the event loop and the workers */
+void snapshot_invalidate(void);
+/* Publish a new snapshot if the state has changed since the last one,
+ * called from the event loop */
+void snapshot_update(void);
+
+/* Readers, called from the management thread only.
+ * Same arguments and return values as the CTL_ functions. */
+int snapshot_get_cist_bridge_status(int br_index, CIST_BridgeStatus *status,
+                                    char *root_port_name);
+int snapshot_get_msti_bridge_status(int br_index, __u16 mstid,
+                                    MSTI_BridgeStatus *status,
+                                    char *root_port_name);
+int snapshot_get_cist_port_status(int br_index, int port_index,
+                                  CIST_PortStatus *status);
+/* The ethtool SUPPORTED_xxx mask of the port, read when it was added or
+ * came up last */
+int snapshot_get_port_supported(int br_index, int port_index,
+                                __u32 *supported);
+int snapshot_get_msti_port_status(int br_index, int port_index, __u16 mstid,
+                                  MSTI_PortStatus *status);
+int snapshot_get_mstilist(int br_index, int *num_mstis, __u16 *mstids);
+
+#endif /* _MSTP_SNAPSHOT_H */
@@ -30,6 +30,7 @@
 
 #include "mstp.h"
 #include "config.h"
+#include "snapshot.h"
 #include "snmp.h"
 
 #include "libnsh/scalar.h"
@@ -59,7 +60,7 @@ static int snmp_get_dot1d_stp(void *value, int len, int id)
     if (br_index < 0)
         return SNMP_ERR_GENERR;
 
-    if (CTL_get_cist_bridge_status(br_index, &s, root_port_name))
+    if (snapshot_get_cist_bridge_status(br_index, &s, root_port_name))
         return SNMP_ERR_GENERR;
 
     switch (id) {
@@ -30,6 +30,7 @@
 
 #include "mstp.h"
 #include "config.h"
+#include "snapshot.h"
 #include "snmp.h"
 
 #include "libnsh/table.h"
@@ -131,10 +132,10 @@ static int table_load (netsnmp_cache *cache, void* vmagic)
     if (br_index < 0)
         return 0;
 
-    if (CTL_get_cist_bridge_status(br_index, &s, root_port_name))
+    if (snapshot_get_cist_bridge_status(br_index, &s, root_port_name))
         return 0;
 
-    parse_cfg = parse_conf(MSTPD_CONFIG_FILE);
+    parse_cfg = parse_conf_cached();
     if(!parse_cfg)
 	return 0;
 
@@ -153,7 +154,7 @@ static int table_load (netsnmp_cache *cache, void* vmagic)
         port_p = cfg_getstr(cfg_port, "ifname");
         port_index = if_nametoindex(port_p);
 
-        if (CTL_get_cist_port_status(br_index, port_index, &ps))
+        if (snapshot_get_cist_port_status(br_index, port_index, &ps))
             continue; /* failed to get port state */
 
         /* designated bridge */
@@ -0,0 +1,71 @@
+/*
+ * stats.c   Latency histograms of the daemon.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <string.h>
+
+#include "stats.h"
+
+stats_hist_t stats_hists[STATS_NUM_HISTS];
+__thread stats_hist_t *stats_local = stats_hists;
+__u64 stats_sm_run_timeouts;
+
+static stats_hist_t *sets[STATS_MAX_SETS] = { stats_hists };
+static int num_sets = 1;
+
+void stats_record(stats_hist_id_t id, __u64 value)
+{
+    stats_hist_t *h = stats_local + id;
+
+    if(!h->count || (value < h->min))
+        h->min = value;
+    if(value > h->max)
+        h->max = value;
+    ++(h->count);
+    h->sum += value;
+    ++(h->buckets[stats_bucket(value)]);
+}
+
+void stats_reset(void)
+{
+    int i;
+
+    for(i = 0; i < num_sets; ++i)
+        memset(sets[i], 0, sizeof(stats_hists));
+    stats_sm_run_timeouts = 0;
+}
+
+bool stats_register(stats_hist_t *hists)
+{
+    if(STATS_MAX_SETS <= num_sets)
+        return false;
+    sets[num_sets++] = hists;
+    return true;
+}
+
+void stats_get(stats_hist_id_t id, stats_hist_t *hist)
+{
+    const stats_hist_t *h;
+    int i, b;
+
+    *hist = stats_hists[id];
+    for(i = 1; i < num_sets; ++i)
+    {
+        h = sets[i] + id;
+        if(!h->count)
+            continue;
+        if(!hist->count || (h->min < hist->min))
+            hist->min = h->min;
+        if(h->max > hist->max)
+            hist->max = h->max;
+        hist->count += h->count;
+        hist->sum += h->sum;
+        for(b = 0; b < STATS_BUCKETS; ++b)
+            hist->buckets[b] += h->buckets[b];
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * stats.h   Latency histograms of the daemon.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_STATS_H
+#define _MSTP_STATS_H
+
+#include <time.h>
+#include <stdbool.h>
+#include <linux/types.h>
+
+/* Log-linear (HDR-style) histograms: every power of two range is split
+ * into STATS_SUB buckets, so the relative error of a value read back
+ * from the histogram is below 1/STATS_SUB. Values from 2^(STATS_MAX_EXP+1)
+ * up go to the last bucket.
+ */
+#define STATS_SUB_BITS  4
+#define STATS_SUB       (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXP   39      /* ~550 s in ns */
+#define STATS_BUCKETS   ((STATS_MAX_EXP - STATS_SUB_BITS + 2) * STATS_SUB)
+
+typedef enum
+{
+    STATS_RX_BPDU,          /* BPDU reception until state machines settle */
+    STATS_SM_ITERATIONS,    /* state machines iterations per event, count */
+    STATS_ROLE_TO_STATE,    /* role change until next port state change */
+    STATS_BR_SET_STATE,     /* kernel calls */
+    STATS_BR_FLUSH_PORT,
+    STATS_BR_FDB_AGEING,    /* rapid ageing pass over the FDB of a bridge */
+    STATS_TICK_LAG,         /* one second tick lag behind the schedule */
+    STATS_DRIVER_SET_STATE, /* driver operations, submit until done */
+    STATS_DRIVER_FLUSH,
+    STATS_NUM_HISTS
+} stats_hist_id_t;
+
+typedef struct
+{
+    __u64 count;
+    __u64 sum;
+    __u64 min;
+    __u64 max;
+    __u32 buckets[STATS_BUCKETS];
+} stats_hist_t;
+
+/* Every thread records to its own set of histograms, stats_local. It is
+ * stats_hists on the event loop, other threads register their sets with
+ * stats_register() and switch to them. stats_get() merges all sets.
+ */
+#define STATS_MAX_SETS  65
+
+extern stats_hist_t stats_hists[STATS_NUM_HISTS];
+extern __thread stats_hist_t *stats_local;
+/* Number of times the state machines did not settle in one second */
+extern __u64 stats_sm_run_timeouts;
+
+/* CLOCK_MONOTONIC in ns */
+static inline __u64 stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned int stats_bucket(__u64 value)
+{
+    unsigned int e;
+
+    if(STATS_SUB > value)
+        return value;
+    e = 63 - __builtin_clzll(value);
+    if(STATS_MAX_EXP < e)
+        return STATS_BUCKETS - 1;
+    return (e - STATS_SUB_BITS + 1) * STATS_SUB
+           + ((value >> (e - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+
+/* Highest value which goes to the bucket */
+static inline __u64 stats_bucket_value(unsigned int bucket)
+{
+    unsigned int e;
+    __u64 next;
+
+    if(STATS_SUB > bucket)
+        return bucket;
+    e = bucket / STATS_SUB + STATS_SUB_BITS - 1;
+    next = STATS_SUB + bucket % STATS_SUB + 1;
+    return (next << (e - STATS_SUB_BITS)) - 1;
+}
+
+void stats_record(stats_hist_id_t id, __u64 value);
+void stats_reset(void);
+/* Returns false if there are STATS_MAX_SETS sets already */
+bool stats_register(stats_hist_t *hists);
+void stats_get(stats_hist_id_t id, stats_hist_t *hist);
+
+static inline void stats_record_since(stats_hist_id_t id, __u64 start)
+{
+    stats_record(id, stats_now() - start);
+}
+
+#endif /* _MSTP_STATS_H */
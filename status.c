@@ -46,6 +46,7 @@
 #include "log.h"
 #include "leds.h"
 #include "config.h"
+#include "snapshot.h"
 
 extern char *__progname;
 
@@ -76,9 +77,9 @@ char *port_state_to_string(int state, int ansi)
     return ansi ? pretty[state] : regular[state];
 }
 
-const char *port_typestr(char *ifname)
+const char *port_typestr(__u32 supported)
 {
-    switch(ethtool_supported_media (ifname))
+    switch(supported)
     {
     case ETHTOOL_PORT_MASK_GIGA_ETHERNET_OPTIC:
 	return "1000-SFP";
@@ -322,7 +323,7 @@ void mstp_update_status(void)
 	return;
     }
 
-    if(CTL_get_cist_bridge_status(br_index, &s, root_port_name))
+    if(snapshot_get_cist_bridge_status(br_index, &s, root_port_name))
     {
 	ERROR("Failed to get bridge status %s (index %d)\n", br_name, br_index);
 	return;
@@ -350,9 +351,12 @@ void mstp_update_status(void)
 
     set_hold_count(s.tx_hold_count);
 
-    parse_cfg = parse_conf(MSTPD_CONFIG_FILE);
+    parse_cfg = parse_conf_cached();
     if(!parse_cfg)
+    {
+	close(sd);
 	return;
+    }
 
     for(i = 0; i < cfg_size(parse_cfg, "ports"); i++)
     {
@@ -372,7 +376,7 @@ void mstp_update_status(void)
 	    continue;
 	}
 
-	if(CTL_get_cist_port_status(br_index, port_index, &ps))
+	if(snapshot_get_cist_port_status(br_index, port_index, &ps))
 	{
 	    LOG("%s:%s Failed to get port state\n", br_name, port_p/* bridge.ifaces[i] */);
 	    continue;
@@ -395,7 +399,6 @@ void mstp_update_status(void)
 	set_port_designated_root_prio(0, port_p, __be16_to_cpu(ps.designated_root.s.priority));
     }
     close(sd);
-    cfg_free(parse_cfg);
 }
 
 int mstp_write_status_file(int display)
@@ -412,7 +415,7 @@ int mstp_write_status_file(int display)
 	return -1;
     }
 
-    if(CTL_get_cist_bridge_status(br_index, &s, root_port_name))
+    if(snapshot_get_cist_bridge_status(br_index, &s, root_port_name))
     {
 	ERROR("Failed to get bridge status %s (index %d)\n", br_name, br_index);
 	return -1;
@@ -454,7 +457,7 @@ int mstp_write_status_file(int display)
     fprintf(fd, "Port     Type         Cost        Priority  State      Edge   Designated Bridge\n");
     fprintf(fd, "===============================================================================\n");
 
-    parse_cfg2 = parse_conf(MSTPD_CONFIG_FILE);
+    parse_cfg2 = parse_conf_cached();
     if(!parse_cfg2)
 	goto out;
 
@@ -464,6 +467,7 @@ int mstp_write_status_file(int display)
 	int port_index = 0;
 	char *port_p, port_id[50], path_cost[50], port_name[30];
 	int ena, id;
+	__u32 supported = 0;
 
 	cfg_t * cfg_port = cfg_getnsec(parse_cfg2, "ports", i);
 
@@ -474,11 +478,12 @@ int mstp_write_status_file(int display)
 
 	if((ena = port_is_enabled(port_p)))
 	{
-	    if(CTL_get_cist_port_status(br_index, port_index, &ps))
+	    if(snapshot_get_cist_port_status(br_index, port_index, &ps))
 	    {
 		LOG("%s:%s Failed to get port state\n", br_name, port_p);
 		continue;
 	    }
+	    snapshot_get_port_supported(br_index, port_index, &supported);
 
 	    sprintf(port_id, "%d", ps.port_id & 0xff);
 	    sprintf(path_cost, "%d", ps.external_port_path_cost);
@@ -488,7 +493,7 @@ int mstp_write_status_file(int display)
 
 	fprintf(fd, "%-7s  %-11.11s  %-9s   %-8s  %-10s %-5s  %s\n",
 		port_name,
-		port_typestr(port_p),
+		port_typestr(supported),
 		ena ? path_cost : "N/A",
 		ena ? port_id : "N/A",
 		port_state_to_string (ena ? ps.state : 0, 1),
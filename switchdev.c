@@ -0,0 +1,523 @@
+/*
+ * switchdev.c   Driver for bridge ports offloaded to switchdev hardware.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include <linux/if_bridge.h>
+#include <linux/neighbour.h>
+
+#include "mstp.h"
+#include "driver.h"
+#include "switchdev.h"
+#include "libnetlink.h"
+#include "netif_utils.h"
+#include "epoll_loop.h"
+#include "stats.h"
+#include "log.h"
+
+/* How long the kernel may take to report an operation done */
+#define SWITCHDEV_TIMEOUT_NS    (2000 * 1000000ULL)
+
+#define NDA_RTA(r) \
+    ((struct rtattr *)(((char *)(r)) + NLMSG_ALIGN(sizeof(struct ndmsg))))
+
+typedef struct
+{
+    __u8 addr[ETH_ALEN];
+    __u16 vid;
+} fdb_key_t;
+
+/* A submitted operation the kernel has not reported done yet */
+typedef struct
+{
+    struct list_head list;
+    driver_op_t *op;
+    __u64 start, deadline;
+    /* DRIVER_OP_FLUSH: dynamic entries left on the port after the flush */
+    fdb_key_t *keys;
+    int num_keys;
+    /* FDB dumps run without sd_lock, the entries deleted or moved
+     * meanwhile are taken out of them when they are done */
+    bool dumping;
+    bool lost;          /* deletions were lost meanwhile, dump again */
+    fdb_key_t *gone;
+    int num_gone, size_gone;
+} sd_pending_t;
+
+/* Pending operations in submission order. Locked, as the workers submit
+ * the operations of their bridges. FDB dumps are not done under the lock,
+ * they use the rtnl handle of the calling thread. */
+static LIST_HEAD(pending);
+static pthread_mutex_t sd_lock = PTHREAD_MUTEX_INITIALIZER;
+static int flushes_waiting;
+
+/* FDB notifications, RTNLGRP_NEIGH is joined only while flushes wait, as
+ * every learned address is notified */
+static struct rtnl_handle rth_neigh;
+static bool neigh_joined;
+static struct epoll_event_handler neigh_event;
+static struct epoll_event_handler timer_event;
+static __u64 clock_tick_ns;             /* unit of NDA_CACHEINFO */
+
+static void sd_get_caps(driver_caps_t *caps)
+{
+    caps->msti_states = false;  /* the kernel has the CIST state only */
+    caps->flush = DRIVER_FLUSH_PORT;
+}
+
+static bool sd_handles_port(port_t *prt)
+{
+    return prt->sysdeps.offloaded;
+}
+
+static void complete(sd_pending_t *p, int result)
+{
+    list_del(&p->list);
+    if(DRIVER_OP_FLUSH == p->op->type)
+        --flushes_waiting;
+    p->op->result = result;
+    driver_op_done(p->op);
+    free(p->keys);
+    free(p->gone);
+    free(p);
+}
+
+/* Join RTNLGRP_NEIGH before a flush is checked, so that no deletion is
+ * missed, and leave it when no flush waits any more */
+static void update_neigh_group(bool join)
+{
+    int group = RTNLGRP_NEIGH;
+
+    if(join == neigh_joined)
+        return;
+    if(0 > setsockopt(rth_neigh.fd, SOL_NETLINK,
+                      join ? NETLINK_ADD_MEMBERSHIP : NETLINK_DROP_MEMBERSHIP,
+                      &group, sizeof(group)))
+    {
+        ERROR("Couldn't %s FDB notifications: %m", join ? "join" : "leave");
+        return;
+    }
+    neigh_joined = join;
+}
+
+static void arm_timer(void)
+{
+    struct itimerspec its;
+    sd_pending_t *p;
+    __u64 first = 0;
+
+    list_for_each_entry(p, &pending, list)
+        if(!first || (p->deadline < first))
+            first = p->deadline;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = first / 1000000000ULL;
+    its.it_value.tv_nsec = first % 1000000000ULL;
+    if(0 > timerfd_settime(timer_event.fd, TFD_TIMER_ABSTIME, &its, NULL))
+        ERROR("switchdev: timerfd_settime failed: %m");
+}
+
+/* Parse an AF_BRIDGE neighbour message of a bridge FDB entry, entries of
+ * the port device itself (NTF_SELF) are not ours */
+static struct ndmsg *parse_fdb(struct nlmsghdr *n, fdb_key_t *key,
+                               struct nda_cacheinfo **ci)
+{
+    struct ndmsg *ndm = NLMSG_DATA(n);
+    struct rtattr *tb[NDA_MAX + 1];
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+
+    if((len < 0) || (AF_BRIDGE != ndm->ndm_family)
+       || (ndm->ndm_flags & NTF_SELF))
+        return NULL;
+    parse_rtattr(tb, NDA_MAX, NDA_RTA(ndm), len);
+    if(!tb[NDA_LLADDR] || (ETH_ALEN != RTA_PAYLOAD(tb[NDA_LLADDR])))
+        return NULL;
+    memcpy(key->addr, RTA_DATA(tb[NDA_LLADDR]), ETH_ALEN);
+    key->vid = tb[NDA_VLAN] ? *(__u16 *)RTA_DATA(tb[NDA_VLAN]) : 0;
+    if(ci)
+        *ci = (tb[NDA_CACHEINFO]
+               && (sizeof(**ci) <= RTA_PAYLOAD(tb[NDA_CACHEINFO])))
+              ? RTA_DATA(tb[NDA_CACHEINFO]) : NULL;
+    return ndm;
+}
+
+typedef struct
+{
+    int if_index;
+    __u64 min_age;      /* entries updated since are learned anew */
+    fdb_key_t *keys;
+    int num, size;
+} fdb_dump_t;
+
+static int add_key(fdb_key_t **keys, int *num, int *size,
+                   const fdb_key_t *key)
+{
+    if(*num == *size)
+    {
+        int new_size = *size ? 2 * *size : 16;
+        fdb_key_t *new_keys = realloc(*keys, new_size * sizeof(*new_keys));
+        if(!new_keys)
+            return -1;
+        *keys = new_keys;
+        *size = new_size;
+    }
+    (*keys)[(*num)++] = *key;
+    return 0;
+}
+
+static int fdb_dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                        void *arg)
+{
+    fdb_dump_t *dump = arg;
+    struct nda_cacheinfo *ci;
+    struct ndmsg *ndm;
+    fdb_key_t key;
+
+    if((RTM_NEWNEIGH != n->nlmsg_type) || !(ndm = parse_fdb(n, &key, &ci)))
+        return 0;
+    if((ndm->ndm_ifindex != dump->if_index)
+       || (ndm->ndm_state & (NUD_PERMANENT | NUD_NOARP)))
+        return 0;
+    if(ci && ((__u64)ci->ndm_updated * clock_tick_ns < dump->min_age))
+        return 0;
+    return add_key(&dump->keys, &dump->num, &dump->size, &key);
+}
+
+/* Dynamic entries on the port which were there at the flush. The kernel
+ * has deleted the ones it flushes itself before the operation is
+ * submitted, what is left waits for the hardware. */
+static int dump_left(sd_pending_t *p)
+{
+    struct ifinfomsg ifi;
+    fdb_dump_t dump;
+    __u64 since = stats_now() - p->start;
+
+    memset(&dump, 0, sizeof(dump));
+    dump.if_index = p->op->if_index;
+    /* One tick of slack for the rounding of the age */
+    dump.min_age = since + clock_tick_ns;
+    /* An ifinfomsg request dumps the entries of one bridge port */
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = PF_BRIDGE;
+    ifi.ifi_index = p->op->if_index;
+    if((0 > rtnl_dump_request(rth_state_local, RTM_GETNEIGH, &ifi,
+                              sizeof(ifi)))
+       || (0 > rtnl_dump_filter(rth_state_local, fdb_dump_msg, &dump, NULL,
+                                NULL)))
+    {
+        ERROR("%s: FDB dump failed", p->op->ifname);
+        free(dump.keys);
+        return -1;
+    }
+    free(p->keys);
+    p->keys = dump.keys;
+    p->num_keys = dump.num;
+    return 0;
+}
+
+static void forget_key(sd_pending_t *p, const fdb_key_t *key)
+{
+    int i;
+
+    for(i = 0; i < p->num_keys; ++i)
+        if(!memcmp(&p->keys[i], key, sizeof(*key)))
+        {
+            p->keys[i] = p->keys[--p->num_keys];
+            return;
+        }
+}
+
+/* Called with sd_lock held, which is released while the entries left by
+ * the flushes are dumped. The flushes stay pending meanwhile, so that the
+ * deletions notified are not missed, and are dumped again if deletions
+ * got lost. Completes the flushes with nothing left, overwrites flushes */
+static void dump_flushes(sd_pending_t **flushes, int num)
+{
+    sd_pending_t *p;
+    int i, left;
+
+    while(num)
+    {
+        for(i = 0; i < num; ++i)
+        {
+            p = flushes[i];
+            p->dumping = true;
+            p->lost = false;
+            p->num_gone = 0;
+        }
+        pthread_mutex_unlock(&sd_lock);
+        /* Nobody else touches the entries of a flush while it is dumping */
+        for(i = 0; i < num; ++i)
+            if(dump_left(flushes[i]))
+                flushes[i]->num_keys = -1;
+        pthread_mutex_lock(&sd_lock);
+        for(i = left = 0; i < num; ++i)
+        {
+            p = flushes[i];
+            p->dumping = false;
+            if(0 > p->num_keys)
+            {
+                complete(p, -EIO);
+                continue;
+            }
+            if(p->lost)
+            {
+                flushes[left++] = p;
+                continue;
+            }
+            while(p->num_gone)
+                forget_key(p, &p->gone[--p->num_gone]);
+            if(!p->num_keys)
+            {
+                complete(p, 0);
+                continue;
+            }
+            LOG("%s: %d FDB entries left after flush", p->op->ifname,
+                p->num_keys);
+        }
+        num = left;
+    }
+}
+
+static void sd_submit(driver_op_t **ops, int n)
+{
+    sd_pending_t *p, **flushes;
+    driver_op_t *op;
+    int i, num_flushes = 0;
+
+    if(!(flushes = calloc(n + 1, sizeof(*flushes))))
+    {
+        ERROR("Out of memory for %d driver operations", n);
+        for(i = 0; i < n; ++i)
+        {
+            ops[i]->result = -ENOMEM;
+            driver_op_done(ops[i]);
+        }
+        return;
+    }
+    pthread_mutex_lock(&sd_lock);
+    for(i = 0; i < n; ++i)
+    {
+        op = ops[i];
+        op->result = 0;
+        /* The kernel has no FDB per MSTI, nothing was flushed */
+        if((DRIVER_OP_FLUSH == op->type) && op->mstid)
+        {
+            driver_op_done(op);
+            continue;
+        }
+        /* The kernel refuses states other than disabled for ports which
+         * are down, there will be no notification */
+        if((DRIVER_OP_SET_STATE == op->type)
+           && (BR_STATE_DISABLED != op->state) && !op->running)
+        {
+            driver_op_done(op);
+            continue;
+        }
+        if(!(p = calloc(1, sizeof(*p))))
+        {
+            op->result = -ENOMEM;
+            driver_op_done(op);
+            continue;
+        }
+        p->op = op;
+        p->start = stats_now();
+        p->deadline = p->start + SWITCHDEV_TIMEOUT_NS;
+        if(DRIVER_OP_FLUSH == op->type)
+        {
+            update_neigh_group(true);
+            ++flushes_waiting;
+            flushes[num_flushes++] = p;
+        }
+        list_add_tail(&p->list, &pending);
+    }
+    dump_flushes(flushes, num_flushes);
+    if(!flushes_waiting)
+        update_neigh_group(false);
+    arm_timer();
+    pthread_mutex_unlock(&sd_lock);
+    free(flushes);
+}
+
+void switchdev_port_state(int if_index, int state)
+{
+    sd_pending_t *p, *nxt, *match = NULL;
+
+    pthread_mutex_lock(&sd_lock);
+    list_for_each_entry(p, &pending, list)
+    {
+        if((DRIVER_OP_SET_STATE == p->op->type)
+           && (p->op->if_index == if_index) && (p->op->state == state))
+        {
+            match = p;
+            break;
+        }
+    }
+    /* The states requested before the reported one are done too, their
+     * notifications have been lost or merged */
+    if(match)
+        list_for_each_entry_safe(p, nxt, &pending, list)
+        {
+            bool last = (p == match);
+            if((DRIVER_OP_SET_STATE == p->op->type)
+               && (p->op->if_index == if_index))
+                complete(p, 0);
+            if(last)
+                break;
+        }
+    arm_timer();
+    pthread_mutex_unlock(&sd_lock);
+}
+
+static int neigh_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                     void *arg)
+{
+    sd_pending_t *p, *nxt;
+    struct ndmsg *ndm;
+    fdb_key_t key;
+
+    if((RTM_NEWNEIGH != n->nlmsg_type) && (RTM_DELNEIGH != n->nlmsg_type))
+        return 0;
+    if(!(ndm = parse_fdb(n, &key, NULL)))
+        return 0;
+    list_for_each_entry_safe(p, nxt, &pending, list)
+    {
+        if((DRIVER_OP_FLUSH != p->op->type)
+           || ((RTM_DELNEIGH == n->nlmsg_type)
+               != (p->op->if_index == ndm->ndm_ifindex)))
+            continue;
+        /* Deleted from the port, or moved to another one */
+        if(p->dumping)
+        {
+            if(add_key(&p->gone, &p->num_gone, &p->size_gone, &key))
+                ERROR("%s: out of memory for FDB deletions", p->op->ifname);
+            continue;
+        }
+        forget_key(p, &key);
+        if(!p->num_keys)
+            complete(p, 0);
+    }
+    return 0;
+}
+
+static void neigh_handler(uint32_t events, struct epoll_event_handler *h)
+{
+    bool overrun = false;
+    sd_pending_t *p, **flushes;
+    int err, num_flushes = 0;
+
+    pthread_mutex_lock(&sd_lock);
+    while(-ENOBUFS == (err = rtnl_listen(&rth_neigh, neigh_msg, NULL)))
+        overrun = true;
+    if(err < 0)
+        ERROR("Error on FDB monitoring socket");
+    /* Deletions were lost, see what is left now. Without memory for that
+     * the flushes time out */
+    if(overrun && flushes_waiting)
+    {
+        if(!(flushes = calloc(flushes_waiting, sizeof(*flushes))))
+            ERROR("Out of memory for %d FDB dumps", flushes_waiting);
+        else
+        {
+            list_for_each_entry(p, &pending, list)
+            {
+                if(DRIVER_OP_FLUSH != p->op->type)
+                    continue;
+                if(p->dumping)
+                    p->lost = true;
+                else
+                    flushes[num_flushes++] = p;
+            }
+            dump_flushes(flushes, num_flushes);
+            free(flushes);
+        }
+    }
+    if(!flushes_waiting)
+        update_neigh_group(false);
+    arm_timer();
+    pthread_mutex_unlock(&sd_lock);
+}
+
+static void timer_handler(uint32_t events, struct epoll_event_handler *h)
+{
+    sd_pending_t *p, *nxt;
+    __u64 expirations, now = stats_now();
+
+    if(0 > read(h->fd, &expirations, sizeof(expirations)) && EAGAIN != errno)
+        ERROR("switchdev: timerfd read: %m");
+    pthread_mutex_lock(&sd_lock);
+    list_for_each_entry_safe(p, nxt, &pending, list)
+    {
+        if((p->deadline > now) || p->dumping)
+            continue;
+        if(DRIVER_OP_FLUSH == p->op->type)
+            INFO("%s: %d FDB entries still there after flush", p->op->ifname,
+                 p->num_keys);
+        else
+            INFO("%s: kernel has not reported port state %d", p->op->ifname,
+                 p->op->state);
+        complete(p, -ETIMEDOUT);
+    }
+    if(!flushes_waiting)
+        update_neigh_group(false);
+    arm_timer();
+    pthread_mutex_unlock(&sd_lock);
+}
+
+static int sd_start(void)
+{
+    long ticks = sysconf(_SC_CLK_TCK);
+
+    clock_tick_ns = 1000000000ULL / ((0 < ticks) ? ticks : 100);
+    if(0 > rtnl_open(&rth_neigh, 0))
+    {
+        ERROR("Couldn't open rtnl socket for FDB monitoring");
+        return -1;
+    }
+    if(0 > fcntl(rth_neigh.fd, F_SETFL, O_NONBLOCK))
+    {
+        ERROR("Error setting O_NONBLOCK: %m");
+        return -1;
+    }
+    neigh_event.fd = rth_neigh.fd;
+    neigh_event.arg = NULL;
+    neigh_event.handler = neigh_handler;
+    neigh_event.prio = EPOLL_PRIO_NETLINK;
+    TST(0 == add_epoll(&neigh_event), -1);
+
+    timer_event.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(0 > timer_event.fd)
+    {
+        ERROR("switchdev: timerfd_create failed: %m");
+        return -1;
+    }
+    timer_event.arg = NULL;
+    timer_event.handler = timer_handler;
+    timer_event.prio = EPOLL_PRIO_NETLINK;
+    TST(0 == add_epoll(&timer_event), -1);
+    return 0;
+}
+
+static const driver_ops_t switchdev_ops =
+{
+    .name = "switchdev",
+    .start = sd_start,
+    .get_caps = sd_get_caps,
+    .handles_port = sd_handles_port,
+    .submit = sd_submit,
+};
+
+void switchdev_register(void)
+{
+    driver_ops_register(&switchdev_ops);
+}
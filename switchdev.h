@@ -0,0 +1,27 @@
+/*
+ * switchdev.h   Driver for bridge ports offloaded to switchdev hardware.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_SWITCHDEV_H
+#define _MSTP_SWITCHDEV_H
+
+/* Register the switchdev operations, called from driver_mstp_init().
+ *
+ * The kernel bridge propagates port states and flushes of offloaded ports
+ * to the hardware. The operations of such a port are done when the kernel
+ * reports the result: a port state when a link notification of the port
+ * carries it, a flush when the dynamic FDB entries which were left on the
+ * port are deleted. Ports of software bridges are not waited for.
+ */
+void switchdev_register(void);
+
+/* A link notification of the port with IFLA_BRPORT_STATE, from
+ * bridge_notify() */
+void switchdev_port_state(int if_index, int state);
+
+#endif /* _MSTP_SWITCHDEV_H */
@@ -0,0 +1,31 @@
+/*
+ * trace.c   Always-on binary trace of the MSTP state machine events.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include "trace.h"
+
+trace_rec_t trace_ring[TRACE_RING_SIZE];
+__u32 trace_seq;
+
+int trace_get(__u32 *seq, trace_rec_t *recs, int max)
+{
+    __u32 s = *seq;
+    int n;
+
+    if((__u32)(trace_seq - s) > TRACE_RING_SIZE)
+    {
+        s = trace_seq - TRACE_RING_SIZE;
+        /* Ring is not full yet - skip never written records */
+        while((s != trace_seq) && !trace_ring[s & (TRACE_RING_SIZE - 1)].ts)
+            ++s;
+    }
+    for(n = 0; (n < max) && (s != trace_seq); ++n, ++s)
+        recs[n] = trace_ring[s & (TRACE_RING_SIZE - 1)];
+    *seq = s;
+    return n;
+}
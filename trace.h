@@ -0,0 +1,98 @@
+/*
+ * trace.h   Always-on binary trace of the MSTP state machine events.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_TRACE_H
+#define _MSTP_TRACE_H
+
+#include <time.h>
+#include <asm/byteorder.h>
+#include <linux/types.h>
+
+/* The trace keeps the last TRACE_RING_SIZE events in a static ring.
+ * Recording an event costs a clock_gettime() (vDSO) and a store of one
+ * record, there is no formatting and no locking. Workers record
+ * concurrently, so the sequence number is taken atomically; two workers
+ * write the same record only if one is a whole ring behind, which loses
+ * trace data but nothing else. The ring is read with the get_trace ctl
+ * command, while the workers are stopped.
+ */
+
+#define TRACE_RING_SIZE     4096    /* power of two */
+#define TRACE_CHUNK_SIZE    256     /* records per ctl message */
+
+typedef enum
+{
+    TRACE_PRTSM,        /* state - PRTSM_states_t */
+    TRACE_PSTSM,        /* state - PSTSM_states_t */
+    TRACE_TCSM,         /* state - TCSM_states_t */
+    TRACE_PISM,         /* state - PISM_states_t */
+    TRACE_RX_BPDU,      /* state - bpduType, arg - TRACE_BPDU_ARG */
+    TRACE_TX_BPDU,      /* state - bpduType, arg - TRACE_BPDU_ARG */
+    TRACE_SET_STATE,    /* state - BR_STATE_xxx set, arg - requested one */
+    TRACE_FLUSH,        /* MSTP_OUT_flush_all_fids */
+    TRACE_SET_AGEING,   /* arg - requested ageing time */
+    TRACE_SHUTDOWN,     /* MSTP_OUT_shutdown_port */
+    TRACE_NUM_EVENTS
+} trace_event_t;
+
+typedef struct
+{
+    __u64 ts;           /* CLOCK_MONOTONIC, ns */
+    __u32 seq;          /* sequence number, gaps show lost records */
+    __u32 if_index;     /* port */
+    __u16 mstid;
+    __u8 event;         /* trace_event_t */
+    __u8 state;
+    __u32 arg;
+} trace_rec_t;
+
+/* BPDU summary: protocol version, flags and size */
+#define TRACE_BPDU_ARG(_bpdu, _size) \
+    (((__u32)(_bpdu)->protocolVersion << 24) | ((__u32)(_bpdu)->flags << 16) \
+     | ((__u32)(_size) & 0xFFFF))
+#define TRACE_BPDU_VERSION(_arg)    ((_arg) >> 24)
+#define TRACE_BPDU_FLAGS(_arg)      (((_arg) >> 16) & 0xFF)
+#define TRACE_BPDU_SIZE(_arg)       ((_arg) & 0xFFFF)
+
+extern trace_rec_t trace_ring[TRACE_RING_SIZE];
+extern __u32 trace_seq;
+
+static inline void trace_event(trace_event_t event, unsigned int state,
+                               __u32 if_index, __u16 mstid, __u32 arg)
+{
+    __u32 seq = __atomic_fetch_add(&trace_seq, 1, __ATOMIC_RELAXED);
+    trace_rec_t *rec = trace_ring + (seq & (TRACE_RING_SIZE - 1));
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rec->ts = (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->seq = seq;
+    rec->if_index = if_index;
+    rec->mstid = mstid;
+    rec->event = event;
+    rec->state = state;
+    rec->arg = arg;
+}
+
+/* Per-tree port events */
+#define TRACE_PTP(_ptp, _event, _state, _arg)                         \
+    trace_event((_event), (_state), (_ptp)->port->sysdeps.if_index,   \
+                __be16_to_cpu((_ptp)->MSTID), (_arg))
+
+/* Port events, reported for the CIST */
+#define TRACE_PRT(_prt, _event, _state, _arg)                         \
+    trace_event((_event), (_state), (_prt)->sysdeps.if_index, 0, (_arg))
+
+/* Copy up to max records starting from sequence number *seq.
+ * If the oldest records were overwritten, starts from the oldest one left.
+ * Returns number of copied records and updates *seq to the next one.
+ */
+int trace_get(__u32 *seq, trace_rec_t *recs, int max);
+
+#endif /* _MSTP_TRACE_H */
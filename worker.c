@@ -0,0 +1,260 @@
+/*
+ * worker.c   Optional worker threads owning the bridges.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include "worker.h"
+#include "epoll_loop.h"
+#include "bridge_ctl.h"
+#include "libnetlink.h"
+#include "stats.h"
+#include "mstp.h"
+#include "driver.h"
+#include "log.h"
+
+#define WORKER_EV_SIZE  8
+#define NS_PER_SEC      1000000000ULL
+/* MSTP_IN_rx_bpdu() reads a whole MST BPDU without the MSTI messages
+ * whatever the received size, short frames are padded up to that */
+#define WORKER_BPDU_MIN (ETH_HLEN + 3 /* LLC */ + MST_BPDU_SIZE_WO_MSTI_MSGS)
+
+typedef struct
+{
+    int index;
+    pthread_mutex_t lock;
+    int epoll_fd;
+    struct epoll_event_handler timer;
+    __u64 next_tick;            /* CLOCK_MONOTONIC, ns */
+    epoll_queue_t bpdus;        /* from the event loop */
+    unsigned int dropped;       /* BPDUs, since the last tick */
+    struct rtnl_handle rth;     /* for kernel port states */
+    stats_hist_t hists[STATS_NUM_HISTS];
+} worker_t;
+
+typedef struct
+{
+    __u64 start;
+    int if_index;
+    int len;
+    unsigned char data[];
+} worker_bpdu_t;
+
+static worker_t *workers;
+static int num_workers;
+static int next_worker;         /* round robin */
+static int lock_depth;          /* event loop only */
+
+static __thread worker_t *current_worker;
+
+static void worker_bpdu(void *item)
+{
+    worker_bpdu_t *bpdu = item;
+    worker_t *w = current_worker;
+
+    pthread_mutex_lock(&w->lock);
+    bridge_worker_bpdu_rcv(w->index, bpdu->if_index, bpdu->data, bpdu->len,
+                           bpdu->start);
+    driver_ops_submit();
+    pthread_mutex_unlock(&w->lock);
+    free(bpdu);
+}
+
+static void worker_tick(uint32_t events, struct epoll_event_handler *h)
+{
+    worker_t *w = h->arg;
+    __u64 expirations, now;
+    unsigned int dropped;
+
+    if(0 > read(h->fd, &expirations, sizeof(expirations)))
+    {
+        if(EAGAIN != errno)
+            ERROR("Worker %d: timerfd read: %m", w->index);
+        return;
+    }
+    now = stats_now();
+    w->next_tick += (expirations - 1) * NS_PER_SEC;
+
+    pthread_mutex_lock(&w->lock);
+    if(now > w->next_tick)
+        stats_record(STATS_TICK_LAG, now - w->next_tick);
+    /* Catch up with missed ticks, like the event loop does */
+    if(4 < expirations)
+        expirations = 1;
+    while(expirations--)
+        bridge_worker_one_second(w->index);
+    driver_ops_submit();
+    pthread_mutex_unlock(&w->lock);
+
+    w->next_tick += NS_PER_SEC;
+    if((dropped = __atomic_exchange_n(&w->dropped, 0, __ATOMIC_RELAXED)))
+        ERROR("Worker %d: %u BPDUs dropped, queue is full",
+              w->index, dropped);
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *w = arg;
+    struct epoll_event ev[WORKER_EV_SIZE];
+    int r;
+
+    current_worker = w;
+    stats_local = w->hists;
+    rth_state_local = &w->rth;
+    while(1)
+    {
+        r = epoll_wait(w->epoll_fd, ev, WORKER_EV_SIZE, -1);
+        if(r < 0 && errno != EINTR)
+        {
+            ERROR("Worker %d: epoll_wait: %m", w->index);
+            return NULL;
+        }
+        epoll_run_handlers(ev, r);
+    }
+
+    return NULL;
+}
+
+static int worker_init(worker_t *w, int index)
+{
+    struct itimerspec its;
+    struct timespec now;
+
+    w->index = index;
+    pthread_mutex_init(&w->lock, NULL);
+    TST(stats_register(w->hists), -1);
+    if(0 > (w->epoll_fd = epoll_create(WORKER_EV_SIZE)))
+    {
+        ERROR("Worker %d: epoll_create failed: %m", index);
+        return -1;
+    }
+    if(0 > rtnl_open(&w->rth, 0))
+    {
+        ERROR("Worker %d: Couldn't open rtnl socket for setting state",
+              index);
+        return -1;
+    }
+    TST(0 == epoll_queue_init_fd(&w->bpdus, w->epoll_fd, worker_bpdu,
+                                 WORKER_BPDU_BATCH), -1);
+
+    w->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(0 > w->timer.fd)
+    {
+        ERROR("Worker %d: timerfd_create failed: %m", index);
+        return -1;
+    }
+    w->timer.arg = w;
+    w->timer.handler = worker_tick;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    its.it_value.tv_sec = now.tv_sec + 1;
+    its.it_value.tv_nsec = now.tv_nsec;
+    its.it_interval.tv_sec = 1;
+    its.it_interval.tv_nsec = 0;
+    w->next_tick = its.it_value.tv_sec * NS_PER_SEC + its.it_value.tv_nsec;
+    if(0 > timerfd_settime(w->timer.fd, TFD_TIMER_ABSTIME, &its, NULL))
+    {
+        ERROR("Worker %d: timerfd_settime failed: %m", index);
+        return -1;
+    }
+    TST(0 == add_epoll_fd(w->epoll_fd, &w->timer), -1);
+    return 0;
+}
+
+int worker_pool_init(int num)
+{
+    pthread_t thread;
+    sigset_t all, old;
+    int i, err = 0;
+
+    if((0 >= num) || (WORKERS_MAX < num))
+    {
+        ERROR("Invalid number of workers %d", num);
+        return -1;
+    }
+    TST(NULL != (workers = calloc(num, sizeof(*workers))), -1);
+    for(i = 0; i < num; ++i)
+        if(worker_init(workers + i, i))
+            return -1;
+
+    /* Signals are handled by the main thread through signalfd */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for(i = 0; i < num; ++i)
+    {
+        if((err = pthread_create(&thread, NULL, worker_main, workers + i)))
+            break;
+        pthread_detach(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(err)
+    {
+        ERROR("Couldn't start worker %d: %s", i, strerror(err));
+        return -1;
+    }
+    num_workers = num;
+    INFO("Started %d workers", num);
+    return 0;
+}
+
+int worker_assign(void)
+{
+    int worker;
+
+    if(!num_workers)
+        return -1;
+    worker = next_worker;
+    next_worker = (next_worker + 1) % num_workers;
+    return worker;
+}
+
+void worker_bpdu_rcv(int worker, int if_index, const unsigned char *data,
+                     int len, __u64 start)
+{
+    worker_t *w = workers + worker;
+    int size = (len < WORKER_BPDU_MIN) ? WORKER_BPDU_MIN : len;
+    worker_bpdu_t *bpdu = malloc(sizeof(*bpdu) + size);
+
+    if(bpdu)
+    {
+        bpdu->start = start;
+        bpdu->if_index = if_index;
+        bpdu->len = len;
+        memcpy(bpdu->data, data, len);
+        memset(bpdu->data + len, 0, size - len);
+        if(epoll_queue_push(&w->bpdus, bpdu))
+            return;
+        free(bpdu);
+    }
+    __atomic_add_fetch(&w->dropped, 1, __ATOMIC_RELAXED);
+}
+
+void worker_lock_all(void)
+{
+    int i;
+
+    if(lock_depth++)
+        return;
+    for(i = 0; i < num_workers; ++i)
+        pthread_mutex_lock(&workers[i].lock);
+}
+
+void worker_unlock_all(void)
+{
+    int i;
+
+    if(--lock_depth)
+        return;
+    for(i = num_workers - 1; i >= 0; --i)
+        pthread_mutex_unlock(&workers[i].lock);
+}
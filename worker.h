@@ -0,0 +1,44 @@
+/*
+ * worker.h   Optional worker threads owning the bridges.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _MSTP_WORKER_H
+#define _MSTP_WORKER_H
+
+#include <linux/types.h>
+
+/* Bridges share no protocol state, so with workers every bridge is owned
+ * by one of them: the worker runs the one second timer and the received
+ * BPDUs of its bridges on its own epoll, and a reconvergence on one bridge
+ * does not delay the others.
+ *
+ * The event loop stays the dispatcher. It routes received BPDUs to the
+ * owning worker and handles netlink, ctl commands, metrics and snapshots
+ * itself, with all workers stopped by worker_lock_all(). A worker holds
+ * its own lock while it touches its bridges.
+ *
+ * Without workers (the default) everything runs on the event loop and the
+ * functions below do nothing.
+ */
+
+#define WORKERS_MAX         64
+#define WORKER_BPDU_BATCH   32  /* BPDUs per wakeup, between lock releases */
+
+/* Start num worker threads, called from the event loop before the first
+ * bridge is created */
+int worker_pool_init(int num);
+/* Worker for a new bridge, -1 for the event loop if there are no workers */
+int worker_assign(void);
+/* Pass a validated BPDU frame to the worker, called from the event loop */
+void worker_bpdu_rcv(int worker, int if_index, const unsigned char *data,
+                     int len, __u64 start);
+/* Stop all workers, called from the event loop only. Nests. */
+void worker_lock_all(void);
+void worker_unlock_all(void);
+
+#endif /* _MSTP_WORKER_H */